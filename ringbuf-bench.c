@@ -0,0 +1,755 @@
+/*
+ * ringbuf-bench.c - benchmarks for C ring buffer implementation.
+ *
+ * To the extent possible under law, the author(s) have dedicated all
+ * copyright and related and neighboring rights to this software to
+ * the public domain worldwide. This software is distributed without
+ * any warranty.
+ *
+ * You should have received a copy of the CC0 Public Domain Dedication
+ * along with this software. If not, see
+ * <http://creativecommons.org/publicdomain/zero/1.0/>.
+ */
+
+/*
+ * Usage: ringbuf-bench [nmsgs] [bench ...]
+ *
+ * nmsgs scales the amount of work each benchmark does (the default is
+ * 1 << 22), and the remaining arguments, if any, name the benchmarks
+ * to run (memcpy, copy, crc32c, stream, findchr, pipe, socketpair, spsc, mpmc, mutex, set,
+ * spsc-rtt, mpmc-rtt); by default, all of them run.
+ *
+ * Results are printed as CSV on stdout, one line per measurement,
+ * preceded by a header line, so that the output of two builds can be
+ * compared mechanically. The columns are:
+ *
+ *   bench        the benchmark's name
+ *   capacity     the ring buffer's capacity, in bytes
+ *   size         the size of each operation, in bytes
+ *   param        a benchmark-specific parameter: the wrap offset for
+ *                memcpy, copy and findchr; 1 if crc32c's checksum is
+ *                fused into the copy, 0 if it's a second pass; the
+ *                stream threshold for stream; the publish batch for
+ *                spsc;
+ *                the number of producers for mpmc, mutex and set
+ *   ops          the number of operations measured
+ *   seconds      the elapsed wall-clock time
+ *   ops_per_sec  operations per second
+ *   mb_per_sec   payload throughput, in MB (10^6 bytes) per second
+ *   p50_ns, p99_ns, p999_ns
+ *                latency percentiles, in nanoseconds, for the
+ *                benchmarks that measure latency (otherwise empty)
+ */
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <ctype.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/socket.h>
+#include "ringbuf.h"
+
+static double
+now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static uint64_t
+now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void
+fail(const char *what)
+{
+    fprintf(stderr, "%s, exiting.\n", what);
+    exit(1);
+}
+
+static ringbuf_t
+bench_ringbuf(size_t capacity, int flags)
+{
+    ringbuf_t rb = ringbuf_new_flags(capacity, flags);
+    if (!rb)
+        fail("Can't allocate ring buffer");
+    return rb;
+}
+
+static int
+compare_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+    return (x > y) - (x < y);
+}
+
+/*
+ * Print one CSV result line. latencies, if it's not null, holds n
+ * latency samples in nanoseconds, which are sorted in place.
+ */
+static void
+report(const char *bench, size_t capacity, size_t size, size_t param, size_t ops,
+       double elapsed, uint64_t *latencies, size_t n)
+{
+    printf("%s,%zu,%zu,%zu,%zu,%.6f,%.0f,%.1f", bench, capacity, size, param, ops, elapsed,
+           ops / elapsed, (double) ops * size / elapsed / 1e6);
+    if (latencies && n) {
+        qsort(latencies, n, sizeof(*latencies), compare_u64);
+        printf(",%llu,%llu,%llu\n", (unsigned long long) latencies[n / 2],
+               (unsigned long long) latencies[n * 99 / 100],
+               (unsigned long long) latencies[n * 999 / 1000]);
+    } else
+        printf(",,,\n");
+    fflush(stdout);
+}
+
+/*
+ * The number of operations of size bytes each that make up a
+ * single-threaded benchmark run: enough to move nmsgs * 64 bytes, but
+ * at least 1000.
+ */
+static size_t
+bench_ops(size_t nmsgs, size_t size)
+{
+    size_t ops = nmsgs * 64 / size;
+    return ops < 1000 ? 1000 : ops;
+}
+
+/*
+ * Start the (empty) ring buffer rb at offset bytes into its buffer.
+ */
+static void
+bench_offset(ringbuf_t rb, size_t offset)
+{
+    static uint8_t scratch[1 << 16];
+    ringbuf_reset(rb);
+    if (offset > sizeof(scratch) ||
+        !ringbuf_memcpy_into(rb, scratch, offset) ||
+        !ringbuf_memcpy_from(scratch, rb, offset))
+        fail("Can't position ring buffer");
+}
+
+/*
+ * memcpy_into/memcpy_from throughput: copy size bytes into a ring
+ * buffer, then back out again. The ring buffer's capacity is size (a
+ * power of two), and its contents start at offset bytes into the
+ * buffer, so every operation wraps at the same place, unless offset
+ * is 0, in which case none does.
+ */
+static void
+memcpy_bench(size_t nmsgs, size_t size, size_t offset)
+{
+    ringbuf_t rb = bench_ringbuf(size, RINGBUF_POW2);
+    uint8_t *msg = malloc(size);
+    if (!msg)
+        fail("Can't allocate message");
+    memset(msg, 0x5a, size);
+    bench_offset(rb, offset);
+
+    size_t ops = bench_ops(nmsgs, size), i;
+    double start = now();
+    for (i = 0; i != ops; ++i) {
+        ringbuf_memcpy_into(rb, msg, size);
+        ringbuf_memcpy_from(msg, rb, size);
+    }
+    double elapsed = now() - start;
+
+    report("memcpy", size, size, offset, 2 * ops, elapsed, 0, 0);
+    free(msg);
+    ringbuf_free(&rb);
+}
+
+/*
+ * ringbuf_copy throughput: size bytes are copied back and forth
+ * between two ring buffers, positioned as in memcpy_bench.
+ */
+static void
+copy_bench(size_t nmsgs, size_t size, size_t offset)
+{
+    ringbuf_t a = bench_ringbuf(size, RINGBUF_POW2);
+    ringbuf_t b = bench_ringbuf(size, RINGBUF_POW2);
+    bench_offset(a, offset);
+    bench_offset(b, offset);
+    if (ringbuf_memset(a, 0x5a, size) != size)
+        fail("Can't fill ring buffer");
+
+    size_t ops = bench_ops(nmsgs, size), i;
+    double start = now();
+    for (i = 0; i != ops; ++i) {
+        ringbuf_copy(b, a, size);
+        ringbuf_copy(a, b, size);
+    }
+    double elapsed = now() - start;
+
+    report("copy", size, size, offset, 2 * ops, elapsed, 0, 0);
+    ringbuf_free(&a);
+    ringbuf_free(&b);
+}
+
+/*
+ * Checksummed memcpy_into/memcpy_from throughput, positioned as in
+ * memcpy_bench with a wrap in the middle: each message is
+ * checksummed on the way in and on the way out, either during the
+ * copy, or by a second pass over it afterwards.
+ */
+static void
+crc32c_bench(size_t nmsgs, size_t size, int fused)
+{
+    ringbuf_t rb = bench_ringbuf(size, RINGBUF_POW2);
+    uint8_t *msg = malloc(size);
+    if (!msg)
+        fail("Can't allocate message");
+    memset(msg, 0x5a, size);
+    bench_offset(rb, size / 2);
+
+    size_t ops = bench_ops(nmsgs, size), i;
+    uint32_t crc = 0;
+    double start = now();
+    for (i = 0; i != ops; ++i) {
+        if (fused) {
+            ringbuf_memcpy_into_crc32c(rb, msg, size, &crc);
+            ringbuf_memcpy_from_crc32c(msg, rb, size, &crc);
+        } else {
+            ringbuf_memcpy_into(rb, msg, size);
+            crc = ringbuf_crc32c(crc, msg, size);
+            ringbuf_memcpy_from(msg, rb, size);
+            crc = ringbuf_crc32c(crc, msg, size);
+        }
+    }
+    double elapsed = now() - start;
+
+    /* keep the checksum live */
+    if (crc == 0)
+        fprintf(stderr, "crc32c is 0\n");
+    report("crc32c", size, size, fused, 2 * ops, elapsed, 0, 0);
+    free(msg);
+    ringbuf_free(&rb);
+}
+
+/*
+ * Streaming copies: a producer writes size-byte messages into a
+ * 16 MiB ring buffer, whose stream threshold is threshold, and
+ * between writes, it sums its own 256 KiB working set. Plain copies
+ * evict the working set from the cache; streaming copies shouldn't.
+ * The consumer's side of the ring buffer is simply discarded.
+ */
+#define STREAM_BENCH_WORKING_SET (1 << 15)
+
+static void
+stream_bench(size_t nmsgs, size_t size, size_t threshold)
+{
+    ringbuf_t rb = bench_ringbuf(1 << 24, RINGBUF_POW2);
+    ringbuf_set_stream_threshold(rb, threshold);
+    uint8_t *msg = malloc(size);
+    uint64_t *working_set = calloc(STREAM_BENCH_WORKING_SET, sizeof(uint64_t));
+    if (!msg || !working_set)
+        fail("Can't allocate message");
+    memset(msg, 0x5a, size);
+
+    size_t ops = bench_ops(nmsgs, size), i, j;
+    uint64_t sum = 0;
+    double start = now();
+    for (i = 0; i != ops; ++i) {
+        ringbuf_memcpy_into(rb, msg, size);
+        if (ringbuf_bytes_free(rb) < size)
+            ringbuf_consume(rb, ringbuf_bytes_used(rb));
+        for (j = 0; j != STREAM_BENCH_WORKING_SET; ++j)
+            sum += working_set[j];
+    }
+    double elapsed = now() - start;
+
+    /* keep the sum live */
+    if (sum != 0)
+        fprintf(stderr, "working set sum is %llu\n", (unsigned long long) sum);
+    report("stream", ringbuf_capacity(rb), size, threshold, ops, elapsed, 0, 0);
+    free(working_set);
+    free(msg);
+    ringbuf_free(&rb);
+}
+
+/*
+ * findchr scan rate: search a ring buffer holding size bytes for a
+ * character that only occurs in its last byte. The contents start at
+ * offset bytes into a 64 KiB buffer.
+ */
+static void
+findchr_bench(size_t nmsgs, size_t size, size_t offset)
+{
+    ringbuf_t rb = bench_ringbuf(1 << 16, RINGBUF_POW2);
+    bench_offset(rb, offset);
+    if (ringbuf_memset(rb, 'a', size - 1) != size - 1 || ringbuf_memset(rb, '\n', 1) != 1)
+        fail("Can't fill ring buffer");
+
+    size_t ops = bench_ops(nmsgs, size), i;
+    double start = now();
+    for (i = 0; i != ops; ++i)
+        if (ringbuf_findchr(rb, '\n', 0) != size - 1)
+            fail("findchr failed");
+    double elapsed = now() - start;
+
+    report("findchr", ringbuf_capacity(rb), size, offset, ops, elapsed, 0, 0);
+    ringbuf_free(&rb);
+}
+
+/*
+ * ringbuf_write/ringbuf_read throughput: size bytes circulate from a
+ * ring buffer through a pipe (or a socketpair) and back again, in a
+ * single thread.
+ */
+static void
+fd_bench(size_t nmsgs, size_t size, int use_socketpair)
+{
+    int fds[2];
+    if (use_socketpair ? socketpair(AF_UNIX, SOCK_STREAM, 0, fds) : pipe(fds))
+        fail("Can't create pipe");
+    ringbuf_t rb = bench_ringbuf(1 << 16, 0);
+    if (ringbuf_memset(rb, 0x5a, size) != size)
+        fail("Can't fill ring buffer");
+
+    size_t ops = bench_ops(nmsgs, size) / 4, i;
+    double start = now();
+    for (i = 0; i != ops; ++i) {
+        size_t n;
+        for (n = 0; n != size;) {
+            ssize_t w = ringbuf_write(fds[1], rb, size - n);
+            if (w <= 0)
+                fail("Can't write");
+            n += w;
+        }
+        for (n = 0; n != size;) {
+            ssize_t r = ringbuf_read(fds[0], rb, size - n);
+            if (r <= 0)
+                fail("Can't read");
+            n += r;
+        }
+    }
+    double elapsed = now() - start;
+
+    report(use_socketpair ? "socketpair" : "pipe", ringbuf_capacity(rb), size, 0, 2 * ops,
+           elapsed, 0, 0);
+    close(fds[0]);
+    close(fds[1]);
+    ringbuf_free(&rb);
+}
+
+/*
+ * SPSC message throughput: a producer thread copies nmsgs messages of
+ * msg_size bytes each into the ring buffer, and a consumer thread
+ * copies them back out. When batch > 1, the ring buffer defers
+ * publishing, and the producer publishes once every batch messages.
+ */
+struct spsc_bench
+{
+    ringbuf_t rb;
+    size_t msg_size;
+    size_t nmsgs;
+    size_t batch;
+};
+
+static void *
+spsc_bench_producer(void *arg)
+{
+    struct spsc_bench *b = arg;
+    uint8_t msg[256];
+    size_t i;
+    memset(msg, 0x5a, sizeof(msg));
+    for (i = 0; i != b->nmsgs; ++i) {
+        while (!ringbuf_memcpy_into(b->rb, msg, b->msg_size)) {
+            ringbuf_publish(b->rb);
+            sched_yield();
+        }
+        if (b->batch > 1 && (i + 1) % b->batch == 0)
+            ringbuf_publish(b->rb);
+    }
+    ringbuf_publish(b->rb);
+    return 0;
+}
+
+static void *
+spsc_bench_consumer(void *arg)
+{
+    struct spsc_bench *b = arg;
+    uint8_t msg[256];
+    size_t i;
+    for (i = 0; i != b->nmsgs; ++i)
+        while (!ringbuf_memcpy_from(msg, b->rb, b->msg_size))
+            sched_yield();
+    return 0;
+}
+
+static void
+spsc_bench(size_t capacity, size_t msg_size, size_t nmsgs, size_t batch)
+{
+    struct spsc_bench b;
+    int flags = RINGBUF_SPSC | (batch > 1 ? RINGBUF_DEFER_PUBLISH : 0);
+    b.rb = bench_ringbuf(capacity, flags);
+    b.msg_size = msg_size;
+    b.nmsgs = nmsgs;
+    b.batch = batch;
+
+    pthread_t producer, consumer;
+    double start = now();
+    if (pthread_create(&consumer, 0, spsc_bench_consumer, &b) ||
+        pthread_create(&producer, 0, spsc_bench_producer, &b))
+        fail("Can't create threads");
+    pthread_join(producer, 0);
+    pthread_join(consumer, 0);
+    double elapsed = now() - start;
+
+    report("spsc", capacity, msg_size, batch, nmsgs, elapsed, 0, 0);
+    ringbuf_free(&b.rb);
+}
+
+/*
+ * MPMC producer scaling: nproducers threads each copy nmsgs /
+ * nproducers messages of msg_size bytes into the ring buffer, and a
+ * single consumer thread copies them back out. For comparison, when
+ * use_mutex is set, the same workload runs against a default ring
+ * buffer protected by a mutex.
+ */
+#define MPMC_BENCH_MAX_PRODUCERS 32
+
+struct mpmc_bench
+{
+    ringbuf_t rb;
+    pthread_mutex_t *mutex;
+    size_t msg_size;
+    size_t nmsgs;
+};
+
+static void *
+mpmc_bench_producer(void *arg)
+{
+    struct mpmc_bench *b = arg;
+    uint8_t msg[256];
+    size_t i;
+    memset(msg, 0x5a, sizeof(msg));
+    for (i = 0; i != b->nmsgs; ++i) {
+        for (;;) {
+            int copied;
+            if (b->mutex) {
+                pthread_mutex_lock(b->mutex);
+                copied = ringbuf_bytes_free(b->rb) >= b->msg_size;
+                if (copied)
+                    ringbuf_memcpy_into(b->rb, msg, b->msg_size);
+                pthread_mutex_unlock(b->mutex);
+            } else
+                copied = ringbuf_memcpy_into(b->rb, msg, b->msg_size) != 0;
+            if (copied)
+                break;
+            sched_yield();
+        }
+    }
+    return 0;
+}
+
+static void *
+mpmc_bench_consumer(void *arg)
+{
+    struct mpmc_bench *b = arg;
+    uint8_t msg[256];
+    size_t i;
+    for (i = 0; i != b->nmsgs; ++i) {
+        for (;;) {
+            int copied;
+            if (b->mutex) {
+                pthread_mutex_lock(b->mutex);
+                copied = ringbuf_memcpy_from(msg, b->rb, b->msg_size) != 0;
+                pthread_mutex_unlock(b->mutex);
+            } else
+                copied = ringbuf_memcpy_from(msg, b->rb, b->msg_size) != 0;
+            if (copied)
+                break;
+            sched_yield();
+        }
+    }
+    return 0;
+}
+
+static void
+mpmc_bench(size_t capacity, size_t msg_size, size_t nmsgs, size_t nproducers,
+           int use_mutex)
+{
+    struct mpmc_bench producers[MPMC_BENCH_MAX_PRODUCERS];
+    struct mpmc_bench consumer;
+    pthread_t producer_threads[MPMC_BENCH_MAX_PRODUCERS];
+    pthread_t consumer_thread;
+    pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+    size_t i;
+
+    ringbuf_t rb = bench_ringbuf(capacity, use_mutex ? 0 : RINGBUF_MPMC);
+    nmsgs -= nmsgs % nproducers;
+    consumer.rb = rb;
+    consumer.mutex = use_mutex ? &mutex : 0;
+    consumer.msg_size = msg_size;
+    consumer.nmsgs = nmsgs;
+
+    double start = now();
+    if (pthread_create(&consumer_thread, 0, mpmc_bench_consumer, &consumer))
+        fail("Can't create threads");
+    for (i = 0; i != nproducers; ++i) {
+        producers[i] = consumer;
+        producers[i].nmsgs = nmsgs / nproducers;
+        if (pthread_create(&producer_threads[i], 0, mpmc_bench_producer, &producers[i]))
+            fail("Can't create threads");
+    }
+    for (i = 0; i != nproducers; ++i)
+        pthread_join(producer_threads[i], 0);
+    pthread_join(consumer_thread, 0);
+    double elapsed = now() - start;
+
+    report(use_mutex ? "mutex" : "mpmc", capacity, msg_size, nproducers, nmsgs, elapsed, 0, 0);
+    ringbuf_free(&rb);
+}
+
+/*
+ * Ring buffer set producer scaling: the same workload as mpmc_bench,
+ * but each producer pushes its messages, as records, into its own
+ * shard of a ring buffer set, which the consumer drains in batches.
+ */
+struct set_bench
+{
+    ringbuf_set_t set;
+    size_t shard;
+    size_t msg_size;
+    size_t nmsgs;
+};
+
+static void *
+set_bench_producer(void *arg)
+{
+    struct set_bench *b = arg;
+    ringbuf_t rb = ringbuf_set_shard(b->set, b->shard);
+    uint8_t msg[256];
+    size_t i;
+    if (!rb)
+        fail("Can't allocate shard");
+    memset(msg, 0x5a, sizeof(msg));
+    for (i = 0; i != b->nmsgs; ++i)
+        while (!ringbuf_push_record(rb, msg, b->msg_size))
+            sched_yield();
+    return 0;
+}
+
+static void *
+set_bench_consumer(void *arg)
+{
+    struct set_bench *b = arg;
+    uint8_t msgs[32 * 256];
+    size_t lens[32];
+    size_t i = 0;
+    while (i != b->nmsgs) {
+        size_t n = ringbuf_set_pop_records(msgs, b->set, sizeof(msgs), lens, 32);
+        if (n == 0)
+            sched_yield();
+        i += n;
+    }
+    return 0;
+}
+
+static void
+set_bench(size_t capacity, size_t msg_size, size_t nmsgs, size_t nproducers)
+{
+    struct set_bench producers[MPMC_BENCH_MAX_PRODUCERS];
+    struct set_bench consumer;
+    pthread_t producer_threads[MPMC_BENCH_MAX_PRODUCERS];
+    pthread_t consumer_thread;
+    size_t i;
+
+    ringbuf_set_t set = ringbuf_set_new(nproducers, capacity, 0, RINGBUF_SET_BATCH);
+    if (!set)
+        fail("Can't allocate ring buffer set");
+    nmsgs -= nmsgs % nproducers;
+    consumer.set = set;
+    consumer.shard = 0;
+    consumer.msg_size = msg_size;
+    consumer.nmsgs = nmsgs;
+
+    double start = now();
+    if (pthread_create(&consumer_thread, 0, set_bench_consumer, &consumer))
+        fail("Can't create threads");
+    for (i = 0; i != nproducers; ++i) {
+        producers[i] = consumer;
+        producers[i].shard = i;
+        producers[i].nmsgs = nmsgs / nproducers;
+        if (pthread_create(&producer_threads[i], 0, set_bench_producer, &producers[i]))
+            fail("Can't create threads");
+    }
+    for (i = 0; i != nproducers; ++i)
+        pthread_join(producer_threads[i], 0);
+    pthread_join(consumer_thread, 0);
+    double elapsed = now() - start;
+
+    report("set", capacity, msg_size, nproducers, nmsgs, elapsed, 0, 0);
+    ringbuf_set_free(&set);
+}
+
+/*
+ * Cross-thread latency: a client thread sends a message of msg_size
+ * bytes to an echo thread through one ring buffer, and waits for it
+ * to come back through another, nmsgs times. Reported latencies are
+ * round-trip times. Both threads spin for a while before they
+ * yield, so this is only meaningful with at least two cores.
+ */
+struct rtt_bench
+{
+    ringbuf_t to_echo;
+    ringbuf_t from_echo;
+    size_t msg_size;
+    size_t nmsgs;
+};
+
+static void
+rtt_bench_spin(unsigned *spins)
+{
+    if (++*spins > 1000) {
+        *spins = 0;
+        sched_yield();
+    }
+}
+
+static void *
+rtt_bench_echo(void *arg)
+{
+    struct rtt_bench *b = arg;
+    uint8_t msg[256];
+    unsigned spins = 0;
+    size_t i;
+    for (i = 0; i != b->nmsgs; ++i) {
+        while (!ringbuf_memcpy_from(msg, b->to_echo, b->msg_size))
+            rtt_bench_spin(&spins);
+        while (!ringbuf_memcpy_into(b->from_echo, msg, b->msg_size))
+            rtt_bench_spin(&spins);
+    }
+    return 0;
+}
+
+static void
+rtt_bench(size_t capacity, size_t msg_size, size_t nmsgs, int flags)
+{
+    struct rtt_bench b;
+    b.to_echo = bench_ringbuf(capacity, flags);
+    b.from_echo = bench_ringbuf(capacity, flags);
+    b.msg_size = msg_size;
+    b.nmsgs = nmsgs;
+    uint64_t *latencies = malloc(nmsgs * sizeof(*latencies));
+    if (!latencies)
+        fail("Can't allocate latency samples");
+
+    pthread_t echo;
+    if (pthread_create(&echo, 0, rtt_bench_echo, &b))
+        fail("Can't create threads");
+    uint8_t msg[256];
+    unsigned spins = 0;
+    size_t i;
+    memset(msg, 0x5a, sizeof(msg));
+    double start = now();
+    for (i = 0; i != nmsgs; ++i) {
+        uint64_t sent = now_ns();
+        while (!ringbuf_memcpy_into(b.to_echo, msg, msg_size))
+            rtt_bench_spin(&spins);
+        while (!ringbuf_memcpy_from(msg, b.from_echo, msg_size))
+            rtt_bench_spin(&spins);
+        latencies[i] = now_ns() - sent;
+    }
+    double elapsed = now() - start;
+    pthread_join(echo, 0);
+
+    report(flags & RINGBUF_MPMC ? "mpmc-rtt" : "spsc-rtt", capacity, msg_size, 0, nmsgs,
+           elapsed, latencies, nmsgs);
+    free(latencies);
+    ringbuf_free(&b.to_echo);
+    ringbuf_free(&b.from_echo);
+}
+
+static int
+selected(const char *bench, int argc, char **argv)
+{
+    int i, any = 0;
+    for (i = 1; i < argc; ++i) {
+        if (isdigit((unsigned char) argv[i][0]))
+            continue;
+        any = 1;
+        if (strcmp(argv[i], bench) == 0)
+            return 1;
+    }
+    return !any;
+}
+
+int
+main(int argc, char **argv)
+{
+    size_t nmsgs = 1 << 22;
+    if (argc > 1 && isdigit((unsigned char) argv[1][0]))
+        nmsgs = strtoul(argv[1], 0, 0);
+    if (nmsgs == 0)
+        fail("nmsgs must be positive");
+
+    printf("bench,capacity,size,param,ops,seconds,ops_per_sec,mb_per_sec,p50_ns,p99_ns,p999_ns\n");
+
+    size_t size;
+    if (selected("memcpy", argc, argv))
+        for (size = 16; size <= 16384; size *= 4) {
+            memcpy_bench(nmsgs, size, 0);
+            memcpy_bench(nmsgs, size, size / 4);
+            memcpy_bench(nmsgs, size, size / 2);
+        }
+    if (selected("copy", argc, argv))
+        for (size = 16; size <= 16384; size *= 4) {
+            copy_bench(nmsgs, size, 0);
+            copy_bench(nmsgs, size, size / 2);
+        }
+    if (selected("crc32c", argc, argv))
+        for (size = 64; size <= 16384; size *= 16) {
+            crc32c_bench(nmsgs, size, 0);
+            crc32c_bench(nmsgs, size, 1);
+        }
+    if (selected("stream", argc, argv))
+        for (size = 1 << 16; size <= 1 << 20; size *= 4) {
+            stream_bench(nmsgs, size, 0);
+            stream_bench(nmsgs, size, size);
+        }
+    if (selected("findchr", argc, argv))
+        for (size = 64; size <= 65536; size *= 32) {
+            findchr_bench(nmsgs, size, 0);
+            findchr_bench(nmsgs, size, (1 << 16) - size / 2);
+        }
+    for (size = 64; size <= 16384; size *= 16) {
+        if (selected("pipe", argc, argv))
+            fd_bench(nmsgs, size, 0);
+        if (selected("socketpair", argc, argv))
+            fd_bench(nmsgs, size, 1);
+    }
+
+    if (selected("spsc", argc, argv)) {
+        spsc_bench(1 << 16, 16, nmsgs, 1);
+        spsc_bench(1 << 16, 16, nmsgs, 32);
+        spsc_bench(1 << 16, 64, nmsgs, 1);
+        spsc_bench(1 << 16, 64, nmsgs, 32);
+    }
+
+    size_t nproducers;
+    for (nproducers = 1; nproducers <= MPMC_BENCH_MAX_PRODUCERS; nproducers *= 2) {
+        if (selected("mpmc", argc, argv))
+            mpmc_bench(1 << 16, 64, nmsgs / 4, nproducers, 0);
+        if (selected("mutex", argc, argv))
+            mpmc_bench(1 << 16, 64, nmsgs / 4, nproducers, 1);
+        if (selected("set", argc, argv))
+            set_bench(1 << 16, 64, nmsgs / 4, nproducers);
+    }
+
+    if (selected("spsc-rtt", argc, argv))
+        rtt_bench(1 << 12, 64, nmsgs / 16 + 1, RINGBUF_SPSC);
+    if (selected("mpmc-rtt", argc, argv))
+        rtt_bench(1 << 12, 64, nmsgs / 16 + 1, RINGBUF_MPMC);
+    return 0;
+}
@@ -0,0 +1,346 @@
+/*
+ * ringbuf-cpp-test.cc - unit tests for the C++ ring buffer template.
+ *
+ * To the extent possible under law, the author(s) have dedicated all
+ * copyright and related and neighboring rights to this software to
+ * the public domain worldwide. This software is distributed without
+ * any warranty.
+ *
+ * You should have received a copy of the CC0 Public Domain Dedication
+ * along with this software. If not, see
+ * <http://creativecommons.org/publicdomain/zero/1.0/>.
+ */
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include "ringbuf.hpp"
+
+#define START_NEW_TEST(test_num) \
+    fprintf(stderr, "Test %d...", (++test_num));
+
+#define END_TEST(test_num) \
+    fprintf(stderr, "pass.\n");
+
+/*
+ * An element type that counts its live instances, so that the tests
+ * can check that every element that's constructed is also destroyed.
+ */
+struct counted
+{
+    static int live;
+    int value;
+
+    explicit counted(int v = 0)
+        : value(v)
+    {
+        ++live;
+    }
+
+    counted(const counted &other)
+        : value(other.value)
+    {
+        ++live;
+    }
+
+    counted(counted &&other) noexcept
+        : value(other.value)
+    {
+        other.value = -1;
+        ++live;
+    }
+
+    counted &operator=(const counted &) = default;
+
+    counted &
+    operator=(counted &&other) noexcept
+    {
+        value = other.value;
+        other.value = -1;
+        return *this;
+    }
+
+    ~counted()
+    {
+        --live;
+    }
+};
+
+int counted::live = 0;
+
+/* a 48-byte, trivially copyable event */
+struct event
+{
+    std::uint64_t seq;
+    std::uint8_t payload[40];
+};
+
+static_assert(ringbuf<int, 8>::capacity() == 8, "capacity is a constant");
+static_assert(!std::is_copy_constructible<ringbuf<int, 8>>::value, "ringbufs are move-only");
+static_assert(!std::is_copy_assignable<ringbuf<int, 8>>::value, "ringbufs are move-only");
+static_assert(std::is_nothrow_move_constructible<ringbuf<int, 8, 0, false>>::value,
+              "moving separate storage doesn't throw");
+static_assert(sizeof(ringbuf<event, 16>) >= 16 * sizeof(event), "inline storage");
+static_assert(sizeof(ringbuf<event, 16, 0, false>) < 16 * sizeof(event), "separate storage");
+
+#define SPSC_TEST_ELEMS (1 << 18)
+
+/*
+ * The parts of the C core that the tests compare the template with
+ * (ringbuf.h can't be included here; see ringbuf.hpp).
+ */
+extern "C" {
+struct ringbuf_t;
+struct ringbuf_t *ringbuf_new_elems(std::size_t nelems, std::size_t elem_size, int flags);
+void ringbuf_free(struct ringbuf_t **rb);
+std::size_t ringbuf_push_n(struct ringbuf_t *rb, const void *elems, std::size_t n);
+std::size_t ringbuf_pop_n(void *dst, struct ringbuf_t *src, std::size_t n);
+}
+
+int
+main(int argc, char **argv)
+{
+    int test_num = 0;
+
+    START_NEW_TEST(test_num);
+    {
+        ringbuf<int, 4> rb;
+        int x = 0;
+        assert(rb.empty() && !rb.full() && rb.size() == 0);
+        assert(!rb.pop(x) && !rb.pop());
+        assert(rb.front() == nullptr && rb.at(0) == nullptr);
+        for (int i = 0; i != 4; ++i)
+            assert(rb.push(i));
+        assert(rb.full() && rb.size() == 4);
+        assert(*rb.front() == 0 && *rb.at(3) == 3 && rb.at(4) == nullptr);
+
+        /* by default, ring buffers overflow, like the C core's */
+        assert(rb.push(4));
+        assert(rb.size() == 4);
+        assert(*rb.front() == 1 && *rb.at(3) == 4);
+        for (int i = 1; i != 5; ++i) {
+            assert(rb.pop(x));
+            assert(x == i);
+        }
+        assert(rb.empty() && !rb.pop(x));
+    }
+    END_TEST(test_num);
+
+    START_NEW_TEST(test_num);
+    {
+        /* SPSC ring buffers never overflow */
+        ringbuf<int, 3, RINGBUF_SPSC> rb;
+        assert(rb.push(1) && rb.push(2) && rb.push(3));
+        assert(!rb.push(4));
+        assert(rb.size() == 3 && *rb.at(2) == 3);
+        int x;
+        assert(rb.pop(x) && x == 1);
+        assert(rb.push(4));
+        assert(*rb.at(2) == 4);
+    }
+    END_TEST(test_num);
+
+    START_NEW_TEST(test_num);
+    {
+        /* elements are constructed in place, moved out, and destroyed */
+        ringbuf<counted, 5> rb;
+        assert(counted::live == 0);
+        assert(rb.emplace(7));
+        assert(counted::live == 1);
+        counted c(8);
+        assert(rb.push(std::move(c)));
+        assert(c.value == -1);
+        assert(counted::live == 3);
+        counted out;
+        assert(rb.pop(out) && out.value == 7);
+        assert(counted::live == 3);
+        for (int i = 0; i != 10; ++i)
+            assert(rb.emplace(i));
+        assert(counted::live == 2 + 5);
+        assert(rb.front()->value == 5);
+        rb.clear();
+        assert(rb.empty() && counted::live == 2);
+        for (int i = 0; i != 3; ++i)
+            rb.emplace(i);
+    }
+    assert(counted::live == 0);
+    END_TEST(test_num);
+
+    START_NEW_TEST(test_num);
+    {
+        /* move-only and non-trivial elements */
+        ringbuf<std::unique_ptr<int>, 2, RINGBUF_SPSC> rb;
+        assert(rb.push(std::make_unique<int>(1)));
+        assert(rb.emplace(new int(2)));
+        assert(!rb.push(std::make_unique<int>(3)));
+        std::unique_ptr<int> p;
+        assert(rb.pop(p) && *p == 1);
+        assert(rb.pop(p) && *p == 2);
+        assert(!rb.pop(p) && *p == 2);
+
+        ringbuf<std::string, 3> strings;
+        for (int i = 0; i != 5; ++i)
+            strings.emplace(std::string(40, 'a' + i));
+        assert(*strings.front() == std::string(40, 'c'));
+    }
+    END_TEST(test_num);
+
+    START_NEW_TEST(test_num);
+    {
+        /* bulk transfers, across the end of the buffer */
+        ringbuf<event, 10, RINGBUF_SPSC> rb;
+        event in[16], out[16];
+        std::uint64_t seq_in = 0, seq_out = 0;
+        std::srand(1);
+        for (int k = 0; k != 5000; ++k) {
+            std::size_t n = std::rand() % 16;
+            for (std::size_t i = 0; i != n; ++i)
+                in[i].seq = seq_in + i;
+            std::size_t want = std::min<std::size_t>(n, rb.capacity() - rb.size());
+            assert(rb.push_n(in, n) == want);
+            seq_in += want;
+            assert(rb.size() == seq_in - seq_out);
+            for (std::size_t i = 0; i != rb.size(); ++i)
+                assert(rb.at(i)->seq == seq_out + i);
+            n = std::rand() % 16;
+            want = std::min<std::size_t>(n, rb.size());
+            assert(rb.pop_n(out, n) == want);
+            for (std::size_t i = 0; i != want; ++i)
+                assert(out[i].seq == seq_out + i);
+            seq_out += want;
+        }
+
+        /* default ring buffers keep the newest elements */
+        ringbuf<int, 8> rb8;
+        int ints[20], outs[20];
+        for (int i = 0; i != 20; ++i)
+            ints[i] = i;
+        assert(rb8.push_n(ints, 5) == 5);
+        assert(rb8.push_n(ints + 5, 6) == 6);
+        assert(rb8.size() == 8 && *rb8.front() == 3);
+        assert(rb8.push_n(ints, 20) == 20);
+        assert(rb8.pop_n(outs, 20) == 8);
+        for (int i = 0; i != 8; ++i)
+            assert(outs[i] == 12 + i);
+
+        /* non-trivial elements */
+        ringbuf<counted, 4> rbc;
+        counted cs[6];
+        for (int i = 0; i != 6; ++i)
+            cs[i].value = i;
+        assert(rbc.push_n(cs, 3) == 3);
+        assert(rbc.push_n(cs + 3, 3) == 3);
+        assert(rbc.front()->value == 2);
+        counted couts[6];
+        assert(rbc.pop_n(couts, 6) == 4);
+        for (int i = 0; i != 4; ++i)
+            assert(couts[i].value == 2 + i);
+    }
+    assert(counted::live == 0);
+    END_TEST(test_num);
+
+    START_NEW_TEST(test_num);
+    {
+        /* moving inline and separate storage */
+        ringbuf<counted, 4> a;
+        a.emplace(1);
+        a.emplace(2);
+        ringbuf<counted, 4> b(std::move(a));
+        assert(a.empty() && b.size() == 2 && b.front()->value == 1);
+        assert(counted::live == 2);
+        a.emplace(3);
+        b = std::move(a);
+        assert(a.empty() && b.size() == 1 && b.front()->value == 3);
+        assert(counted::live == 1);
+
+        ringbuf<counted, 4, 0, false> c;
+        c.emplace(4);
+        c.emplace(5);
+        const counted *front = c.front();
+        ringbuf<counted, 4, 0, false> d(std::move(c));
+        assert(d.front() == front && d.size() == 2);
+        ringbuf<counted, 4, 0, false> e;
+        e.emplace(6);
+        e = std::move(d);
+        assert(e.front() == front && e.size() == 2);
+        assert(counted::live == 3);
+    }
+    assert(counted::live == 0);
+    END_TEST(test_num);
+
+    START_NEW_TEST(test_num);
+    {
+        /* SPSC, with producer and consumer threads */
+        auto rb = std::make_unique<ringbuf<event, 1000, RINGBUF_SPSC>>();
+        bool ok = true;
+        std::thread consumer([&rb, &ok] {
+            event out[7];
+            std::uint64_t seq = 0;
+            while (seq != SPSC_TEST_ELEMS) {
+                std::size_t n = rb->pop_n(out, 1 + seq % 7);
+                for (std::size_t i = 0; i != n; ++i, ++seq)
+                    if (out[i].seq != seq || out[i].payload[39] != (std::uint8_t) seq)
+                        ok = false;
+                if (n == 0)
+                    std::this_thread::yield();
+            }
+        });
+        std::thread producer([&rb] {
+            std::uint64_t seq = 0;
+            while (seq != SPSC_TEST_ELEMS) {
+                event e;
+                e.seq = seq;
+                e.payload[39] = (std::uint8_t) seq;
+                if (seq % 3 ? rb->push(e) : rb->emplace(e))
+                    ++seq;
+                else
+                    std::this_thread::yield();
+            }
+        });
+        producer.join();
+        consumer.join();
+        assert(ok && rb->empty());
+    }
+    END_TEST(test_num);
+
+    START_NEW_TEST(test_num);
+    {
+        /* overflowing batches behave just as they do in the C core */
+        int in[8] = { 1, 2, 3, 4, 5, 6, 7, 8 };
+        ringbuf<int, 4> rb;
+        ringbuf<int, 4, RINGBUF_SPSC> srb;
+        struct ringbuf_t *crb = ringbuf_new_elems(4, sizeof(int), 0);
+        struct ringbuf_t *csrb = ringbuf_new_elems(4, sizeof(int), RINGBUF_SPSC);
+        assert(crb && csrb);
+        assert(rb.push_n(in, 8) == 8 && ringbuf_push_n(crb, in, 8) == 8);
+        assert(srb.push_n(in, 8) == 4 && ringbuf_push_n(csrb, in, 8) == 4);
+        int out[8], cout[8];
+        assert(rb.pop_n(out, 8) == 4 && ringbuf_pop_n(cout, crb, 8) == 4);
+        assert(std::equal(out, out + 4, cout) && out[0] == 5);
+        assert(srb.pop_n(out, 8) == 4 && ringbuf_pop_n(cout, csrb, 8) == 4);
+        assert(std::equal(out, out + 4, cout) && out[0] == 1);
+        ringbuf_free(&crb);
+        ringbuf_free(&csrb);
+    }
+    END_TEST(test_num);
+
+#if __cplusplus >= 202002L && __has_include(<span>)
+    START_NEW_TEST(test_num);
+    {
+        ringbuf<int, 16> rb;
+        int in[5] = { 1, 2, 3, 4, 5 }, out[5];
+        assert(rb.push_n(std::span<const int>(in)) == 5);
+        assert(rb.pop_n(std::span<int>(out)) == 5);
+        assert(out[4] == 5);
+    }
+    END_TEST(test_num);
+#endif
+
+    return 0;
+}
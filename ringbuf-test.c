@@ -20,6 +20,19 @@
 #include <stdint.h>
 #include <signal.h>
 #include <assert.h>
+#include <errno.h>
+#include <sys/param.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sys/stat.h>
 #include "ringbuf.h"
 
 /*
@@ -64,6 +77,556 @@ sigabort(int unused)
     exit(1);
 }
 
+/*
+ * SPSC stress test: a producer thread pushes a known byte sequence
+ * through the ring buffer in odd-sized chunks, while a consumer
+ * thread drains it and checks the sequence.
+ */
+#define SPSC_TEST_BYTES (1 << 22)
+
+static uint8_t
+spsc_test_byte(size_t n)
+{
+    return (uint8_t) ((n * 31) ^ (n >> 9));
+}
+
+/*
+ * For RINGBUF_DEFER_PUBLISH ring buffers, the producer publishes
+ * after every 8th chunk, and whenever the ring buffer is full.
+ */
+void *
+spsc_test_producer(void *arg)
+{
+    ringbuf_t rb = arg;
+    uint8_t chunk[113];
+    size_t nsent = 0;
+    size_t nchunks = 0;
+    while (nsent != SPSC_TEST_BYTES) {
+        size_t n = MIN(1 + nsent % sizeof(chunk), SPSC_TEST_BYTES - nsent);
+        size_t i;
+        for (i = 0; i != n; ++i)
+            chunk[i] = spsc_test_byte(nsent + i);
+        while (!ringbuf_memcpy_into(rb, chunk, n)) {
+            ringbuf_publish(rb);
+            sched_yield();
+        }
+        nsent += n;
+        if (++nchunks % 8 == 0)
+            ringbuf_publish(rb);
+    }
+    ringbuf_publish(rb);
+    return 0;
+}
+
+void *
+spsc_test_consumer(void *arg)
+{
+    ringbuf_t rb = arg;
+    uint8_t chunk[97];
+    size_t nreceived = 0;
+    while (nreceived != SPSC_TEST_BYTES) {
+        size_t n = MIN(1 + nreceived % sizeof(chunk), SPSC_TEST_BYTES - nreceived);
+        size_t i;
+        while (!ringbuf_memcpy_from(chunk, rb, n))
+            sched_yield();
+        for (i = 0; i != n; ++i)
+            if (chunk[i] != spsc_test_byte(nreceived + i))
+                return (void *) 1;
+        nreceived += n;
+    }
+    return 0;
+}
+
+/*
+ * SPSC record stress test: the producer thread pushes padded records
+ * of varying lengths, each filled with its sequence number, and the
+ * consumer thread pops them in batches, or peeks at and consumes
+ * them in place.
+ */
+#define RECORD_TEST_RECORDS (1 << 16)
+
+void *
+record_test_producer(void *arg)
+{
+    ringbuf_t rb = arg;
+    uint8_t record[61];
+    size_t i;
+    for (i = 0; i != RECORD_TEST_RECORDS; ++i) {
+        size_t len = i % sizeof(record);
+        memset(record, (uint8_t) i, len);
+        while (!ringbuf_push_record(rb, record, len))
+            sched_yield();
+    }
+    return 0;
+}
+
+void *
+record_test_consumer(void *arg)
+{
+    ringbuf_t rb = arg;
+    uint8_t records[4 * 61];
+    size_t lens[4];
+    struct iovec iov[4][2];
+    size_t i = 0, n, r, j;
+    while (i != RECORD_TEST_RECORDS) {
+        if (i % 2) {
+            n = ringbuf_pop_records(records, rb, sizeof(records), lens, 4);
+            const uint8_t *p = records;
+            for (r = 0; r != n; ++r, ++i) {
+                if (lens[r] != i % 61)
+                    return (void *) 1;
+                for (j = 0; j != lens[r]; ++j)
+                    if (*p++ != (uint8_t) i)
+                        return (void *) 1;
+            }
+        } else {
+            n = ringbuf_peek_records(rb, iov, 4);
+            for (r = 0; r != n; ++r, ++i) {
+                if (iov[r][0].iov_len != i % 61 || iov[r][1].iov_len != 0)
+                    return (void *) 1;
+                for (j = 0; j != iov[r][0].iov_len; ++j)
+                    if (((const uint8_t *) iov[r][0].iov_base)[j] != (uint8_t) i)
+                        return (void *) 1;
+            }
+            if (ringbuf_consume_records(rb, n) != n)
+                return (void *) 1;
+        }
+        if (n == 0)
+            sched_yield();
+    }
+    return 0;
+}
+
+/*
+ * Blocking SPSC test: the producer and consumer wait for space and
+ * data instead of yielding, and each pauses now and then, so that
+ * the other side parks.
+ */
+#define BLOCKING_TEST_BYTES (1 << 20)
+
+void *
+blocking_test_producer(void *arg)
+{
+    ringbuf_t rb = arg;
+    uint8_t chunk[113];
+    size_t nsent = 0;
+    size_t nchunks = 0;
+    while (nsent != BLOCKING_TEST_BYTES) {
+        size_t n = MIN(1 + nsent % sizeof(chunk), BLOCKING_TEST_BYTES - nsent);
+        size_t i;
+        for (i = 0; i != n; ++i)
+            chunk[i] = spsc_test_byte(nsent + i);
+        if (!ringbuf_wait_free(rb, n, -1) || !ringbuf_memcpy_into(rb, chunk, n))
+            return (void *) 1;
+        nsent += n;
+        if (++nchunks % 1024 == 0)
+            usleep(200);
+    }
+    return 0;
+}
+
+void *
+blocking_test_consumer(void *arg)
+{
+    ringbuf_t rb = arg;
+    uint8_t chunk[97];
+    size_t nreceived = 0;
+    size_t nchunks = 0;
+    while (nreceived != BLOCKING_TEST_BYTES) {
+        size_t n = MIN(1 + nreceived % sizeof(chunk), BLOCKING_TEST_BYTES - nreceived);
+        size_t i;
+        if (!ringbuf_wait_used(rb, n, -1) || !ringbuf_memcpy_from(chunk, rb, n))
+            return (void *) 1;
+        for (i = 0; i != n; ++i)
+            if (chunk[i] != spsc_test_byte(nreceived + i))
+                return (void *) 1;
+        nreceived += n;
+        if (++nchunks % 1500 == 0)
+            usleep(200);
+    }
+    return 0;
+}
+
+/*
+ * Broadcast stress test: like the SPSC test, but with several reader
+ * threads, each of which must see the whole sequence.
+ */
+void *
+broadcast_test_reader(void *arg)
+{
+    ringbuf_reader_t r = arg;
+    uint8_t chunk[97];
+    size_t nreceived = 0;
+    while (nreceived != SPSC_TEST_BYTES) {
+        size_t n = MIN(1 + nreceived % sizeof(chunk), SPSC_TEST_BYTES - nreceived);
+        size_t i;
+        while (!ringbuf_reader_memcpy_from(chunk, r, n))
+            sched_yield();
+        for (i = 0; i != n; ++i)
+            if (chunk[i] != spsc_test_byte(nreceived + i))
+                return (void *) 1;
+        nreceived += n;
+    }
+    return 0;
+}
+
+/*
+ * Broadcast join stress test: the producer pushes consecutive 64-bit
+ * sequence numbers, while reader threads repeatedly join, read a few
+ * of them, and leave. A joining reader may start at any sequence
+ * number, but must never see more than a ring buffer's worth of
+ * bytes, nor a gap in the sequence, which is what it would see if the
+ * producer had overwritten bytes it considers readable.
+ */
+#define JOIN_TEST_WORDS (1 << 20)
+
+struct join_test
+{
+    ringbuf_t rb;
+    _Atomic int done;
+};
+
+void *
+join_test_producer(void *arg)
+{
+    struct join_test *t = arg;
+    uint64_t words[5];
+    uint64_t nsent = 0;
+    while (nsent != JOIN_TEST_WORDS) {
+        size_t n = MIN(1 + nsent % 5, JOIN_TEST_WORDS - nsent);
+        size_t i;
+        for (i = 0; i != n; ++i)
+            words[i] = nsent + i;
+        while (!ringbuf_memcpy_into(t->rb, words, n * sizeof(words[0])))
+            sched_yield();
+        nsent += n;
+    }
+    atomic_store(&t->done, 1);
+    return 0;
+}
+
+void *
+join_test_reader(void *arg)
+{
+    struct join_test *t = arg;
+    while (!atomic_load(&t->done)) {
+        ringbuf_reader_t r = ringbuf_reader_new(t->rb);
+        if (!r) {
+            sched_yield();
+            continue;
+        }
+        uint64_t word, expected = 0;
+        size_t nread = 0;
+        while (nread != 64) {
+            size_t used = ringbuf_reader_bytes_used(r);
+            if (used > ringbuf_capacity(t->rb) || used % sizeof(word))
+                return (void *) 1;
+            if (used == 0) {
+                if (atomic_load(&t->done))
+                    break;
+                sched_yield();
+                continue;
+            }
+            assert(ringbuf_reader_memcpy_from(&word, r, sizeof(word)));
+            if (nread++ && word != expected)
+                return (void *) 1;
+            expected = word + 1;
+        }
+        ringbuf_reader_free(&r);
+    }
+    return 0;
+}
+
+/*
+ * MPMC stress test: several producer threads push 8-byte messages,
+ * each consisting of the producer's id and a sequence number, while
+ * several consumer threads pop them. Each consumer checks that it
+ * sees each producer's messages in order, and counts them.
+ */
+#define MPMC_TEST_PRODUCERS 4
+#define MPMC_TEST_CONSUMERS 3
+#define MPMC_TEST_MESSAGES (1 << 16)
+
+struct mpmc_test
+{
+    ringbuf_t rb;
+    uint32_t id;
+    _Atomic size_t *nreceived;
+    size_t received[MPMC_TEST_PRODUCERS];
+};
+
+void *
+mpmc_test_producer(void *arg)
+{
+    struct mpmc_test *t = arg;
+    uint32_t msg[2];
+    msg[0] = t->id;
+    for (msg[1] = 0; msg[1] != MPMC_TEST_MESSAGES; ++msg[1])
+        while (!ringbuf_memcpy_into(t->rb, msg, sizeof(msg)))
+            sched_yield();
+    return 0;
+}
+
+void *
+mpmc_test_consumer(void *arg)
+{
+    struct mpmc_test *t = arg;
+    uint32_t msg[2];
+    while (*t->nreceived != MPMC_TEST_PRODUCERS * MPMC_TEST_MESSAGES) {
+        if (!ringbuf_memcpy_from(msg, t->rb, sizeof(msg))) {
+            sched_yield();
+            continue;
+        }
+        if (msg[0] >= MPMC_TEST_PRODUCERS || msg[1] < t->received[msg[0]])
+            return (void *) 1;
+        t->received[msg[0]] = msg[1] + 1;
+        ++*t->nreceived;
+    }
+    return 0;
+}
+
+/*
+ * Ring buffer set stress test: each producer thread pushes records
+ * into its own shard, each stamped with a shared clock, its id and
+ * its sequence number, and the consumer checks that it gets every
+ * producer's records, in order.
+ */
+#define SET_TEST_PRODUCERS 4
+#define SET_TEST_RECORDS (1 << 15)
+
+struct set_test_record
+{
+    uint64_t timestamp;
+    uint32_t id;
+    uint32_t seq;
+};
+
+struct set_test
+{
+    ringbuf_set_t set;
+    uint32_t id;
+    _Atomic uint64_t *clock;
+};
+
+void *
+set_test_producer(void *arg)
+{
+    struct set_test *t = arg;
+    ringbuf_t shard = ringbuf_set_shard(t->set, t->id);
+    if (!shard)
+        return (void *) 1;
+    struct set_test_record r;
+    r.id = t->id;
+    for (r.seq = 0; r.seq != SET_TEST_RECORDS; ++r.seq) {
+        r.timestamp = atomic_fetch_add(t->clock, 1);
+        while (!ringbuf_push_record(shard, &r, sizeof(r)))
+            sched_yield();
+    }
+    return 0;
+}
+
+/*
+ * Codecs for testing ringbuf_codec_copy. The "compressor" doubles
+ * each byte, and ends each stream with a '$'; if there's only room
+ * for the first byte of a pair, the second is left pending. The
+ * "decompressor" undoes that, and the failing codec fails after it's
+ * consumed a few bytes.
+ */
+struct doubling_codec
+{
+    int pending; /* the byte still to be written, or -1 */
+    int ended;   /* the current stream's '$' has been written */
+};
+
+static int
+doubling_codec_process(void *state, const void *in, size_t *in_len, void *out,
+                       size_t *out_len, int mode)
+{
+    struct doubling_codec *d = state;
+    const uint8_t *u8in = in;
+    uint8_t *u8out = out;
+    size_t nin = 0, nout = 0;
+    for (;;) {
+        if (d->pending >= 0) {
+            if (nout == *out_len)
+                break;
+            u8out[nout++] = d->pending;
+            d->pending = -1;
+        }
+        if (nin != *in_len) {
+            if (nout == *out_len)
+                break;
+            u8out[nout++] = d->pending = u8in[nin++];
+            d->ended = 0;
+        } else if (mode == RINGBUF_CODEC_END && !d->ended) {
+            d->pending = '$';
+            d->ended = 1;
+        } else
+            break;
+    }
+    int more = d->pending >= 0 || nin != *in_len;
+    *in_len = nin;
+    *out_len = nout;
+    return more;
+}
+
+static int
+halving_codec_process(void *state, const void *in, size_t *in_len, void *out,
+                      size_t *out_len, int mode)
+{
+    int *odd = state;
+    const uint8_t *u8in = in;
+    uint8_t *u8out = out;
+    size_t nin, nout = 0;
+    for (nin = 0; nin != *in_len; ++nin) {
+        if (*odd)
+            *odd = 0;
+        else if (u8in[nin] != '$') {
+            if (nout == *out_len)
+                break;
+            u8out[nout++] = u8in[nin];
+            *odd = 1;
+        }
+    }
+    int more = nin != *in_len;
+    *in_len = nin;
+    *out_len = nout;
+    return more;
+}
+
+static int
+failing_codec_process(void *state, const void *in, size_t *in_len, void *out,
+                      size_t *out_len, int mode)
+{
+    *in_len = MIN(*in_len, 3);
+    *out_len = 0;
+    return -1;
+}
+
+/*
+ * Push the len bytes at data through the codec enc, from one ring
+ * buffer into another, and from there through dec into a third, and
+ * copy the result to out. Each ring buffer is much smaller than the
+ * data, so each stage runs out of input and of room many times.
+ * Returns 1 if the data comes out the same as it went in.
+ */
+static int
+codec_test_roundtrip(const struct ringbuf_codec *enc, const struct ringbuf_codec *dec,
+                     const uint8_t *data, size_t len, uint8_t *out)
+{
+    ringbuf_t src = ringbuf_new(3001);
+    ringbuf_t mid = ringbuf_new(997);
+    ringbuf_t dst = ringbuf_new(2003);
+    size_t nin = 0, nout = 0, rounds;
+    int ok = src && mid && dst, encoded = 0, decoded = 0;
+    for (rounds = 0; ok && !decoded && rounds != 1000000; ++rounds) {
+        size_t n = MIN(ringbuf_bytes_free(src), len - nin);
+        if (n && !ringbuf_memcpy_into(src, data + nin, n))
+            ok = 0;
+        nin += n;
+        if (!encoded) {
+            int mode = nin == len ? RINGBUF_CODEC_END : RINGBUF_CODEC_CONTINUE;
+            int result = ringbuf_codec_copy(mid, src, ringbuf_bytes_used(src), enc, mode);
+            ok = ok && result >= 0;
+            encoded = result == 0 && mode == RINGBUF_CODEC_END;
+        }
+        int result = ringbuf_codec_copy(dst, mid, ringbuf_bytes_used(mid), dec,
+                                        encoded ? RINGBUF_CODEC_FLUSH : RINGBUF_CODEC_CONTINUE);
+        ok = ok && result >= 0;
+        decoded = encoded && result == 0 && ringbuf_is_empty(mid);
+        n = ringbuf_bytes_used(dst);
+        if (nout + n > len || (n && !ringbuf_memcpy_from(out + nout, dst, n)))
+            ok = 0;
+        nout += n;
+    }
+    ringbuf_free(&src);
+    ringbuf_free(&mid);
+    ringbuf_free(&dst);
+    return ok && decoded && nout == len && memcmp(out, data, len) == 0;
+}
+
+#ifdef RINGBUF_IO_URING
+struct uring_test
+{
+    int ncompleted;
+    int op;
+    ringbuf_t rb;
+    int res;
+};
+
+static void
+uring_test_complete(void *arg, int op, ringbuf_t rb, int res)
+{
+    struct uring_test *t = arg;
+    ++t->ncompleted;
+    t->op = op;
+    t->rb = rb;
+    t->res = res;
+}
+#endif
+
+#ifdef __linux__
+/*
+ * Wait (for a while) until at least count bytes have been released
+ * by z, and return the number of bytes released.
+ */
+static size_t
+zerocopy_test_wait(ringbuf_zerocopy_t z, size_t count)
+{
+    size_t nreleased = 0;
+    int tries;
+    for (tries = 0; nreleased < count && tries != 1000; ++tries) {
+        ssize_t n = ringbuf_zerocopy_complete(z);
+        assert(n >= 0);
+        nreleased += n;
+        if (nreleased < count)
+            usleep(1000);
+    }
+    return nreleased;
+}
+#endif
+
+/*
+ * Naive versions of ringbuf_findset and ringbuf_findstr, which copy
+ * the ring buffer's contents out to a linear buffer first.
+ */
+static size_t
+naive_findset(const uint8_t *p, size_t n, const uint8_t *set, size_t nset, size_t offset)
+{
+    size_t i, j;
+    for (i = offset; i < n; ++i)
+        for (j = 0; j != nset; ++j)
+            if (p[i] == set[j])
+                return i;
+    return n;
+}
+
+static size_t
+naive_findstr(const uint8_t *p, size_t n, const uint8_t *needle, size_t len, size_t offset)
+{
+    size_t i;
+    for (i = offset; i < n && len <= n - i; ++i)
+        if (memcmp(p + i, needle, len) == 0)
+            return i;
+    return n;
+}
+
+/*
+ * A bit-at-a-time CRC32C, to check the library's checksums against.
+ */
+static uint32_t
+crc32c_reference(uint32_t crc, const uint8_t *p, size_t n)
+{
+    crc = ~crc;
+    while (n--) {
+        int k;
+        crc ^= *p++;
+        for (k = 0; k != 8; ++k)
+            crc = (crc >> 1) ^ (0x82f63b78 & -(crc & 1));
+    }
+    return ~crc;
+}
+
 #define START_NEW_TEST(test_num) \
     fprintf(stderr, "Test %d...", (++test_num));
 
@@ -73,6 +636,9 @@ sigabort(int unused)
 /* Default size for these tests. */
 #define RINGBUF_SIZE 4096
 
+/* stands in for ringbuf_new_elems in lists of ring buffer flags */
+#define RINGBUF_ELEMS_TEST (-1)
+
 int
 main(int argc, char **argv)
 {
@@ -2197,6 +2763,2574 @@ main(int argc, char **argv)
     
     ringbuf_free(&rb1);
     ringbuf_free(&rb2);
+
+    /* SPSC ring buffers */
+    rb1 = ringbuf_new_flags(RINGBUF_SIZE - 1, RINGBUF_SPSC);
+    rb1_base = ringbuf_head(rb1);
+
+    START_NEW_TEST(test_num);
+    assert(ringbuf_buffer_size(rb1) == RINGBUF_SIZE);
+    assert(ringbuf_capacity(rb1) == RINGBUF_SIZE - 1);
+    assert(ringbuf_bytes_free(rb1) == ringbuf_capacity(rb1));
+    assert(ringbuf_bytes_used(rb1) == 0);
+    assert(!ringbuf_is_full(rb1));
+    assert(ringbuf_is_empty(rb1));
+    assert(ringbuf_tail(rb1) == ringbuf_head(rb1));
+    assert(ringbuf_tail(rb1) == rb1_base);
+    END_TEST(test_num);
+
+    /* SPSC ringbuf_memcpy_into up to capacity, then refuse to overflow */
+    START_NEW_TEST(test_num);
+    ringbuf_reset(rb1);
+    assert(ringbuf_memcpy_into(rb1, buf, RINGBUF_SIZE - 2) == rb1_base + RINGBUF_SIZE - 2);
+    assert(ringbuf_memcpy_into(rb1, buf, 2) == 0);
+    assert(ringbuf_bytes_used(rb1) == RINGBUF_SIZE - 2);
+    assert(ringbuf_tail(rb1) == rb1_base);
+    assert(ringbuf_memcpy_into(rb1, buf + RINGBUF_SIZE - 2, 1) == rb1_base + RINGBUF_SIZE - 1);
+    assert(ringbuf_is_full(rb1));
+    assert(ringbuf_memcpy_into(rb1, buf, 1) == 0);
+    assert(ringbuf_memset(rb1, 1, 1) == 0);
+    assert(ringbuf_tail(rb1) == rb1_base);
+    assert(ringbuf_head(rb1) == rb1_base + RINGBUF_SIZE - 1);
+    assert(strncmp(ringbuf_tail(rb1), (const char *) buf, RINGBUF_SIZE - 1) == 0);
+    END_TEST(test_num);
+
+    /* SPSC ringbuf_memset won't overflow, either */
+    START_NEW_TEST(test_num);
+    ringbuf_reset(rb1);
+    assert(ringbuf_memset(rb1, 1, 8) == 8);
+    assert(ringbuf_memset(rb1, 2, RINGBUF_SIZE - 8) == 0);
+    assert(ringbuf_bytes_used(rb1) == 8);
+    assert(ringbuf_memset(rb1, 2, RINGBUF_SIZE - 9) == RINGBUF_SIZE - 9);
+    assert(ringbuf_is_full(rb1));
+    assert(ringbuf_tail(rb1) == rb1_base);
+    END_TEST(test_num);
+
+    /* SPSC ringbuf_read clamps the count to the free bytes */
+    START_NEW_TEST(test_num);
+    ringbuf_reset(rb1);
+    assert(lseek(rdfd, 0, SEEK_SET) == 0);
+    assert(ringbuf_memset(rb1, 1, 16) == 16);
+    assert(ringbuf_read(rdfd, rb1, RINGBUF_SIZE) == RINGBUF_SIZE - 1 - 16);
+    assert(ringbuf_is_full(rb1));
+    assert(ringbuf_tail(rb1) == rb1_base);
+    assert(ringbuf_head(rb1) == rb1_base + RINGBUF_SIZE - 1);
+    assert(ringbuf_read(rdfd, rb1, 1) == 0);
+    assert(lseek(rdfd, 0, SEEK_CUR) == RINGBUF_SIZE - 1 - 16);
+    assert(strncmp((const char *) rb1_base + 16, (const char *) buf, RINGBUF_SIZE - 1 - 16) == 0);
+    END_TEST(test_num);
+
+    /* SPSC ringbuf_copy refuses to overflow dst */
+    rb2 = ringbuf_new(RINGBUF_SIZE - 1);
+    START_NEW_TEST(test_num);
+    ringbuf_reset(rb1);
+    ringbuf_reset(rb2);
+    assert(ringbuf_memcpy_into(rb2, buf, RINGBUF_SIZE - 1) == ringbuf_head(rb2));
+    assert(ringbuf_memcpy_into(rb1, buf, 1) == rb1_base + 1);
+    assert(ringbuf_copy(rb1, rb2, RINGBUF_SIZE - 1) == 0);
+    assert(ringbuf_bytes_used(rb2) == RINGBUF_SIZE - 1);
+    assert(ringbuf_bytes_used(rb1) == 1);
+    assert(ringbuf_copy(rb1, rb2, RINGBUF_SIZE - 2) == rb1_base + RINGBUF_SIZE - 1);
+    assert(ringbuf_is_full(rb1));
+    assert(ringbuf_bytes_used(rb2) == 1);
+    END_TEST(test_num);
+    ringbuf_free(&rb2);
+
+    /* SPSC, with producer and consumer threads */
+    START_NEW_TEST(test_num);
+    ringbuf_free(&rb1);
+    rb1 = ringbuf_new_flags(1021, RINGBUF_SPSC);
+    pthread_t producer, consumer;
+    void *consumer_result;
+    assert(pthread_create(&consumer, 0, spsc_test_consumer, rb1) == 0);
+    assert(pthread_create(&producer, 0, spsc_test_producer, rb1) == 0);
+    assert(pthread_join(producer, 0) == 0);
+    assert(pthread_join(consumer, &consumer_result) == 0);
+    assert(consumer_result == 0);
+    assert(ringbuf_is_empty(rb1));
+    END_TEST(test_num);
+
+    ringbuf_free(&rb1);
+
+    /* MPMC ring buffers */
+    START_NEW_TEST(test_num);
+    assert(ringbuf_new_flags(RINGBUF_SIZE - 1, RINGBUF_MPMC | RINGBUF_SPSC) == 0);
+    rb1 = ringbuf_new_flags(RINGBUF_SIZE - 1, RINGBUF_MPMC);
+    rb1_base = ringbuf_head(rb1);
+    assert(ringbuf_buffer_size(rb1) == RINGBUF_SIZE);
+    assert(ringbuf_capacity(rb1) == RINGBUF_SIZE - 1);
+    assert(ringbuf_bytes_free(rb1) == ringbuf_capacity(rb1));
+    assert(ringbuf_is_empty(rb1));
+    assert(ringbuf_tail(rb1) == rb1_base);
+    END_TEST(test_num);
+
+    /* MPMC ring buffers reject overflows and underflows */
+    START_NEW_TEST(test_num);
+    assert(ringbuf_memcpy_into(rb1, buf, RINGBUF_SIZE) == 0);
+    assert(ringbuf_memcpy_into(rb1, buf, RINGBUF_SIZE - 2) == rb1_base + RINGBUF_SIZE - 2);
+    assert(ringbuf_memcpy_into(rb1, buf, 2) == 0);
+    assert(ringbuf_memset(rb1, 1, 2) == 0);
+    assert(ringbuf_memset(rb1, 1, 1) == 1);
+    assert(ringbuf_is_full(rb1));
+    assert(ringbuf_tail(rb1) == rb1_base);
+    assert(ringbuf_memcpy_from(dst, rb1, RINGBUF_SIZE) == 0);
+    assert(ringbuf_memcpy_from(dst, rb1, 11) == rb1_base + 11);
+    assert(strncmp((const char *) dst, (const char *) buf, 11) == 0);
+    assert(ringbuf_bytes_used(rb1) == RINGBUF_SIZE - 12);
+    assert(ringbuf_memcpy_into(rb1, buf, 11) == rb1_base + 10);
+    assert(ringbuf_is_full(rb1));
+    assert(ringbuf_memcpy_from(dst, rb1, RINGBUF_SIZE - 1) == rb1_base + 10);
+    assert(strncmp((const char *) dst, (const char *) buf + 11, RINGBUF_SIZE - 13) == 0);
+    assert(dst[RINGBUF_SIZE - 13] == 1);
+    assert(strncmp((const char *) dst + RINGBUF_SIZE - 12, (const char *) buf, 11) == 0);
+    assert(ringbuf_is_empty(rb1));
+    END_TEST(test_num);
+    ringbuf_free(&rb1);
+
+    /* MPMC, with several producer and consumer threads */
+    START_NEW_TEST(test_num);
+    rb1 = ringbuf_new_flags(1021, RINGBUF_MPMC);
+    {
+        struct mpmc_test producers[MPMC_TEST_PRODUCERS];
+        struct mpmc_test consumers[MPMC_TEST_CONSUMERS];
+        pthread_t producer_threads[MPMC_TEST_PRODUCERS];
+        pthread_t consumer_threads[MPMC_TEST_CONSUMERS];
+        _Atomic size_t nreceived = 0;
+        size_t i;
+        for (i = 0; i != MPMC_TEST_CONSUMERS; ++i) {
+            memset(&consumers[i], 0, sizeof(consumers[i]));
+            consumers[i].rb = rb1;
+            consumers[i].nreceived = &nreceived;
+            assert(pthread_create(&consumer_threads[i], 0, mpmc_test_consumer, &consumers[i]) == 0);
+        }
+        for (i = 0; i != MPMC_TEST_PRODUCERS; ++i) {
+            producers[i].rb = rb1;
+            producers[i].id = i;
+            assert(pthread_create(&producer_threads[i], 0, mpmc_test_producer, &producers[i]) == 0);
+        }
+        for (i = 0; i != MPMC_TEST_PRODUCERS; ++i)
+            assert(pthread_join(producer_threads[i], 0) == 0);
+        for (i = 0; i != MPMC_TEST_CONSUMERS; ++i) {
+            assert(pthread_join(consumer_threads[i], &consumer_result) == 0);
+            assert(consumer_result == 0);
+        }
+        assert(nreceived == MPMC_TEST_PRODUCERS * MPMC_TEST_MESSAGES);
+        assert(ringbuf_is_empty(rb1));
+    }
+    END_TEST(test_num);
+    ringbuf_free(&rb1);
+
+    /* Broadcast ring buffers */
+    START_NEW_TEST(test_num);
+    assert(ringbuf_new_flags(RINGBUF_SIZE - 1, RINGBUF_EVICT_LAGGING) == 0);
+    assert(ringbuf_new_broadcast(RINGBUF_SIZE - 1, 3, RINGBUF_MPMC) == 0);
+    assert(ringbuf_new_broadcast(RINGBUF_SIZE - 1, SIZE_MAX / 2, 0) == 0);
+    rb1 = ringbuf_new_broadcast(RINGBUF_SIZE - 1, 3, 0);
+    rb1_base = ringbuf_head(rb1);
+    assert(ringbuf_buffer_size(rb1) == RINGBUF_SIZE);
+    assert(ringbuf_capacity(rb1) == RINGBUF_SIZE - 1);
+    assert(ringbuf_is_empty(rb1));
+    ringbuf_reader_t r1 = ringbuf_reader_new(rb1);
+    ringbuf_reader_t r2 = ringbuf_reader_new(rb1);
+    ringbuf_reader_t r3 = ringbuf_reader_new(rb1);
+    assert(r1 && r2 && r3);
+    assert(ringbuf_reader_new(rb1) == 0);
+    assert(ringbuf_reader_bytes_used(r1) == 0);
+    assert(!ringbuf_reader_is_evicted(r1));
+    assert(ringbuf_reader_memcpy_from(dst, r1, 1) == 0);
+    END_TEST(test_num);
+
+    /* each reader reads independently */
+    START_NEW_TEST(test_num);
+    assert(ringbuf_memcpy_into(rb1, buf, 100) == rb1_base + 100);
+    assert(ringbuf_reader_bytes_used(r1) == 100);
+    assert(ringbuf_reader_bytes_used(r2) == 100);
+    assert(ringbuf_reader_bytes_used(r3) == 100);
+    assert(ringbuf_reader_memcpy_from(dst, r1, 100) == rb1_base + 100);
+    assert(strncmp((const char *) dst, (const char *) buf, 100) == 0);
+    assert(ringbuf_reader_memcpy_from(dst, r2, 101) == 0);
+    assert(ringbuf_reader_memcpy_from(dst, r2, 50) == rb1_base + 50);
+    assert(strncmp((const char *) dst, (const char *) buf, 50) == 0);
+    assert(ringbuf_reader_bytes_used(r1) == 0);
+    assert(ringbuf_reader_bytes_used(r2) == 50);
+    assert(ringbuf_reader_bytes_used(r3) == 100);
+    END_TEST(test_num);
+
+    /* free space is bounded by the slowest reader */
+    START_NEW_TEST(test_num);
+    assert(ringbuf_memcpy_into(rb1, buf + 100, RINGBUF_SIZE - 1 - 100) == rb1_base + RINGBUF_SIZE - 1);
+    assert(ringbuf_memcpy_into(rb1, buf, 1) == 0);
+    assert(ringbuf_is_full(rb1));
+    assert(ringbuf_reader_memcpy_from(dst, r3, 60) == rb1_base + 60);
+    assert(ringbuf_memcpy_into(rb1, buf, 51) == 0);
+    assert(ringbuf_memcpy_into(rb1, buf, 50) == rb1_base + 49);
+    assert(ringbuf_bytes_used(rb1) == RINGBUF_SIZE - 1);
+    assert(ringbuf_reader_bytes_used(r1) == RINGBUF_SIZE - 1 - 100 + 50);
+    assert(ringbuf_reader_bytes_used(r2) == RINGBUF_SIZE - 1);
+    assert(ringbuf_reader_bytes_used(r3) == RINGBUF_SIZE - 1 - 60 + 50);
+    assert(ringbuf_reader_memcpy_from(dst, r2, RINGBUF_SIZE - 1) == rb1_base + 49);
+    assert(strncmp((const char *) dst, (const char *) buf + 50, RINGBUF_SIZE - 1 - 50) == 0);
+    assert(strncmp((const char *) dst + RINGBUF_SIZE - 1 - 50, (const char *) buf, 50) == 0);
+    END_TEST(test_num);
+
+    /* new readers only see new bytes; freed readers don't hold up the producer */
+    START_NEW_TEST(test_num);
+    ringbuf_reader_free(&r3);
+    assert(!r3);
+    r3 = ringbuf_reader_new(rb1);
+    assert(r3);
+    assert(ringbuf_reader_bytes_used(r3) == 0);
+    ringbuf_reader_free(&r1);
+    assert(ringbuf_memcpy_into(rb1, buf, RINGBUF_SIZE - 1) == rb1_base + 48);
+    assert(ringbuf_reader_bytes_used(r2) == RINGBUF_SIZE - 1);
+    assert(ringbuf_reader_bytes_used(r3) == RINGBUF_SIZE - 1);
+    assert(ringbuf_reader_memcpy_from(dst, r3, RINGBUF_SIZE - 1) == rb1_base + 48);
+    assert(strncmp((const char *) dst, (const char *) buf, RINGBUF_SIZE - 1) == 0);
+    END_TEST(test_num);
+
+    /* ringbuf_reader_write */
+    START_NEW_TEST(test_num);
+    assert(ftruncate(wrfd, 0) == 0);
+    assert(lseek(wrfd, 0, SEEK_SET) == 0);
+    assert(ringbuf_reader_write(wrfd, r2, RINGBUF_SIZE) == 0);
+    /* short count, since r2's tail is at offset 49 */
+    assert(ringbuf_reader_write(wrfd, r2, RINGBUF_SIZE - 1) == RINGBUF_SIZE - 49);
+    assert(ringbuf_reader_bytes_used(r2) == 48);
+    assert(ringbuf_reader_write(wrfd, r2, 48) == 48);
+    assert(ringbuf_reader_bytes_used(r2) == 0);
+    assert(lseek(wrfd, 0, SEEK_SET) == 0);
+    assert(read(wrfd, dst, RINGBUF_SIZE - 1) == RINGBUF_SIZE - 1);
+    assert(strncmp((const char *) dst, (const char *) buf, RINGBUF_SIZE - 1) == 0);
+    END_TEST(test_num);
+
+    /* resetting a broadcast ring buffer resets its readers, too */
+    START_NEW_TEST(test_num);
+    assert(ringbuf_memcpy_into(rb1, buf, 8) == rb1_base + 56);
+    ringbuf_reset(rb1);
+    assert(ringbuf_is_empty(rb1));
+    assert(ringbuf_reader_bytes_used(r2) == 0);
+    assert(ringbuf_reader_bytes_used(r3) == 0);
+    assert(ringbuf_memcpy_into(rb1, buf, 8) == rb1_base + 8);
+    assert(ringbuf_reader_memcpy_from(dst, r2, 8) == rb1_base + 8);
+    END_TEST(test_num);
+    ringbuf_reader_free(&r2);
+    ringbuf_reader_free(&r3);
+    ringbuf_free(&rb1);
+
+    /* evicting lagging readers */
+    START_NEW_TEST(test_num);
+    rb1 = ringbuf_new_broadcast(RINGBUF_SIZE - 1, 2, RINGBUF_EVICT_LAGGING);
+    rb1_base = ringbuf_head(rb1);
+    r1 = ringbuf_reader_new(rb1);
+    r2 = ringbuf_reader_new(rb1);
+    assert(ringbuf_memcpy_into(rb1, buf, RINGBUF_SIZE - 1) == rb1_base + RINGBUF_SIZE - 1);
+    assert(ringbuf_reader_memcpy_from(dst, r1, 16) == rb1_base + 16);
+    /* too big to ever fit, evicts nobody */
+    assert(ringbuf_memcpy_into(rb1, buf, RINGBUF_SIZE) == 0);
+    assert(!ringbuf_reader_is_evicted(r2));
+    assert(ringbuf_memcpy_into(rb1, buf, 16) == rb1_base + 15);
+    assert(!ringbuf_reader_is_evicted(r1));
+    assert(ringbuf_reader_is_evicted(r2));
+    assert(ringbuf_reader_bytes_used(r2) == 0);
+    assert(ringbuf_reader_memcpy_from(dst, r2, 1) == 0);
+    assert(ringbuf_reader_write(wrfd, r2, 1) == 0);
+    assert(ringbuf_reader_bytes_used(r1) == RINGBUF_SIZE - 1);
+    assert(ringbuf_reader_memcpy_from(dst, r1, RINGBUF_SIZE - 1) == rb1_base + 15);
+    assert(strncmp((const char *) dst, (const char *) buf + 16, RINGBUF_SIZE - 1 - 16) == 0);
+    assert(strncmp((const char *) dst + RINGBUF_SIZE - 1 - 16, (const char *) buf, 16) == 0);
+    ringbuf_reader_free(&r2);
+    r2 = ringbuf_reader_new(rb1);
+    assert(r2 && !ringbuf_reader_is_evicted(r2));
+    END_TEST(test_num);
+    ringbuf_reader_free(&r1);
+    ringbuf_reader_free(&r2);
+    ringbuf_free(&rb1);
+
+    /* Broadcast, with producer and reader threads */
+    START_NEW_TEST(test_num);
+    rb1 = ringbuf_new_broadcast(1021, 3, 0);
+    {
+        ringbuf_reader_t readers[3];
+        pthread_t reader_threads[3];
+        size_t i;
+        for (i = 0; i != 3; ++i) {
+            readers[i] = ringbuf_reader_new(rb1);
+            assert(pthread_create(&reader_threads[i], 0, broadcast_test_reader, readers[i]) == 0);
+        }
+        assert(pthread_create(&producer, 0, spsc_test_producer, rb1) == 0);
+        assert(pthread_join(producer, 0) == 0);
+        for (i = 0; i != 3; ++i) {
+            assert(pthread_join(reader_threads[i], &consumer_result) == 0);
+            assert(consumer_result == 0);
+            assert(ringbuf_reader_bytes_used(readers[i]) == 0);
+            ringbuf_reader_free(&readers[i]);
+        }
+    }
+    END_TEST(test_num);
+    ringbuf_free(&rb1);
+
+    /* Broadcast, with readers joining while the producer wraps */
+    START_NEW_TEST(test_num);
+    {
+        struct join_test t = { ringbuf_new_broadcast(1024, 2, 0), 0 };
+        pthread_t reader_threads[2];
+        size_t i;
+        for (i = 0; i != 2; ++i)
+            assert(pthread_create(&reader_threads[i], 0, join_test_reader, &t) == 0);
+        assert(pthread_create(&producer, 0, join_test_producer, &t) == 0);
+        assert(pthread_join(producer, 0) == 0);
+        for (i = 0; i != 2; ++i) {
+            assert(pthread_join(reader_threads[i], &consumer_result) == 0);
+            assert(consumer_result == 0);
+        }
+        ringbuf_free(&t.rb);
+    }
+    END_TEST(test_num);
+
+    /* ringbuf_reserve and ringbuf_commit */
+    rb1 = ringbuf_new(RINGBUF_SIZE - 1);
+    rb1_base = ringbuf_head(rb1);
+    struct iovec iov[2];
+
+    START_NEW_TEST(test_num);
+    assert(ringbuf_reserve(rb1, RINGBUF_SIZE, iov) == 0);
+    assert(ringbuf_reserve(rb1, 0, iov) == 1);
+    assert(iov[0].iov_base == rb1_base && iov[0].iov_len == 0);
+    assert(ringbuf_reserve(rb1, 32, iov) == 1);
+    assert(iov[0].iov_base == rb1_base && iov[0].iov_len == 32);
+    assert(iov[1].iov_len == 0);
+    assert(ringbuf_is_empty(rb1));
+    memcpy(iov[0].iov_base, buf, 32);
+    assert(ringbuf_commit(rb1, 20) == rb1_base + 20);
+    assert(ringbuf_bytes_used(rb1) == 20);
+    assert(ringbuf_head(rb1) == rb1_base + 20);
+    assert(strncmp(ringbuf_tail(rb1), (const char *) buf, 20) == 0);
+    END_TEST(test_num);
+
+    /* reserved regions can wrap */
+    START_NEW_TEST(test_num);
+    ringbuf_reset(rb1);
+    assert(ringbuf_memset(rb1, 1, RINGBUF_SIZE - 10) == RINGBUF_SIZE - 10);
+    assert(ringbuf_reserve(rb1, 11, iov) == 0);
+    assert(ringbuf_memcpy_from(dst, rb1, RINGBUF_SIZE - 20) == rb1_base + RINGBUF_SIZE - 20);
+    assert(ringbuf_reserve(rb1, 29, iov) == 2);
+    assert(iov[0].iov_base == rb1_base + RINGBUF_SIZE - 10 && iov[0].iov_len == 10);
+    assert(iov[1].iov_base == rb1_base && iov[1].iov_len == 19);
+    memcpy(iov[0].iov_base, buf, 10);
+    memcpy(iov[1].iov_base, buf + 10, 19);
+    assert(ringbuf_commit(rb1, 29) == rb1_base + 19);
+    assert(ringbuf_bytes_used(rb1) == 39);
+    assert(ringbuf_memcpy_from(dst, rb1, 10) == rb1_base + RINGBUF_SIZE - 10);
+    assert(ringbuf_memcpy_from(dst, rb1, 29) == rb1_base + 19);
+    assert(strncmp((const char *) dst, (const char *) buf, 29) == 0);
+    assert(ringbuf_is_empty(rb1));
+    END_TEST(test_num);
+
+    /* ringbuf_peek and ringbuf_consume */
+    START_NEW_TEST(test_num);
+    ringbuf_reset(rb1);
+    assert(ringbuf_peek(rb1, 1, iov) == 0);
+    assert(ringbuf_consume(rb1, 1) == 0);
+    assert(ringbuf_peek(rb1, 0, iov) == 1);
+    assert(iov[0].iov_len == 0);
+    assert(ringbuf_memset(rb1, 1, RINGBUF_SIZE - 10) == RINGBUF_SIZE - 10);
+    assert(ringbuf_consume(rb1, RINGBUF_SIZE - 20) == rb1_base + RINGBUF_SIZE - 20);
+    assert(ringbuf_bytes_used(rb1) == 10);
+    assert(ringbuf_memcpy_into(rb1, buf, 24) == rb1_base + 14);
+    assert(ringbuf_peek(rb1, 35, iov) == 0);
+    assert(ringbuf_peek(rb1, 34, iov) == 2);
+    assert(iov[0].iov_base == rb1_base + RINGBUF_SIZE - 20 && iov[0].iov_len == 20);
+    assert(iov[1].iov_base == rb1_base && iov[1].iov_len == 14);
+    assert(ringbuf_peek(rb1, 5, iov) == 1);
+    assert(iov[0].iov_base == rb1_base + RINGBUF_SIZE - 20 && iov[0].iov_len == 5);
+    assert(ringbuf_bytes_used(rb1) == 34);
+    assert(ringbuf_consume(rb1, 35) == 0);
+    assert(ringbuf_consume(rb1, 10) == rb1_base + RINGBUF_SIZE - 10);
+    assert(ringbuf_peek(rb1, 24, iov) == 2);
+    assert(strncmp(iov[0].iov_base, (const char *) buf, 10) == 0);
+    assert(strncmp(iov[1].iov_base, (const char *) buf + 10, 14) == 0);
+    assert(ringbuf_consume(rb1, 24) == rb1_base + 14);
+    assert(ringbuf_is_empty(rb1));
+    END_TEST(test_num);
+    ringbuf_free(&rb1);
+
+    /* ringbuf_used_iovec and ringbuf_free_iovec */
+    rb1 = ringbuf_new(RINGBUF_SIZE - 1);
+    rb1_base = ringbuf_head(rb1);
+
+    START_NEW_TEST(test_num);
+    assert(ringbuf_used_iovec(rb1, 0, iov) == 0);
+    assert(ringbuf_free_iovec(rb1, iov) == 1);
+    assert(iov[0].iov_base == rb1_base && iov[0].iov_len == RINGBUF_SIZE - 1);
+    assert(ringbuf_memcpy_into(rb1, buf, 10) == rb1_base + 10);
+    assert(ringbuf_used_iovec(rb1, 0, iov) == 1);
+    assert(iov[0].iov_base == rb1_base && iov[0].iov_len == 10);
+    assert(ringbuf_used_iovec(rb1, 9, iov) == 1);
+    assert(iov[0].iov_base == rb1_base + 9 && iov[0].iov_len == 1);
+    assert(ringbuf_used_iovec(rb1, 10, iov) == 0);
+    assert(ringbuf_free_iovec(rb1, iov) == 1);
+    assert(iov[0].iov_base == rb1_base + 10 && iov[0].iov_len == RINGBUF_SIZE - 11);
+    END_TEST(test_num);
+
+    /* both regions wrap */
+    START_NEW_TEST(test_num);
+    ringbuf_reset(rb1);
+    assert(ringbuf_memset(rb1, 1, RINGBUF_SIZE - 10) == RINGBUF_SIZE - 10);
+    assert(ringbuf_consume(rb1, RINGBUF_SIZE - 20) == rb1_base + RINGBUF_SIZE - 20);
+    assert(ringbuf_free_iovec(rb1, iov) == 2);
+    assert(iov[0].iov_base == rb1_base + RINGBUF_SIZE - 10 && iov[0].iov_len == 10);
+    assert(iov[1].iov_base == rb1_base && iov[1].iov_len == RINGBUF_SIZE - 21);
+    assert(ringbuf_memcpy_into(rb1, buf, 24) == rb1_base + 14);
+    assert(ringbuf_used_iovec(rb1, 0, iov) == 2);
+    assert(iov[0].iov_base == rb1_base + RINGBUF_SIZE - 20 && iov[0].iov_len == 20);
+    assert(iov[1].iov_base == rb1_base && iov[1].iov_len == 14);
+    assert(ringbuf_used_iovec(rb1, 19, iov) == 2);
+    assert(iov[0].iov_base == rb1_base + RINGBUF_SIZE - 1 && iov[0].iov_len == 1);
+    assert(iov[1].iov_base == rb1_base && iov[1].iov_len == 14);
+    assert(ringbuf_used_iovec(rb1, 20, iov) == 1);
+    assert(iov[0].iov_base == rb1_base && iov[0].iov_len == 14);
+    assert(strncmp(iov[0].iov_base, (const char *) buf + 10, 14) == 0);
+    assert(ringbuf_used_iovec(rb1, 33, iov) == 1);
+    assert(iov[0].iov_base == rb1_base + 13 && iov[0].iov_len == 1);
+    assert(ringbuf_used_iovec(rb1, 34, iov) == 0);
+    assert(ringbuf_free_iovec(rb1, iov) == 1);
+    assert(iov[0].iov_base == rb1_base + 14 && iov[0].iov_len == RINGBUF_SIZE - 35);
+    assert(ringbuf_bytes_used(rb1) == 34);
+    assert(ringbuf_tail(rb1) == rb1_base + RINGBUF_SIZE - 20);
+    assert(ringbuf_head(rb1) == rb1_base + 14);
+    assert(ringbuf_memset(rb1, 1, RINGBUF_SIZE - 35) == RINGBUF_SIZE - 35);
+    assert(ringbuf_free_iovec(rb1, iov) == 0);
+    END_TEST(test_num);
+    ringbuf_free(&rb1);
+
+    /* ringbuf_readv and ringbuf_writev */
+    int fds[2];
+    assert(pipe(fds) == 0);
+    rb1 = ringbuf_new(RINGBUF_SIZE - 1);
+    rb1_base = ringbuf_head(rb1);
+
+    START_NEW_TEST(test_num);
+    assert(ringbuf_writev(fds[1], rb1, 1) == 0);
+    assert(ringbuf_memset(rb1, 1, RINGBUF_SIZE - 10) == RINGBUF_SIZE - 10);
+    assert(ringbuf_consume(rb1, RINGBUF_SIZE - 20) == rb1_base + RINGBUF_SIZE - 20);
+    assert(write(fds[1], test_pattern, strlen(test_pattern)) == strlen(test_pattern));
+    assert(ringbuf_readv(fds[0], rb1, strlen(test_pattern)) == strlen(test_pattern));
+    assert(ringbuf_bytes_used(rb1) == 10 + strlen(test_pattern));
+    assert(ringbuf_head(rb1) == rb1_base + strlen(test_pattern) - 10);
+    assert(ringbuf_tail(rb1) == rb1_base + RINGBUF_SIZE - 20);
+    assert(ringbuf_consume(rb1, 10) == rb1_base + RINGBUF_SIZE - 10);
+    assert(ringbuf_writev(fds[1], rb1, strlen(test_pattern) + 1) == 0);
+    assert(ringbuf_writev(fds[1], rb1, strlen(test_pattern)) == strlen(test_pattern));
+    assert(ringbuf_is_empty(rb1));
+    assert(ringbuf_tail(rb1) == rb1_base + strlen(test_pattern) - 10);
+    assert(read(fds[0], dst, RINGBUF_SIZE * 2) == strlen(test_pattern));
+    assert(strncmp((const char *) dst, test_pattern, strlen(test_pattern)) == 0);
+    END_TEST(test_num);
+
+    /* ringbuf_readv overflow */
+    START_NEW_TEST(test_num);
+    ringbuf_reset(rb1);
+    assert(ringbuf_memset(rb1, 1, RINGBUF_SIZE - 10) == RINGBUF_SIZE - 10);
+    assert(write(fds[1], buf, RINGBUF_SIZE * 2) == RINGBUF_SIZE * 2);
+    assert(ringbuf_readv(fds[0], rb1, 20) == 20);
+    assert(ringbuf_is_full(rb1));
+    assert(ringbuf_head(rb1) == rb1_base + 10);
+    assert(ringbuf_tail(rb1) == rb1_base + 11);
+    /* count is clamped to the ring buffer's capacity */
+    assert(ringbuf_readv(fds[0], rb1, RINGBUF_SIZE * 2) == RINGBUF_SIZE - 1);
+    assert(ringbuf_is_full(rb1));
+    assert(ringbuf_head(rb1) == rb1_base + 9);
+    assert(ringbuf_tail(rb1) == rb1_base + 10);
+    assert(ringbuf_memcpy_from(dst, rb1, RINGBUF_SIZE - 1) == rb1_base + 9);
+    assert(strncmp((const char *) dst, (const char *) buf + 20, RINGBUF_SIZE - 1) == 0);
+    assert(read(fds[0], dst, RINGBUF_SIZE + 2) == RINGBUF_SIZE + 2 - 21);
+    END_TEST(test_num);
+
+    /* ringbuf_readv on an SPSC ring buffer does not overflow */
+    ringbuf_free(&rb1);
+    rb1 = ringbuf_new_flags(RINGBUF_SIZE - 1, RINGBUF_SPSC);
+    rb1_base = ringbuf_head(rb1);
+    START_NEW_TEST(test_num);
+    assert(ringbuf_memset(rb1, 1, RINGBUF_SIZE - 10) == RINGBUF_SIZE - 10);
+    assert(write(fds[1], test_pattern, strlen(test_pattern)) == strlen(test_pattern));
+    assert(ringbuf_readv(fds[0], rb1, strlen(test_pattern)) == 9);
+    assert(ringbuf_is_full(rb1));
+    assert(ringbuf_tail(rb1) == rb1_base);
+    assert(read(fds[0], dst, RINGBUF_SIZE * 2) == strlen(test_pattern) - 9);
+    END_TEST(test_num);
+    ringbuf_free(&rb1);
+    close(fds[0]);
+    close(fds[1]);
+
+#ifdef RINGBUF_IO_URING
+    /* io_uring engine, if the kernel supports it */
+    ringbuf_uring_t u = ringbuf_uring_new(8);
+    if (u) {
+        struct uring_test ut1, ut2;
+        int fds2[2];
+        assert(pipe(fds) == 0);
+        assert(pipe(fds2) == 0);
+        rb1 = ringbuf_new(RINGBUF_SIZE - 1);
+        rb1_base = ringbuf_head(rb1);
+        rb2 = ringbuf_new(RINGBUF_SIZE - 1);
+
+        /* reads and writes of unregistered ring buffers wrap */
+        START_NEW_TEST(test_num);
+        memset(&ut1, 0, sizeof(ut1));
+        assert(ringbuf_uring_read(u, fds[0], rb1, 0, &ut1) == 0);
+        assert(ringbuf_uring_write(u, fds[1], rb1, 1, &ut1) == 0);
+        assert(ringbuf_memset(rb1, 1, RINGBUF_SIZE - 10) == RINGBUF_SIZE - 10);
+        assert(ringbuf_consume(rb1, RINGBUF_SIZE - 20) == rb1_base + RINGBUF_SIZE - 20);
+        assert(write(fds[1], test_pattern, strlen(test_pattern)) == strlen(test_pattern));
+        assert(ringbuf_uring_read(u, fds[0], rb1, 100, &ut1) == 1);
+        assert(ringbuf_uring_read(u, fds[0], rb1, 100, &ut1) == 0);
+        assert(ringbuf_bytes_used(rb1) == 10);
+        assert(ringbuf_uring_submit(u, 1) == 1);
+        assert(ringbuf_uring_complete(u, uring_test_complete) == 1);
+        assert(ut1.ncompleted == 1 && ut1.op == RINGBUF_URING_READ && ut1.rb == rb1);
+        assert(ut1.res == strlen(test_pattern));
+        assert(ringbuf_bytes_used(rb1) == 10 + strlen(test_pattern));
+        assert(ringbuf_head(rb1) == rb1_base + strlen(test_pattern) - 10);
+        assert(ringbuf_uring_write(u, fds[1], rb1, 10 + strlen(test_pattern) + 1, &ut1) == 0);
+        assert(ringbuf_uring_write(u, fds[1], rb1, 10 + strlen(test_pattern), &ut1) == 1);
+        assert(ringbuf_uring_write(u, fds[1], rb1, 1, &ut1) == 0);
+        assert(ringbuf_uring_submit(u, 1) == 1);
+        assert(ringbuf_uring_complete(u, uring_test_complete) == 1);
+        assert(ut1.ncompleted == 2 && ut1.op == RINGBUF_URING_WRITE);
+        assert(ut1.res == 10 + strlen(test_pattern));
+        assert(ringbuf_is_empty(rb1));
+        assert(read(fds[0], dst, RINGBUF_SIZE * 2) == 10 + strlen(test_pattern));
+        assert(strncmp((const char *) dst + 10, test_pattern, strlen(test_pattern)) == 0);
+        END_TEST(test_num);
+
+        /* reads are clamped to the free bytes */
+        START_NEW_TEST(test_num);
+        ringbuf_reset(rb1);
+        assert(ringbuf_memset(rb1, 1, RINGBUF_SIZE - 5) == RINGBUF_SIZE - 5);
+        assert(write(fds[1], test_pattern, strlen(test_pattern)) == strlen(test_pattern));
+        assert(ringbuf_uring_read(u, fds[0], rb1, 100, &ut1) == 1);
+        assert(ringbuf_uring_submit(u, 1) == 1);
+        assert(ringbuf_uring_complete(u, 0) == 1);
+        assert(ut1.ncompleted == 2);
+        assert(ringbuf_is_full(rb1));
+        assert(ringbuf_tail(rb1) == rb1_base);
+        assert(ringbuf_uring_read(u, fds[0], rb1, 100, &ut1) == 0);
+        assert(read(fds[0], dst, RINGBUF_SIZE * 2) == strlen(test_pattern) - 4);
+        END_TEST(test_num);
+
+        /* ring buffers can't be resized under an operation in flight */
+        START_NEW_TEST(test_num);
+        ringbuf_t urb = ringbuf_new(100);
+        assert(ringbuf_memcpy_into(urb, test_pattern, 3));
+        assert(ringbuf_uring_read(u, fds[0], urb, 100, &ut1) == 1);
+        assert(ringbuf_uring_submit(u, 0) == 1);
+        assert(!ringbuf_resize(urb, 100000));
+        assert(write(fds[1], test_pattern + 3, 5) == 5);
+        assert(ringbuf_uring_submit(u, 1) == 0);
+        assert(ringbuf_uring_complete(u, 0) == 1);
+        assert(ringbuf_bytes_used(urb) == 8);
+        assert(ringbuf_resize(urb, 100000));
+        assert(ringbuf_memcpy_from(dst, urb, 8));
+        assert(strncmp((const char *) dst, test_pattern, 8) == 0);
+        ringbuf_free(&urb);
+        END_TEST(test_num);
+
+        /* registered ring buffers, and batches across ring buffers */
+        START_NEW_TEST(test_num);
+        ringbuf_t rbs[2] = { rb1, rb2 };
+        memset(&ut1, 0, sizeof(ut1));
+        memset(&ut2, 0, sizeof(ut2));
+        ringbuf_reset(rb1);
+        assert(ringbuf_uring_register(u, rbs, 2) == 1);
+        assert(ringbuf_uring_register(u, rbs, 2) == 0);
+        assert(ringbuf_memset(rb1, 1, RINGBUF_SIZE - 5) == RINGBUF_SIZE - 5);
+        assert(ringbuf_consume(rb1, RINGBUF_SIZE - 5) == rb1_base + RINGBUF_SIZE - 5);
+        assert(write(fds[1], test_pattern, strlen(test_pattern)) == strlen(test_pattern));
+        assert(write(fds2[1], test_pattern, strlen(test_pattern)) == strlen(test_pattern));
+        assert(ringbuf_uring_read(u, fds[0], rb1, 100, &ut1) == 1);
+        assert(ringbuf_uring_read(u, fds2[0], rb2, 100, &ut2) == 1);
+        assert(ringbuf_uring_submit(u, 2) == 2);
+        assert(ringbuf_uring_complete(u, uring_test_complete) == 2);
+        /* fixed buffers stop at the end of the contiguous buffer */
+        assert(ut1.ncompleted == 1 && ut1.rb == rb1 && ut1.res == 5);
+        assert(ringbuf_head(rb1) == rb1_base);
+        assert(ut2.ncompleted == 1 && ut2.rb == rb2 && ut2.res == strlen(test_pattern));
+        assert(ringbuf_bytes_used(rb2) == strlen(test_pattern));
+        assert(ringbuf_uring_write(u, fds2[1], rb2, strlen(test_pattern), &ut2) == 1);
+        assert(ringbuf_uring_submit(u, 1) == 1);
+        assert(ringbuf_uring_complete(u, uring_test_complete) == 1);
+        assert(ut2.ncompleted == 2 && ut2.res == strlen(test_pattern));
+        assert(ringbuf_is_empty(rb2));
+        assert(read(fds2[0], dst, RINGBUF_SIZE * 2) == strlen(test_pattern));
+        assert(strncmp((const char *) dst, test_pattern, strlen(test_pattern)) == 0);
+        END_TEST(test_num);
+
+        /* errors are reported, and don't move the ring buffer */
+        START_NEW_TEST(test_num);
+        close(fds2[0]);
+        close(fds2[1]);
+        assert(ringbuf_memcpy_into(rb2, test_pattern, 4) == ringbuf_head(rb2));
+        assert(ringbuf_uring_write(u, fds2[1], rb2, 4, &ut2) == 1);
+        assert(ringbuf_uring_submit(u, 1) == 1);
+        assert(ringbuf_uring_complete(u, uring_test_complete) == 1);
+        assert(ut2.ncompleted == 3 && ut2.res == -EBADF);
+        assert(ringbuf_bytes_used(rb2) == 4);
+        END_TEST(test_num);
+
+        /* freeing the engine abandons its operations */
+        START_NEW_TEST(test_num);
+        urb = ringbuf_new(100);
+        assert(ringbuf_memcpy_into(urb, test_pattern, 3));
+        assert(ringbuf_uring_read(u, fds[0], urb, 10, &ut1) == 1);
+        assert(ringbuf_uring_write(u, fds[1], urb, 3, &ut1) == 1);
+        ringbuf_uring_free(&u);
+        assert(u == 0);
+        assert(ringbuf_bytes_used(urb) == 3);
+        u = ringbuf_uring_new(8);
+        assert(u);
+        assert(ringbuf_uring_read(u, fds[0], urb, 10, &ut1) == 1);
+        assert(ringbuf_uring_write(u, fds[1], urb, 3, &ut1) == 1);
+        ringbuf_uring_free(&u);
+        assert(ringbuf_resize(urb, 1000));
+
+        /* ... and cancels those that were submitted */
+        u = ringbuf_uring_new(8);
+        assert(u);
+        assert(ringbuf_uring_read(u, fds[0], urb, 10, &ut1) == 1);
+        assert(ringbuf_uring_submit(u, 0) == 1);
+        ringbuf_uring_free(&u);
+        assert(ringbuf_bytes_used(urb) == 3);
+        assert(write(fds[1], test_pattern, strlen(test_pattern)) == strlen(test_pattern));
+        assert(read(fds[0], dst, RINGBUF_SIZE * 2) == strlen(test_pattern));
+        assert(ringbuf_resize(urb, 2000));
+        ringbuf_free(&urb);
+        END_TEST(test_num);
+
+        ringbuf_free(&rb1);
+        ringbuf_free(&rb2);
+        close(fds[0]);
+        close(fds[1]);
+    }
+#endif
+
+#ifdef __linux__
+    /* zero-copy sends into a pipe with vmsplice */
+    ringbuf_zerocopy_t z;
+    assert(pipe(fds) == 0);
+    rb1 = ringbuf_new(RINGBUF_SIZE - 1);
+    assert(ringbuf_zerocopy_new(rb1, fds[1], 1) == 0);
+    ringbuf_free(&rb1);
+    rb1 = ringbuf_new_flags(RINGBUF_SIZE - 1, RINGBUF_SPSC);
+    rb1_base = ringbuf_head(rb1);
+    assert(ringbuf_zerocopy_new(rb1, fds[1], 0) == 0);
+
+    START_NEW_TEST(test_num);
+    assert(ringbuf_memset(rb1, 1, RINGBUF_SIZE - 10) == RINGBUF_SIZE - 10);
+    assert(ringbuf_consume(rb1, RINGBUF_SIZE - 20) == rb1_base + RINGBUF_SIZE - 20);
+    z = ringbuf_zerocopy_new(rb1, fds[1], 1);
+    assert(z);
+    assert(ringbuf_memcpy_into(rb1, test_pattern, strlen(test_pattern)) == rb1_base + 1);
+    assert(ringbuf_zerocopy_send(z, 22, 0) == 0);
+    assert(ringbuf_zerocopy_send(z, 15, 0) == 15);
+    assert(ringbuf_zerocopy_pinned(z) == 15);
+    assert(ringbuf_bytes_used(rb1) == 21);
+    assert(ringbuf_zerocopy_send(z, 7, 0) == 0);
+    /* the rest wraps, and is sent with a single vmsplice */
+    assert(ringbuf_zerocopy_send(z, 6, 0) == 6);
+    assert(ringbuf_zerocopy_pinned(z) == 21);
+    assert(ringbuf_zerocopy_send(z, 1, 0) == 0);
+    assert(ringbuf_zerocopy_complete(z) == 0);
+    assert(ringbuf_bytes_used(rb1) == 21);
+    assert(ringbuf_memset(rb1, 1, RINGBUF_SIZE) == 0);
+    assert(read(fds[0], dst, 10) == 10);
+    assert(ringbuf_zerocopy_complete(z) == 10);
+    assert(ringbuf_tail(rb1) == rb1_base + RINGBUF_SIZE - 10);
+    assert(ringbuf_zerocopy_pinned(z) == 11);
+    assert(read(fds[0], dst, RINGBUF_SIZE * 2) == 11);
+    assert(strncmp((const char *) dst, test_pattern, strlen(test_pattern)) == 0);
+    assert(ringbuf_zerocopy_complete(z) == 11);
+    assert(ringbuf_is_empty(rb1));
+    assert(ringbuf_zerocopy_pinned(z) == 0);
+
+    /* the pinned bytes can't move */
+    assert(ringbuf_memcpy_into(rb1, test_pattern, 10));
+    assert(ringbuf_zerocopy_send(z, 4, 0) == 4);
+    assert(!ringbuf_resize(rb1, 5000));
+    assert(read(fds[0], dst, 4) == 4);
+    assert(ringbuf_zerocopy_complete(z) == 4);
+    assert(!ringbuf_resize(rb1, 5000));
+    END_TEST(test_num);
+    ringbuf_zerocopy_free(&z);
+    assert(z == 0);
+    assert(ringbuf_resize(rb1, 5000));
+    assert(ringbuf_bytes_used(rb1) == 6);
+    close(fds[0]);
+    close(fds[1]);
+
+    /* zero-copy sends on a TCP socket with MSG_ZEROCOPY, if supported */
+    struct sockaddr_in addr;
+    socklen_t addrlen = sizeof(addr);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    assert(listener != -1);
+    assert(bind(listener, (struct sockaddr *) &addr, sizeof(addr)) == 0);
+    assert(listen(listener, 1) == 0);
+    assert(getsockname(listener, (struct sockaddr *) &addr, &addrlen) == 0);
+    fds[0] = socket(AF_INET, SOCK_STREAM, 0);
+    assert(fds[0] != -1);
+    assert(connect(fds[0], (struct sockaddr *) &addr, sizeof(addr)) == 0);
+    fds[1] = accept(listener, 0, 0);
+    assert(fds[1] != -1);
+    ringbuf_reset(rb1);
+    rb1_base = ringbuf_head(rb1);
+    z = ringbuf_zerocopy_new(rb1, fds[0], 1);
+    if (z) {
+        START_NEW_TEST(test_num);
+        assert(ringbuf_memcpy_into(rb1, buf, 100) == rb1_base + 100);
+        assert(ringbuf_zerocopy_send(z, 60, 0) == 60);
+        assert(ringbuf_zerocopy_pinned(z) == 60);
+        assert(ringbuf_bytes_used(rb1) == 100);
+        /* only 1 send may be in flight */
+        assert(ringbuf_zerocopy_send(z, 40, 0) == 0);
+        assert(zerocopy_test_wait(z, 60) == 60);
+        assert(ringbuf_tail(rb1) == rb1_base + 60);
+        assert(ringbuf_zerocopy_send(z, 40, 0) == 40);
+        assert(zerocopy_test_wait(z, 40) == 40);
+        assert(ringbuf_is_empty(rb1));
+        size_t nreceived = 0;
+        while (nreceived != 100) {
+            ssize_t n = read(fds[1], dst + nreceived, RINGBUF_SIZE * 2 - nreceived);
+            assert(n > 0);
+            nreceived += n;
+        }
+        assert(memcmp(dst, buf, 100) == 0);
+        END_TEST(test_num);
+        ringbuf_zerocopy_free(&z);
+    }
+    ringbuf_free(&rb1);
+    close(fds[0]);
+    close(fds[1]);
+    close(listener);
+#endif
+
+    /* ringbuf_recvmsg and ringbuf_sendmsg */
+    assert(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    rb1 = ringbuf_new(RINGBUF_SIZE - 1);
+    rb1_base = ringbuf_head(rb1);
+    rb2 = ringbuf_new(RINGBUF_SIZE - 1);
+
+    START_NEW_TEST(test_num);
+    assert(ringbuf_sendmsg(fds[0], rb1, 1, 0) == 0);
+    assert(ringbuf_memset(rb1, 1, RINGBUF_SIZE - 10) == RINGBUF_SIZE - 10);
+    assert(ringbuf_consume(rb1, RINGBUF_SIZE - 10) == rb1_base + RINGBUF_SIZE - 10);
+    assert(ringbuf_memcpy_into(rb1, buf, 24) == rb1_base + 14);
+    assert(ringbuf_sendmsg(fds[0], rb1, 24, 0) == 24);
+    assert(ringbuf_is_empty(rb1));
+    assert(ringbuf_memset(rb2, 1, RINGBUF_SIZE - 5) == RINGBUF_SIZE - 5);
+    assert(ringbuf_consume(rb2, RINGBUF_SIZE - 5) == ringbuf_head(rb2));
+    assert(ringbuf_recvmsg(fds[1], rb2, 24, 0) == 24);
+    assert(ringbuf_bytes_used(rb2) == 24);
+    assert(ringbuf_memcpy_from(dst, rb2, 24) == ringbuf_head(rb2));
+    assert(strncmp((const char *) dst, (const char *) buf, 24) == 0);
+    END_TEST(test_num);
+    ringbuf_free(&rb1);
+    ringbuf_free(&rb2);
+    close(fds[0]);
+    close(fds[1]);
+
+    /* committing to a ring buffer that defers publishing */
+    START_NEW_TEST(test_num);
+    rb1 = ringbuf_new_flags(RINGBUF_SIZE - 1, RINGBUF_SPSC | RINGBUF_DEFER_PUBLISH);
+    rb1_base = ringbuf_head(rb1);
+    assert(ringbuf_reserve(rb1, 16, iov) == 1);
+    memset(iov[0].iov_base, 1, 16);
+    assert(ringbuf_commit(rb1, 16) == rb1_base + 16);
+    assert(ringbuf_bytes_used(rb1) == 0);
+    assert(ringbuf_peek(rb1, 16, iov) == 0);
+    assert(ringbuf_publish(rb1) == 16);
+    assert(ringbuf_peek(rb1, 16, iov) == 1);
+    assert(iov[0].iov_base == rb1_base && iov[0].iov_len == 16);
+    END_TEST(test_num);
+    ringbuf_free(&rb1);
+
+    /* Mirrored ring buffers */
+    START_NEW_TEST(test_num);
+    size_t pagesize = sysconf(_SC_PAGESIZE);
+    uint8_t *mbuf = malloc(pagesize * 2);
+    uint8_t *mdst = malloc(pagesize * 2);
+    fill_buffer(mbuf, pagesize * 2, test_pattern);
+    rb1 = ringbuf_new_flags(1, RINGBUF_MIRROR);
+    assert(rb1);
+    rb1_base = ringbuf_head(rb1);
+    assert(ringbuf_buffer_size(rb1) == pagesize);
+    assert(ringbuf_capacity(rb1) == pagesize);
+    assert(ringbuf_bytes_free(rb1) == pagesize);
+    assert(ringbuf_is_empty(rb1));
+    ringbuf_free(&rb1);
+    rb1 = ringbuf_new_flags(pagesize + 1, RINGBUF_MIRROR);
+    assert(ringbuf_capacity(rb1) == 2 * pagesize);
+    ringbuf_free(&rb1);
+    rb1 = ringbuf_new_flags(pagesize, RINGBUF_MIRROR);
+    rb1_base = ringbuf_head(rb1);
+    assert(ringbuf_capacity(rb1) == pagesize);
+    END_TEST(test_num);
+
+    /* the whole capacity is usable, and wrapped regions are contiguous */
+    START_NEW_TEST(test_num);
+    assert(ringbuf_memcpy_into(rb1, mbuf, pagesize) == rb1_base);
+    assert(ringbuf_is_full(rb1));
+    assert(ringbuf_memcpy_from(mdst, rb1, 100) == rb1_base + 100);
+    assert(ringbuf_memcpy_into(rb1, mbuf + pagesize, 100) == rb1_base + 100);
+    assert(ringbuf_is_full(rb1));
+    assert(ringbuf_tail(rb1) == rb1_base + 100);
+    assert(memcmp(ringbuf_tail(rb1), mbuf + 100, pagesize) == 0);
+    assert(ringbuf_findchr(rb1, mbuf[pagesize + 50], pagesize - 100) ==
+           pagesize - 100 + ((const char *) memchr(mbuf + pagesize, mbuf[pagesize + 50], 100) -
+                             (const char *) (mbuf + pagesize)));
+    assert(ringbuf_memcpy_from(mdst, rb1, pagesize) == rb1_base + 100);
+    assert(memcmp(mdst, mbuf + 100, pagesize) == 0);
+    assert(ringbuf_is_empty(rb1));
+    END_TEST(test_num);
+
+    /* overflowing a mirrored ring buffer */
+    START_NEW_TEST(test_num);
+    ringbuf_reset(rb1);
+    assert(ringbuf_memcpy_into(rb1, mbuf, 10) == rb1_base + 10);
+    assert(ringbuf_memcpy_into(rb1, mbuf, pagesize) == rb1_base + 10);
+    assert(ringbuf_is_full(rb1));
+    assert(ringbuf_tail(rb1) == rb1_base + 10);
+    assert(memcmp(ringbuf_tail(rb1), mbuf, pagesize) == 0);
+    assert(ringbuf_memset(rb1, 3, 2 * pagesize) == pagesize);
+    assert(ringbuf_is_full(rb1));
+    assert(ringbuf_tail(rb1) == rb1_base + 10);
+    END_TEST(test_num);
+
+    /* ringbuf_read and ringbuf_write don't stop at the wrap */
+    START_NEW_TEST(test_num);
+    ringbuf_reset(rb1);
+    int pipefds[2];
+    assert(pipe(pipefds) == 0);
+    assert(write(pipefds[1], mbuf, pagesize) == pagesize);
+    assert(ftruncate(wrfd, 0) == 0);
+    assert(lseek(wrfd, 0, SEEK_SET) == 0);
+    assert(ringbuf_memset(rb1, 1, pagesize - 11) == pagesize - 11);
+    assert(ringbuf_memcpy_from(mdst, rb1, pagesize - 11) == rb1_base + pagesize - 11);
+    assert(ringbuf_read(pipefds[0], rb1, pagesize) == pagesize);
+    close(pipefds[0]);
+    close(pipefds[1]);
+    assert(ringbuf_is_full(rb1));
+    assert(ringbuf_head(rb1) == rb1_base + pagesize - 11);
+    assert(ringbuf_write(wrfd, rb1, pagesize) == pagesize);
+    assert(ringbuf_is_empty(rb1));
+    assert(lseek(wrfd, 0, SEEK_SET) == 0);
+    assert(read(wrfd, mdst, pagesize + 1) == pagesize);
+    assert(memcmp(mdst, mbuf, pagesize) == 0);
+    END_TEST(test_num);
+
+    /* ringbuf_copy between mirrored and non-mirrored ring buffers */
+    START_NEW_TEST(test_num);
+    rb2 = ringbuf_new(pagesize);
+    ringbuf_reset(rb1);
+    assert(ringbuf_memset(rb1, 1, pagesize - 11) == pagesize - 11);
+    assert(ringbuf_memcpy_from(mdst, rb1, pagesize - 11) == rb1_base + pagesize - 11);
+    assert(ringbuf_memcpy_into(rb1, mbuf, 64) == rb1_base + 53);
+    assert(ringbuf_copy(rb2, rb1, 64) == ringbuf_head(rb2));
+    assert(ringbuf_bytes_used(rb2) == 64);
+    assert(ringbuf_copy(rb1, rb2, 64) == rb1_base + 117);
+    assert(memcmp(ringbuf_tail(rb1), mbuf, 64) == 0);
+    ringbuf_free(&rb2);
+    END_TEST(test_num);
+
+    /* reserved and peeked regions of mirrored ring buffers never wrap */
+    START_NEW_TEST(test_num);
+    assert(ringbuf_reserve(rb1, pagesize - 64, iov) == 1);
+    assert(iov[0].iov_base == rb1_base + 117 && iov[0].iov_len == pagesize - 64);
+    memcpy(iov[0].iov_base, mbuf, pagesize - 64);
+    assert(ringbuf_commit(rb1, pagesize - 64) == rb1_base + 53);
+    assert(ringbuf_consume(rb1, 64) == rb1_base + 117);
+    assert(ringbuf_peek(rb1, pagesize - 64, iov) == 1);
+    assert(memcmp(iov[0].iov_base, mbuf, pagesize - 64) == 0);
+    END_TEST(test_num);
+    ringbuf_free(&rb1);
+    free(mbuf);
+    free(mdst);
+
+    /* RINGBUF_DEFER_PUBLISH is only valid for SPSC ring buffers */
+    START_NEW_TEST(test_num);
+    assert(ringbuf_new_flags(RINGBUF_SIZE - 1, RINGBUF_DEFER_PUBLISH) == 0);
+    END_TEST(test_num);
+
+    rb1 = ringbuf_new_flags(RINGBUF_SIZE - 1, RINGBUF_SPSC | RINGBUF_DEFER_PUBLISH);
+    rb1_base = ringbuf_head(rb1);
+
+    /* unpublished bytes are neither used nor free */
+    START_NEW_TEST(test_num);
+    assert(ringbuf_memcpy_into(rb1, buf, 16) == rb1_base + 16);
+    assert(ringbuf_memcpy_into(rb1, buf + 16, 16) == rb1_base + 32);
+    assert(ringbuf_memset(rb1, 57, 8) == 8);
+    assert(ringbuf_bytes_used(rb1) == 0);
+    assert(ringbuf_is_empty(rb1));
+    assert(ringbuf_bytes_free(rb1) == RINGBUF_SIZE - 1 - 40);
+    assert(ringbuf_head(rb1) == rb1_base + 40);
+    assert(ringbuf_tail(rb1) == rb1_base);
+    assert(ringbuf_memcpy_from(dst, rb1, 1) == 0);
+    assert(ringbuf_findchr(rb1, buf[0], 0) == 0);
+    END_TEST(test_num);
+
+    /* ringbuf_publish publishes the whole batch at once */
+    START_NEW_TEST(test_num);
+    assert(ringbuf_publish(rb1) == 40);
+    assert(ringbuf_bytes_used(rb1) == 40);
+    assert(ringbuf_bytes_free(rb1) == RINGBUF_SIZE - 1 - 40);
+    assert(ringbuf_publish(rb1) == 0);
+    assert(ringbuf_memcpy_from(dst, rb1, 40) == rb1_base + 40);
+    assert(strncmp((const char *) dst, (const char *) buf, 32) == 0);
+    assert(dst[32] == 57 && dst[39] == 57);
+    assert(ringbuf_is_empty(rb1));
+    assert(ringbuf_bytes_free(rb1) == RINGBUF_SIZE - 1);
+    END_TEST(test_num);
+
+    /* pending bytes count against the free space */
+    START_NEW_TEST(test_num);
+    ringbuf_reset(rb1);
+    assert(ringbuf_memcpy_into(rb1, buf, RINGBUF_SIZE - 1) == rb1_base + RINGBUF_SIZE - 1);
+    assert(ringbuf_is_full(rb1));
+    assert(ringbuf_memcpy_into(rb1, buf, 1) == 0);
+    assert(ringbuf_publish(rb1) == RINGBUF_SIZE - 1);
+    assert(ringbuf_memcpy_from(dst, rb1, 8) == rb1_base + 8);
+    assert(ringbuf_memcpy_into(rb1, buf, 8) == rb1_base + 7);
+    assert(ringbuf_bytes_used(rb1) == RINGBUF_SIZE - 1 - 8);
+    assert(ringbuf_is_full(rb1));
+    assert(ringbuf_publish(rb1) == 8);
+    assert(ringbuf_bytes_used(rb1) == RINGBUF_SIZE - 1);
+    END_TEST(test_num);
+
+    /* ringbuf_publish on a ring buffer that doesn't defer publishing */
+    rb2 = ringbuf_new(RINGBUF_SIZE - 1);
+    START_NEW_TEST(test_num);
+    assert(ringbuf_memcpy_into(rb2, buf, 16) == ringbuf_head(rb2));
+    assert(ringbuf_bytes_used(rb2) == 16);
+    assert(ringbuf_publish(rb2) == 0);
+    assert(ringbuf_bytes_used(rb2) == 16);
+    END_TEST(test_num);
+    ringbuf_free(&rb2);
+
+    /* SPSC with deferred publishing, with producer and consumer threads */
+    START_NEW_TEST(test_num);
+    ringbuf_free(&rb1);
+    rb1 = ringbuf_new_flags(1021, RINGBUF_SPSC | RINGBUF_DEFER_PUBLISH);
+    assert(pthread_create(&consumer, 0, spsc_test_consumer, rb1) == 0);
+    assert(pthread_create(&producer, 0, spsc_test_producer, rb1) == 0);
+    assert(pthread_join(producer, 0) == 0);
+    assert(pthread_join(consumer, &consumer_result) == 0);
+    assert(consumer_result == 0);
+    assert(ringbuf_is_empty(rb1));
+    END_TEST(test_num);
+
+    ringbuf_free(&rb1);
+
+    /* power-of-two ring buffers */
+    START_NEW_TEST(test_num);
+    rb1 = ringbuf_new_flags(1000, RINGBUF_POW2);
+    assert(ringbuf_capacity(rb1) == 1024);
+    assert(ringbuf_buffer_size(rb1) == 1024);
+    ringbuf_free(&rb1);
+    rb1 = ringbuf_new_flags(0, RINGBUF_POW2);
+    assert(ringbuf_capacity(rb1) == 1);
+    assert(ringbuf_memset(rb1, 1, 1) == 1);
+    assert(ringbuf_is_full(rb1));
+    ringbuf_free(&rb1);
+    assert(ringbuf_new_flags(SIZE_MAX, RINGBUF_POW2) == 0);
+    END_TEST(test_num);
+
+    /* filling a power-of-two ring buffer uses every byte */
+    rb1 = ringbuf_new_flags(RINGBUF_SIZE, RINGBUF_POW2);
+    rb1_base = ringbuf_head(rb1);
+    START_NEW_TEST(test_num);
+    assert(ringbuf_capacity(rb1) == RINGBUF_SIZE);
+    assert(ringbuf_memcpy_into(rb1, buf, RINGBUF_SIZE) == rb1_base);
+    assert(ringbuf_is_full(rb1));
+    assert(ringbuf_bytes_used(rb1) == RINGBUF_SIZE);
+    assert(ringbuf_bytes_free(rb1) == 0);
+    assert(ringbuf_head(rb1) == ringbuf_tail(rb1));
+    assert(ringbuf_memcpy_from(dst, rb1, RINGBUF_SIZE) == rb1_base);
+    assert(memcmp(dst, buf, RINGBUF_SIZE) == 0);
+    assert(ringbuf_is_empty(rb1));
+    END_TEST(test_num);
+
+    /* wrapping, overflow and searching with masked counters */
+    START_NEW_TEST(test_num);
+    ringbuf_reset(rb1);
+    assert(ringbuf_memset(rb1, 1, RINGBUF_SIZE - 5) == RINGBUF_SIZE - 5);
+    assert(ringbuf_consume(rb1, RINGBUF_SIZE - 5) == rb1_base + RINGBUF_SIZE - 5);
+    assert(ringbuf_memcpy_into(rb1, test_pattern, strlen(test_pattern)) == rb1_base + 6);
+    assert(ringbuf_findchr(rb1, 'g', 0) == 6);
+    assert(ringbuf_findchr(rb1, 'k', 0) == 10);
+    assert(ringbuf_memset(rb1, 2, RINGBUF_SIZE - 1) == RINGBUF_SIZE - 1);
+    assert(ringbuf_is_full(rb1));
+    assert(ringbuf_head(rb1) == rb1_base + 5);
+    assert(ringbuf_tail(rb1) == rb1_base + 5);
+    assert(ringbuf_findchr(rb1, 'k', 0) == 0);
+    assert(ringbuf_memcpy_from(dst, rb1, 1) == rb1_base + 6);
+    assert(dst[0] == 'k');
+    END_TEST(test_num);
+    ringbuf_free(&rb1);
+
+    /* power-of-two mirrored ring buffers */
+    START_NEW_TEST(test_num);
+    rb1 = ringbuf_new_flags(pagesize + 1, RINGBUF_POW2 | RINGBUF_MIRROR);
+    if (rb1) {
+        assert(ringbuf_capacity(rb1) == 2 * pagesize);
+        rb1_base = ringbuf_head(rb1);
+        assert(ringbuf_memset(rb1, 1, 2 * pagesize - 5) == 2 * pagesize - 5);
+        assert(ringbuf_consume(rb1, 2 * pagesize - 5) == rb1_base + 2 * pagesize - 5);
+        assert(ringbuf_memcpy_into(rb1, test_pattern, strlen(test_pattern)) == rb1_base + 6);
+        assert(strncmp((const char *) ringbuf_tail(rb1), test_pattern, strlen(test_pattern)) == 0);
+        ringbuf_free(&rb1);
+    }
+    END_TEST(test_num);
+
+    /* single-allocation, aligned ring buffers */
+    START_NEW_TEST(test_num);
+    assert(ringbuf_new_aligned(100, 0, 0) == 0);
+    assert(ringbuf_new_aligned(100, 0, 48) == 0);
+    assert(ringbuf_new_aligned(100, RINGBUF_MIRROR, 64) == 0);
+    assert(ringbuf_new_aligned(100, RINGBUF_DEFER_PUBLISH, 64) == 0);
+    assert(ringbuf_new_aligned(SIZE_MAX, 0, 64) == 0);
+    rb1 = ringbuf_new_aligned(100, 0, 1);
+    assert(((uintptr_t) ringbuf_head(rb1) & 63) == 0);
+    ringbuf_free(&rb1);
+    rb1 = ringbuf_new_aligned(100, RINGBUF_SPSC, pagesize);
+    assert(((uintptr_t) ringbuf_head(rb1) & (pagesize - 1)) == 0);
+    assert(ringbuf_capacity(rb1) == 100);
+    rb1_base = ringbuf_head(rb1);
+    assert(ringbuf_memcpy_into(rb1, buf, 100) == rb1_base + 100);
+    assert(ringbuf_is_full(rb1));
+    assert(ringbuf_memcpy_into(rb1, buf, 1) == 0);
+    assert(ringbuf_memcpy_from(dst, rb1, 100) == rb1_base + 100);
+    assert(memcmp(dst, buf, 100) == 0);
+    ringbuf_free(&rb1);
+    assert(rb1 == 0);
+    rb1 = ringbuf_new_aligned(1000, RINGBUF_POW2, 256);
+    assert(((uintptr_t) ringbuf_head(rb1) & 255) == 0);
+    assert(ringbuf_capacity(rb1) == 1024);
+    ringbuf_free(&rb1);
+    END_TEST(test_num);
+
+    /* ring buffers in caller-provided storage */
+    static uint8_t storage[RINGBUF_STORAGE_OVERHEAD + RINGBUF_SIZE];
+    START_NEW_TEST(test_num);
+    assert(ringbuf_storage_size(SIZE_MAX, 0) == 0);
+    assert(ringbuf_storage_size(RINGBUF_SIZE - 1, 0) <= sizeof(storage));
+    assert(ringbuf_init(storage, sizeof(storage), RINGBUF_SIZE - 1, RINGBUF_MIRROR) == 0);
+    assert(ringbuf_init(storage, sizeof(storage), RINGBUF_SIZE - 1, RINGBUF_DEFER_PUBLISH) == 0);
+    assert(ringbuf_init(storage, sizeof(storage), sizeof(storage), 0) == 0);
+    rb1 = ringbuf_init(storage, sizeof(storage), RINGBUF_SIZE - 1, 0);
+    assert((uint8_t *) rb1 >= storage && (uint8_t *) rb1 < storage + sizeof(storage));
+    assert(ringbuf_capacity(rb1) == RINGBUF_SIZE - 1);
+    assert((const uint8_t *) ringbuf_head(rb1) + RINGBUF_SIZE <= storage + sizeof(storage));
+    rb1_base = ringbuf_head(rb1);
+    assert(ringbuf_memset(rb1, 1, RINGBUF_SIZE - 10) == RINGBUF_SIZE - 10);
+    assert(ringbuf_consume(rb1, RINGBUF_SIZE - 10) == rb1_base + RINGBUF_SIZE - 10);
+    assert(ringbuf_memcpy_into(rb1, test_pattern, strlen(test_pattern)) == rb1_base + 1);
+    assert(ringbuf_memcpy_from(dst, rb1, strlen(test_pattern)) == rb1_base + 1);
+    assert(strncmp((const char *) dst, test_pattern, strlen(test_pattern)) == 0);
+    ringbuf_free(&rb1);
+    assert(rb1 == 0);
+    END_TEST(test_num);
+
+    /* unaligned storage of exactly ringbuf_storage_size bytes */
+    START_NEW_TEST(test_num);
+    size_t storage_size = ringbuf_storage_size(100, RINGBUF_SPSC);
+    assert(storage_size <= RINGBUF_STORAGE_OVERHEAD + 101);
+    size_t offset;
+    for (offset = 1; offset != 64; offset += 21) {
+        rb1 = ringbuf_init(storage + offset, storage_size, 100, RINGBUF_SPSC);
+        assert(rb1);
+        assert(((uintptr_t) rb1 & 63) == 0);
+        assert((const uint8_t *) ringbuf_head(rb1) + 101 <= storage + offset + storage_size);
+        assert(ringbuf_memset(rb1, 7, 100) == 100);
+        assert(ringbuf_is_full(rb1));
+        ringbuf_free(&rb1);
+    }
+    END_TEST(test_num);
+
+    /* backing memory options */
+    START_NEW_TEST(test_num);
+    assert(ringbuf_new_flags(RINGBUF_SIZE, RINGBUF_HUGETLB | RINGBUF_MIRROR) == 0);
+    assert(ringbuf_new_aligned(RINGBUF_SIZE, RINGBUF_PREFAULT, 64) == 0);
+    assert(ringbuf_init(storage, sizeof(storage), 100, RINGBUF_THP) == 0);
+    int backing_flags[] = {
+        RINGBUF_PREFAULT,
+        RINGBUF_THP,
+        RINGBUF_THP | RINGBUF_PREFAULT | RINGBUF_POW2,
+        RINGBUF_PREFAULT | RINGBUF_MIRROR,
+        RINGBUF_HUGETLB | RINGBUF_PREFAULT,
+    };
+    for (offset = 0; offset != sizeof(backing_flags) / sizeof(backing_flags[0]); ++offset) {
+        rb1 = ringbuf_new_flags(RINGBUF_SIZE * 2, backing_flags[offset]);
+
+        /* no huge pages may be reserved, and mirroring may not be possible */
+        if (!rb1) {
+            assert(backing_flags[offset] & (RINGBUF_HUGETLB | RINGBUF_MIRROR));
+            continue;
+        }
+        rb1_base = ringbuf_head(rb1);
+        assert(((uintptr_t) rb1_base & (pagesize - 1)) == 0);
+        assert(ringbuf_capacity(rb1) >= RINGBUF_SIZE * 2);
+        assert(ringbuf_memset(rb1, 1, 10) == 10);
+        assert(ringbuf_consume(rb1, 10) == rb1_base + 10);
+        assert(ringbuf_memcpy_into(rb1, buf, RINGBUF_SIZE * 2) == ringbuf_head(rb1));
+        assert(ringbuf_memcpy_from(dst, rb1, RINGBUF_SIZE * 2) == ringbuf_head(rb1));
+        assert(memcmp(dst, buf, RINGBUF_SIZE * 2) == 0);
+        ringbuf_free(&rb1);
+    }
+    END_TEST(test_num);
+
+    /* NUMA node binding */
+    START_NEW_TEST(test_num);
+    assert(ringbuf_new_numa(RINGBUF_SIZE, 0, -1) == 0);
+    assert(ringbuf_new_numa(RINGBUF_SIZE, 0, 1 << 20) == 0);
+    assert(ringbuf_new_numa(RINGBUF_SIZE, RINGBUF_DEFER_PUBLISH, 0) == 0);
+    rb1 = ringbuf_new_numa(RINGBUF_SIZE - 1, RINGBUF_PREFAULT, 0);
+
+    /* binding may not be permitted, e.g., in a container */
+    if (rb1) {
+        rb1_base = ringbuf_head(rb1);
+        assert(ringbuf_capacity(rb1) == RINGBUF_SIZE - 1);
+        assert(ringbuf_memset(rb1, 1, RINGBUF_SIZE - 5) == RINGBUF_SIZE - 5);
+        assert(ringbuf_consume(rb1, RINGBUF_SIZE - 5) == rb1_base + RINGBUF_SIZE - 5);
+        assert(ringbuf_memcpy_into(rb1, test_pattern, strlen(test_pattern)) == rb1_base + 6);
+        assert(ringbuf_memcpy_from(dst, rb1, strlen(test_pattern)) == rb1_base + 6);
+        assert(strncmp((const char *) dst, test_pattern, strlen(test_pattern)) == 0);
+        ringbuf_free(&rb1);
+    }
+    END_TEST(test_num);
+
+    /* ringbuf_findset */
+    rb1 = ringbuf_new(RINGBUF_SIZE - 1);
+    rb1_base = ringbuf_head(rb1);
+    START_NEW_TEST(test_num);
+    assert(ringbuf_findset(rb1, "a", 1, 0) == 0);
+    assert(ringbuf_memcpy_into(rb1, "GET / HTTP/1.1\r\nHost: x;y\n", 27) == rb1_base + 27);
+    assert(ringbuf_findset(rb1, "", 0, 0) == 27);
+    /* the NUL terminators of the set and of the copied string count */
+    assert(ringbuf_findset(rb1, ";\n", 3, 0) == 15);
+    assert(ringbuf_findset(rb1, ";\n", 3, 16) == 23);
+    assert(ringbuf_findset(rb1, ";\n", 3, 24) == 25);
+    assert(ringbuf_findset(rb1, ";\n", 3, 26) == 26);
+    assert(ringbuf_findset(rb1, ";\n", 2, 26) == 27);
+    assert(ringbuf_findset(rb1, ";\n", 3, 27) == 27);
+    assert(ringbuf_findset(rb1, "\r\n", 2, 0) == 14);
+    assert(ringbuf_findset(rb1, "zq", 2, 0) == 27);
+    assert(ringbuf_findset(rb1, "G", 1, 0) == 0);
+    assert(ringbuf_findset(rb1, "G", 1, 1) == 27);
+    /* a set that's too large for the SIMD kernels */
+    assert(ringbuf_findset(rb1, "abcdefghijklmnopqrstuvwx;", 25, 0) == 17);
+    END_TEST(test_num);
+
+    /* ringbuf_findset across the end of the contiguous buffer */
+    START_NEW_TEST(test_num);
+    ringbuf_reset(rb1);
+    assert(ringbuf_memset(rb1, 'a', RINGBUF_SIZE - 40) == RINGBUF_SIZE - 40);
+    assert(ringbuf_consume(rb1, RINGBUF_SIZE - 50) == rb1_base + RINGBUF_SIZE - 50);
+    assert(ringbuf_memset(rb1, 'b', 60) == 60);
+    assert(ringbuf_memcpy_into(rb1, "x;", 2) == rb1_base + 22);
+    assert(ringbuf_findset(rb1, "b", 1, 0) == 10);
+    assert(ringbuf_findset(rb1, ";x", 2, 0) == 70);
+    assert(ringbuf_findset(rb1, ";", 1, 0) == 71);
+    assert(ringbuf_findset(rb1, "c", 1, 0) == 72);
+    END_TEST(test_num);
+
+    /* ringbuf_findstr */
+    START_NEW_TEST(test_num);
+    ringbuf_reset(rb1);
+    assert(ringbuf_findstr(rb1, "", 0, 0) == 0);
+    assert(ringbuf_memcpy_into(rb1, "GET / HTTP/1.1\r\nHost: x\r\n\r\nbody", 31) == rb1_base + 31);
+    assert(ringbuf_findstr(rb1, "", 0, 5) == 5);
+    assert(ringbuf_findstr(rb1, "", 0, 31) == 31);
+    assert(ringbuf_findstr(rb1, "\r\n", 2, 0) == 14);
+    assert(ringbuf_findstr(rb1, "\r\n", 2, 15) == 23);
+    assert(ringbuf_findstr(rb1, "\r\n\r\n", 4, 0) == 23);
+    assert(ringbuf_findstr(rb1, "body", 4, 0) == 27);
+    assert(ringbuf_findstr(rb1, "body", 4, 28) == 31);
+    assert(ringbuf_findstr(rb1, "bodyx", 5, 0) == 31);
+    assert(ringbuf_findstr(rb1, "HTTX", 4, 0) == 31);
+    assert(ringbuf_findstr(rb1, "GET / HTTP/1.1\r\nHost: x\r\n\r\nbody", 31, 0) == 0);
+    assert(ringbuf_findstr(rb1, "GET / HTTP/1.1\r\nHost: x\r\n\r\nbody", 32, 0) == 31);
+    END_TEST(test_num);
+
+    /* matches split across the end of the contiguous buffer */
+    START_NEW_TEST(test_num);
+    size_t split;
+    for (split = 1; split != 4; ++split) {
+        ringbuf_reset(rb1);
+        assert(ringbuf_memset(rb1, 'a', RINGBUF_SIZE - 4 - split) == RINGBUF_SIZE - 4 - split);
+        assert(ringbuf_consume(rb1, RINGBUF_SIZE - 4 - split) == rb1_base + RINGBUF_SIZE - 4 - split);
+        assert(ringbuf_memcpy_into(rb1, "\r\n\r\r\n\r\n", 7) == rb1_base + 3 - split);
+        assert(ringbuf_findstr(rb1, "\r\n\r\n", 4, 0) == 3);
+        assert(ringbuf_findstr(rb1, "\r\n\r\n", 4, 4) == 7);
+        assert(ringbuf_findstr(rb1, "\n\r\r", 3, 0) == 1);
+    }
+    END_TEST(test_num);
+
+    /* compare against naive searches, at random offsets and wraps */
+    START_NEW_TEST(test_num);
+    srand(1);
+    for (offset = 0; offset != 2000; ++offset) {
+        ringbuf_reset(rb1);
+        size_t start = rand() % RINGBUF_SIZE;
+        size_t n = rand() % 300;
+        assert(ringbuf_memset(rb1, 0, start) == start);
+        assert(ringbuf_consume(rb1, start) == ringbuf_head(rb1));
+        size_t k;
+        for (k = 0; k != n; ++k)
+            buf2[k] = "abc\r\n;"[rand() % 6];
+        assert(ringbuf_memcpy_into(rb1, buf2, n) == ringbuf_head(rb1));
+
+        uint8_t set[20];
+        size_t nset = rand() % 20;
+        for (k = 0; k != nset; ++k)
+            set[k] = (rand() % 4 == 0) ? "abc\r\n;"[rand() % 6] : 'd' + rand() % 20;
+        size_t from = rand() % 310;
+        assert(ringbuf_findset(rb1, set, nset, from) == naive_findset(buf2, n, set, nset, from));
+
+        size_t len = rand() % 5;
+        size_t at = n ? rand() % n : 0;
+        const uint8_t *needle = (at + len <= n) ? buf2 + at : (const uint8_t *) "\r\n\r\n";
+        from = rand() % (n + 2);
+        assert(ringbuf_findstr(rb1, needle, len, from) ==
+               (from >= n ? n : naive_findstr(buf2, n, needle, len, from)));
+    }
+    END_TEST(test_num);
+    ringbuf_free(&rb1);
+
+    /* scan cursors */
+    rb1 = ringbuf_new(RINGBUF_SIZE - 1);
+    ringbuf_cursor_t cur = ringbuf_cursor_new(rb1);
+    assert(cur);
+
+    START_NEW_TEST(test_num);
+    assert(ringbuf_cursor_findchr(cur, '\n') == 0);
+    assert(ringbuf_memcpy_into(rb1, "GET / HT", 8) == ringbuf_head(rb1));
+    assert(ringbuf_cursor_findchr(cur, '\n') == 8);
+    assert(ringbuf_memcpy_into(rb1, "TP/1.1\r", 8) == ringbuf_head(rb1));
+    assert(ringbuf_cursor_findchr(cur, '\n') == 16);
+    assert(ringbuf_memcpy_into(rb1, "\nHost: x\n", 9) == ringbuf_head(rb1));
+    assert(ringbuf_cursor_findchr(cur, '\n') == 16);
+    /* the cursor stays at the match until it's consumed */
+    assert(ringbuf_cursor_findchr(cur, '\n') == 16);
+    END_TEST(test_num);
+
+    START_NEW_TEST(test_num);
+    /* consuming rebases the cursor */
+    assert(ringbuf_consume(rb1, 17) == ringbuf_tail(rb1));
+    assert(ringbuf_cursor_findchr(cur, '\n') == 7);
+    /* consuming up to the match */
+    assert(ringbuf_consume(rb1, 7) == ringbuf_tail(rb1));
+    assert(ringbuf_cursor_findchr(cur, '\n') == 0);
+    assert(ringbuf_consume(rb1, 1) == ringbuf_tail(rb1));
+    assert(ringbuf_cursor_findchr(cur, '\n') == 0);
+    assert(ringbuf_is_empty(rb1));
+    END_TEST(test_num);
+
+    START_NEW_TEST(test_num);
+    /* a delimiter split across reads, and across the end of the buffer */
+    ringbuf_cursor_reset(cur);
+    assert(ringbuf_cursor_findstr(cur, "\r\n\r\n", 4) == 0);
+    assert(ringbuf_memcpy_into(rb1, "Host: x\r\n\r", 10) == ringbuf_head(rb1));
+    assert(ringbuf_cursor_findstr(cur, "\r\n\r\n", 4) == 10);
+    assert(ringbuf_memset(rb1, 'x', 4) == 4);
+    assert(ringbuf_cursor_findstr(cur, "\r\n\r\n", 4) == 14);
+    ringbuf_reset(rb1);
+    assert(ringbuf_memset(rb1, 0, RINGBUF_SIZE - 5) == RINGBUF_SIZE - 5);
+    assert(ringbuf_consume(rb1, RINGBUF_SIZE - 5) == ringbuf_head(rb1));
+    ringbuf_cursor_reset(cur);
+    assert(ringbuf_memcpy_into(rb1, "ab\r\n\r", 5) == ringbuf_head(rb1));
+    assert(ringbuf_cursor_findstr(cur, "\r\n\r\n", 4) == 5);
+    assert(ringbuf_memcpy_into(rb1, "\ncd", 3) == ringbuf_head(rb1));
+    assert(ringbuf_cursor_findstr(cur, "\r\n\r\n", 4) == 2);
+    assert(ringbuf_cursor_findstr(cur, "\r\n\r\n", 4) == 2);
+    assert(ringbuf_consume(rb1, 6) == ringbuf_tail(rb1));
+    assert(ringbuf_cursor_findstr(cur, "\r\n\r\n", 4) == 2);
+    END_TEST(test_num);
+
+    START_NEW_TEST(test_num);
+    /* sets */
+    ringbuf_reset(rb1);
+    ringbuf_cursor_reset(cur);
+    assert(ringbuf_memcpy_into(rb1, "key", 3) == ringbuf_head(rb1));
+    assert(ringbuf_cursor_findset(cur, "=;&", 3) == 3);
+    assert(ringbuf_memcpy_into(rb1, "=value", 6) == ringbuf_head(rb1));
+    assert(ringbuf_cursor_findset(cur, "=;&", 3) == 3);
+    assert(ringbuf_cursor_findset(cur, "", 0) == 9);
+    END_TEST(test_num);
+
+    START_NEW_TEST(test_num);
+    /* overflow and reset invalidate the cursor */
+    ringbuf_reset(rb1);
+    ringbuf_cursor_reset(cur);
+    assert(ringbuf_memset(rb1, 'a', RINGBUF_SIZE - 10) == RINGBUF_SIZE - 10);
+    assert(ringbuf_cursor_findchr(cur, '\n') == RINGBUF_SIZE - 10);
+    assert(ringbuf_memcpy_into(rb1, "\nbcdefghijklmnopqrst", 20) == ringbuf_head(rb1));
+    assert(ringbuf_is_full(rb1));
+    /* the searched bytes that survived the overflow aren't rescanned */
+    assert(ringbuf_cursor_findchr(cur, '\n') == RINGBUF_SIZE - 21);
+    assert(ringbuf_memset(rb1, 'z', RINGBUF_SIZE - 1) == RINGBUF_SIZE - 1);
+    assert(ringbuf_cursor_findchr(cur, 'z') == 0);
+    ringbuf_reset(rb1);
+    assert(ringbuf_memcpy_into(rb1, "ab\n", 3) == ringbuf_head(rb1));
+    assert(ringbuf_cursor_findchr(cur, '\n') == 2);
+    END_TEST(test_num);
+
+    START_NEW_TEST(test_num);
+    /* incremental searches agree with full searches */
+    srand(2);
+    ringbuf_reset(rb1);
+    ringbuf_cursor_reset(cur);
+    for (offset = 0; offset != 5000; ++offset) {
+        size_t n = rand() % 20;
+        size_t k;
+        for (k = 0; k != n; ++k)
+            buf2[k] = "ab\r\n"[rand() % 4];
+        if (ringbuf_bytes_free(rb1) >= n)
+            assert(ringbuf_memcpy_into(rb1, buf2, n) == ringbuf_head(rb1));
+        size_t found = ringbuf_cursor_findstr(cur, "\r\n\r\n", 4);
+        assert(found == ringbuf_findstr(rb1, "\r\n\r\n", 4, 0));
+        if (found != ringbuf_bytes_used(rb1) && rand() % 2)
+            assert(ringbuf_consume(rb1, found + 4) == ringbuf_tail(rb1));
+        else if (rand() % 8 == 0)
+            assert(ringbuf_consume(rb1, rand() % (ringbuf_bytes_used(rb1) + 1)) ==
+                   ringbuf_tail(rb1));
+    }
+    END_TEST(test_num);
+    ringbuf_cursor_free(&cur);
+    assert(cur == 0);
+    ringbuf_free(&rb1);
+
+    /* records */
+    START_NEW_TEST(test_num);
+    rb1 = ringbuf_new(RINGBUF_SIZE - 1);
+    struct iovec recs[4][2];
+    size_t lens[4];
+    assert(ringbuf_peek_record(rb1, iov) == -1);
+    assert(ringbuf_pop_record(dst, rb1, RINGBUF_SIZE * 2) == -1);
+    assert(ringbuf_consume_records(rb1, 1) == 0);
+    assert(ringbuf_push_record(rb1, "hello", 5) == 1);
+    assert(ringbuf_push_record(rb1, 0, 0) == 1);
+    assert(ringbuf_push_record(rb1, "world!", 6) == 1);
+    assert(ringbuf_bytes_used(rb1) == 3 * 4 + 11);
+    assert(ringbuf_peek_record(rb1, iov) == 5);
+    assert(iov[0].iov_len == 5 && iov[1].iov_len == 0);
+    assert(strncmp(iov[0].iov_base, "hello", 5) == 0);
+    assert(ringbuf_peek_records(rb1, recs, 4) == 3);
+    assert(recs[1][0].iov_len == 0 && recs[1][1].iov_len == 0);
+    assert(recs[2][0].iov_len == 6 && strncmp(recs[2][0].iov_base, "world!", 6) == 0);
+    /* too small */
+    assert(ringbuf_pop_record(dst, rb1, 4) == 5);
+    assert(ringbuf_bytes_used(rb1) == 3 * 4 + 11);
+    assert(ringbuf_pop_record(dst, rb1, 5) == 5);
+    assert(strncmp((const char *) dst, "hello", 5) == 0);
+    assert(ringbuf_pop_record(0, rb1, 0) == 0);
+    assert(ringbuf_pop_record(dst, rb1, 6) == 6);
+    assert(strncmp((const char *) dst, "world!", 6) == 0);
+    assert(ringbuf_is_empty(rb1));
+    END_TEST(test_num);
+
+    START_NEW_TEST(test_num);
+    /* batches */
+    assert(ringbuf_push_record(rb1, "abc", 3) == 1);
+    assert(ringbuf_push_record(rb1, "defg", 4) == 1);
+    assert(ringbuf_push_record(rb1, "hi", 2) == 1);
+    assert(ringbuf_pop_records(dst, rb1, 8, lens, 4) == 2);
+    assert(lens[0] == 3 && lens[1] == 4);
+    assert(strncmp((const char *) dst, "abcdefg", 7) == 0);
+    assert(ringbuf_pop_records(dst, rb1, 1, lens, 4) == 0);
+    assert(ringbuf_pop_records(dst, rb1, 8, lens, 4) == 1);
+    assert(lens[0] == 2 && strncmp((const char *) dst, "hi", 2) == 0);
+    assert(ringbuf_push_record(rb1, "abc", 3) == 1);
+    assert(ringbuf_push_record(rb1, "defg", 4) == 1);
+    assert(ringbuf_push_record(rb1, "hi", 2) == 1);
+    assert(ringbuf_consume_records(rb1, 2) == 2);
+    assert(ringbuf_peek_record(rb1, iov) == 2);
+    assert(ringbuf_consume_records(rb1, 2) == 1);
+    assert(ringbuf_is_empty(rb1));
+    END_TEST(test_num);
+
+    START_NEW_TEST(test_num);
+    /* full, and records that don't fit */
+    ringbuf_reset(rb1);
+    assert(ringbuf_push_record(rb1, buf, RINGBUF_SIZE - 5) == 1);
+    assert(ringbuf_is_full(rb1));
+    assert(ringbuf_push_record(rb1, 0, 0) == 0);
+    assert(ringbuf_bytes_used(rb1) == RINGBUF_SIZE - 1);
+    assert(ringbuf_pop_record(dst, rb1, RINGBUF_SIZE * 2) == RINGBUF_SIZE - 5);
+    assert(memcmp(dst, buf, RINGBUF_SIZE - 5) == 0);
+    assert(ringbuf_push_record(rb1, buf, RINGBUF_SIZE - 4) == 0);
+    assert(ringbuf_is_empty(rb1));
+    END_TEST(test_num);
+
+    START_NEW_TEST(test_num);
+    /* a header and a record split across the end of the buffer */
+    ringbuf_reset(rb1);
+    assert(ringbuf_memset(rb1, 0, RINGBUF_SIZE - 2) == RINGBUF_SIZE - 2);
+    assert(ringbuf_consume(rb1, RINGBUF_SIZE - 2) == ringbuf_head(rb1));
+    assert(ringbuf_push_record(rb1, "wrapped", 7) == 1);
+    assert(ringbuf_peek_record(rb1, iov) == 7);
+    assert(iov[0].iov_len + iov[1].iov_len == 7);
+    assert(ringbuf_push_record(rb1, "again", 5) == 1);
+    assert(ringbuf_pop_record(dst, rb1, 7) == 7);
+    assert(strncmp((const char *) dst, "wrapped", 7) == 0);
+    assert(ringbuf_pop_record(dst, rb1, 7) == 5);
+    assert(strncmp((const char *) dst, "again", 5) == 0);
+    ringbuf_free(&rb1);
+    END_TEST(test_num);
+
+    START_NEW_TEST(test_num);
+    /* padded records never wrap */
+    assert(ringbuf_new_flags(RINGBUF_SIZE - 1, RINGBUF_RECORD_PAD | RINGBUF_MPMC) == 0);
+    assert(ringbuf_new_broadcast(RINGBUF_SIZE - 1, 2, RINGBUF_RECORD_PAD) == 0);
+    rb1 = ringbuf_new_flags(RINGBUF_SIZE - 1, RINGBUF_RECORD_PAD);
+    assert(ringbuf_memset(rb1, 0, RINGBUF_SIZE - 10) == RINGBUF_SIZE - 10);
+    assert(ringbuf_consume(rb1, RINGBUF_SIZE - 10) == ringbuf_head(rb1));
+    assert(ringbuf_push_record(rb1, "xy", 2) == 1);
+    assert(ringbuf_push_record(rb1, "padded", 6) == 1);
+    assert(ringbuf_bytes_used(rb1) == 6 + 4 + 4 + 6);
+    assert(ringbuf_peek_records(rb1, recs, 4) == 2);
+    assert(recs[1][0].iov_base == (uint8_t *) ringbuf_head(rb1) - 6);
+    assert(recs[1][0].iov_len == 6 && recs[1][1].iov_len == 0);
+    assert(strncmp(recs[1][0].iov_base, "padded", 6) == 0);
+    assert(ringbuf_consume_records(rb1, 2) == 2);
+    assert(ringbuf_is_empty(rb1));
+    /* fewer bytes left than a length */
+    ringbuf_reset(rb1);
+    assert(ringbuf_memset(rb1, 0, RINGBUF_SIZE - 2) == RINGBUF_SIZE - 2);
+    assert(ringbuf_consume(rb1, RINGBUF_SIZE - 2) == ringbuf_head(rb1));
+    assert(ringbuf_push_record(rb1, "xyz", 3) == 1);
+    assert(ringbuf_bytes_used(rb1) == 2 + 4 + 3);
+    assert(ringbuf_peek_record(rb1, iov) == 3);
+    assert(iov[1].iov_len == 0 && strncmp(iov[0].iov_base, "xyz", 3) == 0);
+    assert(ringbuf_pop_record(dst, rb1, 3) == 3);
+    assert(ringbuf_is_empty(rb1));
+    ringbuf_free(&rb1);
+    END_TEST(test_num);
+
+    START_NEW_TEST(test_num);
+    /* random pushes and pops against a model, for several kinds of ring buffer */
+    srand(3);
+    int record_flags[] = { 0, RINGBUF_RECORD_PAD, RINGBUF_POW2, RINGBUF_POW2 | RINGBUF_RECORD_PAD,
+                           RINGBUF_MIRROR, RINGBUF_SPSC | RINGBUF_RECORD_PAD };
+    for (offset = 0; offset != sizeof(record_flags) / sizeof(record_flags[0]); ++offset) {
+        rb1 = ringbuf_new_flags(RINGBUF_SIZE - 1, record_flags[offset]);
+        assert(rb1);
+        size_t model_head = 0, model_tail = 0, k;
+        size_t model_lens[RINGBUF_SIZE];
+        uint8_t model_seed[RINGBUF_SIZE];
+        for (k = 0; k != 20000; ++k) {
+            if (rand() % 2) {
+                size_t len = rand() % 100;
+                uint8_t seed = rand();
+                size_t j;
+                for (j = 0; j != len; ++j)
+                    buf2[j] = seed + j;
+                if (ringbuf_push_record(rb1, buf2, len)) {
+                    model_lens[model_head % RINGBUF_SIZE] = len;
+                    model_seed[model_head++ % RINGBUF_SIZE] = seed;
+                } else
+                    assert(ringbuf_bytes_free(rb1) < 4 + len +
+                           ((record_flags[offset] & RINGBUF_RECORD_PAD) ? 4 + len : 0));
+            } else {
+                size_t n = rand() % 4 + 1, got, j, r;
+                size_t want = MIN(n, model_head - model_tail);
+                if (rand() % 2) {
+                    got = ringbuf_pop_records(dst, rb1, RINGBUF_SIZE * 2, lens, n);
+                    assert(got == want);
+                    uint8_t *p = dst;
+                    for (r = 0; r != got; ++r) {
+                        size_t m = model_tail++ % RINGBUF_SIZE;
+                        assert(lens[r] == model_lens[m]);
+                        for (j = 0; j != lens[r]; ++j)
+                            assert(*p++ == (uint8_t) (model_seed[m] + j));
+                    }
+                } else {
+                    got = ringbuf_peek_records(rb1, recs, n);
+                    assert(got == want);
+                    for (r = 0; r != got; ++r) {
+                        size_t m = (model_tail + r) % RINGBUF_SIZE;
+                        assert(recs[r][0].iov_len + recs[r][1].iov_len == model_lens[m]);
+                        if (record_flags[offset] & (RINGBUF_RECORD_PAD | RINGBUF_MIRROR))
+                            assert(recs[r][1].iov_len == 0);
+                        for (j = 0; j != model_lens[m]; ++j) {
+                            const uint8_t *q = j < recs[r][0].iov_len ?
+                                (const uint8_t *) recs[r][0].iov_base + j :
+                                (const uint8_t *) recs[r][1].iov_base + j - recs[r][0].iov_len;
+                            assert(*q == (uint8_t) (model_seed[m] + j));
+                        }
+                    }
+                    assert(ringbuf_consume_records(rb1, got) == got);
+                    model_tail += got;
+                }
+            }
+            assert(ringbuf_is_empty(rb1) == (model_head == model_tail));
+        }
+        ringbuf_free(&rb1);
+    }
+    END_TEST(test_num);
+
+    /* SPSC records, with producer and consumer threads */
+    START_NEW_TEST(test_num);
+    rb1 = ringbuf_new_flags(1021, RINGBUF_SPSC | RINGBUF_RECORD_PAD);
+    assert(pthread_create(&consumer, 0, record_test_consumer, rb1) == 0);
+    assert(pthread_create(&producer, 0, record_test_producer, rb1) == 0);
+    assert(pthread_join(producer, 0) == 0);
+    assert(pthread_join(consumer, &consumer_result) == 0);
+    assert(consumer_result == 0);
+    assert(ringbuf_is_empty(rb1));
+    ringbuf_free(&rb1);
+    END_TEST(test_num);
+
+    /* element ring buffers */
+    START_NEW_TEST(test_num);
+    struct elem_test { uint64_t seq; uint8_t payload[40]; } elem, elems[16];
+    assert(sizeof(struct elem_test) == 48);
+    assert(ringbuf_new_elems(10, 0, 0) == 0);
+    assert(ringbuf_new_elems(0, sizeof(elem), 0) == 0);
+    assert(ringbuf_new_elems(SIZE_MAX / 2, sizeof(elem), 0) == 0);
+    assert(ringbuf_new_elems(10, sizeof(elem), RINGBUF_RECORD_PAD) == 0);
+    assert(ringbuf_new_elems(10, sizeof(elem), RINGBUF_POW2) == 0);
+    rb1 = ringbuf_new_elems(10, sizeof(elem), RINGBUF_SPSC);
+    assert(rb1);
+    assert(ringbuf_elem_size(rb1) == sizeof(elem));
+    assert(ringbuf_elems_capacity(rb1) == 10);
+    assert(ringbuf_capacity(rb1) == 10 * sizeof(elem));
+    assert(ringbuf_elems_free(rb1) == 10);
+    assert(ringbuf_at(rb1, 0) == 0);
+    assert(ringbuf_pop(&elem, rb1) == 0);
+    for (offset = 0; offset != 10; ++offset) {
+        elem.seq = offset;
+        memset(elem.payload, (int) offset, sizeof(elem.payload));
+        assert(ringbuf_push(rb1, &elem) == 1);
+    }
+    assert(ringbuf_is_full(rb1));
+    assert(ringbuf_elems_used(rb1) == 10);
+    assert(ringbuf_push(rb1, &elem) == 0);
+    for (offset = 0; offset != 10; ++offset)
+        assert(((struct elem_test *) ringbuf_at(rb1, offset))->seq == offset);
+    assert(ringbuf_at(rb1, 10) == 0);
+    assert(ringbuf_pop(&elem, rb1) == 1);
+    assert(elem.seq == 0);
+    assert(((struct elem_test *) ringbuf_at(rb1, 0))->seq == 1);
+    END_TEST(test_num);
+
+    START_NEW_TEST(test_num);
+    /* bulk, and elements are never split across the end of the buffer */
+    uint64_t seq_in = 10, seq_out = 1;
+    srand(4);
+    for (offset = 0; offset != 5000; ++offset) {
+        size_t n = rand() % 16, k;
+        for (k = 0; k != n; ++k)
+            elems[k].seq = seq_in + k;
+        size_t want = MIN(n, ringbuf_elems_free(rb1));
+        assert(ringbuf_push_n(rb1, elems, n) == want);
+        seq_in += want;
+        size_t used = ringbuf_elems_used(rb1);
+        assert(used == seq_in - seq_out);
+        for (k = 0; k != used; ++k) {
+            struct elem_test *e = ringbuf_at(rb1, k);
+            assert(e->seq == seq_out + k);
+            assert(k == 0 || (uint8_t *) e == (uint8_t *) ringbuf_at(rb1, k - 1) + sizeof(elem) ||
+                   (uint8_t *) e + sizeof(elem) * ringbuf_elems_capacity(rb1) ==
+                   (uint8_t *) ringbuf_at(rb1, k - 1) + sizeof(elem));
+        }
+        n = rand() % 16;
+        want = MIN(n, used);
+        assert(ringbuf_pop_n(elems, rb1, n) == want);
+        for (k = 0; k != want; ++k)
+            assert(elems[k].seq == seq_out + k);
+        seq_out += want;
+    }
+    ringbuf_free(&rb1);
+    END_TEST(test_num);
+
+    START_NEW_TEST(test_num);
+    /* default element ring buffers overflow, overwriting the oldest elements */
+    rb1 = ringbuf_new_elems(10, sizeof(elem), 0);
+    for (offset = 0; offset != 13; ++offset)
+        elems[offset].seq = offset;
+    assert(ringbuf_push_n(rb1, elems, 7) == 7);
+    assert(ringbuf_push_n(rb1, elems + 7, 6) == 6);
+    assert(ringbuf_is_full(rb1));
+    assert(((struct elem_test *) ringbuf_at(rb1, 0))->seq == 3);
+    elem.seq = 13;
+    assert(ringbuf_push(rb1, &elem) == 1);
+    assert(ringbuf_pop_n(elems, rb1, 16) == 10);
+    for (offset = 0; offset != 10; ++offset)
+        assert(elems[offset].seq == offset + 4);
+
+    /* a batch larger than the ring buffer leaves its newest elements */
+    for (offset = 0; offset != 13; ++offset)
+        elems[offset].seq = 100 + offset;
+    assert(ringbuf_push_n(rb1, elems, 13) == 13);
+    assert(ringbuf_pop_n(elems, rb1, 16) == 10);
+    for (offset = 0; offset != 10; ++offset)
+        assert(elems[offset].seq == 103 + offset);
+    ringbuf_free(&rb1);
+    END_TEST(test_num);
+
+    START_NEW_TEST(test_num);
+    /* MPMC, and power-of-two and mirrored element ring buffers */
+    int elem_flags[] = { RINGBUF_MPMC, RINGBUF_POW2, RINGBUF_MIRROR | RINGBUF_SPSC };
+    for (offset = 0; offset != sizeof(elem_flags) / sizeof(elem_flags[0]); ++offset) {
+        uint64_t e64 = 0, k;
+        rb1 = ringbuf_new_elems(100, sizeof(e64), elem_flags[offset]);
+        if (!rb1 && (elem_flags[offset] & RINGBUF_MIRROR))
+            continue;
+        assert(rb1);
+        assert(ringbuf_elems_capacity(rb1) >= 100);
+        assert(ringbuf_capacity(rb1) % sizeof(e64) == 0);
+        seq_in = seq_out = 0;
+        for (k = 0; k != 3000; ++k) {
+            uint64_t in[7], out[7];
+            size_t j, n = rand() % 8;
+            for (j = 0; j != n; ++j)
+                in[j] = seq_in + j;
+            n = MIN(n, ringbuf_elems_free(rb1));
+            assert(ringbuf_push_n(rb1, in, n) == n);
+            seq_in += n;
+            n = ringbuf_pop_n(out, rb1, rand() % 8);
+            for (j = 0; j != n; ++j)
+                assert(out[j] == seq_out + j);
+            seq_out += n;
+            if (ringbuf_pop(&e64, rb1))
+                assert(e64 == seq_out++);
+        }
+        ringbuf_free(&rb1);
+    }
+    END_TEST(test_num);
+
+    START_NEW_TEST(test_num);
+    /* overflowing writes keep only the last capacity bytes */
+    for (offset = 0; offset != RINGBUF_SIZE * 2; ++offset)
+        buf[offset] = (uint8_t) (offset * 7);
+    ringbuf_t orb = ringbuf_new(RINGBUF_SIZE - 1);
+    assert(ringbuf_memcpy_into(orb, buf, 100) == ringbuf_head(orb));
+    assert(ringbuf_memcpy_into(orb, buf, RINGBUF_SIZE * 2 - 5) == ringbuf_head(orb));
+    assert(ringbuf_is_full(orb));
+    assert(ringbuf_memcpy_from(dst, orb, RINGBUF_SIZE - 1));
+    assert(memcmp(dst, buf + RINGBUF_SIZE - 4, RINGBUF_SIZE - 1) == 0);
+    assert(ringbuf_is_empty(orb));
+    assert(ringbuf_memset(orb, 'x', RINGBUF_SIZE * 3) == RINGBUF_SIZE);
+    assert(ringbuf_is_full(orb));
+    assert(ringbuf_memcpy_from(dst, orb, RINGBUF_SIZE - 1));
+    assert(dst[0] == 'x' && dst[RINGBUF_SIZE - 2] == 'x');
+
+    /* and so do overflowing copies, which still consume every byte */
+    ringbuf_t orb2 = ringbuf_new(RINGBUF_SIZE);
+    ringbuf_t orb3 = ringbuf_new(1000);
+    assert(ringbuf_memcpy_into(orb3, buf, 600));
+    assert(ringbuf_memcpy_into(orb2, buf + 600, RINGBUF_SIZE));
+    assert(ringbuf_copy(orb3, orb2, 2500) == ringbuf_head(orb3));
+    assert(ringbuf_bytes_used(orb2) == RINGBUF_SIZE - 2500);
+    assert(ringbuf_is_full(orb3));
+    assert(ringbuf_memcpy_from(dst, orb3, 1000));
+    assert(memcmp(dst, buf + 600 + 1500, 1000) == 0);
+    assert(ringbuf_memcpy_from(dst, orb2, RINGBUF_SIZE - 2500));
+    assert(memcmp(dst, buf + 600 + 2500, RINGBUF_SIZE - 2500) == 0);
+    ringbuf_free(&orb);
+    ringbuf_free(&orb2);
+    ringbuf_free(&orb3);
+    END_TEST(test_num);
+
+    START_NEW_TEST(test_num);
+    /* overflow policies */
+    assert(ringbuf_new_flags(10, RINGBUF_OVERFLOW_REJECT | RINGBUF_OVERFLOW_TRUNCATE) == 0);
+    orb = ringbuf_new_flags(100, RINGBUF_OVERFLOW_REJECT);
+    orb2 = ringbuf_new_flags(100, RINGBUF_OVERFLOW_TRUNCATE);
+    orb3 = ringbuf_new(200);
+    assert(ringbuf_memcpy_into(orb, buf, 60));
+    assert(ringbuf_memcpy_into(orb, buf, 41) == 0);
+    assert(ringbuf_memset(orb, 0, 41) == 0);
+    assert(ringbuf_memset(orb, 0, 1000) == 0);
+    assert(ringbuf_bytes_used(orb) == 60);
+    assert(ringbuf_memcpy_into(orb, buf + 60, 40));
+    assert(ringbuf_is_full(orb));
+    assert(ringbuf_memcpy_from(dst, orb, 100));
+    assert(memcmp(dst, buf, 100) == 0);
+
+    assert(ringbuf_memcpy_into(orb2, buf, 60) == ringbuf_head(orb2));
+    assert(ringbuf_memcpy_into(orb2, buf + 60, 1000) == ringbuf_head(orb2));
+    assert(ringbuf_is_full(orb2));
+    assert(ringbuf_memcpy_into(orb2, buf, 1) == ringbuf_head(orb2));
+    assert(ringbuf_memset(orb2, 0, 10) == 0);
+    assert(ringbuf_memcpy_from(dst, orb2, 100));
+    assert(memcmp(dst, buf, 100) == 0);
+    assert(ringbuf_memset(orb2, 'y', 1000) == 100);
+    assert(ringbuf_is_full(orb2));
+    assert(ringbuf_memcpy_from(dst, orb2, 10));
+
+    /* copies reject or truncate, and truncated copies consume only what fits */
+    assert(ringbuf_memcpy_into(orb3, buf, 200));
+    assert(ringbuf_memcpy_into(orb, buf, 50));
+    assert(ringbuf_copy(orb, orb3, 51) == 0);
+    assert(ringbuf_bytes_used(orb3) == 200 && ringbuf_bytes_used(orb) == 50);
+    assert(ringbuf_copy(orb, orb3, 50) == ringbuf_head(orb));
+    assert(ringbuf_is_full(orb));
+    assert(ringbuf_copy(orb2, orb3, 100) == ringbuf_head(orb2));
+    assert(ringbuf_is_full(orb2));
+    assert(ringbuf_bytes_used(orb3) == 140);
+    assert(ringbuf_memcpy_from(dst, orb2, 100));
+    assert(dst[89] == 'y' && memcmp(dst + 90, buf + 50, 10) == 0);
+    assert(ringbuf_memcpy_from(dst, orb3, 140));
+    assert(memcmp(dst, buf + 60, 140) == 0);
+
+    /* reads from file descriptors never overflow */
+    int opipe[2];
+    assert(pipe(opipe) == 0);
+    ringbuf_reset(orb2);
+    assert(write(opipe[1], buf, 30) == 30);
+    assert(ringbuf_read(opipe[0], orb2, 30) == 30);
+    assert(write(opipe[1], buf, 200) == 200);
+    assert(ringbuf_read(opipe[0], orb2, 200) == 70);
+    assert(ringbuf_is_full(orb2));
+    ringbuf_reset(orb);
+    assert(ringbuf_readv(opipe[0], orb, 200) == 100);
+    assert(ringbuf_is_full(orb));
+    assert(ringbuf_memcpy_from(dst, orb, 100));
+    assert(memcmp(dst, buf + 70, 100) == 0);
+    close(opipe[0]);
+    close(opipe[1]);
+    ringbuf_free(&orb);
+    ringbuf_free(&orb2);
+    ringbuf_free(&orb3);
+
+    /* element ring buffers, and MPMC with truncation */
+    uint32_t oelems[8] = { 1, 2, 3, 4, 5, 6, 7, 8 }, oout[8];
+    orb = ringbuf_new_elems(6, sizeof(uint32_t), RINGBUF_OVERFLOW_REJECT);
+    assert(ringbuf_push_n(orb, oelems, 8) == 0);
+    assert(ringbuf_push_n(orb, oelems, 4) == 4);
+    assert(ringbuf_push_n(orb, oelems, 3) == 0);
+    assert(ringbuf_push_n(orb, oelems, 2) == 2);
+    assert(ringbuf_push(orb, oelems) == 0);
+    ringbuf_free(&orb);
+    orb = ringbuf_new_elems(6, sizeof(uint32_t), RINGBUF_OVERFLOW_TRUNCATE);
+    assert(ringbuf_push_n(orb, oelems, 4) == 4);
+    assert(ringbuf_push_n(orb, oelems + 4, 4) == 2);
+    assert(ringbuf_pop_n(oout, orb, 8) == 6);
+    assert(oout[5] == 6);
+    ringbuf_free(&orb);
+    orb = ringbuf_new_flags(100, RINGBUF_MPMC | RINGBUF_OVERFLOW_TRUNCATE);
+    assert(ringbuf_memcpy_into(orb, buf, 150));
+    assert(ringbuf_is_full(orb));
+    assert(ringbuf_memcpy_from(dst, orb, 100));
+    assert(memcmp(dst, buf, 100) == 0);
+    ringbuf_free(&orb);
+    END_TEST(test_num);
+
+    START_NEW_TEST(test_num);
+    /* resizing preserves the contents, whether or not they wrap */
+    int resize_flags[] = { 0, RINGBUF_POW2, RINGBUF_THP, RINGBUF_MIRROR, RINGBUF_ELEMS_TEST };
+    for (offset = 0; offset != sizeof(resize_flags) / sizeof(resize_flags[0]); ++offset) {
+        int rflags = resize_flags[offset];
+        size_t es = rflags == RINGBUF_ELEMS_TEST ? 8 : 1;
+        ringbuf_t rrb = es == 8 ? ringbuf_new_elems(16, es, 0) : ringbuf_new_flags(100, rflags);
+        if (!rrb && (rflags & RINGBUF_MIRROR))
+            continue;
+        assert(rrb);
+        uint8_t rin[300], rout[300];
+        size_t k, j;
+        seq_in = seq_out = 0;
+        for (k = 0; k != 2000; ++k) {
+            size_t n = (rand() % 100) / es * es;
+            n = MIN(n, ringbuf_bytes_free(rrb));
+            for (j = 0; j != n; ++j)
+                rin[j] = (uint8_t) (seq_in + j);
+            assert(ringbuf_memcpy_into(rrb, rin, n));
+            seq_in += n;
+            n = (rand() % 100) / es * es;
+            n = MIN(n, ringbuf_bytes_used(rrb));
+            assert(ringbuf_memcpy_from(rout, rrb, n));
+            for (j = 0; j != n; ++j)
+                assert(rout[j] == (uint8_t) (seq_out + j));
+            seq_out += n;
+
+            if (k % 7 == 0) {
+                size_t used = ringbuf_bytes_used(rrb);
+                size_t capacity = (es + rand() % 300) / es * es;
+                if (capacity < used) {
+                    /* unless it's rounded up, the new capacity is too small */
+                    assert(!ringbuf_resize(rrb, capacity) || (rflags > 0 && rflags != RINGBUF_THP));
+                    capacity = MAX(used, es);
+                }
+                assert(ringbuf_resize(rrb, capacity));
+                assert(ringbuf_capacity(rrb) >= capacity);
+                assert(ringbuf_bytes_used(rrb) == used);
+            }
+        }
+        ringbuf_free(&rrb);
+    }
+
+    /* ring buffers that can't be resized */
+    orb = ringbuf_new_flags(100, RINGBUF_RECORD_PAD);
+    assert(!ringbuf_resize(orb, 200));
+    ringbuf_free(&orb);
+    orb = ringbuf_new_aligned(100, 0, 64);
+    assert(!ringbuf_resize(orb, 200));
+    ringbuf_free(&orb);
+    orb = ringbuf_new_broadcast(100, 2, 0);
+    assert(!ringbuf_resize(orb, 200));
+    ringbuf_free(&orb);
+    orb = ringbuf_new_elems(10, 4, 0);
+    assert(!ringbuf_resize(orb, 41));
+    assert(ringbuf_resize(orb, 44) && ringbuf_elems_capacity(orb) == 11);
+    ringbuf_free(&orb);
+
+    /* a cursor starts over after a resize */
+    orb = ringbuf_new(50);
+    assert(ringbuf_memcpy_into(orb, "aaaa\nbbbb", 9));
+    ringbuf_cursor_t rcur = ringbuf_cursor_new(orb);
+    assert(ringbuf_cursor_findchr(rcur, '\n') == 4);
+    assert(ringbuf_memcpy_from(dst, orb, 5));
+    assert(ringbuf_cursor_findchr(rcur, 'b') == 0);
+    assert(ringbuf_resize(orb, 5000));
+    assert(ringbuf_memcpy_into(orb, "\n", 1));
+    assert(ringbuf_cursor_findchr(rcur, '\n') == 4);
+    ringbuf_cursor_free(&rcur);
+    ringbuf_free(&orb);
+    END_TEST(test_num);
+
+    START_NEW_TEST(test_num);
+    /* automatic growth, up to a ceiling */
+    orb = ringbuf_new_flags(16, RINGBUF_SPSC);
+    assert(!ringbuf_set_max_capacity(orb, 1000));
+    ringbuf_free(&orb);
+    orb = ringbuf_new(16);
+    assert(ringbuf_set_max_capacity(orb, 100));
+    assert(ringbuf_memcpy_into(orb, buf, 10));
+    assert(ringbuf_capacity(orb) == 16);
+    assert(ringbuf_memcpy_into(orb, buf + 10, 10));
+    assert(ringbuf_capacity(orb) == 32);
+    assert(ringbuf_memcpy_into(orb, buf + 20, 30));
+    assert(ringbuf_capacity(orb) == 64);
+    assert(ringbuf_bytes_used(orb) == 50);
+    assert(ringbuf_memcpy_into(orb, buf + 50, 100));
+    assert(ringbuf_capacity(orb) == 100);
+    assert(ringbuf_is_full(orb));
+    assert(ringbuf_memcpy_from(dst, orb, 100));
+    assert(memcmp(dst, buf + 50, 100) == 0);
+    ringbuf_free(&orb);
+
+    /* growth takes precedence over the overflow policy */
+    orb = ringbuf_new_flags(16, RINGBUF_OVERFLOW_REJECT | RINGBUF_POW2);
+    assert(ringbuf_set_max_capacity(orb, 64));
+    assert(ringbuf_memset(orb, 1, 40) == 40);
+    assert(ringbuf_capacity(orb) == 64);
+    assert(ringbuf_memcpy_into(orb, buf, 30) == 0);
+    assert(ringbuf_memcpy_into(orb, buf, 24));
+    assert(ringbuf_is_full(orb));
+    ringbuf_free(&orb);
+    orb = ringbuf_new_elems(2, sizeof(uint32_t), RINGBUF_OVERFLOW_TRUNCATE);
+    assert(ringbuf_set_max_capacity(orb, 5 * sizeof(uint32_t)));
+    assert(ringbuf_push_n(orb, oelems, 8) == 5);
+    assert(ringbuf_pop_n(oout, orb, 8) == 5 && oout[4] == 5);
+    ringbuf_free(&orb);
+    orb = ringbuf_new_elems(2, sizeof(uint32_t), RINGBUF_POW2);
+    assert(ringbuf_set_max_capacity(orb, 8 * sizeof(uint32_t)));
+    for (offset = 0; offset != 6; ++offset)
+        assert(ringbuf_push(orb, oelems + offset));
+    assert(ringbuf_capacity(orb) == 8 * sizeof(uint32_t));
+    assert(ringbuf_pop_n(oout, orb, 8) == 6);
+    for (offset = 0; offset != 6; ++offset)
+        assert(oout[offset] == offset + 1);
+    ringbuf_free(&orb);
+    END_TEST(test_num);
+
+    START_NEW_TEST(test_num);
+    /* blocking waits */
+    assert(ringbuf_new_flags(100, RINGBUF_BLOCKING) == 0);
+    assert(ringbuf_new_broadcast(100, 2, RINGBUF_BLOCKING) == 0);
+    orb = ringbuf_new_flags(100, RINGBUF_SPSC | RINGBUF_BLOCKING);
+    assert(ringbuf_wait_free(orb, 100, -1));
+    assert(!ringbuf_wait_free(orb, 101, -1));
+    assert(!ringbuf_wait_used(orb, 1, 0));
+    struct timespec wstart, wend;
+    clock_gettime(CLOCK_MONOTONIC, &wstart);
+    assert(!ringbuf_wait_used(orb, 1, 20));
+    clock_gettime(CLOCK_MONOTONIC, &wend);
+    assert((wend.tv_sec - wstart.tv_sec) * 1000000000L + (wend.tv_nsec - wstart.tv_nsec) >=
+           20000000L);
+    assert(ringbuf_memcpy_into(orb, buf, 60));
+    assert(ringbuf_wait_used(orb, 60, -1));
+    assert(!ringbuf_wait_free(orb, 41, 1));
+    assert(ringbuf_wait_free(orb, 40, 0));
+    ringbuf_free(&orb);
+
+    orb = ringbuf_new_flags(1021, RINGBUF_SPSC | RINGBUF_BLOCKING);
+    assert(pthread_create(&consumer, 0, blocking_test_consumer, orb) == 0);
+    assert(pthread_create(&producer, 0, blocking_test_producer, orb) == 0);
+    assert(pthread_join(producer, &consumer_result) == 0);
+    assert(consumer_result == 0);
+    assert(pthread_join(consumer, &consumer_result) == 0);
+    assert(consumer_result == 0);
+    assert(ringbuf_is_empty(orb));
+    ringbuf_free(&orb);
+    END_TEST(test_num);
+
+#ifdef __linux__
+    START_NEW_TEST(test_num);
+    /* the eventfd is readable iff there's data, once it's re-armed */
+    orb = ringbuf_new(100);
+    assert(ringbuf_eventfd(orb) == -1);
+    ringbuf_free(&orb);
+    orb = ringbuf_new_flags(100, RINGBUF_MPMC | RINGBUF_BLOCKING);
+    assert(ringbuf_memcpy_into(orb, buf, 10));
+    int efd = ringbuf_eventfd(orb);
+    assert(efd >= 0 && ringbuf_eventfd(orb) == efd);
+    struct pollfd pfd = { efd, POLLIN, 0 };
+    assert(poll(&pfd, 1, 0) == 1);
+    assert(ringbuf_memcpy_from(dst, orb, 10));
+    assert(poll(&pfd, 1, 0) == 1);
+    assert(ringbuf_eventfd_rearm(orb) == 0);
+    assert(poll(&pfd, 1, 0) == 0);
+    assert(ringbuf_memcpy_into(orb, buf, 5));
+    assert(poll(&pfd, 1, 0) == 1);
+    assert(ringbuf_memcpy_into(orb, buf, 5));
+    assert(ringbuf_eventfd_rearm(orb) == 10);
+    assert(poll(&pfd, 1, 0) == 1);
+    assert(ringbuf_memcpy_from(dst, orb, 10));
+    assert(ringbuf_eventfd_rearm(orb) == 0);
+    assert(poll(&pfd, 1, 0) == 0);
+    ringbuf_free(&orb);
+    END_TEST(test_num);
+#endif
+
+    START_NEW_TEST(test_num);
+    /* statistics */
+    {
+        struct ringbuf_stats st;
+        orb = ringbuf_new_flags(100, RINGBUF_SPSC);
+#ifdef RINGBUF_STATS
+        assert(ringbuf_get_stats(orb, &st) == 1);
+        assert(st.in_calls == 0 && st.out_calls == 0 && st.high_water == 0);
+        assert(ringbuf_memcpy_into(orb, buf, 60));
+        assert(!ringbuf_memcpy_into(orb, buf, 50));
+        assert(ringbuf_memcpy_from(dst, orb, 50));
+        assert(!ringbuf_memcpy_from(dst, orb, 20));
+        assert(ringbuf_memcpy_into(orb, buf, 60));
+        assert(ringbuf_memcpy_from(dst, orb, 70));
+        assert(ringbuf_get_stats(orb, &st));
+        assert(st.in_calls == 2 && st.in_bytes == 120);
+        assert(st.in_rejected == 1 && st.in_short == 0 && st.in_wraps == 1);
+        assert(st.out_calls == 2 && st.out_bytes == 120);
+        assert(st.out_rejected == 1 && st.out_short == 0 && st.out_wraps == 1);
+        assert(st.high_water == 70 && st.overflows == 0 && st.overwritten == 0);
+
+        /* empty writes and reads aren't calls */
+        assert(ringbuf_memcpy_into(orb, buf, 0));
+        assert(ringbuf_memcpy_from(dst, orb, 0));
+        assert(ringbuf_get_stats(orb, &st));
+        assert(st.in_calls == 2 && st.out_calls == 2);
+        ringbuf_reset_stats(orb);
+        assert(ringbuf_get_stats(orb, &st));
+        assert(st.in_calls == 0 && st.in_bytes == 0 && st.in_rejected == 0);
+        assert(st.out_calls == 0 && st.out_wraps == 0 && st.high_water == 0);
+        ringbuf_free(&orb);
+
+        /* overflows */
+        orb = ringbuf_new(10);
+        assert(ringbuf_memcpy_into(orb, buf, 8));
+        assert(ringbuf_memcpy_into(orb, buf, 15));
+        assert(ringbuf_get_stats(orb, &st));
+        assert(st.in_calls == 2 && st.in_bytes == 23);
+        assert(st.overflows == 1 && st.overwritten == 13 && st.high_water == 10);
+        ringbuf_free(&orb);
+
+        /* short transfers */
+        orb = ringbuf_new_flags(10, RINGBUF_OVERFLOW_TRUNCATE);
+        assert(ringbuf_memcpy_into(orb, buf, 8));
+        assert(ringbuf_memcpy_into(orb, buf, 8));
+        assert(ringbuf_memset(orb, 0, 1) == 0);
+        assert(ringbuf_pop_n(dst, orb, 12) == 10);
+        assert(ringbuf_get_stats(orb, &st));
+        assert(st.in_calls == 2 && st.in_bytes == 10 && st.in_short == 2);
+        assert(st.out_calls == 1 && st.out_short == 1 && st.overflows == 0);
+        ringbuf_free(&orb);
+        int sfds[2];
+        assert(pipe(sfds) == 0);
+        assert(write(sfds[1], buf, 5) == 5);
+        orb = ringbuf_new_flags(100, RINGBUF_SPSC);
+        assert(ringbuf_read(sfds[0], orb, 20) == 5);
+        assert(ringbuf_write(sfds[1], orb, 6) == 0);
+        assert(ringbuf_write(sfds[1], orb, 5) == 5);
+        assert(ringbuf_get_stats(orb, &st));
+        assert(st.in_calls == 1 && st.in_short == 1);
+        assert(st.out_calls == 1 && st.out_rejected == 1 && st.out_short == 0);
+        close(sfds[0]);
+        close(sfds[1]);
+#else
+        assert(ringbuf_memcpy_into(orb, buf, 60));
+        assert(ringbuf_get_stats(orb, &st) == 0);
+        assert(st.in_calls == 0 && st.in_bytes == 0 && st.high_water == 0);
+        ringbuf_reset_stats(orb);
+#endif
+        ringbuf_free(&orb);
+    }
+    END_TEST(test_num);
+
+    START_NEW_TEST(test_num);
+    /* shared ring buffers */
+    {
+        char shm_name[64];
+        snprintf(shm_name, sizeof(shm_name), "/ringbuf-test-%ld", (long) getpid());
+        shm_unlink(shm_name);
+        int sfd = shm_open(shm_name, O_RDWR | O_CREAT | O_EXCL, 0600);
+        assert(sfd != -1);
+        shm_unlink(shm_name);
+        assert(ringbuf_shm_create(sfd, 1000, 0) == 0);
+        assert(ringbuf_shm_create(sfd, 1000, RINGBUF_SPSC | RINGBUF_THP) == 0);
+        assert(ringbuf_shm_create(sfd, 1000, RINGBUF_SPSC | RINGBUF_MPMC) == 0);
+        assert(ringbuf_shm_attach(sfd) == 0);
+        ringbuf_t srb = ringbuf_shm_create(sfd, 1000, RINGBUF_SPSC);
+        assert(srb);
+        assert(ringbuf_capacity(srb) == 1000 && ringbuf_is_empty(srb));
+        assert(ringbuf_shm_create(sfd, 1000, RINGBUF_SPSC) == 0);
+        assert(!ringbuf_resize(srb, 2000));
+
+        /* a second view of the same ring buffer, at another address */
+        ringbuf_t srb2 = ringbuf_shm_attach(sfd);
+        assert(srb2 && srb2 != srb);
+        assert(ringbuf_capacity(srb2) == 1000 && ringbuf_is_empty(srb2));
+        size_t k;
+        for (k = 0; k != 200; ++k) {
+            size_t n = 1 + k * 37 % 999;
+            assert(ringbuf_memcpy_into(srb, buf + k, n));
+            assert(ringbuf_bytes_used(srb2) == n);
+            assert(ringbuf_memcpy_from(dst, srb2, n));
+            assert(memcmp(dst, buf + k, n) == 0);
+        }
+        assert(ringbuf_is_empty(srb) && ringbuf_tail(srb2) != ringbuf_tail(srb));
+        assert((const uint8_t *) ringbuf_tail(srb) - (const uint8_t *) srb ==
+               (const uint8_t *) ringbuf_tail(srb2) - (const uint8_t *) srb2);
+        assert(ringbuf_memcpy_into(srb2, buf, 10));
+        ringbuf_free(&srb2);
+        assert(ringbuf_bytes_used(srb) == 10);
+        assert(ringbuf_memcpy_from(dst, srb, 10) && memcmp(dst, buf, 10) == 0);
+        ringbuf_free(&srb);
+
+        /* the ring buffer survives its creator's view */
+        srb = ringbuf_shm_attach(sfd);
+        assert(srb && ringbuf_is_empty(srb));
+        ringbuf_free(&srb);
+
+        /* a header from another version can't be attached */
+        uint32_t *version = mmap(0, sizeof(uint64_t) + sizeof(uint32_t),
+                                 PROT_READ | PROT_WRITE, MAP_SHARED, sfd, 0);
+        assert(version != MAP_FAILED);
+        version += 2; /* after the 64-bit magic number */
+        ++*version;
+        assert(ringbuf_shm_attach(sfd) == 0);
+        --*version;
+        assert((srb = ringbuf_shm_attach(sfd)) != 0);
+        ringbuf_free(&srb);
+        munmap(version - 2, sizeof(uint64_t) + sizeof(uint32_t));
+        close(sfd);
+
+        /* mirrored */
+        sfd = shm_open(shm_name, O_RDWR | O_CREAT | O_EXCL, 0600);
+        assert(sfd != -1);
+        shm_unlink(shm_name);
+        srb = ringbuf_shm_create(sfd, 4096, RINGBUF_SPSC | RINGBUF_MIRROR);
+        assert(srb);
+        srb2 = ringbuf_shm_attach(sfd);
+        close(sfd);
+        assert(srb2);
+        size_t scap = ringbuf_capacity(srb);
+        assert(ringbuf_memset(srb, 0, scap - 100) == scap - 100);
+        assert(ringbuf_memcpy_from(dst, srb2, scap - 100));
+        assert(ringbuf_memcpy_into(srb, buf, 300));
+        struct iovec siov[2];
+        assert(ringbuf_peek(srb2, 300, siov) == 1);
+        assert(siov[0].iov_len == 300 && memcmp(siov[0].iov_base, buf, 300) == 0);
+        ringbuf_free(&srb);
+        ringbuf_free(&srb2);
+
+        /* create or attach by name */
+        srb = ringbuf_shm_open(shm_name, 500, RINGBUF_SPSC | RINGBUF_POW2);
+        assert(srb && ringbuf_capacity(srb) == 512);
+        srb2 = ringbuf_shm_open(shm_name, 500, RINGBUF_SPSC | RINGBUF_POW2);
+        assert(srb2);
+        assert(ringbuf_shm_open(shm_name, 500, RINGBUF_SPSC) == 0);
+        assert(ringbuf_shm_open(shm_name, 1000, RINGBUF_SPSC | RINGBUF_POW2) == 0);
+        assert(ringbuf_memcpy_into(srb, buf, 512));
+        assert(ringbuf_is_full(srb2));
+        ringbuf_free(&srb);
+        ringbuf_free(&srb2);
+        shm_unlink(shm_name);
+
+#ifdef __linux__
+        /* a consumer process, which parks on a shared futex */
+        sfd = shm_open(shm_name, O_RDWR | O_CREAT | O_EXCL, 0600);
+        assert(sfd != -1);
+        shm_unlink(shm_name);
+        srb = ringbuf_shm_create(sfd, 1021, RINGBUF_SPSC | RINGBUF_BLOCKING);
+        assert(srb && ringbuf_eventfd(srb) == -1);
+        pid_t pid = fork();
+        assert(pid != -1);
+        if (pid == 0) {
+            ringbuf_t crb = ringbuf_shm_attach(sfd);
+            _exit(crb && blocking_test_consumer(crb) == 0 ? 0 : 1);
+        }
+        close(sfd);
+        assert(blocking_test_producer(srb) == 0);
+        int status;
+        assert(waitpid(pid, &status, 0) == pid);
+        assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+        assert(ringbuf_is_empty(srb));
+        ringbuf_free(&srb);
+#endif
+    }
+    END_TEST(test_num);
+
+    START_NEW_TEST(test_num);
+    /* persistent ring buffers */
+    {
+        char path[64];
+        snprintf(path, sizeof(path), "/tmp/ringbuf-test-%ld.ring", (long) getpid());
+        unlink(path);
+        ringbuf_t prb = ringbuf_new(100);
+        assert(!ringbuf_file_set_sync(prb, 1, 1) && !ringbuf_file_sync(prb));
+        ringbuf_free(&prb);
+        assert(ringbuf_file_open(path, 1000, RINGBUF_HUGETLB) == 0);
+        prb = ringbuf_file_open(path, 1000, 0);
+        assert(prb && ringbuf_capacity(prb) == 1000 && ringbuf_is_empty(prb));
+        assert(ringbuf_file_set_sync(prb, 4096, 0));
+        assert(!ringbuf_resize(prb, 2000));
+        size_t k;
+        for (k = 0; k != 30; ++k)
+            assert(ringbuf_memcpy_into(prb, buf + 50 * k, 50));
+        assert(ringbuf_is_full(prb));
+        assert(ringbuf_file_sync(prb));
+        ringbuf_free(&prb);
+
+        /* the same capacity and flags recover the contents */
+        assert(ringbuf_file_open(path, 2000, 0) == 0);
+        assert(ringbuf_file_open(path, 1000, RINGBUF_SPSC) == 0);
+        prb = ringbuf_file_open(path, 1000, 0);
+        assert(prb && ringbuf_bytes_used(prb) == 1000);
+        assert(ringbuf_memcpy_from(dst, prb, 400));
+        assert(memcmp(dst, buf + 500, 400) == 0);
+        assert(ringbuf_memcpy_into(prb, buf, 100));
+        ringbuf_free(&prb);
+        prb = ringbuf_file_open(path, 1000, 0);
+        assert(prb && ringbuf_bytes_used(prb) == 700);
+        assert(ringbuf_memcpy_from(dst, prb, 700));
+        assert(memcmp(dst, buf + 900, 600) == 0 && memcmp(dst + 600, buf, 100) == 0);
+        ringbuf_free(&prb);
+
+        /* it isn't a shared ring buffer */
+        int pfd = open(path, O_RDWR);
+        assert(pfd != -1 && ringbuf_shm_attach(pfd) == 0);
+        close(pfd);
+        unlink(path);
+
+        /* a process that dies loses only what it hadn't published */
+        prb = ringbuf_file_open(path, 1000, RINGBUF_SPSC | RINGBUF_DEFER_PUBLISH);
+        assert(prb);
+        ringbuf_free(&prb);
+        pid_t ppid = fork();
+        assert(ppid != -1);
+        if (ppid == 0) {
+            ringbuf_t crb = ringbuf_file_open(path, 1000, RINGBUF_SPSC | RINGBUF_DEFER_PUBLISH);
+            if (!crb || !ringbuf_file_set_sync(crb, 64, 10) ||
+                !ringbuf_memcpy_into(crb, buf, 100) || ringbuf_publish(crb) != 100 ||
+                !ringbuf_memcpy_into(crb, buf + 100, 50))
+                _exit(1);
+            _exit(0);
+        }
+        int pstatus;
+        assert(waitpid(ppid, &pstatus, 0) == ppid);
+        assert(WIFEXITED(pstatus) && WEXITSTATUS(pstatus) == 0);
+        prb = ringbuf_file_open(path, 1000, RINGBUF_SPSC | RINGBUF_DEFER_PUBLISH);
+        assert(prb && ringbuf_bytes_used(prb) == 100 && ringbuf_bytes_free(prb) == 900);
+        assert(ringbuf_memcpy_into(prb, buf + 200, 900));
+        assert(ringbuf_publish(prb) == 900 && ringbuf_is_full(prb));
+        assert(ringbuf_memcpy_from(dst, prb, 1000));
+        assert(memcmp(dst, buf, 100) == 0 && memcmp(dst + 100, buf + 200, 900) == 0);
+        ringbuf_free(&prb);
+        unlink(path);
+
+        /* a file whose creator never finished is started over; others are left alone */
+        prb = ringbuf_file_open(path, 1000, 0);
+        assert(prb);
+        ringbuf_free(&prb);
+        pfd = open(path, O_RDWR);
+        struct stat pst;
+        assert(pfd != -1 && fstat(pfd, &pst) == 0);
+        assert(ftruncate(pfd, 0) == 0 && ftruncate(pfd, pst.st_size) == 0);
+        prb = ringbuf_file_open(path, 1000, 0);
+        assert(prb && ringbuf_is_empty(prb));
+        ringbuf_free(&prb);
+        assert(ftruncate(pfd, 0) == 0 && ftruncate(pfd, pst.st_size + 4096) == 0);
+        assert(ringbuf_file_open(path, 1000, 0) == 0);
+        assert(fstat(pfd, &pst) == 0 && pst.st_size != 0);
+        assert(ftruncate(pfd, 0) == 0);
+        assert(write(pfd, test_pattern, strlen(test_pattern)) == strlen(test_pattern));
+        assert(ringbuf_file_open(path, 1000, 0) == 0);
+        memset(dst, 0, 64);
+        assert(pread(pfd, dst, 64, 0) == strlen(test_pattern));
+        assert(strcmp((const char *) dst, test_pattern) == 0);
+        close(pfd);
+        unlink(path);
+    }
+    END_TEST(test_num);
+
+    START_NEW_TEST(test_num);
+    /* checksumming transfers */
+    {
+        uint8_t bytes[3000];
+        size_t k;
+        for (k = 0; k != sizeof(bytes); ++k)
+            bytes[k] = spsc_test_byte(k);
+        assert(ringbuf_crc32c(0, "123456789", 9) == 0xe3069283);
+        assert(ringbuf_crc32c(0, bytes, 0) == 0);
+        memset(dst, 0, 32);
+        assert(ringbuf_crc32c(0, dst, 32) == 0x8a9136aa);
+        for (k = 0; k != 64; ++k) {
+            uint32_t crc = ringbuf_crc32c(0, bytes, k);
+            assert(crc == crc32c_reference(0, bytes, k));
+            assert(ringbuf_crc32c(crc, bytes + k, 1000 - k) == crc32c_reference(0, bytes, 1000));
+        }
+
+        /* the checksum carries across wraps and calls */
+        ringbuf_t crb = ringbuf_new(1000);
+        ringbuf_t crb2 = ringbuf_new(777);
+        uint32_t in_crc = 0, copy_crc = 0, out_crc = 0;
+        size_t nin = 0, ncopied = 0, nout = 0;
+        for (k = 0; nout != sizeof(bytes); ++k) {
+            size_t n = MIN(1 + (k * 37) % 300, sizeof(bytes) - nin);
+            if (n <= ringbuf_bytes_free(crb)) {
+                assert(ringbuf_memcpy_into_crc32c(crb, bytes + nin, n, &in_crc) ==
+                       ringbuf_head(crb));
+                nin += n;
+            }
+            n = MIN(1 + (k * 53) % 250, ringbuf_bytes_used(crb));
+            if (n <= ringbuf_bytes_free(crb2)) {
+                assert(ringbuf_copy_crc32c(crb2, crb, n, &copy_crc) == ringbuf_head(crb2));
+                ncopied += n;
+            }
+            n = MIN(1 + (k * 29) % 200, ringbuf_bytes_used(crb2));
+            assert(ringbuf_memcpy_from_crc32c(dst + nout, crb2, n, &out_crc) ==
+                   ringbuf_tail(crb2));
+            nout += n;
+            assert(in_crc == crc32c_reference(0, bytes, nin));
+            assert(copy_crc == crc32c_reference(0, bytes, ncopied));
+            assert(out_crc == crc32c_reference(0, bytes, nout));
+        }
+        assert(memcmp(dst, bytes, sizeof(bytes)) == 0);
+
+        /* refusals leave the checksum alone, and crc may be 0 */
+        uint32_t crc = 0x12345678;
+        assert(ringbuf_memcpy_from_crc32c(dst, crb, 1, &crc) == 0 && crc == 0x12345678);
+        assert(ringbuf_copy_crc32c(crb2, crb, 1, &crc) == 0 && crc == 0x12345678);
+        assert(ringbuf_memcpy_into_crc32c(crb, bytes, 10, 0));
+        assert(ringbuf_copy_crc32c(crb2, crb, 10, 0));
+        assert(ringbuf_memcpy_from_crc32c(dst, crb2, 10, 0));
+        assert(memcmp(dst, bytes, 10) == 0);
+        ringbuf_t srb = ringbuf_new_flags(100, RINGBUF_SPSC);
+        assert(ringbuf_memcpy_into_crc32c(srb, bytes, 101, &crc) == 0 && crc == 0x12345678);
+
+        /* overflows checksum the bytes they skip, too */
+        crc = 0;
+        assert(ringbuf_memcpy_into_crc32c(crb, bytes, 2500, &crc));
+        assert(crc == crc32c_reference(0, bytes, 2500));
+        assert(ringbuf_memcpy_from(dst, crb, 1000));
+        assert(memcmp(dst, bytes + 1500, 1000) == 0);
+        assert(ringbuf_memcpy_into(crb, bytes, 1000));
+        crc = 0;
+        assert(ringbuf_copy_crc32c(crb2, crb, 1000, &crc));
+        assert(crc == crc32c_reference(0, bytes, 1000));
+        assert(ringbuf_is_empty(crb) && ringbuf_is_full(crb2));
+        assert(ringbuf_memcpy_from(dst, crb2, 777));
+        assert(memcmp(dst, bytes + 223, 777) == 0);
+        ringbuf_free(&srb);
+        ringbuf_free(&crb2);
+        ringbuf_free(&crb);
+    }
+    END_TEST(test_num);
+
+    START_NEW_TEST(test_num);
+    /* streaming copies */
+    {
+        ringbuf_t nrb = ringbuf_new(RINGBUF_SIZE - 3);
+        ringbuf_t nrb2 = ringbuf_new(RINGBUF_SIZE + 5);
+        ringbuf_set_stream_threshold(nrb, 100);
+        ringbuf_set_stream_threshold(nrb2, 1);
+        size_t k, nin = 0, nout = 0;
+        for (k = 0; k != 500; ++k) {
+            /* every alignment, short and long writes, across the wrap */
+            size_t n = (k * 997) % 1500;
+            assert(ringbuf_memcpy_into(nrb, buf + nin % RINGBUF_SIZE, n));
+            nin += n;
+            assert(ringbuf_bytes_used(nrb) == n);
+            assert(ringbuf_copy(nrb2, nrb, n));
+            assert(ringbuf_memcpy_from(dst, nrb2, n));
+            assert(memcmp(dst, buf + nout % RINGBUF_SIZE, n) == 0);
+            nout += n;
+        }
+
+        /* overflowing writes stream only the bytes that survive */
+        assert(ringbuf_memcpy_into(nrb, buf, RINGBUF_SIZE * 2));
+        assert(ringbuf_is_full(nrb));
+        assert(ringbuf_memcpy_from(dst, nrb, RINGBUF_SIZE - 3));
+        assert(memcmp(dst, buf + RINGBUF_SIZE + 3, RINGBUF_SIZE - 3) == 0);
+
+        /* a threshold of 0 turns streaming off again */
+        ringbuf_set_stream_threshold(nrb, 0);
+        assert(ringbuf_memcpy_into(nrb, buf2, 1000));
+        assert(ringbuf_memcpy_from(dst, nrb, 1000));
+        assert(memcmp(dst, buf2, 1000) == 0);
+
+        /* prefetching the wrapped segment doesn't change what's written */
+        int sfds[2];
+        assert(pipe(sfds) == 0);
+        ringbuf_reset(nrb);
+        assert(ringbuf_memcpy_into(nrb, buf, RINGBUF_SIZE - 1000));
+        assert(ringbuf_memcpy_from(dst, nrb, RINGBUF_SIZE - 1000));
+        assert(ringbuf_memcpy_into(nrb, buf, 2000));
+        ssize_t nfirst = ringbuf_buffer_size(nrb) - (RINGBUF_SIZE - 1000);
+        assert(ringbuf_write(sfds[1], nrb, 2000) == nfirst);
+        assert(ringbuf_write(sfds[1], nrb, 2000 - nfirst) == 2000 - nfirst);
+        assert(read(sfds[0], dst, 2000) == 2000);
+        assert(memcmp(dst, buf, 2000) == 0);
+        close(sfds[0]);
+        close(sfds[1]);
+        ringbuf_free(&nrb2);
+        ringbuf_free(&nrb);
+    }
+    END_TEST(test_num);
+
+    START_NEW_TEST(test_num);
+    /* ring buffer sets */
+    {
+        assert(ringbuf_set_new(0, 100, 0, RINGBUF_SET_BATCH) == 0);
+        assert(ringbuf_set_new(2, 100, RINGBUF_MPMC, RINGBUF_SET_BATCH) == 0);
+        assert(ringbuf_set_new(2, 100, RINGBUF_BLOCKING, RINGBUF_SET_BATCH) == 0);
+        assert(ringbuf_set_new(2, 100, 0, 3) == 0);
+
+        /* round-robin, skipping the shards that don't exist */
+        ringbuf_set_t set = ringbuf_set_new(3, 100, 0, RINGBUF_SET_ROUND_ROBIN);
+        assert(set && ringbuf_set_nshards(set) == 3);
+        assert(ringbuf_set_shard(set, 3) == 0);
+        uint8_t rec[16];
+        size_t shard = 99;
+        assert(ringbuf_set_pop_record(rec, set, sizeof(rec), &shard) == -1 && shard == 99);
+        ringbuf_t s0 = ringbuf_set_shard(set, 0);
+        ringbuf_t s2 = ringbuf_set_shard(set, 2);
+        assert(s0 && s2 && s0 != s2 && ringbuf_set_shard(set, 0) == s0);
+        assert(ringbuf_push_record(s0, "a1", 2) && ringbuf_push_record(s0, "a2", 2) &&
+               ringbuf_push_record(s0, "a3", 2));
+        assert(ringbuf_push_record(s2, "c1", 2) && ringbuf_push_record(s2, "c2--", 4));
+        assert(ringbuf_set_bytes_used(set) == 3 * 6 + 6 + 8);
+        assert(ringbuf_set_pop_record(rec, set, sizeof(rec), &shard) == 2 && shard == 0);
+        assert(memcmp(rec, "a1", 2) == 0);
+        assert(ringbuf_set_pop_record(rec, set, sizeof(rec), &shard) == 2 && shard == 2);
+        assert(memcmp(rec, "c1", 2) == 0);
+
+        /* a record that's too long is left alone, and tried first next time */
+        assert(ringbuf_set_pop_record(rec, set, 3, &shard) == 2 && shard == 0);
+        assert(ringbuf_set_pop_record(rec, set, 3, &shard) == 4 && shard == 2);
+        assert(ringbuf_set_pop_record(rec, set, sizeof(rec), &shard) == 4 && shard == 2);
+        assert(memcmp(rec, "c2--", 4) == 0);
+        assert(ringbuf_set_pop_record(rec, set, sizeof(rec), 0) == 2);
+        assert(memcmp(rec, "a3", 2) == 0);
+        assert(ringbuf_set_bytes_used(set) == 0);
+        assert(ringbuf_set_pop_record(rec, set, sizeof(rec), 0) == -1);
+        ringbuf_set_free(&set);
+        assert(set == 0);
+
+        /* batches drain one shard before moving on */
+        set = ringbuf_set_new(2, 100, RINGBUF_RECORD_PAD, RINGBUF_SET_BATCH);
+        assert(set);
+        s0 = ringbuf_set_shard(set, 0);
+        ringbuf_t s1 = ringbuf_set_shard(set, 1);
+        assert(ringbuf_push_record(s0, "a1", 2) && ringbuf_push_record(s1, "b1", 2) &&
+               ringbuf_push_record(s0, "a2", 2) && ringbuf_push_record(s1, "b2", 2));
+        size_t lens[32];
+        assert(ringbuf_set_pop_records(dst, set, 1000, lens, 3) == 3);
+        assert(memcmp(dst, "a1a2b1", 6) == 0 && lens[0] == 2 && lens[2] == 2);
+        assert(ringbuf_push_record(s0, "a3", 2));
+        assert(ringbuf_set_pop_records(dst, set, 1000, lens, 8) == 2);
+        assert(memcmp(dst, "b2a3", 4) == 0);
+        assert(ringbuf_push_record(s1, "b3", 2) && ringbuf_push_record(s1, "b4", 2));
+        assert(ringbuf_set_pop_records(dst, set, 3, lens, 8) == 1);
+        assert(ringbuf_set_pop_record(dst, set, 3, &shard) == 2 && shard == 1);
+        assert(ringbuf_set_bytes_used(set) == 0);
+        ringbuf_set_free(&set);
+
+        /* timestamps merge the shards */
+        set = ringbuf_set_new(3, 200, RINGBUF_POW2, RINGBUF_SET_TIMESTAMP);
+        assert(set);
+        static const uint64_t stamps[3][4] = {
+            { 1, 5, 9, 9 }, { 2, 3, 9, 12 }, { 4, 7, 8, 10 }
+        };
+        size_t j, k;
+        for (j = 0; j != 3; ++j) {
+            ringbuf_t sh = ringbuf_set_shard(set, j);
+            assert(sh);
+            for (k = 0; k != 4; ++k)
+                assert(ringbuf_push_record(sh, &stamps[j][k], sizeof(uint64_t)));
+        }
+        assert(ringbuf_push_record(ringbuf_set_shard(set, 1), "x", 1));
+        uint64_t last = 0, stamp;
+        for (k = 0; k != 12; ++k) {
+            assert(ringbuf_set_pop_record(&stamp, set, sizeof(stamp), &shard) == 8);
+            assert(stamp >= last);
+            last = stamp;
+        }
+        assert(ringbuf_set_pop_record(rec, set, sizeof(rec), &shard) == 1 && shard == 1);
+        ringbuf_set_free(&set);
+
+        /* producer threads, each with its own shard */
+        int order;
+        for (order = RINGBUF_SET_ROUND_ROBIN; order <= RINGBUF_SET_TIMESTAMP; ++order) {
+            set = ringbuf_set_new(SET_TEST_PRODUCERS, 4096, 0, order);
+            assert(set);
+            _Atomic uint64_t clock = 0;
+            struct set_test tests[SET_TEST_PRODUCERS];
+            pthread_t producers[SET_TEST_PRODUCERS];
+            for (j = 0; j != SET_TEST_PRODUCERS; ++j) {
+                tests[j].set = set;
+                tests[j].id = j;
+                tests[j].clock = &clock;
+                assert(pthread_create(&producers[j], 0, set_test_producer, &tests[j]) == 0);
+            }
+            uint32_t next_seq[SET_TEST_PRODUCERS] = { 0 };
+            size_t nreceived = 0;
+            struct set_test_record records[32];
+            while (nreceived != SET_TEST_PRODUCERS * SET_TEST_RECORDS) {
+                size_t n = ringbuf_set_pop_records(records, set, sizeof(records), lens, 32);
+                if (n == 0)
+                    sched_yield();
+                for (k = 0; k != n; ++k) {
+                    assert(lens[k] == sizeof(records[k]));
+                    assert(records[k].id < SET_TEST_PRODUCERS);
+                    assert(records[k].seq == next_seq[records[k].id]++);
+                }
+                nreceived += n;
+            }
+            for (j = 0; j != SET_TEST_PRODUCERS; ++j) {
+                void *result;
+                assert(pthread_join(producers[j], &result) == 0 && result == 0);
+            }
+            assert(ringbuf_set_bytes_used(set) == 0);
+
+            struct ringbuf_stats stats;
+#ifdef RINGBUF_STATS
+            assert(ringbuf_set_get_stats(set, &stats));
+            assert(stats.in_calls == SET_TEST_PRODUCERS * SET_TEST_RECORDS);
+            assert(stats.in_bytes == stats.out_bytes && stats.high_water <= 4096);
+#else
+            assert(!ringbuf_set_get_stats(set, &stats) && stats.in_calls == 0);
+#endif
+            ringbuf_set_free(&set);
+        }
+    }
+    END_TEST(test_num);
+
+    START_NEW_TEST(test_num);
+    /* streaming codecs */
+    {
+        struct doubling_codec doubler = { -1, 0 };
+        int halver = 0;
+        struct ringbuf_codec enc = { doubling_codec_process, 0, &doubler };
+        struct ringbuf_codec dec = { halving_codec_process, 0, &halver };
+        struct ringbuf_codec failing = { failing_codec_process, 0, 0 };
+        ringbuf_t csrc = ringbuf_new(1000);
+        ringbuf_t cdst = ringbuf_new(333);
+
+        /* both sides wrap, and dst fills up first, with half a pair pending */
+        assert(ringbuf_memcpy_into(cdst, buf, 300) && ringbuf_memcpy_from(dst, cdst, 300));
+        assert(ringbuf_memcpy_into(csrc, buf, 900) && ringbuf_memcpy_from(dst, csrc, 900));
+        assert(ringbuf_memcpy_into(csrc, buf, 600));
+        assert(ringbuf_codec_copy(cdst, csrc, 1000, &enc, RINGBUF_CODEC_END) == 1);
+        assert(ringbuf_is_full(cdst) && ringbuf_bytes_used(csrc) == 600 - 167);
+        size_t k, nout = 0;
+        for (k = 0; k != 333; ++k)
+            assert(((uint8_t *) ringbuf_tail(cdst))[0] == buf[k / 2] &&
+                   ringbuf_consume(cdst, 1));
+        nout = 333;
+        int result;
+        while ((result = ringbuf_codec_copy(cdst, csrc, 1000, &enc, RINGBUF_CODEC_END)) == 1) {
+            size_t n = ringbuf_bytes_used(cdst);
+            assert(ringbuf_memcpy_from(dst + nout, cdst, n));
+            nout += n;
+        }
+        assert(result == 0 && ringbuf_is_empty(csrc));
+        size_t n = ringbuf_bytes_used(cdst);
+        assert(ringbuf_memcpy_from(dst + nout, cdst, n));
+        nout += n;
+        assert(nout == 1201 && dst[1200] == '$');
+        for (k = 333; k != 1200; ++k)
+            assert(dst[k] == buf[k / 2]);
+
+        /* END only ends a stream once, and CONTINUE may leave output pending */
+        assert(ringbuf_codec_copy(cdst, csrc, 10, &enc, RINGBUF_CODEC_END) == 0);
+        assert(ringbuf_is_empty(cdst));
+        assert(ringbuf_memcpy_into(csrc, "xyz", 3));
+        assert(ringbuf_memcpy_into(cdst, buf, 328));
+        assert(ringbuf_codec_copy(cdst, csrc, 3, &enc, RINGBUF_CODEC_CONTINUE) == 0);
+        assert(ringbuf_is_full(cdst) && ringbuf_is_empty(csrc) && doubler.pending == 'z');
+        ringbuf_reset(cdst);
+        assert(ringbuf_codec_copy(cdst, csrc, 0, &enc, RINGBUF_CODEC_END) == 0);
+        assert(ringbuf_bytes_used(cdst) == 2);
+        assert(memcmp(ringbuf_tail(cdst), "z$", 2) == 0);
+
+        /* codec errors */
+        assert(ringbuf_memcpy_into(csrc, buf, 10));
+        assert(ringbuf_codec_copy(cdst, csrc, 10, &failing, RINGBUF_CODEC_CONTINUE) == -1);
+        assert(ringbuf_bytes_used(csrc) == 7);
+        ringbuf_codec_free(&failing);
+        assert(failing.state == 0);
+
+        uint8_t *data = malloc(200000);
+        uint8_t *out = malloc(200000);
+        assert(data && out);
+        for (k = 0; k != 200000; ++k)
+            data[k] = k % 7 == 0 ? spsc_test_byte(k) : 'a' + (k / 13) % 26;
+        for (k = 0; k != 200000; ++k)
+            if (data[k] == '$')
+                data[k] = '#';
+        doubler.pending = -1;
+        assert(codec_test_roundtrip(&enc, &dec, data, 200000, out));
+
+#ifdef RINGBUF_ZSTD
+        struct ringbuf_codec zenc, zdec;
+        assert(!ringbuf_codec_zstd_compress(&zenc, 1000));
+        assert(ringbuf_codec_zstd_compress(&zenc, 3) && ringbuf_codec_zstd_decompress(&zdec));
+        assert(codec_test_roundtrip(&zenc, &zdec, data, 200000, out));
+
+        /* the contexts carry on to the next frame */
+        assert(codec_test_roundtrip(&zenc, &zdec, data + 1000, 50000, out));
+        ringbuf_codec_free(&zenc);
+        ringbuf_codec_free(&zdec);
+#endif
+#ifdef RINGBUF_LZ4
+        struct ringbuf_codec lenc, ldec;
+        assert(!ringbuf_codec_lz4_compress(&lenc, 1000));
+        assert(ringbuf_codec_lz4_compress(&lenc, 0) && ringbuf_codec_lz4_decompress(&ldec));
+        assert(codec_test_roundtrip(&lenc, &ldec, data, 200000, out));
+        assert(codec_test_roundtrip(&lenc, &ldec, data + 1000, 50000, out));
+        ringbuf_codec_free(&lenc);
+        ringbuf_codec_free(&ldec);
+#endif
+        free(out);
+        free(data);
+        ringbuf_free(&cdst);
+        ringbuf_free(&csrc);
+    }
+    END_TEST(test_num);
+
     free(buf);
     free(buf2);
     free(dst);
@@ -13,335 +13,4683 @@
  * <http://creativecommons.org/publicdomain/zero/1.0/>.
  */
 
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE /* for memfd_create */
+#endif
+#if defined(RINGBUF_NDEBUG) && !defined(NDEBUG)
+#define NDEBUG /* see below */
+#endif
+
+#ifndef RINGBUF_INLINE
+#define RINGBUF_INLINE
+#endif
 #include "ringbuf.h"
 
-#include <stdint.h>
-#include <stdlib.h>
-#include <string.h>
-#include <sys/types.h>
-#include <unistd.h>
-#include <sys/param.h>
-#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <sys/param.h>
+#include <assert.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <errno.h>
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <netinet/in.h>
+#include <linux/errqueue.h>
+#include <linux/mempolicy.h>
+#include <linux/futex.h>
+#include <sys/eventfd.h>
+#else
+#include <pthread.h>
+#endif
+#include <time.h>
+#include <limits.h>
+#ifdef RINGBUF_IO_URING
+#include <linux/io_uring.h>
+#endif
+#ifdef RINGBUF_ZSTD
+#include <zstd.h>
+#endif
+#ifdef RINGBUF_LZ4
+#include <lz4frame.h>
+#endif
+#if !defined(RINGBUF_NO_SIMD) && defined(__GNUC__) && \
+    (defined(__x86_64__) || defined(__i386__))
+#define RINGBUF_SIMD_X86 1
+#include <immintrin.h>
+#elif !defined(RINGBUF_NO_SIMD) && defined(__aarch64__)
+#define RINGBUF_SIMD_NEON 1
+#include <arm_neon.h>
+#include <arm_acle.h>
+#ifdef __linux__
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+#endif
+#ifdef __APPLE__
+#include <mach/mach.h>
+#include <mach/mach_vm.h>
+#endif
+
+/*
+ * The code is written for clarity, not cleverness or performance, and
+ * contains many assert()s to enforce invariant assumptions and catch
+ * bugs. Feel free to optimize the code and to remove asserts for use
+ * in your own projects, once you're comfortable that it functions as
+ * intended. Defining RINGBUF_NDEBUG (or NDEBUG) compiles them out;
+ * the former only affects this file.
+ */
+
+/*
+ * The ring buffer structure, and the query functions that are defined
+ * inline in ringbuf.h, are always visible here. These declarations
+ * make this file provide the out-of-line definitions of the query
+ * functions, for callers that don't define RINGBUF_INLINE.
+ */
+extern size_t ringbuf_buffer_size(const struct ringbuf_t *rb);
+extern size_t ringbuf_capacity(const struct ringbuf_t *rb);
+extern size_t ringbuf_bytes_free(const struct ringbuf_t *rb);
+extern size_t ringbuf_bytes_used(const struct ringbuf_t *rb);
+extern int ringbuf_is_full(const struct ringbuf_t *rb);
+extern int ringbuf_is_empty(const struct ringbuf_t *rb);
+
+
+/*
+ * A reader of a broadcast ring buffer.
+ *
+ * A reader's tail is stored by the reader's thread, and loaded by the
+ * producer when it needs to know how much room is left, so each
+ * reader gets its own cache line.
+ */
+enum { READER_FREE, READER_JOINING, READER_ACTIVE, READER_EVICTED };
+
+struct ringbuf_reader_t
+{
+    _Alignas(RINGBUF_CACHELINE) _Atomic uint64_t tail;
+    _Atomic int state;
+    ringbuf_t rb;
+    uint64_t head_cache;
+};
+
+/*
+ * Flags used internally, which can't be passed to ringbuf_new_flags.
+ */
+#define RINGBUF_BROADCAST 0x10000
+#define RINGBUF_SINGLE_ALLOC 0x20000   /* header and buffer in one allocation */
+#define RINGBUF_CALLER_STORAGE 0x40000 /* header and buffer in caller's storage */
+#define RINGBUF_ELEMS 0x80000          /* buffer size is a whole number of elements */
+#define RINGBUF_SHARED 0x100000        /* header and buffer in a shared mapping */
+#define RINGBUF_PERSISTENT 0x200000    /* header and buffer in a mapped file */
+#define RINGBUF_INTERNAL_FLAGS \
+    (RINGBUF_BROADCAST | RINGBUF_SINGLE_ALLOC | RINGBUF_CALLER_STORAGE | RINGBUF_ELEMS | \
+     RINGBUF_SHARED | RINGBUF_PERSISTENT)
+
+/*
+ * Flags that require the internal buffer to be mapped, rather than
+ * allocated with malloc.
+ */
+#define RINGBUF_MAPPING_FLAGS (RINGBUF_HUGETLB | RINGBUF_THP | RINGBUF_PREFAULT)
+
+/*
+ * Flags under which the ring buffer never overflows.
+ */
+#define RINGBUF_NO_OVERWRITE \
+    (RINGBUF_SPSC | RINGBUF_MPMC | RINGBUF_OVERFLOW_REJECT | RINGBUF_OVERFLOW_TRUNCATE)
+
+/*
+ * Bounds and initial value of the adaptive spin budget of the
+ * blocking waits, in pause instructions.
+ */
+#define RINGBUF_SPIN_MIN 16
+#define RINGBUF_SPIN_INIT 256
+#define RINGBUF_SPIN_MAX 8192
+
+/*
+ * Set in data_waiters while the ring buffer's eventfd is armed.
+ */
+#define RINGBUF_EVENTFD_ARMED 0x80000000u
+
+/*
+ * NUMA nodes are bound with a fixed-size node mask.
+ */
+#define RINGBUF_MAX_NUMA_NODES 1024
+
+/*
+ * Round n up to a power of two. Returns 0 if the result doesn't fit
+ * in a size_t.
+ */
+static size_t
+ringbuf_round_pow2(size_t n)
+{
+    size_t pow2 = 1;
+    while (pow2 < n) {
+        if (pow2 > SIZE_MAX / 2)
+            return 0;
+        pow2 *= 2;
+    }
+    return pow2;
+}
+
+/*
+ * Allocate size bytes of memory (a multiple of the page size), mapped
+ * twice, back-to-back, so that buf[i] and buf[i + size] are the same
+ * byte. Returns 0 if the platform can't do it.
+ */
+static uint8_t *
+ringbuf_mirror_alloc(size_t size)
+{
+#ifdef __APPLE__
+    mach_vm_address_t addr = 0;
+    if (mach_vm_allocate(mach_task_self(), &addr, 2 * size, VM_FLAGS_ANYWHERE) != KERN_SUCCESS)
+        return 0;
+    mach_vm_address_t mirror = addr + size;
+    vm_prot_t cur_prot, max_prot;
+    if (mach_vm_remap(mach_task_self(), &mirror, size, 0,
+                      VM_FLAGS_FIXED | VM_FLAGS_OVERWRITE,
+                      mach_task_self(), addr, 0, &cur_prot, &max_prot,
+                      VM_INHERIT_DEFAULT) != KERN_SUCCESS) {
+        mach_vm_deallocate(mach_task_self(), addr, 2 * size);
+        return 0;
+    }
+    return (uint8_t *) addr;
+#else
+#ifdef __linux__
+    int fd = memfd_create("ringbuf", MFD_CLOEXEC);
+#else
+    char name[64];
+    snprintf(name, sizeof(name), "/ringbuf-%ld-%p", (long) getpid(), (void *) &name);
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd != -1)
+        shm_unlink(name);
+#endif
+    if (fd == -1)
+        return 0;
+    uint8_t *buf = 0;
+    if (ftruncate(fd, size) == 0) {
+
+        /* reserve the address space, then map the pages twice over it */
+        void *addr = mmap(0, 2 * size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (addr != MAP_FAILED) {
+            buf = addr;
+            if (mmap(buf, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED,
+                     fd, 0) == MAP_FAILED ||
+                mmap(buf + size, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED,
+                     fd, 0) == MAP_FAILED) {
+                munmap(addr, 2 * size);
+                buf = 0;
+            }
+        }
+    }
+    close(fd);
+    return buf;
+#endif
+}
+
+static void
+ringbuf_mirror_free(uint8_t *buf, size_t size)
+{
+#ifdef __APPLE__
+    mach_vm_deallocate(mach_task_self(), (mach_vm_address_t) buf, 2 * size);
+#else
+    munmap(buf, 2 * size);
+#endif
+}
+
+/*
+ * Returns 1 if the combination of public and internal flags is
+ * valid.
+ */
+static int
+ringbuf_valid_flags(int flags)
+{
+    if ((flags & RINGBUF_DEFER_PUBLISH) && !(flags & RINGBUF_SPSC))
+        return 0;
+    if ((flags & RINGBUF_MPMC) && (flags & RINGBUF_SPSC))
+        return 0;
+    if ((flags & RINGBUF_EVICT_LAGGING) && !(flags & RINGBUF_BROADCAST))
+        return 0;
+    if ((flags & RINGBUF_RECORD_PAD) && (flags & (RINGBUF_MPMC | RINGBUF_BROADCAST)))
+        return 0;
+    if ((flags & RINGBUF_OVERFLOW_REJECT) && (flags & RINGBUF_OVERFLOW_TRUNCATE))
+        return 0;
+    if ((flags & RINGBUF_BLOCKING) &&
+        (!(flags & (RINGBUF_SPSC | RINGBUF_MPMC)) || (flags & RINGBUF_BROADCAST)))
+        return 0;
+    return 1;
+}
+
+/*
+ * The internal buffer size of a ring buffer with the given capacity
+ * and flags, or 0 if it doesn't fit in a size_t.
+ */
+static size_t
+ringbuf_size_for(size_t capacity, int flags)
+{
+    if ((flags & RINGBUF_ELEMS) && !(flags & (RINGBUF_MIRROR | RINGBUF_POW2)))
+        return capacity;
+    if (!(flags & (RINGBUF_MIRROR | RINGBUF_POW2))) {
+
+        /* One byte is used for detecting the full condition. */
+        return capacity == SIZE_MAX ? 0 : capacity + 1;
+    }
+
+    /*
+     * Head and tail are counters, so there's no need for a
+     * sacrificial byte to tell a full buffer from an empty one; any
+     * extra bytes from rounding up to a page multiple or a power of
+     * two are usable, too.
+     */
+    size_t size = MAX(capacity, 1);
+    if (flags & RINGBUF_MIRROR) {
+        size_t pagesize = sysconf(_SC_PAGESIZE);
+        if (size > SIZE_MAX - pagesize)
+            return 0;
+        size = (size + pagesize - 1) / pagesize * pagesize;
+    }
+    if (flags & RINGBUF_POW2)
+        size = ringbuf_round_pow2(size);
+    return size;
+}
+
+/*
+ * The usable capacity of a ring buffer with an internal buffer of
+ * size bytes and the given flags.
+ */
+static size_t
+ringbuf_capacity_for(size_t size, int flags)
+{
+    return (flags & (RINGBUF_MIRROR | RINGBUF_POW2 | RINGBUF_ELEMS)) ? size : size - 1;
+}
+
+/*
+ * The ring buffer's contiguous buffer. Its address is kept relative
+ * to the ring buffer's own, so that a ring buffer in a mapping that's
+ * shared between processes (see ringbuf_shm_create) is valid at
+ * whatever address each process maps it.
+ */
+static uint8_t *
+ringbuf_buf(const struct ringbuf_t *rb)
+{
+    return (uint8_t *) ((uintptr_t) rb + rb->buf_offset);
+}
+
+/*
+ * Initialize a ring buffer header rb for the internal buffer buf of
+ * size bytes, and reset it.
+ */
+static void
+ringbuf_setup(ringbuf_t rb, uint8_t *buf, size_t size, int flags)
+{
+    rb->buf_offset = (uintptr_t) buf - (uintptr_t) rb;
+    rb->size = size;
+    rb->capacity = ringbuf_capacity_for(size, flags);
+    rb->mask = (flags & RINGBUF_POW2) ? size - 1 : 0;
+    rb->map_size = 0;
+    rb->elem_size = 1;
+    rb->max_capacity = 0;
+    rb->stream_threshold = 0;
+    atomic_init(&rb->data_seq, 0);
+    atomic_init(&rb->data_waiters, 0);
+    atomic_init(&rb->space_seq, 0);
+    atomic_init(&rb->space_waiters, 0);
+    atomic_init(&rb->data_spins, RINGBUF_SPIN_INIT);
+    atomic_init(&rb->space_spins, RINGBUF_SPIN_INIT);
+    rb->eventfd = -1;
+    rb->sync_bytes = 0;
+    rb->sync_ms = 0;
+    atomic_init(&rb->synced_head, 0);
+    atomic_init(&rb->synced_at, 0);
+#ifdef RINGBUF_STATS
+    ringbuf_reset_stats(rb);
+#endif
+    rb->flags = flags;
+    rb->readers = 0;
+    rb->max_readers = 0;
+    rb->zerocopy_senders = 0;
+#ifdef RINGBUF_IO_URING
+    rb->uring = 0;
+    rb->uring_index = 0;
+    rb->uring_inflight = 0;
+#endif
+    ringbuf_reset(rb);
+}
+
+/*
+ * The system's default huge page size.
+ */
+static size_t
+ringbuf_hugepage_size(void)
+{
+    size_t kb = 2048;
+#ifdef __linux__
+    FILE *f = fopen("/proc/meminfo", "r");
+    if (f) {
+        char line[128];
+        while (fgets(line, sizeof(line), f))
+            if (sscanf(line, "Hugepagesize: %zu kB", &kb) == 1)
+                break;
+        fclose(f);
+    }
+#endif
+    return kb * 1024;
+}
+
+/*
+ * Map an anonymous internal buffer of at least size bytes, aligned to
+ * the huge page size for RINGBUF_HUGETLB and RINGBUF_THP, and set
+ * *map_size to the length of the mapping. If populate is set, the
+ * mapping is prefaulted as it's created.
+ */
+static uint8_t *
+ringbuf_map_alloc(size_t size, int flags, int populate, size_t *map_size)
+{
+    size_t pagesize = sysconf(_SC_PAGESIZE);
+    size_t align = (flags & (RINGBUF_HUGETLB | RINGBUF_THP)) ? ringbuf_hugepage_size() : pagesize;
+    if (size > SIZE_MAX - 2 * align)
+        return 0;
+    size_t len = (size + align - 1) / align * align;
+    int mflags = MAP_PRIVATE | MAP_ANONYMOUS;
+#ifdef MAP_POPULATE
+    if (populate)
+        mflags |= MAP_POPULATE;
+#endif
+
+    if (flags & RINGBUF_HUGETLB) {
+#ifdef MAP_HUGETLB
+        /* hugetlb mappings are always aligned */
+        void *p = mmap(0, len, PROT_READ | PROT_WRITE, mflags | MAP_HUGETLB, -1, 0);
+        if (p == MAP_FAILED)
+            return 0;
+        *map_size = len;
+        return p;
+#else
+        return 0;
+#endif
+    }
+
+    /*
+     * Over-map by the alignment, and trim the excess from either
+     * end, so that transparent huge pages can back the whole buffer.
+     */
+    size_t extra = align - pagesize;
+    uint8_t *p = mmap(0, len + extra, PROT_READ | PROT_WRITE, mflags, -1, 0);
+    if (p == MAP_FAILED)
+        return 0;
+    uint8_t *aligned = (uint8_t *) (((uintptr_t) p + align - 1) & ~(uintptr_t) (align - 1));
+    if (aligned != p)
+        munmap(p, aligned - p);
+    if (aligned + len != p + len + extra)
+        munmap(aligned + len, p + len + extra - (aligned + len));
+#ifdef MADV_HUGEPAGE
+    if (flags & RINGBUF_THP)
+        madvise(aligned, len, MADV_HUGEPAGE);
+#endif
+    *map_size = len;
+    return aligned;
+}
+
+/*
+ * Bind the memory from addr to addr + len to NUMA node node. Returns
+ * 1 on success, or 0 if the node is invalid or binding isn't
+ * supported.
+ */
+static int
+ringbuf_bind_node(void *addr, size_t len, int node)
+{
+#ifdef __linux__
+    const size_t bits = 8 * sizeof(unsigned long);
+    unsigned long nodemask[RINGBUF_MAX_NUMA_NODES / (8 * sizeof(unsigned long))];
+    if (node < 0 || node >= RINGBUF_MAX_NUMA_NODES)
+        return 0;
+    memset(nodemask, 0, sizeof(nodemask));
+    nodemask[node / bits] = 1UL << (node % bits);
+
+    /* the kernel expects one more than the number of bits in the mask */
+    return syscall(__NR_mbind, addr, len, MPOL_BIND, nodemask,
+                   RINGBUF_MAX_NUMA_NODES + 1, 0) == 0;
+#else
+    return 0;
+#endif
+}
+
+/*
+ * Touch every page of the len bytes at buf, so that none of them
+ * faults later on.
+ */
+static void
+ringbuf_prefault(uint8_t *buf, size_t len)
+{
+    size_t pagesize = sysconf(_SC_PAGESIZE);
+    size_t i;
+    for (i = 0; i < len; i += pagesize)
+        ((volatile uint8_t *) buf)[i] = 0;
+}
+
+/*
+ * Allocate the internal buffer of size bytes for a ring buffer with
+ * the given flags, on NUMA node node, unless node is -1. Sets
+ * *map_size as for ringbuf_map_alloc, or to 0 if the buffer isn't an
+ * anonymous mapping.
+ */
+static uint8_t *
+ringbuf_buffer_alloc(size_t size, int flags, int node, size_t *map_size)
+{
+    *map_size = 0;
+    if (!(flags & (RINGBUF_MIRROR | RINGBUF_MAPPING_FLAGS)) && node == -1)
+        return malloc(size);
+
+    /*
+     * Pages must be bound to the node, and advised, before they're
+     * faulted in; MAP_POPULATE can only be used when neither is
+     * necessary.
+     */
+    int populate = (flags & RINGBUF_PREFAULT) && !(flags & RINGBUF_THP) && node == -1;
+    uint8_t *buf;
+    size_t len;
+    if (flags & RINGBUF_MIRROR) {
+        if (flags & RINGBUF_HUGETLB)
+            return 0;
+        buf = ringbuf_mirror_alloc(size);
+        len = size;
+        populate = 0;
+    } else {
+        buf = ringbuf_map_alloc(size, flags, populate, map_size);
+        len = *map_size;
+    }
+    if (!buf)
+        return 0;
+
+    if (node != -1 && !ringbuf_bind_node(buf, len, node)) {
+        if (flags & RINGBUF_MIRROR)
+            ringbuf_mirror_free(buf, size);
+        else
+            munmap(buf, *map_size);
+        return 0;
+    }
+    if ((flags & RINGBUF_PREFAULT) && !populate)
+        ringbuf_prefault(buf, len);
+    return buf;
+}
+
+static ringbuf_t
+ringbuf_create(size_t capacity, int flags, int node)
+{
+    if (!ringbuf_valid_flags(flags))
+        return 0;
+    size_t size = ringbuf_size_for(capacity, flags);
+    if (size == 0)
+        return 0;
+
+    ringbuf_t rb;
+    if (posix_memalign((void **) &rb, RINGBUF_CACHELINE, sizeof(struct ringbuf_t)))
+        return 0;
+
+    size_t map_size;
+    uint8_t *buf = ringbuf_buffer_alloc(size, flags, node, &map_size);
+    if (!buf) {
+        free(rb);
+        return 0;
+    }
+    ringbuf_setup(rb, buf, size, flags);
+    rb->map_size = map_size;
+    return rb;
+}
+
+/*
+ * The size of a ring buffer header, rounded up to the given power of
+ * two, so that an internal buffer following it is aligned.
+ */
+static size_t
+ringbuf_header_size(size_t alignment)
+{
+    return (sizeof(struct ringbuf_t) + alignment - 1) & ~(alignment - 1);
+}
+
+_Static_assert(RINGBUF_CACHELINE - 1 + sizeof(struct ringbuf_t) <= RINGBUF_STORAGE_OVERHEAD,
+               "RINGBUF_STORAGE_OVERHEAD is too small");
+
+ringbuf_t
+ringbuf_new_aligned(size_t capacity, int flags, size_t alignment)
+{
+    if ((flags & (RINGBUF_MIRROR | RINGBUF_MAPPING_FLAGS | RINGBUF_INTERNAL_FLAGS)) ||
+        !ringbuf_valid_flags(flags))
+        return 0;
+    if (alignment == 0 || (alignment & (alignment - 1)))
+        return 0;
+    alignment = MAX(alignment, RINGBUF_CACHELINE);
+    size_t size = ringbuf_size_for(capacity, flags);
+    size_t header_size = ringbuf_header_size(alignment);
+    if (size == 0 || size > SIZE_MAX - header_size)
+        return 0;
+
+    ringbuf_t rb;
+    if (posix_memalign((void **) &rb, alignment, header_size + size))
+        return 0;
+    ringbuf_setup(rb, (uint8_t *) rb + header_size, size, flags | RINGBUF_SINGLE_ALLOC);
+    return rb;
+}
+
+size_t
+ringbuf_storage_size(size_t capacity, int flags)
+{
+    size_t size = ringbuf_size_for(capacity, flags);
+    size_t overhead = RINGBUF_CACHELINE - 1 + ringbuf_header_size(RINGBUF_CACHELINE);
+    if (size == 0 || size > SIZE_MAX - overhead)
+        return 0;
+    return overhead + size;
+}
+
+ringbuf_t
+ringbuf_init(void *storage, size_t storage_size, size_t capacity, int flags)
+{
+    if ((flags & (RINGBUF_MIRROR | RINGBUF_MAPPING_FLAGS | RINGBUF_INTERNAL_FLAGS)) ||
+        !ringbuf_valid_flags(flags))
+        return 0;
+    size_t size = ringbuf_size_for(capacity, flags);
+    if (size == 0)
+        return 0;
+
+    /* the header must be aligned, even if storage isn't */
+    size_t padding = -(uintptr_t) storage & (RINGBUF_CACHELINE - 1);
+    size_t header_size = ringbuf_header_size(RINGBUF_CACHELINE);
+    if (storage_size < padding + header_size || storage_size - padding - header_size < size)
+        return 0;
+
+    ringbuf_t rb = (ringbuf_t) ((uint8_t *) storage + padding);
+    ringbuf_setup(rb, (uint8_t *) rb + header_size, size, flags | RINGBUF_CALLER_STORAGE);
+    return rb;
+}
+
+ringbuf_t
+ringbuf_new(size_t capacity)
+{
+    return ringbuf_new_flags(capacity, 0);
+}
+
+ringbuf_t
+ringbuf_new_flags(size_t capacity, int flags)
+{
+    if (flags & RINGBUF_INTERNAL_FLAGS)
+        return 0;
+    return ringbuf_create(capacity, flags, -1);
+}
+
+ringbuf_t
+ringbuf_new_numa(size_t capacity, int flags, int node)
+{
+    if ((flags & RINGBUF_INTERNAL_FLAGS) || node < 0)
+        return 0;
+    return ringbuf_create(capacity, flags, node);
+}
+
+ringbuf_t
+ringbuf_new_broadcast(size_t capacity, size_t max_readers, int flags)
+{
+    if ((flags & (RINGBUF_MPMC | RINGBUF_INTERNAL_FLAGS)) ||
+        max_readers > SIZE_MAX / sizeof(struct ringbuf_reader_t))
+        return 0;
+
+    /*
+     * The producer side of a broadcast ring buffer works just like an
+     * SPSC ring buffer's.
+     */
+    ringbuf_t rb = ringbuf_create(capacity, flags | RINGBUF_SPSC | RINGBUF_BROADCAST, -1);
+    if (!rb)
+        return 0;
+
+    if (posix_memalign((void **) &rb->readers, RINGBUF_CACHELINE,
+                       max_readers * sizeof(struct ringbuf_reader_t))) {
+        ringbuf_free(&rb);
+        return 0;
+    }
+    rb->max_readers = max_readers;
+    size_t i;
+    for (i = 0; i != max_readers; ++i) {
+        atomic_init(&rb->readers[i].tail, 0);
+        atomic_init(&rb->readers[i].state, READER_FREE);
+        rb->readers[i].rb = rb;
+    }
+    return rb;
+}
+
+/*
+ * Shared (and persistent) ring buffers. The mapping begins with a
+ * versioned header, which tells a process that attaches to the ring
+ * buffer where everything else is, and whether it was created by a
+ * compatible build of this file; then the ring buffer itself, on the
+ * next cache line; and then, on the next page boundary, the internal
+ * buffer (mapped twice, for a mirrored ring buffer). Nothing in the
+ * header or the ring buffer is an absolute address, so each process
+ * can map the file wherever it likes.
+ *
+ * The creator fills in the header and the ring buffer, and only then
+ * stores the magic number, so that a process that sees the magic
+ * number sees everything else, too. After that, the header never
+ * changes.
+ */
+#define RINGBUF_SHM_MAGIC 0x21667562676e6972ull /* "ringbuf!" */
+#define RINGBUF_SHM_VERSION 3
+
+struct ringbuf_shm_header
+{
+    _Atomic uint64_t magic;
+    uint32_t version;
+    uint32_t header_size; /* offset of the internal buffer from the mapping's start */
+    uint64_t ringbuf_size; /* the creator's sizeof(struct ringbuf_t) */
+    uint64_t size;         /* the internal buffer size */
+};
+
+#define RINGBUF_SHM_RB_OFFSET RINGBUF_CACHELINE
+
+_Static_assert(sizeof(struct ringbuf_shm_header) <= RINGBUF_SHM_RB_OFFSET,
+               "the shared ring buffer header is too large");
+
+/*
+ * The start of a shared ring buffer's mapping.
+ */
+static uint8_t *
+ringbuf_shm_base(const struct ringbuf_t *rb)
+{
+    return (uint8_t *) rb - RINGBUF_SHM_RB_OFFSET;
+}
+
+/*
+ * The size of the header and the ring buffer, rounded up to a page
+ * multiple.
+ */
+static size_t
+ringbuf_shm_header_size(void)
+{
+    size_t pagesize = sysconf(_SC_PAGESIZE);
+    return (RINGBUF_SHM_RB_OFFSET + sizeof(struct ringbuf_t) + pagesize - 1) / pagesize *
+           pagesize;
+}
+
+/*
+ * Returns 1 if flags, which include exactly one of RINGBUF_SHARED
+ * and RINGBUF_PERSISTENT, are valid for a mapped ring buffer. Only
+ * ring buffers that never overflow can be shared, as a producer that
+ * overwrote the consumer's data would also have to move its tail.
+ */
+static int
+ringbuf_mapped_valid_flags(int flags)
+{
+    int kind = flags & (RINGBUF_SHARED | RINGBUF_PERSISTENT);
+    flags &= ~kind;
+    if ((kind != RINGBUF_SHARED && kind != RINGBUF_PERSISTENT) ||
+        (flags & (RINGBUF_INTERNAL_FLAGS | RINGBUF_HUGETLB | RINGBUF_THP)) ||
+        !ringbuf_valid_flags(flags))
+        return 0;
+    if (kind == RINGBUF_SHARED && !(flags & (RINGBUF_SPSC | RINGBUF_MPMC)))
+        return 0;
+#ifndef __linux__
+    if (kind == RINGBUF_SHARED && (flags & RINGBUF_BLOCKING))
+        return 0;
+#endif
+    return 1;
+}
+
+/*
+ * Map the ring buffer in fd, whose internal buffer is size bytes at
+ * header_size bytes into the file, and return the start of the
+ * mapping, whose length is stored in *map_size.
+ */
+static uint8_t *
+ringbuf_shm_map(int fd, size_t header_size, size_t size, int flags, size_t *map_size)
+{
+    size_t len = header_size + size;
+    int mflags = MAP_SHARED;
+#ifdef MAP_POPULATE
+    if (flags & RINGBUF_PREFAULT)
+        mflags |= MAP_POPULATE;
+#endif
+    if (!(flags & RINGBUF_MIRROR)) {
+        void *addr = mmap(0, len, PROT_READ | PROT_WRITE, mflags, fd, 0);
+        *map_size = len;
+        return addr == MAP_FAILED ? 0 : addr;
+    }
+
+    /* reserve the address space, then map the internal buffer twice */
+    void *addr = mmap(0, len + size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (addr == MAP_FAILED)
+        return 0;
+    uint8_t *base = addr;
+    if (mmap(base, len, PROT_READ | PROT_WRITE, mflags | MAP_FIXED, fd, 0) == MAP_FAILED ||
+        mmap(base + len, size, PROT_READ | PROT_WRITE, mflags | MAP_FIXED,
+             fd, header_size) == MAP_FAILED) {
+        munmap(addr, len + size);
+        return 0;
+    }
+    *map_size = len + size;
+    return base;
+}
+
+/*
+ * Create a mapped ring buffer in the empty file fd. flags include
+ * RINGBUF_SHARED or RINGBUF_PERSISTENT.
+ */
+static ringbuf_t
+ringbuf_mapped_create(int fd, size_t capacity, int flags)
+{
+    if (!ringbuf_mapped_valid_flags(flags))
+        return 0;
+    size_t size = ringbuf_size_for(capacity, flags);
+    size_t header_size = ringbuf_shm_header_size();
+    if (size == 0 || size > (SIZE_MAX - header_size) / 2)
+        return 0;
+
+    /* don't clobber a ring buffer that someone may be using */
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size != 0 || ftruncate(fd, header_size + size) != 0)
+        return 0;
+    size_t map_size;
+    uint8_t *base = ringbuf_shm_map(fd, header_size, size, flags, &map_size);
+    if (!base)
+        return 0;
+
+    struct ringbuf_shm_header *h = (struct ringbuf_shm_header *) base;
+    h->version = RINGBUF_SHM_VERSION;
+    h->header_size = header_size;
+    h->ringbuf_size = sizeof(struct ringbuf_t);
+    h->size = size;
+    ringbuf_t rb = (ringbuf_t) (base + RINGBUF_SHM_RB_OFFSET);
+    ringbuf_setup(rb, base + header_size, size, flags);
+    rb->map_size = map_size;
+    atomic_store_explicit(&h->magic, RINGBUF_SHM_MAGIC, memory_order_release);
+    return rb;
+}
+
+/*
+ * Map the ring buffer that was created in fd with ringbuf_mapped_create
+ * and the given kind of flag (RINGBUF_SHARED or RINGBUF_PERSISTENT).
+ */
+static ringbuf_t
+ringbuf_mapped_attach(int fd, int kind)
+{
+    /* map the header and the ring buffer first, to find the rest */
+    size_t header_size = ringbuf_shm_header_size();
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (uint64_t) st.st_size < header_size)
+        return 0;
+    void *addr = mmap(0, header_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED)
+        return 0;
+    const struct ringbuf_shm_header *h = addr;
+    const struct ringbuf_t *hrb = (const struct ringbuf_t *) ((uint8_t *) addr +
+                                                                RINGBUF_SHM_RB_OFFSET);
+    int valid = atomic_load_explicit(&h->magic, memory_order_acquire) == RINGBUF_SHM_MAGIC &&
+                h->version == RINGBUF_SHM_VERSION && h->header_size == header_size &&
+                h->ringbuf_size == sizeof(struct ringbuf_t) &&
+                h->size != 0 && h->size <= (SIZE_MAX - header_size) / 2 &&
+                h->size <= (uint64_t) st.st_size - header_size &&
+                hrb->size == h->size &&
+                (hrb->flags & (RINGBUF_SHARED | RINGBUF_PERSISTENT)) == kind &&
+                ringbuf_mapped_valid_flags(hrb->flags) &&
+                hrb->buf_offset == header_size - RINGBUF_SHM_RB_OFFSET &&
+                hrb->capacity == ringbuf_capacity_for(hrb->size, hrb->flags) &&
+                hrb->mask == ((hrb->flags & RINGBUF_POW2) ? hrb->size - 1 : 0) &&
+                (hrb->size & hrb->mask) == 0 && hrb->elem_size == 1;
+    size_t size = h->size;
+    int flags = hrb->flags;
+    munmap(addr, header_size);
+    if (!valid)
+        return 0;
+
+    size_t map_size;
+    uint8_t *base = ringbuf_shm_map(fd, header_size, size, flags, &map_size);
+    if (!base)
+        return 0;
+    return (ringbuf_t) (base + RINGBUF_SHM_RB_OFFSET);
+}
+
+ringbuf_t
+ringbuf_shm_create(int fd, size_t capacity, int flags)
+{
+    if (flags & RINGBUF_INTERNAL_FLAGS)
+        return 0;
+    return ringbuf_mapped_create(fd, capacity, flags | RINGBUF_SHARED);
+}
+
+ringbuf_t
+ringbuf_shm_attach(int fd)
+{
+    return ringbuf_mapped_attach(fd, RINGBUF_SHARED);
+}
+
+ringbuf_t
+ringbuf_shm_open(const char *name, size_t capacity, int flags)
+{
+    ringbuf_t rb = 0;
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd != -1) {
+        rb = ringbuf_shm_create(fd, capacity, flags);
+        if (!rb)
+            shm_unlink(name);
+        close(fd);
+        return rb;
+    }
+    if (errno != EEXIST || (fd = shm_open(name, O_RDWR, 0)) == -1)
+        return 0;
+
+    /* give the creator up to a second to initialize the ring buffer */
+    int tries;
+    for (tries = 0; !rb && tries != 1000; ++tries)
+        if (!(rb = ringbuf_shm_attach(fd)))
+            usleep(1000);
+    close(fd);
+    if (rb && (rb->size != ringbuf_size_for(capacity, flags) ||
+               (rb->flags & ~RINGBUF_SHARED) != flags))
+        ringbuf_free(&rb);
+    return rb;
+}
+
+/*
+ * Persistent ring buffers use the same file format as shared ring
+ * buffers, in a regular file that only one process opens at a time.
+ * A process that dies leaves its writes in the page cache, which
+ * the kernel writes back to the file in its own time; the sync
+ * policy only matters if the machine itself goes down.
+ */
+
+/*
+ * The time, in milliseconds, according to a clock that's cheap to
+ * read on every publish.
+ */
+static uint64_t
+ringbuf_file_clock(void)
+{
+    struct timespec ts;
+#ifdef CLOCK_MONOTONIC_COARSE
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+#else
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+#endif
+    return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/*
+ * Put a ring buffer that was recovered from its file back into a
+ * consistent state. Bytes that were claimed or copied but not
+ * published when the previous process died are lost, and the state
+ * that only made sense in that process is cleared.
+ */
+static void
+ringbuf_file_recover(ringbuf_t rb)
+{
+    uint64_t head = atomic_load_explicit(&rb->head, memory_order_relaxed);
+    uint64_t tail = atomic_load_explicit(&rb->tail, memory_order_relaxed);
+
+    /* the process may have died between overwriting and moving the tail */
+    if (tail > head)
+        tail = head;
+    if (head - tail > ringbuf_capacity(rb))
+        tail = head - ringbuf_capacity(rb);
+    atomic_store_explicit(&rb->head_pending, head, memory_order_relaxed);
+    atomic_store_explicit(&rb->tail, tail, memory_order_relaxed);
+    atomic_store_explicit(&rb->tail_pending, tail, memory_order_relaxed);
+    rb->tail_cache = tail;
+    rb->head_cache = head;
+    rb->reserved = 0;
+    rb->max_capacity = 0;
+    rb->stream_threshold = 0;
+    atomic_store_explicit(&rb->data_waiters, 0, memory_order_relaxed);
+    atomic_store_explicit(&rb->space_waiters, 0, memory_order_relaxed);
+    rb->eventfd = -1;
+    rb->zerocopy_senders = 0;
+#ifdef RINGBUF_IO_URING
+    rb->uring = 0;
+    rb->uring_index = 0;
+    rb->uring_inflight = 0;
+#endif
+    rb->sync_bytes = 0;
+    rb->sync_ms = 0;
+    atomic_store_explicit(&rb->synced_head, head, memory_order_relaxed);
+    atomic_store_explicit(&rb->synced_at, ringbuf_file_clock(), memory_order_relaxed);
+}
+
+/*
+ * Is the file a ring buffer with the given capacity and flags whose
+ * creator died before initializing it? If so, it's exactly the size
+ * of such a ring buffer, and its header is still all zeros. Anything
+ * else may be someone's data, and must be left alone.
+ */
+static int
+ringbuf_file_incomplete(int fd, off_t file_size, size_t capacity, int flags)
+{
+    size_t size = ringbuf_size_for(capacity, flags | RINGBUF_PERSISTENT);
+    size_t header_size = ringbuf_shm_header_size();
+    if (size == 0 || size > (SIZE_MAX - header_size) / 2 ||
+        (uint64_t) file_size != header_size + size)
+        return 0;
+
+    uint8_t *header = malloc(header_size);
+    if (!header)
+        return 0;
+    size_t i = 0;
+    if (pread(fd, header, header_size, 0) == (ssize_t) header_size)
+        while (i != header_size && header[i] == 0)
+            ++i;
+    free(header);
+    return i == header_size;
+}
+
+ringbuf_t
+ringbuf_file_open(const char *path, size_t capacity, int flags)
+{
+    if (flags & RINGBUF_INTERNAL_FLAGS)
+        return 0;
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd == -1)
+        return 0;
+
+    /*
+     * Hold a lock until the file is initialized, so that a process
+     * that opens it at the same time as its creator doesn't see it
+     * half-initialized. Closing fd releases the lock.
+     */
+    int locked;
+    while ((locked = flock(fd, LOCK_EX)) == -1 && errno == EINTR)
+        ;
+    struct stat st;
+    if (locked == -1 || fstat(fd, &st) != 0) {
+        close(fd);
+        return 0;
+    }
+
+    ringbuf_t rb = 0;
+    if (st.st_size != 0 && ringbuf_file_incomplete(fd, st.st_size, capacity, flags) &&
+        ftruncate(fd, 0) == 0)
+        st.st_size = 0;
+    if (st.st_size == 0) {
+        rb = ringbuf_mapped_create(fd, capacity, flags | RINGBUF_PERSISTENT);
+        if (rb)
+            atomic_store_explicit(&rb->synced_at, ringbuf_file_clock(), memory_order_relaxed);
+    } else if ((rb = ringbuf_mapped_attach(fd, RINGBUF_PERSISTENT)) != 0) {
+        if (rb->size != ringbuf_size_for(capacity, flags) ||
+            (rb->flags & ~RINGBUF_PERSISTENT) != flags)
+            ringbuf_free(&rb);
+        else
+            ringbuf_file_recover(rb);
+    }
+    close(fd);
+    return rb;
+}
+
+int
+ringbuf_file_set_sync(ringbuf_t rb, size_t bytes, unsigned ms)
+{
+    if (!(rb->flags & RINGBUF_PERSISTENT))
+        return 0;
+    rb->sync_bytes = bytes;
+    rb->sync_ms = ms;
+    return 1;
+}
+
+int
+ringbuf_file_sync(ringbuf_t rb)
+{
+    if (!(rb->flags & RINGBUF_PERSISTENT))
+        return 0;
+    uint8_t *base = ringbuf_shm_base(rb);
+    size_t header_size = ((struct ringbuf_shm_header *) base)->header_size;
+    uint64_t head = atomic_load_explicit(&rb->head, memory_order_acquire);
+
+    /* the data first, so that the counters never cover stale bytes */
+    int ok = msync(base + header_size, ringbuf_buffer_size(rb), MS_SYNC) == 0 &&
+             msync(base, header_size, MS_SYNC) == 0;
+    atomic_store_explicit(&rb->synced_head, head, memory_order_relaxed);
+    atomic_store_explicit(&rb->synced_at, ringbuf_file_clock(), memory_order_relaxed);
+    return ok;
+}
+
+/*
+ * Called after publishing up to head in a persistent ring buffer:
+ * sync the file if the sync policy says it's time. When several MPMC
+ * producers find that it is, only the one that advances synced_head
+ * syncs.
+ */
+static void
+ringbuf_file_published(ringbuf_t rb, uint64_t head)
+{
+    uint64_t synced = atomic_load_explicit(&rb->synced_head, memory_order_relaxed);
+    int due = rb->sync_bytes && head - synced >= rb->sync_bytes;
+    if (!due && rb->sync_ms && head != synced)
+        due = ringbuf_file_clock() - atomic_load_explicit(&rb->synced_at, memory_order_relaxed) >=
+              rb->sync_ms;
+    if (due && atomic_compare_exchange_strong_explicit(&rb->synced_head, &synced, head,
+                                                       memory_order_relaxed,
+                                                       memory_order_relaxed))
+        ringbuf_file_sync(rb);
+}
+
+void
+ringbuf_reset(ringbuf_t rb)
+{
+    atomic_store_explicit(&rb->head, 0, memory_order_release);
+    atomic_store_explicit(&rb->head_pending, 0, memory_order_relaxed);
+    atomic_store_explicit(&rb->tail, 0, memory_order_release);
+    atomic_store_explicit(&rb->tail_pending, 0, memory_order_relaxed);
+    rb->tail_cache = rb->head_cache = 0;
+    rb->reserved = 0;
+
+    size_t i;
+    for (i = 0; i != rb->max_readers; ++i) {
+        atomic_store_explicit(&rb->readers[i].tail, 0, memory_order_relaxed);
+        rb->readers[i].head_cache = 0;
+    }
+}
+
+void
+ringbuf_free(ringbuf_t *rb)
+{
+    assert(rb && *rb);
+    free((*rb)->readers);
+    if ((*rb)->eventfd != -1)
+        close((*rb)->eventfd);
+    if ((*rb)->flags & RINGBUF_CALLER_STORAGE) {
+        *rb = 0;
+        return;
+    }
+    if (((*rb)->flags & RINGBUF_PERSISTENT) && ((*rb)->sync_bytes || (*rb)->sync_ms))
+        ringbuf_file_sync(*rb);
+    if ((*rb)->flags & (RINGBUF_SHARED | RINGBUF_PERSISTENT)) {
+        size_t map_size = (*rb)->map_size;
+        munmap(ringbuf_shm_base(*rb), map_size);
+        *rb = 0;
+        return;
+    }
+    if ((*rb)->flags & RINGBUF_MIRROR)
+        ringbuf_mirror_free(ringbuf_buf(*rb), (*rb)->size);
+    else if ((*rb)->map_size)
+        munmap(ringbuf_buf(*rb), (*rb)->map_size);
+    else if (!((*rb)->flags & RINGBUF_SINGLE_ALLOC))
+        free(ringbuf_buf(*rb));
+    free(*rb);
+    *rb = 0;
+}
+
+/*
+ * Return a pointer to one-past-the-end of the ring buffer's
+ * contiguous buffer. You shouldn't normally need to use this function
+ * unless you're writing a new ringbuf_* function.
+ *
+ * For mirrored ring buffers, this is the end of the mirror, so that
+ * any region of up to ringbuf_buffer_size bytes that starts inside
+ * the buffer also ends before ringbuf_end, and the loops that copy
+ * data into or out of the buffer never need to wrap. Pointers into
+ * the mirror should be wrapped before they're returned to a caller
+ * (see ringbuf_ptr).
+ */
+static const uint8_t *
+ringbuf_end(const struct ringbuf_t *rb)
+{
+    if (rb->flags & RINGBUF_MIRROR)
+        return ringbuf_buf(rb) + 2 * ringbuf_buffer_size(rb);
+    return ringbuf_buf(rb) + ringbuf_buffer_size(rb);
+}
+
+static uint64_t
+ringbuf_load_head(const struct ringbuf_t *rb)
+{
+    return atomic_load_explicit(&rb->head, memory_order_acquire);
+}
+
+static uint64_t
+ringbuf_load_tail(const struct ringbuf_t *rb)
+{
+    return atomic_load_explicit(&rb->tail, memory_order_acquire);
+}
+
+static uint64_t
+ringbuf_load_head_pending(const struct ringbuf_t *rb)
+{
+    return atomic_load_explicit(&rb->head_pending, memory_order_relaxed);
+}
+
+/*
+ * Given a ring buffer rb and a head or tail counter, return a pointer
+ * to the counter's location within the contiguous buffer.
+ */
+static uint8_t *
+ringbuf_ptr(const struct ringbuf_t *rb, uint64_t counter)
+{
+    if (rb->flags & RINGBUF_POW2)
+        return ringbuf_buf(rb) + (counter & rb->mask);
+    return ringbuf_buf(rb) + (counter % ringbuf_buffer_size(rb));
+}
+
+/*
+ * Statistics (see ringbuf_get_stats) are only kept when this file is
+ * compiled with RINGBUF_STATS; otherwise, the RINGBUF_STAT macros
+ * compile to nothing, and their arguments aren't evaluated.
+ */
+#ifdef RINGBUF_STATS
+static void
+ringbuf_stat_add(const struct ringbuf_t *rb, _Atomic uint64_t *stat, uint64_t n)
+{
+    /* each side's counters have a single writer, except in MPMC mode */
+    if (rb->flags & RINGBUF_MPMC)
+        atomic_fetch_add_explicit(stat, n, memory_order_relaxed);
+    else
+        atomic_store_explicit(stat, atomic_load_explicit(stat, memory_order_relaxed) + n,
+                              memory_order_relaxed);
+}
+
+/*
+ * Account for the bytes from counter from to counter to, which have
+ * just been added (or, for ringbuf_stat_out, removed).
+ */
+static void
+ringbuf_stat_in(ringbuf_t rb, uint64_t from, uint64_t to)
+{
+    if (to == from)
+        return;
+    ringbuf_stat_add(rb, &rb->stat_in_calls, 1);
+    ringbuf_stat_add(rb, &rb->stat_in_bytes, to - from);
+    if ((uint64_t) (ringbuf_ptr(rb, from) - ringbuf_buf(rb)) + (to - from) > ringbuf_buffer_size(rb))
+        ringbuf_stat_add(rb, &rb->stat_in_wraps, 1);
+
+    uint64_t used = MIN(to - ringbuf_load_tail(rb), ringbuf_capacity(rb));
+    uint64_t high = atomic_load_explicit(&rb->stat_high_water, memory_order_relaxed);
+    while (used > high &&
+           !atomic_compare_exchange_weak_explicit(&rb->stat_high_water, &high, used,
+                                                  memory_order_relaxed, memory_order_relaxed))
+        ;
+}
+
+static void
+ringbuf_stat_out(ringbuf_t rb, uint64_t from, uint64_t to)
+{
+    if (to == from)
+        return;
+    ringbuf_stat_add(rb, &rb->stat_out_calls, 1);
+    ringbuf_stat_add(rb, &rb->stat_out_bytes, to - from);
+    if ((uint64_t) (ringbuf_ptr(rb, from) - ringbuf_buf(rb)) + (to - from) > ringbuf_buffer_size(rb))
+        ringbuf_stat_add(rb, &rb->stat_out_wraps, 1);
+}
+
+#define RINGBUF_STAT(rb, name, n) ringbuf_stat_add((rb), &(rb)->stat_##name, (n))
+#define RINGBUF_STAT_IN(rb, from, to) ringbuf_stat_in((rb), (from), (to))
+#define RINGBUF_STAT_OUT(rb, from, to) ringbuf_stat_out((rb), (from), (to))
+#else
+#define RINGBUF_STAT(rb, name, n) ((void) 0)
+#define RINGBUF_STAT_IN(rb, from, to) ((void) 0)
+#define RINGBUF_STAT_OUT(rb, from, to) ((void) 0)
+#endif
+
+/*
+ * A producer-side (or consumer-side) call that asked for count bytes
+ * and got n: short if 0 <= n < count.
+ */
+#define RINGBUF_STAT_SHORT(rb, side, n, count) \
+    ((ssize_t) (n) >= 0 && (size_t) (n) < (count) ? RINGBUF_STAT(rb, side##_short, 1) : (void) 0)
+
+int
+ringbuf_get_stats(const struct ringbuf_t *rb, struct ringbuf_stats *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+#ifdef RINGBUF_STATS
+    stats->in_bytes = atomic_load_explicit(&rb->stat_in_bytes, memory_order_relaxed);
+    stats->in_calls = atomic_load_explicit(&rb->stat_in_calls, memory_order_relaxed);
+    stats->in_short = atomic_load_explicit(&rb->stat_in_short, memory_order_relaxed);
+    stats->in_rejected = atomic_load_explicit(&rb->stat_in_rejected, memory_order_relaxed);
+    stats->in_wraps = atomic_load_explicit(&rb->stat_in_wraps, memory_order_relaxed);
+    stats->overflows = atomic_load_explicit(&rb->stat_overflows, memory_order_relaxed);
+    stats->overwritten = atomic_load_explicit(&rb->stat_overwritten, memory_order_relaxed);
+    stats->high_water = atomic_load_explicit(&rb->stat_high_water, memory_order_relaxed);
+    stats->out_bytes = atomic_load_explicit(&rb->stat_out_bytes, memory_order_relaxed);
+    stats->out_calls = atomic_load_explicit(&rb->stat_out_calls, memory_order_relaxed);
+    stats->out_short = atomic_load_explicit(&rb->stat_out_short, memory_order_relaxed);
+    stats->out_rejected = atomic_load_explicit(&rb->stat_out_rejected, memory_order_relaxed);
+    stats->out_wraps = atomic_load_explicit(&rb->stat_out_wraps, memory_order_relaxed);
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+void
+ringbuf_reset_stats(ringbuf_t rb)
+{
+#ifdef RINGBUF_STATS
+    atomic_store_explicit(&rb->stat_in_bytes, 0, memory_order_relaxed);
+    atomic_store_explicit(&rb->stat_in_calls, 0, memory_order_relaxed);
+    atomic_store_explicit(&rb->stat_in_short, 0, memory_order_relaxed);
+    atomic_store_explicit(&rb->stat_in_rejected, 0, memory_order_relaxed);
+    atomic_store_explicit(&rb->stat_in_wraps, 0, memory_order_relaxed);
+    atomic_store_explicit(&rb->stat_overflows, 0, memory_order_relaxed);
+    atomic_store_explicit(&rb->stat_overwritten, 0, memory_order_relaxed);
+    atomic_store_explicit(&rb->stat_high_water, 0, memory_order_relaxed);
+    atomic_store_explicit(&rb->stat_out_bytes, 0, memory_order_relaxed);
+    atomic_store_explicit(&rb->stat_out_calls, 0, memory_order_relaxed);
+    atomic_store_explicit(&rb->stat_out_short, 0, memory_order_relaxed);
+    atomic_store_explicit(&rb->stat_out_rejected, 0, memory_order_relaxed);
+    atomic_store_explicit(&rb->stat_out_wraps, 0, memory_order_relaxed);
+#else
+    (void) rb;
+#endif
+}
+
+/*
+ * Blocking waits (see RINGBUF_BLOCKING). A thread that waits for
+ * data (or space) registers itself in data_waiters (or
+ * space_waiters), checks again, and only then parks on data_seq (or
+ * space_seq). A thread that publishes data (or space) checks for
+ * registered waiters, and only if there are any does it bump the
+ * sequence word and wake them. The seq_cst fences on both sides
+ * guarantee that either the waiter sees the new counter, or the
+ * publisher sees the waiter; and a waiter whose sequence word has
+ * been bumped since it read it doesn't park at all.
+ *
+ * Threads are parked on a futex on Linux (a process-shared one, for
+ * ring buffers in shared memory), and elsewhere on a single condition
+ * variable that's shared by all ring buffers, which is only used once
+ * a waiter has given up spinning. The condition variable can't wake
+ * another process, so blocking shared ring buffers are Linux only.
+ */
+#ifndef __linux__
+static pthread_mutex_t ringbuf_park_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ringbuf_park_cond = PTHREAD_COND_INITIALIZER;
+#endif
+
+/*
+ * Set *left to the time from now until the CLOCK_MONOTONIC
+ * deadline. Returns 0 if the deadline has passed.
+ */
+static int
+ringbuf_time_left(const struct timespec *deadline, struct timespec *left)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    left->tv_sec = deadline->tv_sec - now.tv_sec;
+    left->tv_nsec = deadline->tv_nsec - now.tv_nsec;
+    if (left->tv_nsec < 0) {
+        left->tv_nsec += 1000000000;
+        --left->tv_sec;
+    }
+    return left->tv_sec >= 0;
+}
+
+#ifdef __linux__
+static int
+ringbuf_futex_op(const struct ringbuf_t *rb, int op)
+{
+    /* futexes in a mapping that's shared between processes can't be private */
+    return (rb->flags & RINGBUF_SHARED) ? op : op | FUTEX_PRIVATE_FLAG;
+}
+#endif
+
+/*
+ * Park the calling thread until *seq is no longer val, the deadline
+ * (if any) passes, or a spurious wakeup. Returns 0 if the deadline
+ * has passed.
+ */
+static int
+ringbuf_park(const struct ringbuf_t *rb, _Atomic uint32_t *seq, uint32_t val,
+             const struct timespec *deadline)
+{
+    struct timespec left;
+    if (deadline && !ringbuf_time_left(deadline, &left))
+        return 0;
+#ifdef __linux__
+    if (syscall(SYS_futex, (uint32_t *) seq, ringbuf_futex_op(rb, FUTEX_WAIT), val,
+                deadline ? &left : 0, 0, 0) == -1 && errno == ETIMEDOUT)
+        return 0;
+    return 1;
+#else
+    struct timespec abstime;
+    int r = 0;
+    if (deadline) {
+        clock_gettime(CLOCK_REALTIME, &abstime);
+        abstime.tv_sec += left.tv_sec;
+        abstime.tv_nsec += left.tv_nsec;
+        if (abstime.tv_nsec >= 1000000000) {
+            abstime.tv_nsec -= 1000000000;
+            ++abstime.tv_sec;
+        }
+    }
+    pthread_mutex_lock(&ringbuf_park_mutex);
+    while (atomic_load_explicit(seq, memory_order_relaxed) == val && r == 0)
+        r = deadline ? pthread_cond_timedwait(&ringbuf_park_cond, &ringbuf_park_mutex, &abstime)
+                     : pthread_cond_wait(&ringbuf_park_cond, &ringbuf_park_mutex);
+    pthread_mutex_unlock(&ringbuf_park_mutex);
+    return r != ETIMEDOUT;
+#endif
+}
+
+/*
+ * Wake all of the threads parked on seq.
+ */
+static void
+ringbuf_unpark(const struct ringbuf_t *rb, _Atomic uint32_t *seq)
+{
+#ifdef __linux__
+    syscall(SYS_futex, (uint32_t *) seq, ringbuf_futex_op(rb, FUTEX_WAKE), INT_MAX, 0, 0, 0);
+#else
+    pthread_mutex_lock(&ringbuf_park_mutex);
+    pthread_cond_broadcast(&ringbuf_park_cond);
+    pthread_mutex_unlock(&ringbuf_park_mutex);
+#endif
+}
+
+/*
+ * Called after publishing data (or space): wake the registered
+ * waiters, if any, and signal the eventfd, if it's armed.
+ */
+static void
+ringbuf_wake(ringbuf_t rb, _Atomic uint32_t *waiters, _Atomic uint32_t *seq)
+{
+    atomic_thread_fence(memory_order_seq_cst);
+    uint32_t w = atomic_load_explicit(waiters, memory_order_relaxed);
+    if (w == 0)
+        return;
+    if ((w & RINGBUF_EVENTFD_ARMED) &&
+        (atomic_fetch_and_explicit(waiters, ~RINGBUF_EVENTFD_ARMED, memory_order_relaxed) &
+         RINGBUF_EVENTFD_ARMED)) {
+        uint64_t one = 1;
+        ssize_t n = write(rb->eventfd, &one, sizeof(one));
+        (void) n;
+    }
+    if (w & ~RINGBUF_EVENTFD_ARMED) {
+        atomic_fetch_add_explicit(seq, 1, memory_order_release);
+        ringbuf_unpark(rb, seq);
+    }
+}
+
+static void
+ringbuf_store_head(ringbuf_t rb, uint64_t head)
+{
+    atomic_store_explicit(&rb->head, head, memory_order_release);
+    if (rb->flags & RINGBUF_BLOCKING)
+        ringbuf_wake(rb, &rb->data_waiters, &rb->data_seq);
+    if (rb->flags & RINGBUF_PERSISTENT)
+        ringbuf_file_published(rb, head);
+}
+
+static void
+ringbuf_store_tail(ringbuf_t rb, uint64_t tail)
+{
+    RINGBUF_STAT_OUT(rb, atomic_load_explicit(&rb->tail, memory_order_relaxed), tail);
+    atomic_store_explicit(&rb->tail, tail, memory_order_release);
+    if (rb->flags & RINGBUF_BLOCKING)
+        ringbuf_wake(rb, &rb->space_waiters, &rb->space_seq);
+}
+
+/*
+ * Describe the count bytes of rb that start at the given head or
+ * tail counter with one or two iovecs, splitting the region at the
+ * end of the contiguous buffer if necessary. Returns the number of
+ * iovecs needed.
+ */
+static int
+ringbuf_region(const struct ringbuf_t *rb, uint64_t counter, size_t count,
+               struct iovec iov[2])
+{
+    uint8_t *p = ringbuf_ptr(rb, counter);
+    size_t n = MIN(ringbuf_end(rb) - p, count);
+    iov[0].iov_base = p;
+    iov[0].iov_len = n;
+    iov[1].iov_base = ringbuf_buf(rb);
+    iov[1].iov_len = count - n;
+    return iov[1].iov_len ? 2 : 1;
+}
+
+/*
+ * Tell the CPU that we're spinning.
+ */
+static void
+ringbuf_pause(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+/*
+ * Called repeatedly while waiting for another thread to make
+ * progress: spin briefly, then start yielding the CPU, in case the
+ * thread we're waiting for has been preempted.
+ */
+static void
+ringbuf_relax(unsigned *spins)
+{
+    if (++*spins < 64)
+        ringbuf_pause();
+    else
+        sched_yield();
+}
+
+/*
+ * Find the tail of the slowest active reader of a broadcast ring
+ * buffer, and store it as the ring buffer's tail. If there are no
+ * active readers, the ring buffer is empty.
+ *
+ * If the ring buffer evicts lagging readers, any reader whose tail is
+ * behind min_tail is evicted first.
+ */
+static uint64_t
+ringbuf_readers_tail(ringbuf_t rb, uint64_t min_tail)
+{
+    int evict = (rb->flags & RINGBUF_EVICT_LAGGING) != 0;
+    uint64_t tail = ringbuf_load_head(rb);
+
+    /*
+     * Pairs with the fence in ringbuf_reader_new: either we see a
+     * joining reader's slot, or it sees the head we just loaded.
+     */
+    atomic_thread_fence(memory_order_seq_cst);
+    size_t i;
+    for (i = 0; i != rb->max_readers; ++i) {
+        struct ringbuf_reader_t *r = &rb->readers[i];
+        int state = atomic_load_explicit(&r->state, memory_order_acquire);
+
+        /* a joining reader's tail isn't set yet, but it will be soon */
+        unsigned spins = 0;
+        while (state == READER_JOINING) {
+            ringbuf_relax(&spins);
+            state = atomic_load_explicit(&r->state, memory_order_acquire);
+        }
+        if (state != READER_ACTIVE)
+            continue;
+        uint64_t rtail = atomic_load_explicit(&r->tail, memory_order_acquire);
+        if (evict && rtail < min_tail) {
+            int active = READER_ACTIVE;
+            if (atomic_compare_exchange_strong(&r->state, &active, READER_EVICTED))
+                continue;
+        }
+        tail = MIN(tail, rtail);
+    }
+
+    /*
+     * Make sure that any evictions are visible before we start
+     * overwriting the evicted readers' bytes; ringbuf_reader_memcpy_from
+     * relies on this.
+     */
+    atomic_thread_fence(memory_order_release);
+    ringbuf_store_tail(rb, tail);
+    return tail;
+}
+
+/*
+ * The number of free bytes in the ring buffer, as seen by the
+ * producer. The consumer's tail is only reloaded if the cached copy
+ * says there are fewer than count bytes free.
+ */
+static size_t
+ringbuf_producer_free(ringbuf_t rb, size_t count)
+{
+    uint64_t head = ringbuf_load_head_pending(rb);
+    size_t nfree = ringbuf_capacity(rb) - (head - rb->tail_cache);
+    if (nfree < count) {
+        if (rb->flags & RINGBUF_BROADCAST) {
+            /* the tail we'd need to make room for count bytes */
+            uint64_t min_tail = count > ringbuf_capacity(rb) ?
+                0 : head + count - ringbuf_capacity(rb);
+            rb->tail_cache = ringbuf_readers_tail(rb, min_tail);
+        } else
+            rb->tail_cache = ringbuf_load_tail(rb);
+        nfree = ringbuf_capacity(rb) - (head - rb->tail_cache);
+    }
+    return nfree;
+}
+
+/*
+ * The number of bytes used in the ring buffer, as seen by the
+ * consumer. The producer's head is only reloaded if the cached copy
+ * says there are fewer than count bytes used.
+ */
+static size_t
+ringbuf_consumer_used(ringbuf_t rb, size_t count)
+{
+    /* broadcast ring buffers are consumed via their readers */
+    assert(!(rb->flags & RINGBUF_BROADCAST));
+    uint64_t tail = ringbuf_load_tail(rb);
+    size_t nused = rb->head_cache - tail;
+    if (nused < count) {
+        rb->head_cache = ringbuf_load_head(rb);
+        nused = rb->head_cache - tail;
+    }
+    return nused;
+}
+
+/*
+ * Advance the producer's head to the given value, and publish it
+ * unless the ring buffer defers publishing to ringbuf_publish.
+ */
+static void
+ringbuf_produce(ringbuf_t rb, uint64_t head)
+{
+    RINGBUF_STAT_IN(rb, atomic_load_explicit(&rb->head_pending, memory_order_relaxed), head);
+    atomic_store_explicit(&rb->head_pending, head, memory_order_relaxed);
+    if (!(rb->flags & RINGBUF_DEFER_PUBLISH))
+        ringbuf_store_head(rb, head);
+}
+
+/*
+ * Fix up the tail after the producer has overflowed the ring buffer
+ * (which is only possible when it's not in SPSC mode): the oldest
+ * bytes have been overwritten, and the buffer is now full.
+ */
+static void
+ringbuf_overflow(ringbuf_t rb)
+{
+    assert(!(rb->flags & RINGBUF_NO_OVERWRITE));
+
+    /*
+     * The new tail may be beyond the consumer's cached head, so
+     * refresh that, too. (No other thread can be using a non-SPSC
+     * ring buffer.)
+     */
+    rb->head_cache = ringbuf_load_head(rb);
+    rb->tail_cache = rb->head_cache - ringbuf_capacity(rb);
+    RINGBUF_STAT(rb, overflows, 1);
+    RINGBUF_STAT(rb, overwritten, rb->tail_cache - ringbuf_load_tail(rb));
+
+    /*
+     * This isn't the consumer's doing, so it's not a consumer-side
+     * store, and there are no waiters to wake (see RINGBUF_BLOCKING).
+     */
+    atomic_store_explicit(&rb->tail, rb->tail_cache, memory_order_release);
+    assert(ringbuf_is_full(rb));
+}
+
+/*
+ * Wait until ready(rb) is at least count: spin for up to the spin
+ * budget *spins, then park. The budget adapts to how long waits take:
+ * it doubles each time spinning pays off, and halves each time the
+ * waiter has to park anyway.
+ */
+static int
+ringbuf_wait(ringbuf_t rb, size_t count, int timeout_ms,
+             size_t (*ready)(const struct ringbuf_t *),
+             _Atomic uint32_t *waiters, _Atomic uint32_t *seq, _Atomic unsigned *spins)
+{
+    assert(rb->flags & RINGBUF_BLOCKING);
+    if (!(rb->flags & RINGBUF_BLOCKING) || count > ringbuf_capacity(rb))
+        return 0;
+    if (ready(rb) >= count)
+        return 1;
+
+    unsigned budget = atomic_load_explicit(spins, memory_order_relaxed);
+    unsigned i;
+    for (i = 0; i != budget; ++i) {
+        ringbuf_pause();
+        if (ready(rb) >= count) {
+            if (budget < RINGBUF_SPIN_MAX)
+                atomic_store_explicit(spins, budget * 2, memory_order_relaxed);
+            return 1;
+        }
+    }
+    if (budget > RINGBUF_SPIN_MIN)
+        atomic_store_explicit(spins, budget / 2, memory_order_relaxed);
+    if (timeout_ms == 0)
+        return 0;
+
+    struct timespec deadline;
+    if (timeout_ms > 0) {
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += timeout_ms / 1000;
+        deadline.tv_nsec += (timeout_ms % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000) {
+            deadline.tv_nsec -= 1000000000;
+            ++deadline.tv_sec;
+        }
+    }
+    for (;;) {
+        uint32_t val = atomic_load_explicit(seq, memory_order_acquire);
+        atomic_fetch_add_explicit(waiters, 1, memory_order_relaxed);
+        atomic_thread_fence(memory_order_seq_cst);
+        int woken = ready(rb) >= count ||
+                    ringbuf_park(rb, seq, val, timeout_ms > 0 ? &deadline : 0);
+        atomic_fetch_sub_explicit(waiters, 1, memory_order_relaxed);
+        if (ready(rb) >= count)
+            return 1;
+        if (!woken)
+            return 0;
+    }
+}
+
+int
+ringbuf_wait_used(ringbuf_t rb, size_t count, int timeout_ms)
+{
+    return ringbuf_wait(rb, count, timeout_ms, ringbuf_bytes_used,
+                        &rb->data_waiters, &rb->data_seq, &rb->data_spins);
+}
+
+int
+ringbuf_wait_free(ringbuf_t rb, size_t count, int timeout_ms)
+{
+    return ringbuf_wait(rb, count, timeout_ms, ringbuf_bytes_free,
+                        &rb->space_waiters, &rb->space_seq, &rb->space_spins);
+}
+
+int
+ringbuf_eventfd(ringbuf_t rb)
+{
+#ifdef __linux__
+    /* (a shared ring buffer's eventfd would only be valid in one process) */
+    if (!(rb->flags & RINGBUF_BLOCKING) || (rb->flags & RINGBUF_SHARED))
+        return -1;
+    if (rb->eventfd == -1) {
+        rb->eventfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (rb->eventfd == -1)
+            return -1;
+        ringbuf_eventfd_rearm(rb);
+    }
+    return rb->eventfd;
+#else
+    return -1;
+#endif
+}
+
+size_t
+ringbuf_eventfd_rearm(ringbuf_t rb)
+{
+    assert(rb->eventfd != -1);
+    uint64_t n;
+    ssize_t r = read(rb->eventfd, &n, sizeof(n));
+    (void) r;
+
+    /*
+     * Arm the eventfd, as a waiter registers itself, and then check
+     * for data that a producer published before it could see the
+     * armed eventfd.
+     */
+    atomic_fetch_or_explicit(&rb->data_waiters, RINGBUF_EVENTFD_ARMED, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    size_t used = ringbuf_bytes_used(rb);
+    if (used && (atomic_fetch_and_explicit(&rb->data_waiters, ~RINGBUF_EVENTFD_ARMED,
+                                           memory_order_relaxed) & RINGBUF_EVENTFD_ARMED)) {
+        n = 1;
+        r = write(rb->eventfd, &n, sizeof(n));
+    }
+    return used;
+}
+
+/*
+ * Claim count bytes for the producer, beginning at *head. *overflow
+ * is set to nonzero if writing them will overflow the ring
+ * buffer. Returns 0, and claims nothing, if the ring buffer would
+ * overflow but isn't allowed to (SPSC and MPMC modes).
+ */
+static int
+ringbuf_producer_claim(ringbuf_t rb, size_t count, uint64_t *head, int *overflow)
+{
+    if (rb->flags & RINGBUF_MPMC) {
+        uint64_t h = atomic_load_explicit(&rb->head_pending, memory_order_relaxed);
+        do {
+            uint64_t tail = ringbuf_load_tail(rb);
+            if (count > ringbuf_capacity(rb) - (h - tail))
+                return 0;
+        } while (!atomic_compare_exchange_weak_explicit(&rb->head_pending, &h, h + count,
+                                                        memory_order_relaxed,
+                                                        memory_order_relaxed));
+        *head = h;
+        *overflow = 0;
+        return 1;
+    }
+
+    *overflow = count > ringbuf_producer_free(rb, count);
+    if (*overflow && (rb->flags & RINGBUF_NO_OVERWRITE))
+        return 0;
+    *head = ringbuf_load_head_pending(rb);
+    return 1;
+}
+
+/*
+ * Like ringbuf_producer_claim, but for ring buffers created with
+ * RINGBUF_OVERFLOW_TRUNCATE, reduces *count to the number of free
+ * bytes, and always succeeds (possibly claiming 0 bytes). MPMC
+ * producers retry when another producer claims the free space first.
+ */
+static int
+ringbuf_producer_claim_upto(ringbuf_t rb, size_t *count, uint64_t *head, int *overflow)
+{
+    if (!(rb->flags & RINGBUF_OVERFLOW_TRUNCATE))
+        return ringbuf_producer_claim(rb, *count, head, overflow);
+
+    size_t n;
+    do
+        n = MIN(*count, ringbuf_bytes_free(rb));
+    while (!ringbuf_producer_claim(rb, n, head, overflow));
+    if (n < *count)
+        RINGBUF_STAT(rb, in_short, 1);
+    *count = n;
+    return 1;
+}
+
+/*
+ * The number of leading bytes of a count-byte write that will be
+ * overwritten by the write's own trailing bytes, and so needn't be
+ * copied at all.
+ */
+static size_t
+ringbuf_doomed(const struct ringbuf_t *rb, size_t count)
+{
+    size_t capacity = ringbuf_capacity(rb);
+    return count > capacity ? count - capacity : 0;
+}
+
+/*
+ * Commit the count bytes that the producer claimed at head, once
+ * they've been copied into the buffer.
+ */
+static void
+ringbuf_producer_commit(ringbuf_t rb, uint64_t head, size_t count, int overflow)
+{
+    if (rb->flags & RINGBUF_MPMC) {
+        unsigned spins = 0;
+        /*
+         * (acquire, so that our release store of head also covers the
+         * bytes copied by the threads ahead of us)
+         */
+        while (ringbuf_load_head(rb) != head)
+            ringbuf_relax(&spins);
+        RINGBUF_STAT_IN(rb, head, head + count);
+        ringbuf_store_head(rb, head + count);
+        return;
+    }
+
+    ringbuf_produce(rb, head + count);
+    if (overflow)
+        ringbuf_overflow(rb);
+}
+
+/*
+ * Claim count bytes for the consumer, beginning at *tail. Returns 0,
+ * and claims nothing, if fewer than count bytes are used.
+ */
+static int
+ringbuf_consumer_claim(ringbuf_t rb, size_t count, uint64_t *tail)
+{
+    if (rb->flags & RINGBUF_MPMC) {
+        uint64_t t = atomic_load_explicit(&rb->tail_pending, memory_order_relaxed);
+        do {
+            uint64_t head = ringbuf_load_head(rb);
+            if (count > head - t)
+                return 0;
+        } while (!atomic_compare_exchange_weak_explicit(&rb->tail_pending, &t, t + count,
+                                                        memory_order_relaxed,
+                                                        memory_order_relaxed));
+        *tail = t;
+        return 1;
+    }
+
+    if (count > ringbuf_consumer_used(rb, count))
+        return 0;
+    *tail = ringbuf_load_tail(rb);
+    return 1;
+}
+
+/*
+ * Commit the count bytes that the consumer claimed at tail, once
+ * they've been copied out of the buffer.
+ */
+static void
+ringbuf_consumer_commit(ringbuf_t rb, uint64_t tail, size_t count)
+{
+    if (rb->flags & RINGBUF_MPMC) {
+        unsigned spins = 0;
+        while (ringbuf_load_tail(rb) != tail)
+            ringbuf_relax(&spins);
+    }
+    ringbuf_store_tail(rb, tail + count);
+}
+
+/*
+ * Resize rb's internal buffer, which isn't mirrored, to new_size
+ * bytes, as realloc(3) does: the first MIN(rb->size, new_size) bytes
+ * are preserved, but the buffer may move. Anonymous mappings are
+ * resized with mremap(2) where possible, and only grow by whole
+ * pages (or huge pages). Sets *map_size to the length of the new
+ * mapping, if any. Returns the new buffer, or 0, leaving the old
+ * buffer untouched, if there's not enough memory.
+ */
+static uint8_t *
+ringbuf_buffer_realloc(ringbuf_t rb, size_t new_size, size_t *map_size)
+{
+    *map_size = rb->map_size;
+    if (!rb->map_size)
+        return realloc(ringbuf_buf(rb), new_size);
+
+    size_t pagesize = sysconf(_SC_PAGESIZE);
+    size_t align = (rb->flags & (RINGBUF_HUGETLB | RINGBUF_THP)) ? ringbuf_hugepage_size() : pagesize;
+    if (new_size > SIZE_MAX - align)
+        return 0;
+    size_t len = (new_size + align - 1) / align * align;
+    if (len == rb->map_size)
+        return ringbuf_buf(rb);
+
+    uint8_t *p = MAP_FAILED;
+#ifdef __linux__
+    p = mremap(ringbuf_buf(rb), rb->map_size, len, MREMAP_MAYMOVE);
+#endif
+    if (p == MAP_FAILED) {
+        p = ringbuf_map_alloc(new_size, rb->flags, 0, &len);
+        if (!p)
+            return 0;
+        memcpy(p, ringbuf_buf(rb), MIN(rb->size, new_size));
+        munmap(ringbuf_buf(rb), rb->map_size);
+    }
+#ifdef MADV_HUGEPAGE
+    if (rb->flags & RINGBUF_THP)
+        madvise(p, len, MADV_HUGEPAGE);
+#endif
+    if ((rb->flags & RINGBUF_PREFAULT) && len > rb->map_size)
+        ringbuf_prefault(p + rb->map_size, len - rb->map_size);
+    *map_size = len;
+    return p;
+}
+
+int
+ringbuf_resize(ringbuf_t rb, size_t capacity)
+{
+    if ((rb->flags & (RINGBUF_BROADCAST | RINGBUF_SINGLE_ALLOC | RINGBUF_CALLER_STORAGE |
+                      RINGBUF_SHARED | RINGBUF_PERSISTENT | RINGBUF_RECORD_PAD)) ||
+        rb->reserved || rb->zerocopy_senders)
+        return 0;
+#ifdef RINGBUF_IO_URING
+    if (rb->uring || rb->uring_inflight)
+        return 0;
+#endif
+    size_t size = ringbuf_size_for(capacity, rb->flags);
+    if (size == 0 || size % rb->elem_size)
+        return 0;
+    uint64_t tail = ringbuf_load_tail(rb);
+    uint64_t head = ringbuf_load_head(rb);
+    uint64_t head_pending = ringbuf_load_head_pending(rb);
+    size_t used = head_pending - tail;
+    if (used > ringbuf_capacity_for(size, rb->flags))
+        return 0;
+    if (size == rb->size)
+        return 1;
+
+    /*
+     * The contents are the first bytes, from the tail to the end of
+     * the buffer, followed by the second bytes, which wrapped around
+     * to the start of the buffer. At most one of the two runs is
+     * moved, and then only if the contents wrap.
+     */
+    size_t old_size = rb->size;
+    size_t t = ringbuf_ptr(rb, tail) - ringbuf_buf(rb);
+    size_t first = MIN(used, old_size - t);
+    size_t second = used - first;
+    size_t new_t = t;
+    size_t map_size = rb->map_size;
+    uint8_t *buf;
+
+    if (rb->flags & RINGBUF_MIRROR) {
+
+        /* the contents are contiguous in the mirror */
+        buf = ringbuf_mirror_alloc(size);
+        if (!buf)
+            return 0;
+        memcpy(buf, ringbuf_buf(rb) + t, used);
+        ringbuf_mirror_free(ringbuf_buf(rb), old_size);
+        new_t = 0;
+    } else if (size > old_size) {
+        buf = ringbuf_buffer_realloc(rb, size, &map_size);
+        if (!buf)
+            return 0;
+        if (second != 0 && first <= second) {
+
+            /* move the first bytes to the end of the new buffer */
+            memmove(buf + size - first, buf + t, first);
+            new_t = size - first;
+        } else if (second != 0) {
+
+            /* move the second bytes past the old end, wrapping if need be */
+            size_t n = MIN(second, size - old_size);
+            memcpy(buf + old_size, buf, n);
+            memmove(buf, buf + n, second - n);
+        }
+    } else {
+        if (second != 0) {
+            memmove(ringbuf_buf(rb) + size - first, ringbuf_buf(rb) + t, first);
+            new_t = size - first;
+        } else if (t + used > size) {
+            memmove(ringbuf_buf(rb), ringbuf_buf(rb) + t, used);
+            new_t = 0;
+        }
+
+        /* if the buffer can't be shrunk, it's still big enough */
+        buf = ringbuf_buffer_realloc(rb, size, &map_size);
+        if (!buf) {
+            buf = ringbuf_buf(rb);
+            map_size = rb->map_size;
+        }
+    }
+
+    rb->buf_offset = (uintptr_t) buf - (uintptr_t) rb;
+    rb->size = size;
+    rb->capacity = ringbuf_capacity_for(size, rb->flags);
+    rb->mask = (rb->flags & RINGBUF_POW2) ? size - 1 : 0;
+    rb->map_size = map_size;
+
+    /*
+     * Move the counters forward, never back, to the first tail that
+     * falls at new_t, so that stale counters (such as a cursor's) are
+     * behind the new tail.
+     */
+    uint64_t new_tail = head_pending + (new_t + size - head_pending % size) % size;
+    atomic_store_explicit(&rb->tail, new_tail, memory_order_relaxed);
+    atomic_store_explicit(&rb->tail_pending, new_tail, memory_order_relaxed);
+    atomic_store_explicit(&rb->head, new_tail + (head - tail), memory_order_relaxed);
+    atomic_store_explicit(&rb->head_pending, new_tail + used, memory_order_relaxed);
+    rb->tail_cache = new_tail;
+    rb->head_cache = new_tail + (head - tail);
+    return 1;
+}
+
+int
+ringbuf_set_max_capacity(ringbuf_t rb, size_t max_capacity)
+{
+    if ((rb->flags & (RINGBUF_SPSC | RINGBUF_MPMC | RINGBUF_BROADCAST | RINGBUF_SINGLE_ALLOC |
+                      RINGBUF_CALLER_STORAGE | RINGBUF_PERSISTENT | RINGBUF_RECORD_PAD)))
+        return 0;
+    rb->max_capacity = max_capacity;
+    return 1;
+}
+
+void
+ringbuf_set_stream_threshold(ringbuf_t rb, size_t threshold)
+{
+    rb->stream_threshold = threshold;
+}
+
+/*
+ * If rb has fewer than count bytes free, and it's allowed to grow
+ * (see ringbuf_set_max_capacity), try to grow it to make room: at
+ * least to double its capacity, and at most to its maximum
+ * capacity. Producer-side functions call this before they check for
+ * free space, so that growing takes precedence over the ring
+ * buffer's overflow policy.
+ */
+static void
+ringbuf_auto_grow(ringbuf_t rb, size_t count)
+{
+    if (!rb->max_capacity || count <= ringbuf_bytes_free(rb))
+        return;
+    size_t used = ringbuf_bytes_used(rb);
+    size_t max = rb->max_capacity;
+    size_t want = used > max || count > max - used ? max : used + count;
+    size_t capacity = rb->capacity > max / 2 ? max : 2 * rb->capacity;
+    capacity = MAX(capacity, want);
+    if (capacity > rb->capacity)
+        ringbuf_resize(rb, capacity);
+}
+
+size_t
+ringbuf_publish(ringbuf_t rb)
+{
+    assert(!(rb->flags & RINGBUF_MPMC));
+    uint64_t head = atomic_load_explicit(&rb->head, memory_order_relaxed);
+    uint64_t head_pending = ringbuf_load_head_pending(rb);
+    ringbuf_store_head(rb, head_pending);
+    return head_pending - head;
+}
+
+const void *
+ringbuf_tail(const struct ringbuf_t *rb)
+{
+    return ringbuf_ptr(rb, ringbuf_load_tail(rb));
+}
+
+const void *
+ringbuf_head(const struct ringbuf_t *rb)
+{
+    return ringbuf_ptr(rb, ringbuf_load_head_pending(rb));
+}
+
+size_t
+ringbuf_findchr(const struct ringbuf_t *rb, int c, size_t offset)
+{
+    assert(!(rb->flags & (RINGBUF_MPMC | RINGBUF_BROADCAST)));
+    const uint8_t *bufend = ringbuf_end(rb);
+    size_t bytes_used = ringbuf_bytes_used(rb);
+    if (offset >= bytes_used)
+        return bytes_used;
+
+    const uint8_t *start = ringbuf_ptr(rb, ringbuf_load_tail(rb) + offset);
+    assert(bufend > start);
+    size_t n = MIN(bufend - start, bytes_used - offset);
+    const uint8_t *found = memchr(start, c, n);
+    if (found)
+        return offset + (found - start);
+    else
+        return ringbuf_findchr(rb, c, offset + n);
+}
+
+/*
+ * Byte-set search kernels, which return the index of the first of the
+ * n bytes at p that's in the set, or n if there's none. The SIMD
+ * kernels compare each vector of bytes against each byte in the set
+ * in turn, so they're only used for small sets; larger ones use the
+ * scalar kernel and the set's bitmap. The kernel is chosen at run
+ * time, the first time it's needed, according to the CPU's features.
+ * Define RINGBUF_NO_SIMD to always use the scalar kernel.
+ */
+#define RINGBUF_SIMD_MAX_SET 16
+
+struct ringbuf_byteset
+{
+    size_t nbytes;
+    uint8_t bytes[RINGBUF_SIMD_MAX_SET];
+    uint8_t bitmap[256 / 8];
+};
+
+static void
+ringbuf_byteset_init(struct ringbuf_byteset *set, const uint8_t *bytes, size_t nbytes)
+{
+    memset(set, 0, sizeof(*set));
+    size_t i;
+    for (i = 0; i != nbytes; ++i) {
+        uint8_t b = bytes[i];
+        if (set->bitmap[b / 8] & (1 << (b % 8)))
+            continue;
+        set->bitmap[b / 8] |= 1 << (b % 8);
+        if (set->nbytes < RINGBUF_SIMD_MAX_SET)
+            set->bytes[set->nbytes] = b;
+        ++set->nbytes;
+    }
+}
+
+typedef size_t (*ringbuf_findset_fn)(const uint8_t *p, size_t n,
+                                     const struct ringbuf_byteset *set);
+
+static size_t
+ringbuf_findset_scalar(const uint8_t *p, size_t n, const struct ringbuf_byteset *set)
+{
+    if (set->nbytes == 1) {
+        const uint8_t *found = memchr(p, set->bytes[0], n);
+        return found ? (size_t) (found - p) : n;
+    }
+    size_t i;
+    for (i = 0; i != n; ++i)
+        if (set->bitmap[p[i] / 8] & (1 << (p[i] % 8)))
+            return i;
+    return n;
+}
+
+#ifdef RINGBUF_SIMD_X86
+__attribute__((target("sse2")))
+static size_t
+ringbuf_findset_sse2(const uint8_t *p, size_t n, const struct ringbuf_byteset *set)
+{
+    if (set->nbytes > RINGBUF_SIMD_MAX_SET)
+        return ringbuf_findset_scalar(p, n, set);
+
+    __m128i needles[RINGBUF_SIMD_MAX_SET];
+    size_t i, j;
+    for (j = 0; j != set->nbytes; ++j)
+        needles[j] = _mm_set1_epi8((char) set->bytes[j]);
+    for (i = 0; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (p + i));
+        __m128i match = _mm_cmpeq_epi8(v, needles[0]);
+        for (j = 1; j != set->nbytes; ++j)
+            match = _mm_or_si128(match, _mm_cmpeq_epi8(v, needles[j]));
+        int mask = _mm_movemask_epi8(match);
+        if (mask)
+            return i + __builtin_ctz(mask);
+    }
+    return i + ringbuf_findset_scalar(p + i, n - i, set);
+}
+
+__attribute__((target("avx2")))
+static size_t
+ringbuf_findset_avx2(const uint8_t *p, size_t n, const struct ringbuf_byteset *set)
+{
+    if (set->nbytes > RINGBUF_SIMD_MAX_SET)
+        return ringbuf_findset_scalar(p, n, set);
+
+    __m256i needles[RINGBUF_SIMD_MAX_SET];
+    size_t i, j;
+    for (j = 0; j != set->nbytes; ++j)
+        needles[j] = _mm256_set1_epi8((char) set->bytes[j]);
+    for (i = 0; i + 32 <= n; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *) (p + i));
+        __m256i match = _mm256_cmpeq_epi8(v, needles[0]);
+        for (j = 1; j != set->nbytes; ++j)
+            match = _mm256_or_si256(match, _mm256_cmpeq_epi8(v, needles[j]));
+        unsigned mask = _mm256_movemask_epi8(match);
+        if (mask)
+            return i + __builtin_ctz(mask);
+    }
+    return i + ringbuf_findset_sse2(p + i, n - i, set);
+}
+#endif /* RINGBUF_SIMD_X86 */
+
+#ifdef RINGBUF_SIMD_NEON
+static size_t
+ringbuf_findset_neon(const uint8_t *p, size_t n, const struct ringbuf_byteset *set)
+{
+    if (set->nbytes > RINGBUF_SIMD_MAX_SET)
+        return ringbuf_findset_scalar(p, n, set);
+
+    uint8x16_t needles[RINGBUF_SIMD_MAX_SET];
+    size_t i, j;
+    for (j = 0; j != set->nbytes; ++j)
+        needles[j] = vdupq_n_u8(set->bytes[j]);
+    for (i = 0; i + 16 <= n; i += 16) {
+        uint8x16_t v = vld1q_u8(p + i);
+        uint8x16_t match = vceqq_u8(v, needles[0]);
+        for (j = 1; j != set->nbytes; ++j)
+            match = vorrq_u8(match, vceqq_u8(v, needles[j]));
+
+        /* narrow each byte of the match to a nibble of a 64-bit mask */
+        uint8x8_t narrowed = vshrn_n_u16(vreinterpretq_u16_u8(match), 4);
+        uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(narrowed), 0);
+        if (mask)
+            return i + (__builtin_ctzll(mask) >> 2);
+    }
+    return i + ringbuf_findset_scalar(p + i, n - i, set);
+}
+#endif /* RINGBUF_SIMD_NEON */
+
+static size_t
+ringbuf_findset_resolve(const uint8_t *p, size_t n, const struct ringbuf_byteset *set);
+
+static _Atomic ringbuf_findset_fn ringbuf_findset_kernel = ringbuf_findset_resolve;
+
+static size_t
+ringbuf_findset_resolve(const uint8_t *p, size_t n, const struct ringbuf_byteset *set)
+{
+    ringbuf_findset_fn kernel = ringbuf_findset_scalar;
+#if defined(RINGBUF_SIMD_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        kernel = ringbuf_findset_avx2;
+    else if (__builtin_cpu_supports("sse2"))
+        kernel = ringbuf_findset_sse2;
+#elif defined(RINGBUF_SIMD_NEON)
+    kernel = ringbuf_findset_neon;
+#endif
+    atomic_store_explicit(&ringbuf_findset_kernel, kernel, memory_order_relaxed);
+    return kernel(p, n, set);
+}
+
+/*
+ * Search the bytes of rb from logical offset offset up to (but not
+ * including) logical offset end, relative to tail, for a byte in
+ * set. Returns the offset of the byte, or end if there's none.
+ */
+static size_t
+ringbuf_scan(const struct ringbuf_t *rb, const struct ringbuf_byteset *set,
+             uint64_t tail, size_t offset, size_t end)
+{
+    ringbuf_findset_fn kernel =
+        atomic_load_explicit(&ringbuf_findset_kernel, memory_order_relaxed);
+    struct iovec iov[2];
+    int iovcnt = ringbuf_region(rb, tail + offset, end - offset, iov);
+    int i;
+    for (i = 0; i != iovcnt; ++i) {
+        size_t found = kernel(iov[i].iov_base, iov[i].iov_len, set);
+        if (found != iov[i].iov_len)
+            return offset + found;
+        offset += found;
+    }
+    return end;
+}
+
+size_t
+ringbuf_findset(const struct ringbuf_t *rb, const void *set, size_t nset, size_t offset)
+{
+    assert(!(rb->flags & (RINGBUF_MPMC | RINGBUF_BROADCAST)));
+    size_t bytes_used = ringbuf_bytes_used(rb);
+    if (offset >= bytes_used || nset == 0)
+        return bytes_used;
+
+    struct ringbuf_byteset byteset;
+    ringbuf_byteset_init(&byteset, set, nset);
+    return ringbuf_scan(rb, &byteset, ringbuf_load_tail(rb), offset, bytes_used);
+}
+
+/*
+ * Search the bytes_used bytes of rb that follow tail for needle,
+ * starting at logical offset offset. Returns the offset of the first
+ * occurrence, or bytes_used if there's none.
+ */
+static size_t
+ringbuf_search(const struct ringbuf_t *rb, uint64_t tail, size_t bytes_used,
+               const uint8_t *needle, size_t len, size_t offset)
+{
+    if (offset >= bytes_used || len > bytes_used - offset)
+        return bytes_used;
+    if (len == 0)
+        return offset;
+
+    /*
+     * Look for the needle's first byte, and compare the rest of the
+     * needle in (at most) two pieces, in case it's split across the
+     * end of the buffer.
+     */
+    struct ringbuf_byteset first;
+    ringbuf_byteset_init(&first, needle, 1);
+    size_t end = bytes_used - len + 1;
+    while (offset < end) {
+        offset = ringbuf_scan(rb, &first, tail, offset, end);
+        if (offset == end)
+            break;
+
+        struct iovec iov[2];
+        int iovcnt = ringbuf_region(rb, tail + offset, len, iov);
+        if (memcmp(iov[0].iov_base, needle, iov[0].iov_len) == 0 &&
+            (iovcnt == 1 ||
+             memcmp(iov[1].iov_base, needle + iov[0].iov_len, iov[1].iov_len) == 0))
+            return offset;
+        ++offset;
+    }
+    return bytes_used;
+}
+
+size_t
+ringbuf_findstr(const struct ringbuf_t *rb, const void *needle, size_t len, size_t offset)
+{
+    assert(!(rb->flags & (RINGBUF_MPMC | RINGBUF_BROADCAST)));
+    return ringbuf_search(rb, ringbuf_load_tail(rb), ringbuf_bytes_used(rb),
+                          needle, len, offset);
+}
+
+/*
+ * A scan cursor remembers, as a counter, where its next search should
+ * begin. Because counters are never reused, the cursor stays valid as
+ * the head advances and as the tail is consumed up to it. If the tail
+ * has moved past it (the bytes were consumed, or overwritten by an
+ * overflow), or it's beyond the head (the ring buffer was reset), the
+ * search restarts at the tail.
+ */
+struct ringbuf_cursor_t
+{
+    ringbuf_t rb;
+    uint64_t next;
+};
+
+ringbuf_cursor_t
+ringbuf_cursor_new(ringbuf_t rb)
+{
+    assert(!(rb->flags & (RINGBUF_MPMC | RINGBUF_BROADCAST)));
+    ringbuf_cursor_t cur = malloc(sizeof(struct ringbuf_cursor_t));
+    if (cur) {
+        cur->rb = rb;
+        cur->next = ringbuf_load_tail(rb);
+    }
+    return cur;
+}
+
+void
+ringbuf_cursor_free(ringbuf_cursor_t *cur)
+{
+    assert(cur && *cur);
+    free(*cur);
+    *cur = 0;
+}
+
+void
+ringbuf_cursor_reset(ringbuf_cursor_t cur)
+{
+    cur->next = ringbuf_load_tail(cur->rb);
+}
+
+/*
+ * Load the cursor's ring buffer's tail and number of bytes used, and
+ * return the logical offset at which the cursor's next search should
+ * begin.
+ */
+static size_t
+ringbuf_cursor_offset(ringbuf_cursor_t cur, uint64_t *tail, size_t *bytes_used)
+{
+    *tail = ringbuf_load_tail(cur->rb);
+    *bytes_used = ringbuf_bytes_used(cur->rb);
+    if (cur->next < *tail || cur->next - *tail > *bytes_used)
+        cur->next = *tail;
+    return cur->next - *tail;
+}
+
+size_t
+ringbuf_cursor_findchr(ringbuf_cursor_t cur, int c)
+{
+    uint8_t byte = c;
+    return ringbuf_cursor_findset(cur, &byte, 1);
+}
+
+size_t
+ringbuf_cursor_findset(ringbuf_cursor_t cur, const void *set, size_t nset)
+{
+    uint64_t tail;
+    size_t bytes_used;
+    size_t offset = ringbuf_cursor_offset(cur, &tail, &bytes_used);
+    if (nset == 0)
+        return bytes_used;
+
+    struct ringbuf_byteset byteset;
+    ringbuf_byteset_init(&byteset, set, nset);
+    size_t found = ringbuf_scan(cur->rb, &byteset, tail, offset, bytes_used);
+    cur->next = tail + found;
+    return found;
+}
+
+size_t
+ringbuf_cursor_findstr(ringbuf_cursor_t cur, const void *needle, size_t len)
+{
+    uint64_t tail;
+    size_t bytes_used;
+    size_t offset = ringbuf_cursor_offset(cur, &tail, &bytes_used);
+    size_t found = ringbuf_search(cur->rb, tail, bytes_used, needle, len, offset);
+
+    /*
+     * If there's no match, the last len - 1 bytes may still be the
+     * start of one.
+     */
+    if (found == bytes_used && len > 0)
+        cur->next = tail + MAX(offset, bytes_used - MIN(bytes_used, len - 1));
+    else
+        cur->next = tail + found;
+    return found;
+}
+
+/*
+ * CRC32C (Castagnoli) kernels for the checksumming transfer
+ * functions. Each kernel folds the n bytes at src into crc, which is
+ * the raw (non-inverted) CRC register, and, unless dst is 0, also
+ * copies them to dst, so that each byte is only loaded once. As with
+ * findset, the kernel is chosen the first time it's needed, according
+ * to what the CPU supports.
+ */
+typedef uint32_t (*ringbuf_crc32c_fn)(uint8_t *dst, const uint8_t *src,
+                                      size_t n, uint32_t crc);
+
+static const uint32_t ringbuf_crc32c_table[256] = {
+    0x00000000, 0xf26b8303, 0xe13b70f7, 0x1350f3f4,
+    0xc79a971f, 0x35f1141c, 0x26a1e7e8, 0xd4ca64eb,
+    0x8ad958cf, 0x78b2dbcc, 0x6be22838, 0x9989ab3b,
+    0x4d43cfd0, 0xbf284cd3, 0xac78bf27, 0x5e133c24,
+    0x105ec76f, 0xe235446c, 0xf165b798, 0x030e349b,
+    0xd7c45070, 0x25afd373, 0x36ff2087, 0xc494a384,
+    0x9a879fa0, 0x68ec1ca3, 0x7bbcef57, 0x89d76c54,
+    0x5d1d08bf, 0xaf768bbc, 0xbc267848, 0x4e4dfb4b,
+    0x20bd8ede, 0xd2d60ddd, 0xc186fe29, 0x33ed7d2a,
+    0xe72719c1, 0x154c9ac2, 0x061c6936, 0xf477ea35,
+    0xaa64d611, 0x580f5512, 0x4b5fa6e6, 0xb93425e5,
+    0x6dfe410e, 0x9f95c20d, 0x8cc531f9, 0x7eaeb2fa,
+    0x30e349b1, 0xc288cab2, 0xd1d83946, 0x23b3ba45,
+    0xf779deae, 0x05125dad, 0x1642ae59, 0xe4292d5a,
+    0xba3a117e, 0x4851927d, 0x5b016189, 0xa96ae28a,
+    0x7da08661, 0x8fcb0562, 0x9c9bf696, 0x6ef07595,
+    0x417b1dbc, 0xb3109ebf, 0xa0406d4b, 0x522bee48,
+    0x86e18aa3, 0x748a09a0, 0x67dafa54, 0x95b17957,
+    0xcba24573, 0x39c9c670, 0x2a993584, 0xd8f2b687,
+    0x0c38d26c, 0xfe53516f, 0xed03a29b, 0x1f682198,
+    0x5125dad3, 0xa34e59d0, 0xb01eaa24, 0x42752927,
+    0x96bf4dcc, 0x64d4cecf, 0x77843d3b, 0x85efbe38,
+    0xdbfc821c, 0x2997011f, 0x3ac7f2eb, 0xc8ac71e8,
+    0x1c661503, 0xee0d9600, 0xfd5d65f4, 0x0f36e6f7,
+    0x61c69362, 0x93ad1061, 0x80fde395, 0x72966096,
+    0xa65c047d, 0x5437877e, 0x4767748a, 0xb50cf789,
+    0xeb1fcbad, 0x197448ae, 0x0a24bb5a, 0xf84f3859,
+    0x2c855cb2, 0xdeeedfb1, 0xcdbe2c45, 0x3fd5af46,
+    0x7198540d, 0x83f3d70e, 0x90a324fa, 0x62c8a7f9,
+    0xb602c312, 0x44694011, 0x5739b3e5, 0xa55230e6,
+    0xfb410cc2, 0x092a8fc1, 0x1a7a7c35, 0xe811ff36,
+    0x3cdb9bdd, 0xceb018de, 0xdde0eb2a, 0x2f8b6829,
+    0x82f63b78, 0x709db87b, 0x63cd4b8f, 0x91a6c88c,
+    0x456cac67, 0xb7072f64, 0xa457dc90, 0x563c5f93,
+    0x082f63b7, 0xfa44e0b4, 0xe9141340, 0x1b7f9043,
+    0xcfb5f4a8, 0x3dde77ab, 0x2e8e845f, 0xdce5075c,
+    0x92a8fc17, 0x60c37f14, 0x73938ce0, 0x81f80fe3,
+    0x55326b08, 0xa759e80b, 0xb4091bff, 0x466298fc,
+    0x1871a4d8, 0xea1a27db, 0xf94ad42f, 0x0b21572c,
+    0xdfeb33c7, 0x2d80b0c4, 0x3ed04330, 0xccbbc033,
+    0xa24bb5a6, 0x502036a5, 0x4370c551, 0xb11b4652,
+    0x65d122b9, 0x97baa1ba, 0x84ea524e, 0x7681d14d,
+    0x2892ed69, 0xdaf96e6a, 0xc9a99d9e, 0x3bc21e9d,
+    0xef087a76, 0x1d63f975, 0x0e330a81, 0xfc588982,
+    0xb21572c9, 0x407ef1ca, 0x532e023e, 0xa145813d,
+    0x758fe5d6, 0x87e466d5, 0x94b49521, 0x66df1622,
+    0x38cc2a06, 0xcaa7a905, 0xd9f75af1, 0x2b9cd9f2,
+    0xff56bd19, 0x0d3d3e1a, 0x1e6dcdee, 0xec064eed,
+    0xc38d26c4, 0x31e6a5c7, 0x22b65633, 0xd0ddd530,
+    0x0417b1db, 0xf67c32d8, 0xe52cc12c, 0x1747422f,
+    0x49547e0b, 0xbb3ffd08, 0xa86f0efc, 0x5a048dff,
+    0x8ecee914, 0x7ca56a17, 0x6ff599e3, 0x9d9e1ae0,
+    0xd3d3e1ab, 0x21b862a8, 0x32e8915c, 0xc083125f,
+    0x144976b4, 0xe622f5b7, 0xf5720643, 0x07198540,
+    0x590ab964, 0xab613a67, 0xb831c993, 0x4a5a4a90,
+    0x9e902e7b, 0x6cfbad78, 0x7fab5e8c, 0x8dc0dd8f,
+    0xe330a81a, 0x115b2b19, 0x020bd8ed, 0xf0605bee,
+    0x24aa3f05, 0xd6c1bc06, 0xc5914ff2, 0x37faccf1,
+    0x69e9f0d5, 0x9b8273d6, 0x88d28022, 0x7ab90321,
+    0xae7367ca, 0x5c18e4c9, 0x4f48173d, 0xbd23943e,
+    0xf36e6f75, 0x0105ec76, 0x12551f82, 0xe03e9c81,
+    0x34f4f86a, 0xc69f7b69, 0xd5cf889d, 0x27a40b9e,
+    0x79b737ba, 0x8bdcb4b9, 0x988c474d, 0x6ae7c44e,
+    0xbe2da0a5, 0x4c4623a6, 0x5f16d052, 0xad7d5351,
+};
+
+static uint32_t
+ringbuf_crc32c_scalar(uint8_t *dst, const uint8_t *src, size_t n, uint32_t crc)
+{
+    if (dst)
+        memcpy(dst, src, n);
+    while (n--)
+        crc = (crc >> 8) ^ ringbuf_crc32c_table[(crc ^ *src++) & 0xff];
+    return crc;
+}
+
+#ifdef RINGBUF_SIMD_X86
+__attribute__((target("sse4.2")))
+static uint32_t
+ringbuf_crc32c_sse42(uint8_t *dst, const uint8_t *src, size_t n, uint32_t crc)
+{
+#ifdef __x86_64__
+    uint64_t crc64 = crc;
+    for (; n >= 8; n -= 8, src += 8) {
+        uint64_t v;
+        memcpy(&v, src, 8);
+        crc64 = _mm_crc32_u64(crc64, v);
+        if (dst) {
+            memcpy(dst, &v, 8);
+            dst += 8;
+        }
+    }
+    crc = (uint32_t) crc64;
+#endif
+    for (; n >= 4; n -= 4, src += 4) {
+        uint32_t v;
+        memcpy(&v, src, 4);
+        crc = _mm_crc32_u32(crc, v);
+        if (dst) {
+            memcpy(dst, &v, 4);
+            dst += 4;
+        }
+    }
+    for (; n; --n) {
+        uint8_t v = *src++;
+        crc = _mm_crc32_u8(crc, v);
+        if (dst)
+            *dst++ = v;
+    }
+    return crc;
+}
+#endif /* RINGBUF_SIMD_X86 */
+
+#ifdef RINGBUF_SIMD_NEON
+#ifdef __clang__
+__attribute__((target("crc")))
+#else
+__attribute__((target("+crc")))
+#endif
+static uint32_t
+ringbuf_crc32c_armv8(uint8_t *dst, const uint8_t *src, size_t n, uint32_t crc)
+{
+    for (; n >= 8; n -= 8, src += 8) {
+        uint64_t v;
+        memcpy(&v, src, 8);
+        crc = __crc32cd(crc, v);
+        if (dst) {
+            memcpy(dst, &v, 8);
+            dst += 8;
+        }
+    }
+    for (; n; --n) {
+        uint8_t v = *src++;
+        crc = __crc32cb(crc, v);
+        if (dst)
+            *dst++ = v;
+    }
+    return crc;
+}
+#endif /* RINGBUF_SIMD_NEON */
+
+static uint32_t
+ringbuf_crc32c_resolve(uint8_t *dst, const uint8_t *src, size_t n, uint32_t crc);
+
+static _Atomic ringbuf_crc32c_fn ringbuf_crc32c_kernel = ringbuf_crc32c_resolve;
+
+static uint32_t
+ringbuf_crc32c_resolve(uint8_t *dst, const uint8_t *src, size_t n, uint32_t crc)
+{
+    ringbuf_crc32c_fn kernel = ringbuf_crc32c_scalar;
+#if defined(RINGBUF_SIMD_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.2"))
+        kernel = ringbuf_crc32c_sse42;
+#elif defined(RINGBUF_SIMD_NEON) && defined(__APPLE__)
+    kernel = ringbuf_crc32c_armv8;
+#elif defined(RINGBUF_SIMD_NEON) && defined(__linux__)
+    if (getauxval(AT_HWCAP) & HWCAP_CRC32)
+        kernel = ringbuf_crc32c_armv8;
+#endif
+    atomic_store_explicit(&ringbuf_crc32c_kernel, kernel, memory_order_relaxed);
+    return kernel(dst, src, n, crc);
+}
+
+/*
+ * Copy n bytes from src to dst. If crc isn't 0, also fold them into
+ * the running checksum *crc, in the same pass.
+ */
+static inline void
+ringbuf_transfer(uint8_t *dst, const uint8_t *src, size_t n, uint32_t *crc)
+{
+    if (!crc) {
+        memcpy(dst, src, n);
+        return;
+    }
+    ringbuf_crc32c_fn kernel =
+        atomic_load_explicit(&ringbuf_crc32c_kernel, memory_order_relaxed);
+    *crc = ~kernel(dst, src, n, ~*crc);
+}
+
+uint32_t
+ringbuf_crc32c(uint32_t crc, const void *buf, size_t n)
+{
+    ringbuf_crc32c_fn kernel =
+        atomic_load_explicit(&ringbuf_crc32c_kernel, memory_order_relaxed);
+    return ~kernel(0, buf, n, ~crc);
+}
+
+/*
+ * Should a producer-side copy of count bytes into rb use streaming
+ * stores? (See ringbuf_set_stream_threshold.)
+ */
+static inline int
+ringbuf_streaming(const struct ringbuf_t *rb, size_t count, const uint32_t *crc)
+{
+#if defined(RINGBUF_SIMD_X86) && defined(__SSE2__)
+    return rb->stream_threshold && count >= rb->stream_threshold && !crc;
+#else
+    return 0;
+#endif
+}
+
+#if defined(RINGBUF_SIMD_X86) && defined(__SSE2__)
+/*
+ * Copy n bytes from src to dst with non-temporal stores, in aligned
+ * 16-byte blocks, and plain copies of the unaligned ends. The final
+ * fence orders the streaming stores, which are weakly ordered even
+ * on x86, before the release store that publishes them.
+ */
+static void
+ringbuf_stream(uint8_t *dst, const uint8_t *src, size_t n)
+{
+    size_t lead = MIN(-(uintptr_t) dst & 15, n);
+    memcpy(dst, src, lead);
+    dst += lead;
+    src += lead;
+    n -= lead;
+    for (; n >= 64; n -= 64, src += 64, dst += 64) {
+        __m128i a = _mm_loadu_si128((const __m128i *) src);
+        __m128i b = _mm_loadu_si128((const __m128i *) (src + 16));
+        __m128i c = _mm_loadu_si128((const __m128i *) (src + 32));
+        __m128i d = _mm_loadu_si128((const __m128i *) (src + 48));
+        _mm_stream_si128((__m128i *) dst, a);
+        _mm_stream_si128((__m128i *) (dst + 16), b);
+        _mm_stream_si128((__m128i *) (dst + 32), c);
+        _mm_stream_si128((__m128i *) (dst + 48), d);
+    }
+    for (; n >= 16; n -= 16, src += 16, dst += 16)
+        _mm_stream_si128((__m128i *) dst, _mm_loadu_si128((const __m128i *) src));
+    memcpy(dst, src, n);
+    _mm_sfence();
+}
+#else
+#define ringbuf_stream(dst, src, n) memcpy((dst), (src), (n))
+#endif
+
+/* how much of the segment after a wrap ringbuf_prefetch_wrap fetches */
+#define RINGBUF_PREFETCH_WRAP 512
+
+/*
+ * A consumer-side transfer is about to reach the end of rb's buffer,
+ * and continue with count more bytes at its start. Prefetch the
+ * first few lines there: the hardware prefetcher follows the
+ * transfer's addresses, so it can't see the wrap coming.
+ */
+static inline void
+ringbuf_prefetch_wrap(const struct ringbuf_t *rb, size_t count)
+{
+#ifdef __GNUC__
+    const uint8_t *p = ringbuf_buf(rb);
+    size_t off;
+    for (off = 0; off < MIN(count, RINGBUF_PREFETCH_WRAP); off += RINGBUF_CACHELINE)
+        __builtin_prefetch(p + off, 0, 3);
+#endif
+}
+
+size_t
+ringbuf_memset(ringbuf_t dst, int c, size_t len)
+{
+    ringbuf_auto_grow(dst, len);
+    const uint8_t *bufend = ringbuf_end(dst);
+    size_t count = MIN(len, ringbuf_buffer_size(dst));
+    uint64_t head;
+    int overflow;
+
+    /* a rejected write must fit in its entirety */
+    if (dst->flags & RINGBUF_OVERFLOW_REJECT)
+        count = len;
+    if (!ringbuf_producer_claim_upto(dst, &count, &head, &overflow)) {
+        RINGBUF_STAT(dst, in_rejected, 1);
+        return 0;
+    }
+
+    size_t nwritten = 0;
+    uint8_t *p = ringbuf_ptr(dst, head);
+    while (nwritten != count) {
+
+        /* don't copy beyond the end of the buffer */
+        assert(bufend > p);
+        size_t n = MIN(bufend - p, count - nwritten);
+        memset(p, c, n);
+        p += n;
+        nwritten += n;
+
+        /* wrap? */
+        if (p == bufend)
+            p = ringbuf_buf(dst);
+    }
+    ringbuf_producer_commit(dst, head, nwritten, overflow);
+
+    return nwritten;
+}
+
+void *
+ringbuf_memcpy_into(ringbuf_t dst, const void *src, size_t count)
+{
+    return ringbuf_memcpy_into_crc32c(dst, src, count, 0);
+}
+
+void *
+ringbuf_memcpy_into_crc32c(ringbuf_t dst, const void *src, size_t count, uint32_t *crc)
+{
+    ringbuf_auto_grow(dst, count);
+    const uint8_t *u8src = src;
+    const uint8_t *bufend = ringbuf_end(dst);
+    uint64_t head;
+    int overflow;
+
+    if (!ringbuf_producer_claim_upto(dst, &count, &head, &overflow)) {
+        RINGBUF_STAT(dst, in_rejected, 1);
+        return 0;
+    }
+
+    /* skip the bytes that this write would overwrite itself */
+    size_t nread = ringbuf_doomed(dst, count);
+    if (crc)
+        *crc = ringbuf_crc32c(*crc, u8src, nread);
+    int stream = ringbuf_streaming(dst, count, crc);
+    uint8_t *p = ringbuf_ptr(dst, head + nread);
+    while (nread != count) {
+        /* don't copy beyond the end of the buffer */
+        assert(bufend > p);
+        size_t n = MIN(bufend - p, count - nread);
+        if (stream)
+            ringbuf_stream(p, u8src + nread, n);
+        else
+            ringbuf_transfer(p, u8src + nread, n, crc);
+        p += n;
+        nread += n;
+
+        /* wrap? */
+        if (p == bufend)
+            p = ringbuf_buf(dst);
+    }
+    ringbuf_producer_commit(dst, head, nread, overflow);
+
+    return ringbuf_ptr(dst, head + nread);
+}
+
+ssize_t
+ringbuf_read(int fd, ringbuf_t rb, size_t count)
+{
+    assert(!(rb->flags & RINGBUF_MPMC));
+    ringbuf_auto_grow(rb, count);
+    const uint8_t *bufend = ringbuf_end(rb);
+    size_t nfree = ringbuf_producer_free(rb, count);
+    uint64_t head = ringbuf_load_head_pending(rb);
+    uint8_t *p = ringbuf_ptr(rb, head);
+    size_t requested = count;
+
+    /* never overflow a ring buffer that forbids it */
+    if (rb->flags & RINGBUF_NO_OVERWRITE)
+        count = MIN(nfree, count);
+
+    /* don't write beyond the end of the buffer */
+    assert(bufend > p);
+    count = MIN(bufend - p, count);
+    ssize_t n = read(fd, p, count);
+    if (n > 0) {
+        assert(p + n <= bufend);
+        ringbuf_produce(rb, head + n);
+
+        /* fix up the tail pointer if an overflow occurred */
+        if (n > nfree)
+            ringbuf_overflow(rb);
+    }
+    RINGBUF_STAT_SHORT(rb, in, n, requested);
+
+    return n;
+}
+
+void *
+ringbuf_memcpy_from(void *dst, ringbuf_t src, size_t count)
+{
+    return ringbuf_memcpy_from_crc32c(dst, src, count, 0);
+}
+
+void *
+ringbuf_memcpy_from_crc32c(void *dst, ringbuf_t src, size_t count, uint32_t *crc)
+{
+    uint64_t tail;
+    if (!ringbuf_consumer_claim(src, count, &tail)) {
+        RINGBUF_STAT(src, out_rejected, 1);
+        return 0;
+    }
+
+    uint8_t *u8dst = dst;
+    const uint8_t *bufend = ringbuf_end(src);
+    uint8_t *p = ringbuf_ptr(src, tail);
+    if ((size_t) (bufend - p) < count)
+        ringbuf_prefetch_wrap(src, count - (bufend - p));
+    size_t nwritten = 0;
+    while (nwritten != count) {
+        assert(bufend > p);
+        size_t n = MIN(bufend - p, count - nwritten);
+        ringbuf_transfer(u8dst + nwritten, p, n, crc);
+        p += n;
+        nwritten += n;
+
+        /* wrap ? */
+        if (p == bufend)
+            p = ringbuf_buf(src);
+    }
+    ringbuf_consumer_commit(src, tail, count);
+
+    return ringbuf_ptr(src, tail + count);
+}
+
+ssize_t
+ringbuf_write(int fd, ringbuf_t rb, size_t count)
+{
+    assert(!(rb->flags & RINGBUF_MPMC));
+    size_t bytes_used = ringbuf_consumer_used(rb, count);
+    if (count > bytes_used) {
+        RINGBUF_STAT(rb, out_rejected, 1);
+        return 0;
+    }
+
+    const uint8_t *bufend = ringbuf_end(rb);
+    uint64_t tail = ringbuf_load_tail(rb);
+    uint8_t *p = ringbuf_ptr(rb, tail);
+    size_t requested = count;
+    assert(bufend > p);
+    count = MIN(bufend - p, count);
+
+    /* the next write will most likely pick up at the start of the buffer */
+    if (p + count == bufend && count < bytes_used && !(rb->flags & RINGBUF_MIRROR))
+        ringbuf_prefetch_wrap(rb, bytes_used - count);
+    ssize_t n = write(fd, p, count);
+    if (n > 0) {
+        assert(p + n <= bufend);
+        ringbuf_store_tail(rb, tail + n);
+
+        assert(n + ringbuf_bytes_used(rb) >= bytes_used);
+    }
+    RINGBUF_STAT_SHORT(rb, out, n, requested);
+
+    return n;
+}
+
+void *
+ringbuf_copy(ringbuf_t dst, ringbuf_t src, size_t count)
+{
+    return ringbuf_copy_crc32c(dst, src, count, 0);
+}
+
+void *
+ringbuf_copy_crc32c(ringbuf_t dst, ringbuf_t src, size_t count, uint32_t *crc)
+{
+    assert(!(dst->flags & RINGBUF_MPMC) && !(src->flags & RINGBUF_MPMC));
+    size_t src_bytes_used = ringbuf_consumer_used(src, count);
+    if (count > src_bytes_used) {
+        RINGBUF_STAT(src, out_rejected, 1);
+        return 0;
+    }
+    ringbuf_auto_grow(dst, count);
+    size_t dst_bytes_free = ringbuf_producer_free(dst, count);
+    if (count > dst_bytes_free && (dst->flags & RINGBUF_OVERFLOW_TRUNCATE)) {
+        RINGBUF_STAT(dst, in_short, 1);
+        count = dst_bytes_free;
+    }
+    int overflow = count > dst_bytes_free;
+    if (overflow && (dst->flags & RINGBUF_NO_OVERWRITE)) {
+        RINGBUF_STAT(dst, in_rejected, 1);
+        return 0;
+    }
+
+    const uint8_t *src_bufend = ringbuf_end(src);
+    const uint8_t *dst_bufend = ringbuf_end(dst);
+    uint64_t tail = ringbuf_load_tail(src);
+    uint64_t head = ringbuf_load_head_pending(dst);
+
+    /* skip the bytes that this copy would overwrite itself */
+    size_t ncopied = ringbuf_doomed(dst, count);
+    if (crc) {
+        struct iovec doomed[2];
+        int i, iovcnt = ringbuf_region(src, tail, ncopied, doomed);
+        for (i = 0; i != iovcnt; ++i)
+            *crc = ringbuf_crc32c(*crc, doomed[i].iov_base, doomed[i].iov_len);
+    }
+    int stream = ringbuf_streaming(dst, count, crc);
+    uint8_t *srcp = ringbuf_ptr(src, tail + ncopied);
+    uint8_t *dstp = ringbuf_ptr(dst, head + ncopied);
+    if ((size_t) (src_bufend - srcp) < count - ncopied)
+        ringbuf_prefetch_wrap(src, count - ncopied - (src_bufend - srcp));
+    while (ncopied != count) {
+        assert(src_bufend > srcp);
+        size_t nsrc = MIN(src_bufend - srcp, count - ncopied);
+        assert(dst_bufend > dstp);
+        size_t n = MIN(dst_bufend - dstp, nsrc);
+        if (stream)
+            ringbuf_stream(dstp, srcp, n);
+        else
+            ringbuf_transfer(dstp, srcp, n, crc);
+        srcp += n;
+        dstp += n;
+        ncopied += n;
+
+        /* wrap ? */
+        if (srcp == src_bufend)
+            srcp = ringbuf_buf(src);
+        if (dstp == dst_bufend)
+            dstp = ringbuf_buf(dst);
+    }
+    ringbuf_store_tail(src, tail + count);
+    ringbuf_produce(dst, head + count);
+
+    assert(count + ringbuf_bytes_used(src) >= src_bytes_used);
+
+    if (overflow)
+        ringbuf_overflow(dst);
+
+    return ringbuf_ptr(dst, head + count);
+}
+
+int
+ringbuf_codec_copy(ringbuf_t dst, ringbuf_t src, size_t count,
+                   const struct ringbuf_codec *codec, int mode)
+{
+    assert(!(dst->flags & (RINGBUF_MPMC | RINGBUF_BROADCAST)) && !(src->flags & RINGBUF_MPMC));
+    count = MIN(count, ringbuf_consumer_used(src, count));
+    size_t nfree = ringbuf_producer_free(dst, ringbuf_capacity(dst));
+    uint64_t tail = ringbuf_load_tail(src);
+    uint64_t head = ringbuf_load_head_pending(dst);
+
+    /* one contiguous segment of input and of output at a time */
+    size_t nin = 0, nout = 0;
+    int result;
+    for (;;) {
+        struct iovec in[2], out[2];
+        ringbuf_region(src, tail + nin, count - nin, in);
+        ringbuf_region(dst, head + nout, nfree - nout, out);
+        size_t in_len = in[0].iov_len;
+        size_t out_len = out[0].iov_len;
+        int last = nin + in_len == count;
+        result = codec->process(codec->state, in[0].iov_base, &in_len, out[0].iov_base,
+                                &out_len, last ? mode : RINGBUF_CODEC_CONTINUE);
+        assert(in_len <= in[0].iov_len && out_len <= out[0].iov_len);
+        nin += in_len;
+        nout += out_len;
+        if (result < 0)
+            break;
+        if (nin == count && (result == 0 || mode == RINGBUF_CODEC_CONTINUE)) {
+            result = 0;
+            break;
+        }
+
+        /* if the codec is stuck, it's for want of room */
+        if (in_len == 0 && out_len == 0) {
+            result = 1;
+            break;
+        }
+    }
+    if (nin)
+        ringbuf_store_tail(src, tail + nin);
+    if (nout)
+        ringbuf_produce(dst, head + nout);
+    return result;
+}
+
+void
+ringbuf_codec_free(struct ringbuf_codec *codec)
+{
+    if (codec->free)
+        codec->free(codec->state);
+    codec->state = 0;
+}
+
+#ifdef RINGBUF_ZSTD
+static int
+ringbuf_zstd_compress(void *state, const void *in, size_t *in_len, void *out,
+                      size_t *out_len, int mode)
+{
+    static const ZSTD_EndDirective directives[] = { ZSTD_e_continue, ZSTD_e_flush, ZSTD_e_end };
+    ZSTD_inBuffer ib = { in, *in_len, 0 };
+    ZSTD_outBuffer ob = { out, *out_len, 0 };
+    size_t remaining = ZSTD_compressStream2(state, &ob, &ib, directives[mode]);
+    *in_len = ib.pos;
+    *out_len = ob.pos;
+    if (ZSTD_isError(remaining))
+        return -1;
+    if (mode == RINGBUF_CODEC_CONTINUE)
+        return ib.pos != ib.size;
+    return remaining != 0;
+}
+
+static int
+ringbuf_zstd_decompress(void *state, const void *in, size_t *in_len, void *out,
+                        size_t *out_len, int mode)
+{
+    ZSTD_inBuffer ib = { in, *in_len, 0 };
+    ZSTD_outBuffer ob = { out, *out_len, 0 };
+    size_t hint = ZSTD_decompressStream(state, &ob, &ib);
+    *in_len = ib.pos;
+    *out_len = ob.pos;
+    if (ZSTD_isError(hint))
+        return -1;
+
+    /* with its output full, the decompressor may be holding more */
+    return ib.pos != ib.size || ob.pos == ob.size;
+}
+
+static void
+ringbuf_zstd_free_cctx(void *state)
+{
+    ZSTD_freeCCtx(state);
+}
+
+static void
+ringbuf_zstd_free_dctx(void *state)
+{
+    ZSTD_freeDCtx(state);
+}
+
+int
+ringbuf_codec_zstd_compress(struct ringbuf_codec *codec, int level)
+{
+    ZSTD_CCtx *cctx = ZSTD_createCCtx();
+    if (!cctx)
+        return 0;
+    if (level < ZSTD_minCLevel() || level > ZSTD_maxCLevel() ||
+        ZSTD_isError(ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, level))) {
+        ZSTD_freeCCtx(cctx);
+        return 0;
+    }
+    codec->process = ringbuf_zstd_compress;
+    codec->free = ringbuf_zstd_free_cctx;
+    codec->state = cctx;
+    return 1;
+}
+
+int
+ringbuf_codec_zstd_decompress(struct ringbuf_codec *codec)
+{
+    ZSTD_DCtx *dctx = ZSTD_createDCtx();
+    if (!dctx)
+        return 0;
+    codec->process = ringbuf_zstd_decompress;
+    codec->free = ringbuf_zstd_free_dctx;
+    codec->state = dctx;
+    return 1;
+}
+#endif /* RINGBUF_ZSTD */
+
+#ifdef RINGBUF_LZ4
+/*
+ * LZ4F_compressUpdate and friends need room for their worst case
+ * output, so the compressor writes into pending, sized for the worst
+ * case of compressing RINGBUF_LZ4_CHUNK bytes, and copies it out from
+ * there as space allows. started is set while a frame is open, and
+ * dirty while it has input that hasn't been flushed.
+ */
+#define RINGBUF_LZ4_CHUNK (64 * 1024)
+
+struct ringbuf_lz4
+{
+    LZ4F_cctx *cctx;
+    LZ4F_preferences_t prefs;
+    int started;
+    int dirty;
+    size_t pending_pos;
+    size_t pending_len;
+    size_t pending_size;
+    uint8_t pending[];
+};
+
+static int
+ringbuf_lz4_compress(void *state, const void *in, size_t *in_len, void *out,
+                     size_t *out_len, int mode)
+{
+    struct ringbuf_lz4 *z = state;
+    const uint8_t *u8in = in;
+    uint8_t *u8out = out;
+    size_t nin = 0, nout = 0;
+    int result = 0;
+    for (;;) {
+        size_t n = MIN(z->pending_len - z->pending_pos, *out_len - nout);
+        memcpy(u8out + nout, z->pending + z->pending_pos, n);
+        nout += n;
+        z->pending_pos += n;
+        if (z->pending_pos != z->pending_len) {
+            result = 1;
+            break;
+        }
+        z->pending_pos = z->pending_len = 0;
+
+        size_t produced;
+        if (nin != *in_len && !z->started) {
+            produced = LZ4F_compressBegin(z->cctx, z->pending, z->pending_size, &z->prefs);
+            z->started = 1;
+        } else if (nin != *in_len) {
+            size_t chunk = MIN(*in_len - nin, RINGBUF_LZ4_CHUNK);
+            produced = LZ4F_compressUpdate(z->cctx, z->pending, z->pending_size, u8in + nin,
+                                           chunk, 0);
+            if (!LZ4F_isError(produced)) {
+                nin += chunk;
+                z->dirty = 1;
+            }
+        } else if (mode == RINGBUF_CODEC_FLUSH && z->dirty) {
+            produced = LZ4F_flush(z->cctx, z->pending, z->pending_size, 0);
+            z->dirty = 0;
+        } else if (mode == RINGBUF_CODEC_END && z->started) {
+            produced = LZ4F_compressEnd(z->cctx, z->pending, z->pending_size, 0);
+            z->started = 0;
+            z->dirty = 0;
+        } else
+            break;
+        if (LZ4F_isError(produced)) {
+            result = -1;
+            break;
+        }
+        z->pending_len = produced;
+    }
+    *in_len = nin;
+    *out_len = nout;
+    return result;
+}
+
+static int
+ringbuf_lz4_decompress(void *state, const void *in, size_t *in_len, void *out,
+                       size_t *out_len, int mode)
+{
+    size_t out_size = *out_len;
+    size_t in_size = *in_len;
+    size_t hint = LZ4F_decompress(state, out, out_len, in, in_len, 0);
+    if (LZ4F_isError(hint))
+        return -1;
+
+    /* with its output full, the decompressor may be holding more */
+    return *in_len != in_size || *out_len == out_size;
+}
+
+static void
+ringbuf_lz4_free_cctx(void *state)
+{
+    struct ringbuf_lz4 *z = state;
+    LZ4F_freeCompressionContext(z->cctx);
+    free(z);
+}
+
+static void
+ringbuf_lz4_free_dctx(void *state)
+{
+    LZ4F_freeDecompressionContext(state);
+}
+
+int
+ringbuf_codec_lz4_compress(struct ringbuf_codec *codec, int level)
+{
+    LZ4F_preferences_t prefs;
+    memset(&prefs, 0, sizeof(prefs));
+    prefs.compressionLevel = level;
+    size_t pending_size = MAX(LZ4F_compressBound(RINGBUF_LZ4_CHUNK, &prefs),
+                              (size_t) LZ4F_HEADER_SIZE_MAX);
+    if (level > LZ4F_compressionLevel_max())
+        return 0;
+    struct ringbuf_lz4 *z = malloc(sizeof(struct ringbuf_lz4) + pending_size);
+    if (!z)
+        return 0;
+    if (LZ4F_isError(LZ4F_createCompressionContext(&z->cctx, LZ4F_VERSION))) {
+        free(z);
+        return 0;
+    }
+    z->prefs = prefs;
+    z->started = 0;
+    z->dirty = 0;
+    z->pending_pos = 0;
+    z->pending_len = 0;
+    z->pending_size = pending_size;
+    codec->process = ringbuf_lz4_compress;
+    codec->free = ringbuf_lz4_free_cctx;
+    codec->state = z;
+    return 1;
+}
+
+int
+ringbuf_codec_lz4_decompress(struct ringbuf_codec *codec)
+{
+    LZ4F_dctx *dctx;
+    if (LZ4F_isError(LZ4F_createDecompressionContext(&dctx, LZ4F_VERSION)))
+        return 0;
+    codec->process = ringbuf_lz4_decompress;
+    codec->free = ringbuf_lz4_free_dctx;
+    codec->state = dctx;
+    return 1;
+}
+#endif /* RINGBUF_LZ4 */
+
+int
+ringbuf_reserve(ringbuf_t rb, size_t count, struct iovec iov[2])
+{
+    assert(!(rb->flags & RINGBUF_MPMC));
+    ringbuf_auto_grow(rb, count);
+    if (count > ringbuf_producer_free(rb, count)) {
+        RINGBUF_STAT(rb, in_rejected, 1);
+        return 0;
+    }
+    rb->reserved = count;
+    return ringbuf_region(rb, ringbuf_load_head_pending(rb), count, iov);
+}
+
+void *
+ringbuf_commit(ringbuf_t rb, size_t count)
+{
+    assert(count <= rb->reserved);
+    uint64_t head = ringbuf_load_head_pending(rb) + count;
+    rb->reserved = 0;
+    ringbuf_produce(rb, head);
+    return ringbuf_ptr(rb, head);
+}
+
+int
+ringbuf_peek(ringbuf_t rb, size_t count, struct iovec iov[2])
+{
+    assert(!(rb->flags & RINGBUF_MPMC));
+    if (count > ringbuf_consumer_used(rb, count)) {
+        RINGBUF_STAT(rb, out_rejected, 1);
+        return 0;
+    }
+    return ringbuf_region(rb, ringbuf_load_tail(rb), count, iov);
+}
+
+void *
+ringbuf_consume(ringbuf_t rb, size_t count)
+{
+    assert(!(rb->flags & RINGBUF_MPMC));
+    if (count > ringbuf_consumer_used(rb, count)) {
+        RINGBUF_STAT(rb, out_rejected, 1);
+        return 0;
+    }
+    uint64_t tail = ringbuf_load_tail(rb) + count;
+    ringbuf_store_tail(rb, tail);
+    return ringbuf_ptr(rb, tail);
+}
+
+/*
+ * Helpers for the scatter/gather I/O calls. ringbuf_readv_begin
+ * describes where the next count bytes read into rb will go, and
+ * ringbuf_readv_end adds the n bytes actually read. count is clamped
+ * to rb's capacity, so that a single call can never overwrite bytes
+ * it has just read.
+ */
+static int
+ringbuf_readv_begin(ringbuf_t rb, size_t count, struct iovec iov[2],
+                    uint64_t *head, size_t *nfree)
+{
+    assert(!(rb->flags & RINGBUF_MPMC));
+    ringbuf_auto_grow(rb, count);
+    *nfree = ringbuf_producer_free(rb, count);
+    *head = ringbuf_load_head_pending(rb);
+
+    /* never overflow a ring buffer that forbids it */
+    if (rb->flags & RINGBUF_NO_OVERWRITE)
+        count = MIN(*nfree, count);
+    count = MIN(ringbuf_capacity(rb), count);
+    return ringbuf_region(rb, *head, count, iov);
+}
+
+static void
+ringbuf_readv_end(ringbuf_t rb, uint64_t head, size_t nfree, ssize_t n)
+{
+    if (n > 0) {
+        ringbuf_produce(rb, head + n);
+
+        /* fix up the tail pointer if an overflow occurred */
+        if (n > nfree)
+            ringbuf_overflow(rb);
+    }
+}
+
+/*
+ * ringbuf_writev_begin returns 0 if rb holds fewer than count bytes;
+ * otherwise, it describes the count bytes at rb's tail pointer.
+ */
+static int
+ringbuf_writev_begin(ringbuf_t rb, size_t count, struct iovec iov[2],
+                     uint64_t *tail)
+{
+    assert(!(rb->flags & RINGBUF_MPMC));
+    if (count > ringbuf_consumer_used(rb, count)) {
+        RINGBUF_STAT(rb, out_rejected, 1);
+        return 0;
+    }
+    *tail = ringbuf_load_tail(rb);
+    return ringbuf_region(rb, *tail, count, iov);
+}
+
+ssize_t
+ringbuf_readv(int fd, ringbuf_t rb, size_t count)
+{
+    struct iovec iov[2];
+    uint64_t head;
+    size_t nfree;
+    int iovcnt = ringbuf_readv_begin(rb, count, iov, &head, &nfree);
+    ssize_t n = readv(fd, iov, iovcnt);
+    ringbuf_readv_end(rb, head, nfree, n);
+    RINGBUF_STAT_SHORT(rb, in, n, count);
+    return n;
+}
+
+ssize_t
+ringbuf_writev(int fd, ringbuf_t rb, size_t count)
+{
+    struct iovec iov[2];
+    uint64_t tail;
+    int iovcnt = ringbuf_writev_begin(rb, count, iov, &tail);
+    if (!iovcnt)
+        return 0;
+    ssize_t n = writev(fd, iov, iovcnt);
+    if (n > 0)
+        ringbuf_store_tail(rb, tail + n);
+    RINGBUF_STAT_SHORT(rb, out, n, count);
+    return n;
+}
+
+ssize_t
+ringbuf_recvmsg(int sockfd, ringbuf_t rb, size_t count, int flags)
+{
+    struct iovec iov[2];
+    struct msghdr msg;
+    uint64_t head;
+    size_t nfree;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = ringbuf_readv_begin(rb, count, iov, &head, &nfree);
+    ssize_t n = recvmsg(sockfd, &msg, flags);
+
+    /* with MSG_TRUNC, n may exceed the bytes actually received */
+    ssize_t len = iov[0].iov_len + (msg.msg_iovlen == 2 ? iov[1].iov_len : 0);
+    ringbuf_readv_end(rb, head, nfree, MIN(len, n));
+    RINGBUF_STAT_SHORT(rb, in, MIN(len, n), count);
+    return n;
+}
+
+ssize_t
+ringbuf_sendmsg(int sockfd, ringbuf_t rb, size_t count, int flags)
+{
+    struct iovec iov[2];
+    struct msghdr msg;
+    uint64_t tail;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = ringbuf_writev_begin(rb, count, iov, &tail);
+    if (!msg.msg_iovlen)
+        return 0;
+    ssize_t n = sendmsg(sockfd, &msg, flags);
+    if (n > 0)
+        ringbuf_store_tail(rb, tail + n);
+    RINGBUF_STAT_SHORT(rb, out, n, count);
+    return n;
+}
+
+int
+ringbuf_used_iovec(const struct ringbuf_t *rb, size_t offset, struct iovec iov[2])
+{
+    assert(!(rb->flags & (RINGBUF_MPMC | RINGBUF_BROADCAST)));
+    size_t bytes_used = ringbuf_bytes_used(rb);
+    if (offset >= bytes_used)
+        return 0;
+    return ringbuf_region(rb, ringbuf_load_tail(rb) + offset, bytes_used - offset, iov);
+}
+
+int
+ringbuf_free_iovec(const struct ringbuf_t *rb, struct iovec iov[2])
+{
+    assert(!(rb->flags & RINGBUF_MPMC));
+    size_t bytes_free = ringbuf_bytes_free(rb);
+    if (bytes_free == 0)
+        return 0;
+    return ringbuf_region(rb, ringbuf_load_head_pending(rb), bytes_free, iov);
+}
+
+/*
+ * Records.
+ *
+ * Each record is stored as a native-endian 32-bit length, followed by
+ * the record's bytes. In padded ring buffers, a record that wouldn't
+ * fit between the head and the end of the buffer is preceded by
+ * padding up to the end of the buffer. If at least a length's worth
+ * of bytes are skipped, the padding begins with the length
+ * RINGBUF_RECORD_SKIP; otherwise, the consumer skips them
+ * implicitly, as a length wouldn't fit there anyway.
+ */
+#define RINGBUF_RECORD_HEADER sizeof(uint32_t)
+#define RINGBUF_RECORD_SKIP UINT32_MAX
+
+/*
+ * Copy count bytes between a contiguous memory area and the ring
+ * buffer bytes that start at the given counter, which must not be
+ * split across the end of the buffer more than once.
+ */
+static void
+ringbuf_record_put(ringbuf_t rb, uint64_t counter, const void *src, size_t count)
+{
+    struct iovec iov[2];
+    ringbuf_region(rb, counter, count, iov);
+    memcpy(iov[0].iov_base, src, iov[0].iov_len);
+    memcpy(iov[1].iov_base, (const uint8_t *) src + iov[0].iov_len, iov[1].iov_len);
+}
+
+static void
+ringbuf_record_get(void *dst, const struct ringbuf_t *rb, uint64_t counter, size_t count)
+{
+    struct iovec iov[2];
+    ringbuf_region(rb, counter, count, iov);
+    memcpy(dst, iov[0].iov_base, iov[0].iov_len);
+    memcpy((uint8_t *) dst + iov[0].iov_len, iov[1].iov_base, iov[1].iov_len);
+}
+
+/*
+ * The number of padding bytes that precede a record of len bytes
+ * pushed at head.
+ */
+static size_t
+ringbuf_record_padding(const struct ringbuf_t *rb, uint64_t head, size_t len)
+{
+    if (!(rb->flags & RINGBUF_RECORD_PAD))
+        return 0;
+    size_t contig = ringbuf_end(rb) - ringbuf_ptr(rb, head);
+    return contig < RINGBUF_RECORD_HEADER + len ? contig : 0;
+}
+
+/*
+ * Find the record at tail, given the number of bytes used after it.
+ * Returns the number of bytes the record occupies, including its
+ * length and any padding before it, and sets *body and *len to the
+ * counter and length of the record's bytes; or returns 0 if there's
+ * no record.
+ */
+static size_t
+ringbuf_record_at(const struct ringbuf_t *rb, uint64_t tail, size_t bytes_used,
+                  uint64_t *body, size_t *len)
+{
+    size_t skip = 0;
+    uint32_t hdr;
+    if (bytes_used < RINGBUF_RECORD_HEADER)
+        return 0;
+    if (rb->flags & RINGBUF_RECORD_PAD) {
+        size_t contig = ringbuf_end(rb) - ringbuf_ptr(rb, tail);
+        if (contig < RINGBUF_RECORD_HEADER)
+            skip = contig;
+        else {
+            memcpy(&hdr, ringbuf_ptr(rb, tail), RINGBUF_RECORD_HEADER);
+            if (hdr == RINGBUF_RECORD_SKIP)
+                skip = contig;
+        }
+        if (bytes_used - skip < RINGBUF_RECORD_HEADER)
+            return 0;
+    }
+    ringbuf_record_get(&hdr, rb, tail + skip, RINGBUF_RECORD_HEADER);
+    if (hdr > bytes_used - skip - RINGBUF_RECORD_HEADER)
+        return 0;
+    *body = tail + skip + RINGBUF_RECORD_HEADER;
+    *len = hdr;
+    return skip + RINGBUF_RECORD_HEADER + hdr;
+}
+
+int
+ringbuf_push_record(ringbuf_t rb, const void *src, size_t len)
+{
+    assert(!(rb->flags & (RINGBUF_MPMC | RINGBUF_BROADCAST)));
+    if (len >= RINGBUF_RECORD_SKIP)
+        return 0;
+    ringbuf_auto_grow(rb, RINGBUF_RECORD_HEADER + len);
+    if (len > ringbuf_capacity(rb))
+        return 0;
+    uint64_t head = ringbuf_load_head_pending(rb);
+    size_t skip = ringbuf_record_padding(rb, head, len);
+    size_t count = skip + RINGBUF_RECORD_HEADER + len;
+    if (count > ringbuf_capacity(rb) || count > ringbuf_producer_free(rb, count)) {
+        RINGBUF_STAT(rb, in_rejected, 1);
+        return 0;
+    }
+
+    uint32_t hdr = RINGBUF_RECORD_SKIP;
+    if (skip >= RINGBUF_RECORD_HEADER)
+        memcpy(ringbuf_ptr(rb, head), &hdr, RINGBUF_RECORD_HEADER);
+    hdr = len;
+    ringbuf_record_put(rb, head + skip, &hdr, RINGBUF_RECORD_HEADER);
+    if (len)
+        ringbuf_record_put(rb, head + skip + RINGBUF_RECORD_HEADER, src, len);
+    ringbuf_produce(rb, head + count);
+    return 1;
+}
+
+ssize_t
+ringbuf_peek_record(ringbuf_t rb, struct iovec iov[2])
+{
+    assert(!(rb->flags & (RINGBUF_MPMC | RINGBUF_BROADCAST)));
+    uint64_t body;
+    size_t len;
+    if (!ringbuf_record_at(rb, ringbuf_load_tail(rb), ringbuf_bytes_used(rb), &body, &len))
+        return -1;
+    ringbuf_region(rb, body, len, iov);
+    return len;
+}
+
+size_t
+ringbuf_peek_records(ringbuf_t rb, struct iovec iov[][2], size_t n)
+{
+    assert(!(rb->flags & (RINGBUF_MPMC | RINGBUF_BROADCAST)));
+    uint64_t tail = ringbuf_load_tail(rb);
+    size_t bytes_used = ringbuf_bytes_used(rb);
+    size_t i;
+    for (i = 0; i != n; ++i) {
+        uint64_t body;
+        size_t len;
+        size_t count = ringbuf_record_at(rb, tail, bytes_used, &body, &len);
+        if (!count)
+            break;
+        ringbuf_region(rb, body, len, iov[i]);
+        tail += count;
+        bytes_used -= count;
+    }
+    return i;
+}
+
+size_t
+ringbuf_consume_records(ringbuf_t rb, size_t n)
+{
+    assert(!(rb->flags & (RINGBUF_MPMC | RINGBUF_BROADCAST)));
+    uint64_t tail = ringbuf_load_tail(rb);
+    size_t bytes_used = ringbuf_bytes_used(rb);
+    size_t i;
+    for (i = 0; i != n; ++i) {
+        uint64_t body;
+        size_t len;
+        size_t count = ringbuf_record_at(rb, tail, bytes_used, &body, &len);
+        if (!count)
+            break;
+        tail += count;
+        bytes_used -= count;
+    }
+    if (i)
+        ringbuf_store_tail(rb, tail);
+    return i;
+}
+
+ssize_t
+ringbuf_pop_record(void *dst, ringbuf_t src, size_t size)
+{
+    size_t len;
+    if (ringbuf_pop_records(dst, src, size, &len, 1))
+        return len;
+    struct iovec iov[2];
+    return ringbuf_peek_record(src, iov);
+}
+
+size_t
+ringbuf_pop_records(void *dst, ringbuf_t src, size_t size, size_t *lens, size_t n)
+{
+    assert(!(src->flags & (RINGBUF_MPMC | RINGBUF_BROADCAST)));
+    uint8_t *u8dst = dst;
+    uint64_t tail = ringbuf_load_tail(src);
+    size_t bytes_used = ringbuf_bytes_used(src);
+    size_t i;
+    for (i = 0; i != n; ++i) {
+        uint64_t body;
+        size_t len;
+        size_t count = ringbuf_record_at(src, tail, bytes_used, &body, &len);
+        if (!count || len > size)
+            break;
+        if (len)
+            ringbuf_record_get(u8dst, src, body, len);
+        lens[i] = len;
+        u8dst += len;
+        size -= len;
+        tail += count;
+        bytes_used -= count;
+    }
+    if (i)
+        ringbuf_store_tail(src, tail);
+    return i;
+}
+
+/*
+ * Element ring buffers.
+ *
+ * The internal buffer of an element ring buffer is a whole number of
+ * elements, with no sacrificial byte, and the head and tail only
+ * ever move by whole elements, so no element is ever split across
+ * the end of the buffer.
+ */
+ringbuf_t
+ringbuf_new_elems(size_t nelems, size_t elem_size, int flags)
+{
+    if ((flags & (RINGBUF_INTERNAL_FLAGS | RINGBUF_RECORD_PAD)) || elem_size == 0 ||
+        nelems == 0 || nelems > SIZE_MAX / elem_size)
+        return 0;
+    flags |= RINGBUF_ELEMS;
+    size_t size = ringbuf_size_for(nelems * elem_size, flags);
+    if (size == 0 || size % elem_size)
+        return 0;
+    ringbuf_t rb = ringbuf_create(nelems * elem_size, flags, -1);
+    if (rb)
+        rb->elem_size = elem_size;
+    return rb;
+}
+
+size_t
+ringbuf_elem_size(const struct ringbuf_t *rb)
+{
+    return rb->elem_size;
+}
+
+size_t
+ringbuf_elems_capacity(const struct ringbuf_t *rb)
+{
+    return ringbuf_capacity(rb) / rb->elem_size;
+}
+
+size_t
+ringbuf_elems_used(const struct ringbuf_t *rb)
+{
+    return ringbuf_bytes_used(rb) / rb->elem_size;
+}
+
+size_t
+ringbuf_elems_free(const struct ringbuf_t *rb)
+{
+    return ringbuf_bytes_free(rb) / rb->elem_size;
+}
+
+/*
+ * Claim up to n elements for the producer, beginning at *head, and
+ * return the number claimed. Ring buffers that are allowed to
+ * overflow always claim all n (up to their capacity).
+ */
+static size_t
+ringbuf_elems_producer_claim(ringbuf_t rb, size_t n, uint64_t *head, int *overflow)
+{
+    size_t es = rb->elem_size;
+    if (n <= SIZE_MAX / es)
+        ringbuf_auto_grow(rb, n * es);
+    if (n > ringbuf_capacity(rb) / es && (rb->flags & RINGBUF_OVERFLOW_REJECT))
+        return 0;
+    n = MIN(n, ringbuf_capacity(rb) / es);
+    while (n != 0) {
+        if (rb->flags & RINGBUF_NO_OVERWRITE) {
+            size_t nfree = ringbuf_bytes_free(rb) / es;
+            if (n > nfree && (rb->flags & RINGBUF_OVERFLOW_REJECT))
+                return 0;
+            n = MIN(n, nfree);
+        }
+        if (n != 0 && ringbuf_producer_claim(rb, n * es, head, overflow))
+            return n;
+    }
+    return 0;
+}
+
+/*
+ * Claim up to n elements for the consumer, beginning at *tail, and
+ * return the number claimed.
+ */
+static size_t
+ringbuf_elems_consumer_claim(ringbuf_t rb, size_t n, uint64_t *tail)
+{
+    size_t es = rb->elem_size;
+    while (n != 0) {
+        uint64_t t = atomic_load_explicit((rb->flags & RINGBUF_MPMC) ? &rb->tail_pending : &rb->tail,
+                                          memory_order_acquire);
+        n = MIN(n, (ringbuf_load_head(rb) - t) / es);
+        if (n != 0 && ringbuf_consumer_claim(rb, n * es, tail))
+            return n;
+    }
+    return 0;
+}
+
+int
+ringbuf_push(ringbuf_t rb, const void *elem)
+{
+    uint64_t head;
+    int overflow;
+    ringbuf_auto_grow(rb, rb->elem_size);
+    if (!ringbuf_producer_claim(rb, rb->elem_size, &head, &overflow)) {
+        RINGBUF_STAT(rb, in_rejected, 1);
+        return 0;
+    }
+    memcpy(ringbuf_ptr(rb, head), elem, rb->elem_size);
+    ringbuf_producer_commit(rb, head, rb->elem_size, overflow);
+    return 1;
+}
+
+size_t
+ringbuf_push_n(ringbuf_t rb, const void *elems, size_t n)
+{
+    uint64_t head;
+    int overflow;
+    size_t requested = n;
+    n = ringbuf_elems_producer_claim(rb, n, &head, &overflow);
+
+    /*
+     * Like ringbuf_memcpy_into, a ring buffer that overflows keeps the
+     * newest elements of a batch that's larger than it is.
+     */
+    size_t doomed = n != 0 && !(rb->flags & RINGBUF_NO_OVERWRITE) ? requested - n : 0;
+    RINGBUF_STAT_SHORT(rb, in, n + doomed, requested);
+    if (n == 0)
+        return 0;
+    elems = (const uint8_t *) elems + doomed * rb->elem_size;
+    struct iovec iov[2];
+    ringbuf_region(rb, head, n * rb->elem_size, iov);
+    memcpy(iov[0].iov_base, elems, iov[0].iov_len);
+    memcpy(iov[1].iov_base, (const uint8_t *) elems + iov[0].iov_len, iov[1].iov_len);
+    ringbuf_producer_commit(rb, head, n * rb->elem_size, overflow);
+    return n + doomed;
+}
+
+int
+ringbuf_pop(void *dst, ringbuf_t src)
+{
+    assert(!(src->flags & RINGBUF_BROADCAST));
+    uint64_t tail;
+    if (!ringbuf_consumer_claim(src, src->elem_size, &tail)) {
+        RINGBUF_STAT(src, out_rejected, 1);
+        return 0;
+    }
+    memcpy(dst, ringbuf_ptr(src, tail), src->elem_size);
+    ringbuf_consumer_commit(src, tail, src->elem_size);
+    return 1;
+}
+
+size_t
+ringbuf_pop_n(void *dst, ringbuf_t src, size_t n)
+{
+    assert(!(src->flags & RINGBUF_BROADCAST));
+    uint64_t tail;
+    size_t requested = n;
+    n = ringbuf_elems_consumer_claim(src, n, &tail);
+    RINGBUF_STAT_SHORT(src, out, n, requested);
+    if (n == 0)
+        return 0;
+    struct iovec iov[2];
+    ringbuf_region(src, tail, n * src->elem_size, iov);
+    memcpy(dst, iov[0].iov_base, iov[0].iov_len);
+    memcpy((uint8_t *) dst + iov[0].iov_len, iov[1].iov_base, iov[1].iov_len);
+    ringbuf_consumer_commit(src, tail, n * src->elem_size);
+    return n;
+}
+
+void *
+ringbuf_at(const struct ringbuf_t *rb, size_t k)
+{
+    assert(!(rb->flags & (RINGBUF_MPMC | RINGBUF_BROADCAST)));
+    uint64_t tail = ringbuf_load_tail(rb);
+    size_t n = (ringbuf_load_head(rb) - tail) / rb->elem_size;
+    if (k >= n)
+        return 0;
+    return ringbuf_ptr(rb, tail + k * rb->elem_size);
+}
+
+ringbuf_reader_t
+ringbuf_reader_new(ringbuf_t rb)
+{
+    size_t i;
+    for (i = 0; i != rb->max_readers; ++i) {
+        struct ringbuf_reader_t *r = &rb->readers[i];
+        int state = READER_FREE;
+        if (atomic_compare_exchange_strong(&r->state, &state, READER_JOINING)) {
+            /*
+             * The slot is ours. The producer waits for joining
+             * readers to become active before it computes the tail,
+             * and this fence pairs with the one in
+             * ringbuf_readers_tail, so either the producer sees our
+             * slot, or we see a head that's no older than the tail
+             * it computes.
+             */
+            atomic_thread_fence(memory_order_seq_cst);
+            r->head_cache = ringbuf_load_head(rb);
+            atomic_store_explicit(&r->tail, r->head_cache, memory_order_relaxed);
+            atomic_store_explicit(&r->state, READER_ACTIVE, memory_order_release);
+            return r;
+        }
+    }
+    return 0;
+}
+
+void
+ringbuf_reader_free(ringbuf_reader_t *r)
+{
+    assert(r && *r);
+    atomic_store_explicit(&(*r)->state, READER_FREE, memory_order_release);
+    *r = 0;
+}
+
+int
+ringbuf_reader_is_evicted(const struct ringbuf_reader_t *r)
+{
+    return atomic_load_explicit(&r->state, memory_order_acquire) == READER_EVICTED;
+}
+
+size_t
+ringbuf_reader_bytes_used(const struct ringbuf_reader_t *r)
+{
+    if (ringbuf_reader_is_evicted(r))
+        return 0;
+    uint64_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    return ringbuf_load_head(r->rb) - tail;
+}
+
+/*
+ * The number of bytes available to reader r. The producer's head is
+ * only reloaded if the cached copy says there are fewer than count
+ * bytes available.
+ */
+static size_t
+ringbuf_reader_used(ringbuf_reader_t r, size_t count)
+{
+    uint64_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    size_t nused = r->head_cache - tail;
+    if (nused < count) {
+        r->head_cache = ringbuf_load_head(r->rb);
+        nused = r->head_cache - tail;
+    }
+    return nused;
+}
+
+void *
+ringbuf_reader_memcpy_from(void *dst, ringbuf_reader_t r, size_t count)
+{
+    if (ringbuf_reader_is_evicted(r) || count > ringbuf_reader_used(r, count))
+        return 0;
+
+    ringbuf_t src = r->rb;
+    uint8_t *u8dst = dst;
+    const uint8_t *bufend = ringbuf_end(src);
+    uint64_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    uint8_t *p = ringbuf_ptr(src, tail);
+    size_t nwritten = 0;
+    while (nwritten != count) {
+        assert(bufend > p);
+        size_t n = MIN(bufend - p, count - nwritten);
+        memcpy(u8dst + nwritten, p, n);
+        p += n;
+        nwritten += n;
+
+        /* wrap ? */
+        if (p == bufend)
+            p = ringbuf_buf(src);
+    }
+
+    /*
+     * If we were evicted while copying, the producer may have
+     * overwritten the bytes we copied, so they can't be trusted. The
+     * producer evicts readers before it overwrites their bytes, so if
+     * we copied any overwritten bytes, we're guaranteed to see the
+     * eviction here.
+     */
+    atomic_thread_fence(memory_order_acquire);
+    if (ringbuf_reader_is_evicted(r))
+        return 0;
+
+    atomic_store_explicit(&r->tail, tail + count, memory_order_release);
+    return ringbuf_ptr(src, tail + count);
+}
+
+ssize_t
+ringbuf_reader_write(int fd, ringbuf_reader_t r, size_t count)
+{
+    if (ringbuf_reader_is_evicted(r) || count > ringbuf_reader_used(r, count))
+        return 0;
+
+    ringbuf_t rb = r->rb;
+    const uint8_t *bufend = ringbuf_end(rb);
+    uint64_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    uint8_t *p = ringbuf_ptr(rb, tail);
+    assert(bufend > p);
+    count = MIN(bufend - p, count);
+    ssize_t n = write(fd, p, count);
+    if (n > 0) {
+        assert(p + n <= bufend);
+        atomic_store_explicit(&r->tail, tail + n, memory_order_release);
+    }
+
+    return n;
+}
 
 /*
- * The code is written for clarity, not cleverness or performance, and
- * contains many assert()s to enforce invariant assumptions and catch
- * bugs. Feel free to optimize the code and to remove asserts for use
- * in your own projects, once you're comfortable that it functions as
- * intended.
+ * A ring buffer set's shards are created on demand, by the first call
+ * to ringbuf_set_shard for each one, and published with a
+ * compare-and-swap (in case two threads race to create the same
+ * shard), so that the consumer, which skips the shards that don't
+ * exist yet, only ever sees them fully initialized. next, the shard
+ * the consumer looks at first, is only used by the consumer.
  */
-
-struct ringbuf_t
+struct ringbuf_set_t
 {
-    uint8_t *buf;
-    uint8_t *head, *tail;
-    size_t size;
+    size_t nshards;
+    size_t capacity;
+    int flags;
+    int order;
+    size_t next;
+    _Atomic(ringbuf_t) *shards;
 };
 
-ringbuf_t
-ringbuf_new(size_t capacity)
+ringbuf_set_t
+ringbuf_set_new(size_t nshards, size_t capacity, int flags, int order)
 {
-    ringbuf_t rb = malloc(sizeof(struct ringbuf_t));
-    if (rb) {
+    flags |= RINGBUF_SPSC;
+    if (nshards == 0 || (flags & (RINGBUF_MPMC | RINGBUF_BLOCKING | RINGBUF_INTERNAL_FLAGS)) ||
+        !ringbuf_valid_flags(flags) || ringbuf_size_for(capacity, flags) == 0)
+        return 0;
+    if (order != RINGBUF_SET_ROUND_ROBIN && order != RINGBUF_SET_BATCH &&
+        order != RINGBUF_SET_TIMESTAMP)
+        return 0;
 
-        /* One byte is used for detecting the full condition. */
-        rb->size = capacity + 1;
-        rb->buf = malloc(rb->size);
-        if (rb->buf)
-            ringbuf_reset(rb);
-        else {
-            free(rb);
-            return 0;
-        }
+    ringbuf_set_t set = malloc(sizeof(struct ringbuf_set_t));
+    if (!set)
+        return 0;
+    set->shards = malloc(nshards * sizeof(*set->shards));
+    if (!set->shards) {
+        free(set);
+        return 0;
     }
-    return rb;
+    size_t i;
+    for (i = 0; i != nshards; ++i)
+        atomic_init(&set->shards[i], 0);
+    set->nshards = nshards;
+    set->capacity = capacity;
+    set->flags = flags;
+    set->order = order;
+    set->next = 0;
+    return set;
+}
+
+void
+ringbuf_set_free(ringbuf_set_t *set)
+{
+    assert(set && *set);
+    size_t i;
+    for (i = 0; i != (*set)->nshards; ++i) {
+        ringbuf_t rb = atomic_load_explicit(&(*set)->shards[i], memory_order_acquire);
+        if (rb)
+            ringbuf_free(&rb);
+    }
+    free((*set)->shards);
+    free(*set);
+    *set = 0;
 }
 
 size_t
-ringbuf_buffer_size(const struct ringbuf_t *rb)
+ringbuf_set_nshards(const struct ringbuf_set_t *set)
 {
-    return rb->size;
+    return set->nshards;
 }
 
-void
-ringbuf_reset(ringbuf_t rb)
+/*
+ * The NUMA node of the CPU that the calling thread is running on, or
+ * -1 if it can't be determined.
+ */
+static int
+ringbuf_local_node(void)
 {
-    rb->head = rb->tail = rb->buf;
+#if defined(__linux__) && defined(__NR_getcpu)
+    unsigned cpu, node;
+    if (syscall(__NR_getcpu, &cpu, &node, 0) == 0)
+        return (int) node;
+#endif
+    return -1;
 }
 
-void
-ringbuf_free(ringbuf_t *rb)
+ringbuf_t
+ringbuf_set_shard(ringbuf_set_t set, size_t i)
 {
-    assert(rb && *rb);
-    free((*rb)->buf);
-    free(*rb);
-    *rb = 0;
+    if (i >= set->nshards)
+        return 0;
+    ringbuf_t rb = atomic_load_explicit(&set->shards[i], memory_order_acquire);
+    if (rb)
+        return rb;
+
+    /* not every system can bind memory to the node */
+    int node = ringbuf_local_node();
+    if (node < 0 || !(rb = ringbuf_create(set->capacity, set->flags, node)))
+        rb = ringbuf_create(set->capacity, set->flags, -1);
+    if (!rb)
+        return 0;
+    ringbuf_t existing = 0;
+    if (!atomic_compare_exchange_strong_explicit(&set->shards[i], &existing, rb,
+                                                 memory_order_acq_rel, memory_order_acquire)) {
+        ringbuf_free(&rb);
+        rb = existing;
+    }
+    return rb;
 }
 
-size_t
-ringbuf_capacity(const struct ringbuf_t *rb)
+static ringbuf_t
+ringbuf_set_get(const struct ringbuf_set_t *set, size_t i)
 {
-    return ringbuf_buffer_size(rb) - 1;
+    return atomic_load_explicit(&set->shards[i], memory_order_acquire);
 }
 
 /*
- * Return a pointer to one-past-the-end of the ring buffer's
- * contiguous buffer. You shouldn't normally need to use this function
- * unless you're writing a new ringbuf_* function.
+ * The timestamp of the oldest record in rb, if there is one: the
+ * record's first 8 bytes, or 0 if it's shorter than that.
  */
-static const uint8_t *
-ringbuf_end(const struct ringbuf_t *rb)
+static int
+ringbuf_set_timestamp(ringbuf_t rb, uint64_t *timestamp)
 {
-    return rb->buf + ringbuf_buffer_size(rb);
+    struct iovec iov[2];
+    ssize_t len = ringbuf_peek_record(rb, iov);
+    if (len < 0)
+        return 0;
+    *timestamp = 0;
+    if (len >= (ssize_t) sizeof(*timestamp)) {
+        uint8_t bytes[sizeof(*timestamp)];
+        size_t n = MIN(iov[0].iov_len, sizeof(bytes));
+        memcpy(bytes, iov[0].iov_base, n);
+        memcpy(bytes + n, iov[1].iov_base, sizeof(bytes) - n);
+        memcpy(timestamp, bytes, sizeof(bytes));
+    }
+    return 1;
 }
 
-size_t
-ringbuf_bytes_free(const struct ringbuf_t *rb)
+/*
+ * Choose the shard that the consumer should take its next record
+ * from, starting with set->next, or return nshards if none has a
+ * record. Timestamp ties go to the first shard found, so, as next
+ * moves on, they're broken round-robin.
+ */
+static size_t
+ringbuf_set_choose(const struct ringbuf_set_t *set)
 {
-    if (rb->head >= rb->tail)
-        return ringbuf_capacity(rb) - (rb->head - rb->tail);
-    else
-        return rb->tail - rb->head - 1;
+    size_t best = set->nshards, k;
+    uint64_t best_timestamp = 0;
+    for (k = 0; k != set->nshards; ++k) {
+        size_t i = (set->next + k) % set->nshards;
+        ringbuf_t rb = ringbuf_set_get(set, i);
+        if (!rb)
+            continue;
+        if (set->order != RINGBUF_SET_TIMESTAMP) {
+            struct iovec iov[2];
+            if (ringbuf_peek_record(rb, iov) >= 0)
+                return i;
+            continue;
+        }
+        uint64_t timestamp;
+        if (ringbuf_set_timestamp(rb, &timestamp) &&
+            (best == set->nshards || timestamp < best_timestamp)) {
+            best = i;
+            best_timestamp = timestamp;
+        }
+    }
+    return best;
 }
 
-size_t
-ringbuf_bytes_used(const struct ringbuf_t *rb)
+/*
+ * Move on from shard i, which the consumer just took a record from
+ * (or, if done is 0, found a record too long to take).
+ */
+static void
+ringbuf_set_advance(ringbuf_set_t set, size_t i, int done)
 {
-    return ringbuf_capacity(rb) - ringbuf_bytes_free(rb);
+    if (done && set->order != RINGBUF_SET_BATCH)
+        i = (i + 1) % set->nshards;
+    set->next = i;
 }
 
-int
-ringbuf_is_full(const struct ringbuf_t *rb)
+ssize_t
+ringbuf_set_pop_record(void *dst, ringbuf_set_t set, size_t size, size_t *shard)
 {
-    return ringbuf_bytes_free(rb) == 0;
+    size_t i = ringbuf_set_choose(set);
+    if (i == set->nshards)
+        return -1;
+    ssize_t len = ringbuf_pop_record(dst, ringbuf_set_get(set, i), size);
+    ringbuf_set_advance(set, i, (size_t) len <= size);
+    if (shard)
+        *shard = i;
+    return len;
 }
 
-int
-ringbuf_is_empty(const struct ringbuf_t *rb)
+size_t
+ringbuf_set_pop_records(void *dst, ringbuf_set_t set, size_t size, size_t *lens, size_t n)
 {
-    return ringbuf_bytes_free(rb) == ringbuf_capacity(rb);
+    uint8_t *p = dst;
+    size_t npopped = 0;
+    while (npopped != n) {
+        size_t i = ringbuf_set_choose(set);
+        if (i == set->nshards)
+            break;
+
+        /* a batch takes as many of the shard's records as it can at once */
+        ringbuf_t rb = ringbuf_set_get(set, i);
+        size_t k;
+        if (set->order == RINGBUF_SET_BATCH)
+            k = ringbuf_pop_records(p, rb, size, lens + npopped, n - npopped);
+        else {
+            ssize_t len = ringbuf_pop_record(p, rb, size);
+            k = (size_t) len <= size;
+            if (k)
+                lens[npopped] = len;
+        }
+        ringbuf_set_advance(set, i, k != 0);
+        if (k == 0)
+            break;
+        for (; k; --k, ++npopped) {
+            p += lens[npopped];
+            size -= lens[npopped];
+        }
+    }
+    return npopped;
 }
 
-const void *
-ringbuf_tail(const struct ringbuf_t *rb)
+size_t
+ringbuf_set_bytes_used(const struct ringbuf_set_t *set)
 {
-    return rb->tail;
+    size_t used = 0, i;
+    for (i = 0; i != set->nshards; ++i) {
+        ringbuf_t rb = ringbuf_set_get(set, i);
+        if (rb)
+            used += ringbuf_bytes_used(rb);
+    }
+    return used;
 }
 
-const void *
-ringbuf_head(const struct ringbuf_t *rb)
+int
+ringbuf_set_get_stats(const struct ringbuf_set_t *set, struct ringbuf_stats *stats)
 {
-    return rb->head;
+    memset(stats, 0, sizeof(*stats));
+#ifdef RINGBUF_STATS
+    size_t i;
+    for (i = 0; i != set->nshards; ++i) {
+        ringbuf_t rb = ringbuf_set_get(set, i);
+        struct ringbuf_stats s;
+        if (!rb || !ringbuf_get_stats(rb, &s))
+            continue;
+        stats->in_bytes += s.in_bytes;
+        stats->in_calls += s.in_calls;
+        stats->in_short += s.in_short;
+        stats->in_rejected += s.in_rejected;
+        stats->in_wraps += s.in_wraps;
+        stats->overflows += s.overflows;
+        stats->overwritten += s.overwritten;
+        stats->high_water = MAX(stats->high_water, s.high_water);
+        stats->out_bytes += s.out_bytes;
+        stats->out_calls += s.out_calls;
+        stats->out_short += s.out_short;
+        stats->out_rejected += s.out_rejected;
+        stats->out_wraps += s.out_wraps;
+    }
+    return 1;
+#else
+    return 0;
+#endif
 }
 
+#ifdef __linux__
+
 /*
- * Given a ring buffer rb and a pointer to a location within its
- * contiguous buffer, return the a pointer to the next logical
- * location in the ring buffer.
+ * A zero-copy sender's bytes in flight are those between the ring
+ * buffer's tail and sent.
+ *
+ * For a pipe, the bytes still in the pipe are the last ones sent, so
+ * everything before them has been released.
+ *
+ * For a socket, the kernel numbers each successful MSG_ZEROCOPY send,
+ * starting from 0, and its completion notifications carry ranges of
+ * those numbers, which may arrive out of order. ends and done, which
+ * are indexed by send number modulo nslots (a power of two, so that
+ * the index survives the send number wrapping), record where each
+ * outstanding send ends in the ring buffer and whether it has
+ * completed; the tail is advanced past the oldest sends once they've
+ * completed.
  */
-static uint8_t *
-ringbuf_nextp(ringbuf_t rb, const uint8_t *p)
+struct ringbuf_zerocopy_t
 {
-    /*
-     * The assert guarantees the expression (++p - rb->buf) is
-     * non-negative; therefore, the modulus operation is safe and
-     * portable.
-     */
-    assert((p >= rb->buf) && (p < ringbuf_end(rb)));
-    return rb->buf + ((++p - rb->buf) % ringbuf_buffer_size(rb));
+    ringbuf_t rb;
+    int fd;
+    int is_pipe;
+    uint64_t sent;
+    size_t max_inflight;
+    uint32_t nslots;
+    uint32_t next_send;
+    uint32_t oldest_send;
+    uint64_t *ends;
+    uint8_t *done;
+};
+
+ringbuf_zerocopy_t
+ringbuf_zerocopy_new(ringbuf_t rb, int fd, size_t max_inflight)
+{
+    if (!(rb->flags & RINGBUF_SPSC) || (rb->flags & RINGBUF_BROADCAST) ||
+        max_inflight == 0 || max_inflight > (1u << 31))
+        return 0;
+    uint32_t nslots = 1;
+    while (nslots < max_inflight)
+        nslots *= 2;
+
+    struct stat st;
+    if (fstat(fd, &st) == -1)
+        return 0;
+    int is_pipe = S_ISFIFO(st.st_mode);
+    int one = 1;
+    if (!is_pipe && setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) == -1)
+        return 0;
+
+    ringbuf_zerocopy_t z = malloc(sizeof(struct ringbuf_zerocopy_t));
+    if (!z)
+        return 0;
+    z->rb = rb;
+    ++rb->zerocopy_senders;
+    z->ends = malloc(nslots * sizeof(uint64_t));
+    z->done = calloc(nslots, 1);
+    if (!z->ends || !z->done) {
+        ringbuf_zerocopy_free(&z);
+        return 0;
+    }
+    z->fd = fd;
+    z->is_pipe = is_pipe;
+    z->sent = ringbuf_load_tail(rb);
+    z->max_inflight = max_inflight;
+    z->nslots = nslots;
+    z->next_send = 0;
+    z->oldest_send = 0;
+    return z;
+}
+
+void
+ringbuf_zerocopy_free(ringbuf_zerocopy_t *z)
+{
+    assert(z && *z);
+    --(*z)->rb->zerocopy_senders;
+    free((*z)->ends);
+    free((*z)->done);
+    free(*z);
+    *z = 0;
 }
 
 size_t
-ringbuf_findchr(const struct ringbuf_t *rb, int c, size_t offset)
+ringbuf_zerocopy_pinned(const struct ringbuf_zerocopy_t *z)
 {
-    const uint8_t *bufend = ringbuf_end(rb);
-    size_t bytes_used = ringbuf_bytes_used(rb);
-    if (offset >= bytes_used)
-        return bytes_used;
+    return z->sent - ringbuf_load_tail(z->rb);
+}
 
-    const uint8_t *start = rb->buf +
-        (((rb->tail - rb->buf) + offset) % ringbuf_buffer_size(rb));
-    assert(bufend > start);
-    size_t n = MIN(bufend - start, bytes_used - offset);
-    const uint8_t *found = memchr(start, c, n);
-    if (found)
-        return offset + (found - start);
-    else
-        return ringbuf_findchr(rb, c, offset + n);
+ssize_t
+ringbuf_zerocopy_send(ringbuf_zerocopy_t z, size_t count, int flags)
+{
+    ringbuf_t rb = z->rb;
+    size_t pinned = ringbuf_zerocopy_pinned(z);
+    if (count + pinned > ringbuf_consumer_used(rb, count + pinned))
+        return 0;
+    if (!z->is_pipe && z->next_send - z->oldest_send == z->max_inflight)
+        return 0;
+
+    struct iovec iov[2];
+    int iovcnt = ringbuf_region(rb, z->sent, count, iov);
+    ssize_t n;
+    if (z->is_pipe)
+        n = vmsplice(z->fd, iov, iovcnt, flags);
+    else {
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = iovcnt;
+        n = sendmsg(z->fd, &msg, flags | MSG_ZEROCOPY);
+        if (n > 0) {
+            size_t i = z->next_send++ % z->nslots;
+            z->ends[i] = z->sent + n;
+            z->done[i] = 0;
+        }
+    }
+    if (n > 0)
+        z->sent += n;
+    return n;
 }
 
-size_t
-ringbuf_memset(ringbuf_t dst, int c, size_t len)
+ssize_t
+ringbuf_zerocopy_complete(ringbuf_zerocopy_t z)
 {
-    const uint8_t *bufend = ringbuf_end(dst);
-    size_t nwritten = 0;
-    size_t count = MIN(len, ringbuf_buffer_size(dst));
-    int overflow = count > ringbuf_bytes_free(dst);
+    ringbuf_t rb = z->rb;
+    uint64_t tail = ringbuf_load_tail(rb);
+    uint64_t new_tail = tail;
 
-    while (nwritten != count) {
+    if (z->is_pipe) {
+        int nqueued;
+        if (ioctl(z->fd, FIONREAD, &nqueued) == -1)
+            return -1;
+        new_tail = z->sent - MIN((uint64_t) nqueued, z->sent - tail);
+    } else {
+        for (;;) {
+            char control[CMSG_SPACE(sizeof(struct sock_extended_err) +
+                                    sizeof(struct sockaddr_in6))];
+            struct msghdr msg;
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_control = control;
+            msg.msg_controllen = sizeof(control);
+            if (recvmsg(z->fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) == -1) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK)
+                    break;
+                return -1;
+            }
 
-        /* don't copy beyond the end of the buffer */
-        assert(bufend > dst->head);
-        size_t n = MIN(bufend - dst->head, count - nwritten);
-        memset(dst->head, c, n);
-        dst->head += n;
-        nwritten += n;
+            struct cmsghdr *cmsg;
+            for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+                if (!((cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) ||
+                      (cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR)))
+                    continue;
+                struct sock_extended_err *ee = (struct sock_extended_err *) CMSG_DATA(cmsg);
+                if (ee->ee_errno != 0 || ee->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+                    continue;
 
-        /* wrap? */
-        if (dst->head == bufend)
-            dst->head = dst->buf;
-    }
+                /* ee_info..ee_data is an inclusive range of send numbers */
+                uint32_t send = ee->ee_info;
+                do {
+                    if (send - z->oldest_send < z->next_send - z->oldest_send)
+                        z->done[send % z->nslots] = 1;
+                } while (send++ != ee->ee_data);
+            }
+        }
 
-    if (overflow) {
-        dst->tail = ringbuf_nextp(dst, dst->head);
-        assert(ringbuf_is_full(dst));
+        while (z->oldest_send != z->next_send && z->done[z->oldest_send % z->nslots]) {
+            size_t i = z->oldest_send++ % z->nslots;
+            z->done[i] = 0;
+            new_tail = z->ends[i];
+        }
     }
 
-    return nwritten;
+    if (new_tail != tail)
+        ringbuf_store_tail(rb, new_tail);
+    return new_tail - tail;
 }
 
-void *
-ringbuf_memcpy_into(ringbuf_t dst, const void *src, size_t count)
+#endif /* __linux__ */
+
+#ifdef RINGBUF_IO_URING
+
+/*
+ * The io_uring engine. Each queued operation gets a slot in ops,
+ * whose index is the SQE's user_data; there are as many slots as CQ
+ * entries, so the completion queue can never overflow. The iovecs
+ * for unregistered ring buffers live in the slot, because the kernel
+ * may not read them until the operation is issued.
+ *
+ * The engine is only used by one thread, so its own indices don't
+ * need to be atomic. The shared ring indices are: the kernel advances
+ * the SQ head and the CQ tail, and the engine the SQ tail and the CQ
+ * head.
+ */
+struct ringbuf_uring_op
 {
-    const uint8_t *u8src = src;
-    const uint8_t *bufend = ringbuf_end(dst);
-    int overflow = count > ringbuf_bytes_free(dst);
-    size_t nread = 0;
+    ringbuf_t rb;
+    void *arg;
+    uint64_t counter; /* head or tail when the operation was queued */
+    int op;
+    struct iovec iov[2];
+};
 
-    while (nread != count) {
-        /* don't copy beyond the end of the buffer */
-        assert(bufend > dst->head);
-        size_t n = MIN(bufend - dst->head, count - nread);
-        memcpy(dst->head, u8src + nread, n);
-        dst->head += n;
-        nread += n;
+struct ringbuf_uring_t
+{
+    int fd;
+    void *sq_ring;
+    size_t sq_ring_size;
+    void *cq_ring;
+    size_t cq_ring_size;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
 
-        /* wrap? */
-        if (dst->head == bufend)
-            dst->head = dst->buf;
+    _Atomic unsigned *sq_head;
+    _Atomic unsigned *sq_tail;
+    unsigned *sq_array;
+    unsigned sq_mask;
+    unsigned sq_entries;
+    unsigned sq_queued; /* SQ tail, including unsubmitted SQEs */
+
+    _Atomic unsigned *cq_head;
+    _Atomic unsigned *cq_tail;
+    struct io_uring_cqe *cqes;
+    unsigned cq_mask;
+
+    struct ringbuf_uring_op *ops; /* an op's rb is 0 while it's free */
+    unsigned nops;
+    unsigned *free_ops;
+    unsigned nfree_ops;
+
+    ringbuf_t *registered;
+    unsigned nregistered;
+};
+
+ringbuf_uring_t
+ringbuf_uring_new(unsigned entries)
+{
+    ringbuf_uring_t u = calloc(1, sizeof(struct ringbuf_uring_t));
+    if (!u)
+        return 0;
+    u->sq_ring = u->cq_ring = u->sqes = MAP_FAILED;
+
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    u->fd = syscall(__NR_io_uring_setup, entries, &p);
+    if (u->fd == -1) {
+        ringbuf_uring_free(&u);
+        return 0;
     }
 
-    if (overflow) {
-        dst->tail = ringbuf_nextp(dst, dst->head);
-        assert(ringbuf_is_full(dst));
+    u->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    u->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+        u->sq_ring_size = u->cq_ring_size = MAX(u->sq_ring_size, u->cq_ring_size);
+    u->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    u->sq_ring = mmap(0, u->sq_ring_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+        u->cq_ring = u->sq_ring;
+    else
+        u->cq_ring = mmap(0, u->cq_ring_size, PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_CQ_RING);
+    u->sqes = mmap(0, u->sqes_size, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+    u->ops = calloc(p.cq_entries, sizeof(struct ringbuf_uring_op));
+    u->nops = p.cq_entries;
+    u->free_ops = malloc(p.cq_entries * sizeof(unsigned));
+    if (u->sq_ring == MAP_FAILED || u->cq_ring == MAP_FAILED ||
+        u->sqes == MAP_FAILED || !u->ops || !u->free_ops) {
+        ringbuf_uring_free(&u);
+        return 0;
     }
 
-    return dst->head;
+    uint8_t *sq = u->sq_ring;
+    u->sq_head = (_Atomic unsigned *) (sq + p.sq_off.head);
+    u->sq_tail = (_Atomic unsigned *) (sq + p.sq_off.tail);
+    u->sq_array = (unsigned *) (sq + p.sq_off.array);
+    u->sq_mask = *(unsigned *) (sq + p.sq_off.ring_mask);
+    u->sq_entries = p.sq_entries;
+    u->sq_queued = atomic_load_explicit(u->sq_tail, memory_order_relaxed);
+
+    uint8_t *cq = u->cq_ring;
+    u->cq_head = (_Atomic unsigned *) (cq + p.cq_off.head);
+    u->cq_tail = (_Atomic unsigned *) (cq + p.cq_off.tail);
+    u->cqes = (struct io_uring_cqe *) (cq + p.cq_off.cqes);
+    u->cq_mask = *(unsigned *) (cq + p.cq_off.ring_mask);
+
+    for (u->nfree_ops = 0; u->nfree_ops != p.cq_entries; ++u->nfree_ops)
+        u->free_ops[u->nfree_ops] = p.cq_entries - 1 - u->nfree_ops;
+
+    return u;
 }
 
-ssize_t
-ringbuf_read(int fd, ringbuf_t rb, size_t count)
+/* the user_data of the engine's own cancellation SQEs */
+#define RINGBUF_URING_CANCEL ((uint64_t) -1)
+
+/*
+ * Release an operation's slot, without touching its ring buffer's
+ * head or tail.
+ */
+static void
+ringbuf_uring_abandon(ringbuf_uring_t u, unsigned index)
 {
-    const uint8_t *bufend = ringbuf_end(rb);
-    size_t nfree = ringbuf_bytes_free(rb);
+    struct ringbuf_uring_op *o = &u->ops[index];
+    o->rb->uring_inflight &= ~o->op;
+    o->rb = 0;
+    u->free_ops[u->nfree_ops++] = index;
+}
 
-    /* don't write beyond the end of the buffer */
-    assert(bufend > rb->head);
-    count = MIN(bufend - rb->head, count);
-    ssize_t n = read(fd, rb->head, count);
-    if (n > 0) {
-        assert(rb->head + n <= bufend);
-        rb->head += n;
+/*
+ * Abandon all of the engine's operations. Operations that were never
+ * submitted are dropped; submitted ones are cancelled, and we wait
+ * until the kernel has completed them all, because closing the
+ * io_uring fd doesn't stop them from writing to their ring buffers.
+ * Returns 0 if io_uring_enter(2) fails, in which case some operations
+ * may still be in flight.
+ */
+static int
+ringbuf_uring_cancel(ringbuf_uring_t u)
+{
+    unsigned sq_tail = atomic_load_explicit(u->sq_tail, memory_order_relaxed);
+    for (; u->sq_queued != sq_tail; --u->sq_queued)
+        ringbuf_uring_abandon(u, u->sqes[(u->sq_queued - 1) & u->sq_mask].user_data);
 
-        /* wrap? */
-        if (rb->head == bufend)
-            rb->head = rb->buf;
+    unsigned next = 0;
+    while (u->nfree_ops != u->nops) {
+        unsigned sq_head = atomic_load_explicit(u->sq_head, memory_order_acquire);
+        for (; next != u->nops && u->sq_queued - sq_head != u->sq_entries; ++next) {
+            if (!u->ops[next].rb)
+                continue;
+            unsigned i = u->sq_queued++ & u->sq_mask;
+            struct io_uring_sqe *sqe = &u->sqes[i];
+            memset(sqe, 0, sizeof(*sqe));
+            sqe->opcode = IORING_OP_ASYNC_CANCEL;
+            sqe->fd = -1;
+            sqe->addr = next;
+            sqe->user_data = RINGBUF_URING_CANCEL;
+            u->sq_array[i] = i;
+        }
 
-        /* fix up the tail pointer if an overflow occurred */
-        if (n > nfree) {
-            rb->tail = ringbuf_nextp(rb, rb->head);
-            assert(ringbuf_is_full(rb));
+        /* EBUSY means the CQ overflowed, and we need to reap */
+        if (ringbuf_uring_submit(u, 1) == -1 &&
+            errno != EINTR && errno != EAGAIN && errno != EBUSY)
+            return 0;
+
+        unsigned head = atomic_load_explicit(u->cq_head, memory_order_relaxed);
+        unsigned tail = atomic_load_explicit(u->cq_tail, memory_order_acquire);
+        for (; head != tail; ++head) {
+            uint64_t user_data = u->cqes[head & u->cq_mask].user_data;
+            if (user_data != RINGBUF_URING_CANCEL)
+                ringbuf_uring_abandon(u, user_data);
         }
+        atomic_store_explicit(u->cq_head, head, memory_order_release);
     }
+    return 1;
+}
 
-    return n;
+void
+ringbuf_uring_free(ringbuf_uring_t *u)
+{
+    assert(u && *u);
+    ringbuf_uring_t e = *u;
+    unsigned i;
+    for (i = 0; i != e->nregistered; ++i)
+        e->registered[i]->uring = 0;
+
+    /*
+     * Operations that never completed are abandoned. If they can't
+     * be cancelled, their ring buffers stay marked as in flight, so
+     * that nothing else can be done with the bytes they may still
+     * write to or read from.
+     */
+    if (e->sq_head && e->nfree_ops != e->nops)
+        ringbuf_uring_cancel(e);
+    free(e->registered);
+    free(e->ops);
+    free(e->free_ops);
+    if (e->sqes != MAP_FAILED)
+        munmap(e->sqes, e->sqes_size);
+    if (e->cq_ring != MAP_FAILED && e->cq_ring != e->sq_ring)
+        munmap(e->cq_ring, e->cq_ring_size);
+    if (e->sq_ring != MAP_FAILED)
+        munmap(e->sq_ring, e->sq_ring_size);
+    if (e->fd != -1)
+        close(e->fd);
+    free(e);
+    *u = 0;
 }
 
-void *
-ringbuf_memcpy_from(void *dst, ringbuf_t src, size_t count)
+int
+ringbuf_uring_register(ringbuf_uring_t u, ringbuf_t *rbs, unsigned nrbs)
 {
-    size_t bytes_used = ringbuf_bytes_used(src);
-    if (count > bytes_used)
+    if (u->registered || nrbs == 0)
         return 0;
 
-    uint8_t *u8dst = dst;
-    const uint8_t *bufend = ringbuf_end(src);
-    size_t nwritten = 0;
-    while (nwritten != count) {
-        assert(bufend > src->tail);
-        size_t n = MIN(bufend - src->tail, count - nwritten);
-        memcpy(u8dst + nwritten, src->tail, n);
-        src->tail += n;
-        nwritten += n;
+    unsigned i;
+    for (i = 0; i != nrbs; ++i)
+        if (rbs[i]->uring || (rbs[i]->flags & (RINGBUF_SHARED | RINGBUF_PERSISTENT)))
+            return 0;
 
-        /* wrap ? */
-        if (src->tail == bufend)
-            src->tail = src->buf;
+    struct iovec *iov = malloc(nrbs * sizeof(struct iovec));
+    u->registered = malloc(nrbs * sizeof(ringbuf_t));
+    if (!iov || !u->registered) {
+        free(iov);
+        free(u->registered);
+        u->registered = 0;
+        return 0;
+    }
+    for (i = 0; i != nrbs; ++i) {
+        iov[i].iov_base = ringbuf_buf(rbs[i]);
+        iov[i].iov_len = ringbuf_end(rbs[i]) - ringbuf_buf(rbs[i]);
+    }
+    int result = syscall(__NR_io_uring_register, u->fd, IORING_REGISTER_BUFFERS,
+                         iov, nrbs);
+    free(iov);
+    if (result == -1) {
+        free(u->registered);
+        u->registered = 0;
+        return 0;
     }
 
-    assert(count + ringbuf_bytes_used(src) == bytes_used);
-    return src->tail;
+    for (i = 0; i != nrbs; ++i) {
+        rbs[i]->uring = u;
+        rbs[i]->uring_index = i;
+        u->registered[i] = rbs[i];
+    }
+    u->nregistered = nrbs;
+    return 1;
 }
 
-ssize_t
-ringbuf_write(int fd, ringbuf_t rb, size_t count)
+/*
+ * Queue an SQE for operation op on the count bytes of rb starting at
+ * counter. Returns 0 if the SQ or the op slots are full.
+ */
+static int
+ringbuf_uring_queue(ringbuf_uring_t u, int fd, ringbuf_t rb, int op,
+                    uint64_t counter, size_t count, void *arg)
 {
-    size_t bytes_used = ringbuf_bytes_used(rb);
-    if (count > bytes_used)
+    unsigned sq_head = atomic_load_explicit(u->sq_head, memory_order_acquire);
+    if (u->sq_queued - sq_head == u->sq_entries || u->nfree_ops == 0)
         return 0;
 
-    const uint8_t *bufend = ringbuf_end(rb);
-    assert(bufend > rb->head);
-    count = MIN(bufend - rb->tail, count);
-    ssize_t n = write(fd, rb->tail, count);
-    if (n > 0) {
-        assert(rb->tail + n <= bufend);
-        rb->tail += n;
-
-        /* wrap? */
-        if (rb->tail == bufend)
-            rb->tail = rb->buf;
+    unsigned index = u->free_ops[--u->nfree_ops];
+    struct ringbuf_uring_op *o = &u->ops[index];
+    o->rb = rb;
+    o->arg = arg;
+    o->counter = counter;
+    o->op = op;
+    int iovcnt = ringbuf_region(rb, counter, count, o->iov);
 
-        assert(n + ringbuf_bytes_used(rb) == bytes_used);
+    unsigned i = u->sq_queued++ & u->sq_mask;
+    struct io_uring_sqe *sqe = &u->sqes[i];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->fd = fd;
+    sqe->off = (uint64_t) -1; /* use (and advance) the file position */
+    sqe->user_data = index;
+    if (rb->uring == u) {
+        sqe->opcode = op == RINGBUF_URING_READ ? IORING_OP_READ_FIXED : IORING_OP_WRITE_FIXED;
+        sqe->addr = (uintptr_t) o->iov[0].iov_base;
+        sqe->len = o->iov[0].iov_len;
+        sqe->buf_index = rb->uring_index;
+    } else {
+        sqe->opcode = op == RINGBUF_URING_READ ? IORING_OP_READV : IORING_OP_WRITEV;
+        sqe->addr = (uintptr_t) o->iov;
+        sqe->len = iovcnt;
     }
+    u->sq_array[i] = i;
+    rb->uring_inflight |= op;
+    return 1;
+}
 
-    return n;
+int
+ringbuf_uring_read(ringbuf_uring_t u, int fd, ringbuf_t rb, size_t count, void *arg)
+{
+    assert(!(rb->flags & RINGBUF_MPMC));
+    if (rb->uring_inflight & RINGBUF_URING_READ)
+        return 0;
+    count = MIN(ringbuf_producer_free(rb, count), count);
+    if (count == 0)
+        return 0;
+    return ringbuf_uring_queue(u, fd, rb, RINGBUF_URING_READ,
+                               ringbuf_load_head_pending(rb), count, arg);
 }
 
-void *
-ringbuf_copy(ringbuf_t dst, ringbuf_t src, size_t count)
+int
+ringbuf_uring_write(ringbuf_uring_t u, int fd, ringbuf_t rb, size_t count, void *arg)
 {
-    size_t src_bytes_used = ringbuf_bytes_used(src);
-    if (count > src_bytes_used)
+    assert(!(rb->flags & RINGBUF_MPMC));
+    if (rb->uring_inflight & RINGBUF_URING_WRITE)
         return 0;
-    int overflow = count > ringbuf_bytes_free(dst);
+    if (count == 0 || count > ringbuf_consumer_used(rb, count))
+        return 0;
+    return ringbuf_uring_queue(u, fd, rb, RINGBUF_URING_WRITE,
+                               ringbuf_load_tail(rb), count, arg);
+}
 
-    const uint8_t *src_bufend = ringbuf_end(src);
-    const uint8_t *dst_bufend = ringbuf_end(dst);
-    size_t ncopied = 0;
-    while (ncopied != count) {
-        assert(src_bufend > src->tail);
-        size_t nsrc = MIN(src_bufend - src->tail, count - ncopied);
-        assert(dst_bufend > dst->head);
-        size_t n = MIN(dst_bufend - dst->head, nsrc);
-        memcpy(dst->head, src->tail, n);
-        src->tail += n;
-        dst->head += n;
-        ncopied += n;
+int
+ringbuf_uring_submit(ringbuf_uring_t u, unsigned wait_nr)
+{
+    atomic_store_explicit(u->sq_tail, u->sq_queued, memory_order_release);
+    unsigned to_submit =
+        u->sq_queued - atomic_load_explicit(u->sq_head, memory_order_acquire);
+    return syscall(__NR_io_uring_enter, u->fd, to_submit, wait_nr,
+                   wait_nr ? IORING_ENTER_GETEVENTS : 0, 0, 0);
+}
 
-        /* wrap ? */
-        if (src->tail == src_bufend)
-            src->tail = src->buf;
-        if (dst->head == dst_bufend)
-            dst->head = dst->buf;
-    }
+unsigned
+ringbuf_uring_complete(ringbuf_uring_t u, ringbuf_uring_fn fn)
+{
+    unsigned head = atomic_load_explicit(u->cq_head, memory_order_relaxed);
+    unsigned tail = atomic_load_explicit(u->cq_tail, memory_order_acquire);
+    unsigned ncompleted = tail - head;
+    for (; head != tail; ++head) {
+        struct io_uring_cqe *cqe = &u->cqes[head & u->cq_mask];
+        unsigned index = cqe->user_data;
+        int res = cqe->res;
+        struct ringbuf_uring_op o = u->ops[index];
+        u->ops[index].rb = 0;
+        u->free_ops[u->nfree_ops++] = index;
 
-    assert(count + ringbuf_bytes_used(src) == src_bytes_used);
-    
-    if (overflow) {
-        dst->tail = ringbuf_nextp(dst, dst->head);
-        assert(ringbuf_is_full(dst));
-    }
+        /* reads are clamped to the free bytes, so they never overflow */
+        if (res > 0) {
+            if (o.op == RINGBUF_URING_READ)
+                ringbuf_produce(o.rb, o.counter + res);
+            else
+                ringbuf_store_tail(o.rb, o.counter + res);
+        }
+        o.rb->uring_inflight &= ~o.op;
 
-    return dst->head;
+        /* release the CQE before fn, which may queue more operations */
+        atomic_store_explicit(u->cq_head, head + 1, memory_order_release);
+        if (fn)
+            fn(o.arg, o.op, o.rb, res);
+    }
+    return ncompleted;
 }
+
+#endif /* RINGBUF_IO_URING */
@@ -24,12 +24,41 @@
  * (e.g., with ringbuf_read). The ring buffer's tail pointer points to
  * the starting location where data should be read when copying data
  * *from* the buffer (e.g., with ringbuf_write).
+ *
+ * Functions that copy data into the buffer (ringbuf_memset,
+ * ringbuf_memcpy_into, ringbuf_read, and ringbuf_copy's dst) make up
+ * the buffer's producer side, and functions that copy data out of it
+ * (ringbuf_memcpy_from, ringbuf_write, and ringbuf_copy's src) make up
+ * its consumer side. Ring buffers are not thread-safe by default, but
+ * see RINGBUF_SPSC, below.
  */
 
 #include <stddef.h>
+#include <stdint.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 
 typedef struct ringbuf_t *ringbuf_t;
+typedef struct ringbuf_reader_t *ringbuf_reader_t;
+typedef struct ringbuf_cursor_t *ringbuf_cursor_t;
+typedef struct ringbuf_set_t *ringbuf_set_t;
+
+/*
+ * Define RINGBUF_INLINE before including this header to make the
+ * layout of the ring buffer structure visible, and to define the
+ * small query functions (ringbuf_capacity, ringbuf_bytes_used, etc.)
+ * inline, so that the compiler can inline them into, e.g., tight
+ * polling loops, rather than calling them through an opaque
+ * pointer. The out-of-line definitions in ringbuf.c are still used
+ * wherever the compiler chooses not to inline, so code compiled with
+ * and without RINGBUF_INLINE can be mixed freely. The structure's
+ * fields are private, and may change.
+ */
+#ifdef RINGBUF_INLINE
+#define RINGBUF_INLINE_FN inline
+#else
+#define RINGBUF_INLINE_FN
+#endif
 
 /*
  * Create a new ring buffer with the given capacity (usable
@@ -42,15 +71,508 @@ typedef struct ringbuf_t *ringbuf_t;
 ringbuf_t
 ringbuf_new(size_t capacity);
 
+/*
+ * Flags for ringbuf_new_flags.
+ *
+ * RINGBUF_SPSC: the ring buffer may be shared, without locking, by
+ * one producer thread and one consumer thread running
+ * concurrently. Only the producer thread may call producer-side
+ * functions, and only the consumer thread may call consumer-side
+ * functions; the query functions (ringbuf_bytes_used, etc.) may be
+ * called from either thread, though their results may be stale by
+ * the time they're returned. An SPSC ring buffer never overflows:
+ * producer-side functions that would overflow it copy nothing
+ * instead, as documented for each function below. ringbuf_reset and
+ * ringbuf_free must not be called while either thread is using the
+ * ring buffer.
+ */
+#define RINGBUF_SPSC 0x1
+
+/*
+ * RINGBUF_DEFER_PUBLISH: producer-side functions don't make the bytes
+ * they copy into the ring buffer visible to the consumer; instead,
+ * the producer calls ringbuf_publish to publish all pending bytes at
+ * once. This allows a single atomic store to cover a whole batch of
+ * small writes. Only valid in combination with RINGBUF_SPSC.
+ */
+#define RINGBUF_DEFER_PUBLISH 0x2
+
+/*
+ * RINGBUF_MPMC: the ring buffer may be shared, without locking, by
+ * any number of producer and consumer threads running
+ * concurrently. Producers of an MPMC ring buffer claim disjoint
+ * regions of the buffer and copy their data into them in parallel,
+ * and likewise for consumers; each call to a producer- or
+ * consumer-side function copies its bytes as a single unit, which is
+ * never interleaved with another thread's bytes.
+ *
+ * Only ringbuf_memset, ringbuf_memcpy_into and ringbuf_memcpy_from
+ * may be used to copy data into and out of an MPMC ring buffer,
+ * along with the query functions. Like an SPSC ring buffer, an MPMC
+ * ring buffer never overflows. Not valid in combination with
+ * RINGBUF_SPSC.
+ */
+#define RINGBUF_MPMC 0x4
+
+/*
+ * RINGBUF_EVICT_LAGGING: see ringbuf_new_broadcast.
+ */
+#define RINGBUF_EVICT_LAGGING 0x8
+
+/*
+ * RINGBUF_MIRROR: the ring buffer's memory is mapped twice,
+ * back-to-back, in virtual memory, so that any region of up to
+ * ringbuf_capacity bytes that starts at the ring buffer's head or
+ * tail pointer is contiguous in memory, even if it wraps around the
+ * end of the buffer. Copies into and out of the buffer never need to
+ * be split at the wrap, and ringbuf_read and ringbuf_write can always
+ * move as many bytes as are free or used, respectively, with a single
+ * system call.
+ *
+ * The capacity of a mirrored ring buffer is rounded up to a multiple
+ * of the system's page size, and its usable capacity is the same as
+ * its internal buffer size. Mirrored ring buffers are supported on
+ * Linux, macOS, and POSIX systems with shm_open(3);
+ * ringbuf_new_flags returns 0 if mirroring isn't possible.
+ */
+#define RINGBUF_MIRROR 0x10
+
+/*
+ * RINGBUF_POW2: the ring buffer's capacity is rounded up to a power
+ * of two, and, as with a mirrored ring buffer, its usable capacity is
+ * the same as its internal buffer size, so no byte is wasted. The
+ * head and tail pointers are then located by masking rather than
+ * dividing. Capacities that are powers of two at least as large as
+ * the page size are also page multiples, so this flag may be
+ * combined with RINGBUF_MIRROR; the capacity is then rounded up to a
+ * page multiple first.
+ */
+#define RINGBUF_POW2 0x20
+
+/*
+ * Options for the backing memory of large ring buffers. With any of
+ * these flags, the internal buffer is mapped with mmap(2) rather than
+ * allocated with malloc(3).
+ *
+ * RINGBUF_HUGETLB: back the buffer with huge pages, using
+ * MAP_HUGETLB, to cut TLB misses. Huge pages must be reserved by the
+ * system administrator, and ringbuf_new_flags returns 0 if none are
+ * available. Linux only; not valid in combination with
+ * RINGBUF_MIRROR.
+ *
+ * RINGBUF_THP: align the buffer to the huge page size and advise the
+ * kernel to back it with transparent huge pages (MADV_HUGEPAGE). This
+ * is only advice, and it's ignored where it isn't supported.
+ *
+ * RINGBUF_PREFAULT: fault in the buffer's pages when the ring buffer
+ * is created, with MAP_POPULATE where possible, so that first-touch
+ * page faults don't happen later, while the ring buffer is in use.
+ */
+#define RINGBUF_HUGETLB 0x40
+#define RINGBUF_THP 0x80
+#define RINGBUF_PREFAULT 0x100
+
+/*
+ * RINGBUF_RECORD_PAD: records (see ringbuf_push_record) are padded so
+ * that they never wrap around the end of the buffer, and can always
+ * be accessed in place with a single iovec. Not valid in combination
+ * with RINGBUF_MPMC, or for broadcast ring buffers.
+ */
+#define RINGBUF_RECORD_PAD 0x200
+
+/*
+ * Overflow policies. By default, a write that's larger than the ring
+ * buffer's free space overwrites the oldest bytes in the buffer (and
+ * ringbuf_memcpy_into and ringbuf_copy don't bother to copy bytes
+ * that would be overwritten again within the same write). With one
+ * of these flags, a ring buffer never overflows.
+ *
+ * RINGBUF_OVERFLOW_REJECT: a write that doesn't fit in the free space
+ * writes nothing, and fails, as writes into SPSC and MPMC ring
+ * buffers do.
+ *
+ * RINGBUF_OVERFLOW_TRUNCATE: a write that doesn't fit in the free
+ * space writes as many bytes as do fit, and drops the rest.
+ *
+ * The two flags are mutually exclusive. The functions that read from
+ * a file descriptor (ringbuf_read, ringbuf_readv and ringbuf_recvmsg)
+ * always read at most the free space into a ring buffer with either
+ * policy, so that no bytes are lost.
+ */
+#define RINGBUF_OVERFLOW_REJECT 0x400
+#define RINGBUF_OVERFLOW_TRUNCATE 0x800
+
+/*
+ * RINGBUF_BLOCKING: consumers may wait for data, and producers for
+ * space, with ringbuf_wait_used and ringbuf_wait_free, and the ring
+ * buffer may be watched with an eventfd (see ringbuf_eventfd). Each
+ * time either side publishes, it checks for waiters on the other side
+ * (which costs a full memory fence), and only makes a system call to
+ * wake them if there are any. Only valid in combination with
+ * RINGBUF_SPSC or RINGBUF_MPMC, and not for broadcast ring buffers.
+ */
+#define RINGBUF_BLOCKING 0x1000
+
+/*
+ * Like ringbuf_new, but creates the ring buffer with the given flags
+ * (any combination of the RINGBUF_* flags above, or 0).
+ *
+ * Returns 0 if the combination of flags is invalid, or if there's not
+ * enough memory to fulfill the request.
+ */
+ringbuf_t
+ringbuf_new_flags(size_t capacity, int flags);
+
+/*
+ * Like ringbuf_new_flags, but binds the ring buffer's internal buffer
+ * to NUMA node node (with mbind(2), and without any dependency on
+ * libnuma), so that its pages are allocated on that node no matter
+ * which thread first touches them. Combine with RINGBUF_PREFAULT to
+ * allocate them all up front.
+ *
+ * Returns 0 if the flags are invalid, node is negative or can't be
+ * bound (including on systems other than Linux), or there's not
+ * enough memory on the node to fulfill the request.
+ */
+ringbuf_t
+ringbuf_new_numa(size_t capacity, int flags, int node);
+
+/*
+ * Like ringbuf_new_flags, but allocates the ring buffer's bookkeeping
+ * and its internal buffer together, with a single allocation, and
+ * aligns the internal buffer to alignment bytes, which must be a
+ * power of two (e.g., 64 for a cache line, or the page size). The
+ * bookkeeping is always aligned to a cache line. flags may not
+ * include RINGBUF_MIRROR, or any of the backing memory options.
+ *
+ * Returns 0 if the flags or alignment are invalid, or if there's not
+ * enough memory to fulfill the request.
+ */
+ringbuf_t
+ringbuf_new_aligned(size_t capacity, int flags, size_t alignment);
+
+/*
+ * Create a ring buffer with the given capacity and flags in
+ * caller-provided storage of storage_size bytes (static, stack, or
+ * arena memory, for example), without allocating any memory.
+ * storage needn't be aligned, but must outlive the ring buffer, and
+ * must be at least ringbuf_storage_size(capacity, flags) bytes,
+ * which is never more than RINGBUF_STORAGE_OVERHEAD bytes plus the
+ * ring buffer's internal buffer size (capacity + 1, for a default
+ * ring buffer). flags may not include RINGBUF_MIRROR, or any of the
+ * backing memory options.
+ *
+ * ringbuf_free may be called on the ring buffer, but doesn't release
+ * the storage, which the caller may reuse as soon as the ring buffer
+ * is no longer in use.
+ *
+ * Returns the new ring buffer object, which is located within
+ * storage, or 0 if the flags are invalid or storage_size is too
+ * small.
+ */
+#define RINGBUF_STORAGE_OVERHEAD 512
+
+ringbuf_t
+ringbuf_init(void *storage, size_t storage_size, size_t capacity, int flags);
+
+/*
+ * The number of bytes of storage ringbuf_init needs for a ring buffer
+ * with the given capacity and flags, or 0 if it's too large.
+ */
+size_t
+ringbuf_storage_size(size_t capacity, int flags);
+
+/*
+ * Shared ring buffers, for communication between processes. A shared
+ * ring buffer lives entirely in a file that each process maps (e.g.,
+ * a memfd_create(2) file that's inherited across fork(2) or passed
+ * over a Unix domain socket, or a POSIX shared memory object), and
+ * keeps no absolute addresses, so each process can map it at a
+ * different address. The file begins with a versioned header, so
+ * processes built against an incompatible version of this library
+ * (or with different RINGBUF_* build options) refuse to attach.
+ *
+ * ringbuf_shm_create creates a shared ring buffer with the given
+ * capacity and flags in the file fd, which must be empty, and maps
+ * it. ringbuf_shm_attach maps the shared ring buffer that another
+ * process created in fd. Either way, fd may be closed as soon as the
+ * call returns.
+ *
+ * ringbuf_shm_open creates the POSIX shared memory object name (see
+ * shm_open(3)), and a ring buffer in it, or, if name already exists,
+ * waits up to a second for its creator to finish, and attaches to it,
+ * provided that it has the same capacity and flags. The caller is
+ * responsible for removing name with shm_unlink(3).
+ *
+ * Shared ring buffers must be created with RINGBUF_SPSC or
+ * RINGBUF_MPMC, and each process may then play its part as if the
+ * processes were threads: e.g., one process produces and another
+ * consumes. flags may also include RINGBUF_DEFER_PUBLISH,
+ * RINGBUF_MIRROR, RINGBUF_POW2, RINGBUF_PREFAULT, RINGBUF_RECORD_PAD,
+ * the overflow policies, and, on Linux, RINGBUF_BLOCKING (but
+ * ringbuf_eventfd isn't available). Shared ring buffers can't be
+ * resized, or registered with io_uring.
+ *
+ * ringbuf_free unmaps the calling process's view of a shared ring
+ * buffer, but leaves the file, and the other processes' views, alone.
+ *
+ * These functions return 0 if the flags are invalid, fd isn't empty
+ * (ringbuf_shm_create) or doesn't hold a compatible ring buffer
+ * (ringbuf_shm_attach), or on any system error.
+ */
+ringbuf_t
+ringbuf_shm_create(int fd, size_t capacity, int flags);
+
+ringbuf_t
+ringbuf_shm_attach(int fd);
+
+ringbuf_t
+ringbuf_shm_open(const char *name, size_t capacity, int flags);
+
+/*
+ * Persistent ring buffers, which survive the process that writes to
+ * them: e.g., a flight recorder that keeps the last few megabytes of
+ * traces for inspection after a crash. ringbuf_file_open maps the
+ * ring buffer in the file at path, with the same layout as a shared
+ * ring buffer's, creating the file and the ring buffer if the file
+ * doesn't exist (or is empty), or else recovering the ring buffer
+ * that the file already holds, whose capacity and flags must match.
+ * A file whose creator died before it initialized the ring buffer is
+ * started over; any other file is left alone. ringbuf_file_open
+ * locks the file with flock(2) while it creates or recovers the ring
+ * buffer. Recovery keeps every byte that was published before the previous
+ * process stopped; bytes that it had copied but not yet published are
+ * lost, and, if it died in the middle of overwriting the oldest
+ * bytes in a ring buffer that overflows, those may be damaged.
+ *
+ * Any flags that ringbuf_shm_create accepts are allowed, and, as a
+ * persistent ring buffer is only used within one process, so are the
+ * overflowing modes. Only one process may have a persistent ring
+ * buffer's file open at a time. Like shared ring buffers, persistent
+ * ring buffers can't be resized, or registered with io_uring.
+ *
+ * Data copied into the ring buffer is in the file (or the kernel's
+ * page cache) as soon as it's copied, so it outlives the process
+ * without any system calls. To outlive the machine, too, it must be
+ * synced to disk: ringbuf_file_sync does so immediately, and
+ * ringbuf_file_set_sync sets a policy under which the producer syncs
+ * the file when bytes or more bytes have been published since the
+ * last sync, or ms or more milliseconds have passed since then, when
+ * it next publishes. The data is synced before the head and tail
+ * counters, so a synced ring buffer never claims more than was written.
+ * 0 disables either trigger, and both are 0 each time the ring buffer
+ * is opened. When a sync policy is set, ringbuf_free syncs the file
+ * one last time.
+ *
+ * ringbuf_file_open returns 0 if the flags are invalid, the file
+ * holds something other than a compatible ring buffer with the given
+ * capacity and flags, or on any system error. ringbuf_file_set_sync
+ * and ringbuf_file_sync return 1 on success, and 0 if the ring
+ * buffer isn't persistent (or, for ringbuf_file_sync, msync(2)
+ * fails).
+ */
+ringbuf_t
+ringbuf_file_open(const char *path, size_t capacity, int flags);
+
+int
+ringbuf_file_set_sync(ringbuf_t rb, size_t bytes, unsigned ms);
+
+int
+ringbuf_file_sync(ringbuf_t rb);
+
+/*
+ * Create a new broadcast ring buffer with the given capacity, which
+ * can be consumed by up to max_readers independent readers (see
+ * ringbuf_reader_new). Each byte copied into a broadcast ring buffer
+ * is available to every reader that was registered when it was
+ * copied, and the ring buffer's free space is bounded by its slowest
+ * reader.
+ *
+ * The producer side of a broadcast ring buffer may run concurrently
+ * with its readers, exactly as with an SPSC ring buffer; each reader
+ * must only be used by one thread at a time. flags may include
+ * RINGBUF_DEFER_PUBLISH, and RINGBUF_EVICT_LAGGING. When the latter
+ * is given, a producer that would otherwise have to reject a write
+ * for lack of room instead evicts the readers who are holding on to
+ * the bytes that it needs to overwrite, and then completes the
+ * write. Evicted readers can no longer read from the ring buffer.
+ *
+ * Consumer-side functions can't be used with broadcast ring buffers;
+ * use the ringbuf_reader_* functions, below, instead.
+ *
+ * Returns 0 if the flags are invalid, if max_readers is too large, or
+ * if there's not enough memory to fulfill the request.
+ */
+ringbuf_t
+ringbuf_new_broadcast(size_t capacity, size_t max_readers, int flags);
+
+/*
+ * Register a new reader of the broadcast ring buffer rb. The reader's
+ * tail pointer starts at the ring buffer's head pointer, so it won't
+ * see any bytes that were copied into the ring buffer before it was
+ * registered.
+ *
+ * Returns the new reader, or 0 if rb already has its maximum number
+ * of readers.
+ */
+ringbuf_reader_t
+ringbuf_reader_new(ringbuf_t rb);
+
+/*
+ * Unregister a reader, and, as a side effect, set the pointer to 0.
+ */
+void
+ringbuf_reader_free(ringbuf_reader_t *r);
+
+/*
+ * Returns nonzero if reader r has been evicted from its ring buffer
+ * (see RINGBUF_EVICT_LAGGING). An evicted reader can't read any more
+ * bytes, and should be freed.
+ */
+int
+ringbuf_reader_is_evicted(const struct ringbuf_reader_t *r);
+
+/*
+ * The number of bytes that reader r has yet to read from its ring
+ * buffer.
+ */
+size_t
+ringbuf_reader_bytes_used(const struct ringbuf_reader_t *r);
+
+/*
+ * Like ringbuf_memcpy_from, but copies count bytes starting from
+ * reader r's tail pointer, and only advances r's tail pointer. Returns
+ * 0, and doesn't advance r's tail pointer, if r has fewer than count
+ * bytes to read, or if r has been evicted (in which case the contents
+ * of dst are unspecified).
+ */
+void *
+ringbuf_reader_memcpy_from(void *dst, ringbuf_reader_t r, size_t count);
+
+/*
+ * Like ringbuf_write, but writes from reader r's tail pointer, and
+ * only advances r's tail pointer. Returns 0 if r has fewer than count
+ * bytes to read, or if r has been evicted.
+ *
+ * Note that, unlike ringbuf_reader_memcpy_from, this function can't
+ * detect whether r is evicted while write(2) is in progress. If the
+ * ring buffer evicts lagging readers, the bytes written may have been
+ * overwritten by the producer in that case; check
+ * ringbuf_reader_is_evicted after the call returns.
+ */
+ssize_t
+ringbuf_reader_write(int fd, ringbuf_reader_t r, size_t count);
+
+/*
+ * Publish all bytes that the producer has copied into the ring buffer
+ * since the last call to ringbuf_publish, making them available to
+ * the consumer. Returns the number of bytes published.
+ *
+ * This is only necessary for RINGBUF_DEFER_PUBLISH ring buffers; for
+ * other ring buffers, it's harmless and returns 0.
+ */
+size_t
+ringbuf_publish(ringbuf_t rb);
+
+/*
+ * Wait until at least count bytes are used (for consumers,
+ * ringbuf_wait_used) or free (for producers, ringbuf_wait_free) in a
+ * RINGBUF_BLOCKING ring buffer, or until timeout_ms milliseconds have
+ * passed; a negative timeout_ms waits forever, and 0 doesn't park at
+ * all. The caller first spins for a few microseconds, as most waits
+ * are short; the spin budget adapts to how long recent waits have
+ * taken. Then it parks on a futex (on Linux), or a condition
+ * variable, until the other side publishes.
+ *
+ * Returns 1 if the bytes are available, or 0 on timeout, or if count
+ * is greater than the ring buffer's capacity. In MPMC ring buffers,
+ * another thread may claim the bytes before the caller does.
+ */
+int
+ringbuf_wait_used(ringbuf_t rb, size_t count, int timeout_ms);
+
+int
+ringbuf_wait_free(ringbuf_t rb, size_t count, int timeout_ms);
+
+/*
+ * Return a non-blocking eventfd(2) for a RINGBUF_BLOCKING ring buffer
+ * that's readable when the ring buffer holds data, so that the
+ * consumer can wait for data with poll(2), epoll(7) and the like. The
+ * eventfd is created on the first call, and closed by ringbuf_free.
+ * Returns -1 if the ring buffer wasn't created with RINGBUF_BLOCKING,
+ * or eventfds aren't supported (they're Linux only).
+ *
+ * Once the eventfd is readable, it stays readable until the consumer
+ * calls ringbuf_eventfd_rearm, typically after it has consumed all of
+ * the data it can. ringbuf_eventfd_rearm clears and re-arms the
+ * eventfd, so that the next publish makes it readable again, and
+ * returns the number of bytes used in the ring buffer; if that's
+ * nonzero, the eventfd is readable again immediately. Producers only
+ * write to an armed eventfd, so it costs them at most one system call
+ * per rearm.
+ */
+int
+ringbuf_eventfd(ringbuf_t rb);
+
+size_t
+ringbuf_eventfd_rearm(ringbuf_t rb);
+
+/*
+ * Hot-path statistics for a ring buffer. "In" counts are for the
+ * producer side, and "out" counts for the consumer side. A call that
+ * transfers as much as it can is short if it transferred fewer bytes
+ * (or elements) than the caller asked for, e.g., ringbuf_read, or a
+ * RINGBUF_OVERFLOW_TRUNCATE copy; a call that transfers all or
+ * nothing is rejected if there wasn't enough room or data.
+ */
+struct ringbuf_stats
+{
+    uint64_t in_bytes;     /* bytes made available to the consumer */
+    uint64_t in_calls;     /* successful producer calls */
+    uint64_t in_short;     /* producer calls that were short */
+    uint64_t in_rejected;  /* producer calls that were refused */
+    uint64_t in_wraps;     /* producer calls that wrapped around */
+    uint64_t overflows;    /* producer calls that overwrote old data */
+    uint64_t overwritten;  /* bytes lost to overflows */
+    uint64_t high_water;   /* most bytes ever used at once */
+    uint64_t out_bytes;    /* bytes consumed */
+    uint64_t out_calls;    /* successful consumer calls */
+    uint64_t out_short;    /* consumer calls that were short */
+    uint64_t out_rejected; /* consumer calls that were refused */
+    uint64_t out_wraps;    /* consumer calls that wrapped around */
+};
+
+/*
+ * Copy a snapshot of the ring buffer's statistics into stats, and
+ * return 1. Statistics are only kept when the library is compiled
+ * with RINGBUF_STATS; otherwise, ringbuf_get_stats zeroes stats and
+ * returns 0, and the hot paths pay nothing for them.
+ *
+ * The counters are updated with relaxed atomics, on the producer's
+ * and the consumer's own cache lines, so a snapshot taken while the
+ * ring buffer is in use may be slightly inconsistent. Tracking
+ * high_water costs producers a load of the consumer's tail on each
+ * call. For broadcast ring buffers, the "out" counts follow the
+ * slowest reader.
+ *
+ * ringbuf_reset_stats zeroes the statistics; it should only be
+ * called while the ring buffer is idle.
+ */
+int
+ringbuf_get_stats(const struct ringbuf_t *rb, struct ringbuf_stats *stats);
+
+void
+ringbuf_reset_stats(ringbuf_t rb);
+
 /*
  * The size of the internal buffer, in bytes. One or more bytes may be
  * unusable in order to distinguish the "buffer full" state from the
- * "buffer empty" state.
+ * "buffer empty" state (but see RINGBUF_MIRROR and RINGBUF_POW2).
  *
  * For the usable capacity of the ring buffer, use the
  * ringbuf_capacity function.
  */
-size_t
+RINGBUF_INLINE_FN size_t
 ringbuf_buffer_size(const struct ringbuf_t *rb);
 
 /*
@@ -66,36 +588,105 @@ ringbuf_free(ringbuf_t *rb);
 void
 ringbuf_reset(ringbuf_t rb);
 
+/*
+ * Change the capacity of a ring buffer, in place, preserving its
+ * contents. The new capacity is rounded up just as it is by
+ * ringbuf_new_flags (or, for element ring buffers, ringbuf_new_elems,
+ * in which case it's given in bytes, and must be a whole number of
+ * elements). The internal buffer is grown or shrunk with realloc(3),
+ * or mremap(2) if it's mapped, and only the part of the contents on
+ * one side of the end of the buffer is moved, if they wrap around
+ * it. Mirrored ring buffers are copied to a new mirror, which isn't
+ * bound to a NUMA node.
+ *
+ * Returns 1 on success, or 0 if the contents won't fit in the new
+ * capacity, there's not enough memory, or the ring buffer can't be
+ * resized (broadcast ring buffers, ringbuf_new_aligned and
+ * ringbuf_init ring buffers, and those created with
+ * RINGBUF_RECORD_PAD, or with a reservation, an io_uring
+ * registration, an io_uring read or write, or a zero-copy sender
+ * outstanding), in which case the ring buffer is unchanged.
+ *
+ * The buffer may move, so pointers previously returned by
+ * ringbuf_head, ringbuf_tail and the like are no longer valid
+ * afterwards, and scan cursors start over at the tail. Like
+ * ringbuf_reset, ringbuf_resize must not be called while other
+ * threads are using the ring buffer.
+ */
+int
+ringbuf_resize(ringbuf_t rb, size_t capacity);
+
+/*
+ * Allow a ring buffer to grow automatically, up to max_capacity
+ * bytes, rather than overflow: when a producer-side function needs
+ * more room than is free, the ring buffer is first resized, to at
+ * least double its capacity (but no more than max_capacity), as
+ * ringbuf_resize does. Only if that's not enough does the ring
+ * buffer's overflow policy apply. A max_capacity of 0, the default,
+ * turns automatic growth off.
+ *
+ * Returns 1 on success, or 0 for SPSC, MPMC, and other ring buffers
+ * that ringbuf_resize can't resize.
+ */
+int
+ringbuf_set_max_capacity(ringbuf_t rb, size_t max_capacity);
+
+/*
+ * Copy large writes into a ring buffer with non-temporal (streaming)
+ * stores, which bypass the CPU caches, rather than with memcpy. This
+ * suits a ring buffer whose contents won't be read again until much
+ * later, or by another core, where copying them through the cache
+ * would only evict the producer's working set.
+ *
+ * Each call to ringbuf_memcpy_into, or to ringbuf_copy with rb as
+ * its destination, that copies threshold bytes or more streams its
+ * copy, and fences the stores before the new bytes are published.
+ * Smaller writes, and the checksumming variants of those functions,
+ * copy as usual. A threshold of 0, the default, turns streaming off.
+ * Streaming stores are only used on x86 (and not when ringbuf.c is
+ * compiled with RINGBUF_NO_SIMD); elsewhere, the threshold has no
+ * effect. Like ringbuf_set_max_capacity, this must not be called
+ * while other threads are writing to the ring buffer.
+ */
+void
+ringbuf_set_stream_threshold(ringbuf_t rb, size_t threshold);
+
 /*
  * The usable capacity of the ring buffer, in bytes. Note that this
  * value may be less than the ring buffer's internal buffer size, as
  * returned by ringbuf_buffer_size.
  */
-size_t
+RINGBUF_INLINE_FN size_t
 ringbuf_capacity(const struct ringbuf_t *rb);
 
 /*
  * The number of free/available bytes in the ring buffer. This value
  * is never larger than the ring buffer's usable capacity.
+ *
+ * Bytes that haven't been published yet (see RINGBUF_DEFER_PUBLISH)
+ * are neither free nor used.
  */
-size_t
+RINGBUF_INLINE_FN size_t
 ringbuf_bytes_free(const struct ringbuf_t *rb);
 
 /*
  * The number of bytes currently being used in the ring buffer. This
  * value is never larger than the ring buffer's usable capacity.
  */
-size_t
+RINGBUF_INLINE_FN size_t
 ringbuf_bytes_used(const struct ringbuf_t *rb);
 
-int
+RINGBUF_INLINE_FN int
 ringbuf_is_full(const struct ringbuf_t *rb);
 
-int
+RINGBUF_INLINE_FN int
 ringbuf_is_empty(const struct ringbuf_t *rb);
 
 /*
  * Const access to the head and tail pointers of the ring buffer.
+ *
+ * The head pointer includes any bytes that haven't been published
+ * yet (see RINGBUF_DEFER_PUBLISH).
  */
 const void *
 ringbuf_tail(const struct ringbuf_t *rb);
@@ -117,6 +708,73 @@ ringbuf_head(const struct ringbuf_t *rb);
 size_t
 ringbuf_findchr(const struct ringbuf_t *rb, int c, size_t offset);
 
+/*
+ * Like ringbuf_findchr, but locates the first occurrence of any of
+ * the nset bytes in set (e.g., "\n;" with nset 3, to include the
+ * terminating NUL). If nset is 0, nothing is found.
+ *
+ * The search uses SSE2, AVX2 or NEON instructions where the CPU
+ * supports them, chosen at run time, and sets of up to 16 distinct
+ * bytes; larger sets, and other CPUs, are searched one byte at a
+ * time with a lookup table.
+ */
+size_t
+ringbuf_findset(const struct ringbuf_t *rb, const void *set, size_t nset, size_t offset);
+
+/*
+ * Locate the first occurrence of the len-byte string needle in ring
+ * buffer rb, beginning the search at offset bytes from the ring
+ * buffer's tail pointer, even if the occurrence is split across the
+ * end of the ring buffer's contiguous buffer. Returns the offset of
+ * the occurrence's first byte from the ring buffer's tail pointer, if
+ * found (offset itself, if len is 0); otherwise, returns the number
+ * of bytes used in the ring buffer. As with ringbuf_findchr, offsets
+ * are logical offsets.
+ */
+size_t
+ringbuf_findstr(const struct ringbuf_t *rb, const void *needle, size_t len, size_t offset);
+
+/*
+ * Scan cursors, for incremental searches.
+ *
+ * When a delimiter hasn't arrived yet, searching for it again from
+ * the tail pointer after every read re-examines all the bytes that
+ * were already searched. A scan cursor remembers how far its last
+ * search got, so each search only examines new bytes: the cursor
+ * search functions work like ringbuf_findchr, ringbuf_findset and
+ * ringbuf_findstr, respectively, and return the offset of the match
+ * from the tail pointer (or the number of bytes used if there's
+ * none), but begin where the previous search left off, which is at
+ * the match, if there was one.
+ *
+ * A cursor stays valid as bytes are added to and removed from its
+ * ring buffer; when bytes it has searched are consumed, or
+ * overwritten by an overflow, or the ring buffer is reset, the next
+ * search simply begins at the tail pointer. Each cursor tracks one
+ * search at a time, so call ringbuf_cursor_reset before searching for
+ * something else with it. Cursors must only be used by the ring
+ * buffer's consumer, and not with MPMC or broadcast ring buffers.
+ *
+ * ringbuf_cursor_new returns 0 if there's not enough memory.
+ */
+ringbuf_cursor_t
+ringbuf_cursor_new(ringbuf_t rb);
+
+void
+ringbuf_cursor_free(ringbuf_cursor_t *cur);
+
+void
+ringbuf_cursor_reset(ringbuf_cursor_t cur);
+
+size_t
+ringbuf_cursor_findchr(ringbuf_cursor_t cur, int c);
+
+size_t
+ringbuf_cursor_findset(ringbuf_cursor_t cur, const void *set, size_t nset);
+
+size_t
+ringbuf_cursor_findstr(ringbuf_cursor_t cur, const void *needle, size_t len);
+
 /*
  * Beginning at ring buffer dst's head pointer, fill the ring buffer
  * with a repeating sequence of len bytes, each of value c (converted
@@ -135,6 +793,12 @@ ringbuf_findchr(const struct ringbuf_t *rb, int c, size_t offset);
  *
  * Returns the actual number of bytes written to dst: len, if
  * len < ringbuf_buffer_size(dst), else ringbuf_buffer_size(dst).
+ *
+ * If dst is an SPSC or MPMC ring buffer, or was created with
+ * RINGBUF_OVERFLOW_REJECT, and len is greater than the number of free
+ * bytes in dst, no bytes are written, and the function returns 0. If
+ * dst was created with RINGBUF_OVERFLOW_TRUNCATE, only as many bytes
+ * as are free are written.
  */
 size_t
 ringbuf_memset(ringbuf_t dst, int c, size_t len);
@@ -150,7 +814,17 @@ ringbuf_memset(ringbuf_t dst, int c, size_t len);
  * old data will simply be overwritten in FIFO fashion, as
  * needed. However, note that, if calling the function results in an
  * overflow, the value of the ring buffer's tail pointer may be
- * different than it was before the function was called.
+ * different than it was before the function was called. If count is
+ * greater than dst's capacity, only the last bytes of src, which
+ * survive the overflow, are copied.
+ *
+ * If dst is an SPSC or MPMC ring buffer, or was created with
+ * RINGBUF_OVERFLOW_REJECT, and count is greater than the number of
+ * free bytes in dst, no bytes are copied, and the function returns
+ * 0. If dst was created with RINGBUF_OVERFLOW_TRUNCATE, only as many
+ * bytes as are free are copied. If dst is an MPMC ring buffer, the function
+ * returns a pointer to the end of the bytes that it copied, which may
+ * not be the ring buffer's head pointer by the time it returns.
  */
 void *
 ringbuf_memcpy_into(ringbuf_t dst, const void *src, size_t count);
@@ -159,7 +833,9 @@ ringbuf_memcpy_into(ringbuf_t dst, const void *src, size_t count);
  * This convenience function calls read(2) on the file descriptor fd,
  * using the ring buffer rb as the destination buffer for the read,
  * and returns the value returned by read(2). It will only call
- * read(2) once, and may return a short count.
+ * read(2) once, and may return a short count. (Unless rb is a
+ * mirrored ring buffer, the count is cut short at the end of rb's
+ * contiguous buffer.)
  *
  * It is possible to read more data from the file descriptor than is
  * available in the buffer; i.e., it's possible to overflow the ring
@@ -169,6 +845,9 @@ ringbuf_memcpy_into(ringbuf_t dst, const void *src, size_t count);
  * fashion, as needed. However, note that, if calling the function
  * results in an overflow, the value of the ring buffer's tail pointer
  * may be different than it was before the function was called.
+ *
+ * If rb is an SPSC ring buffer, count is first clamped to the number
+ * of free bytes in rb, so that the read never overflows it.
  */
 ssize_t
 ringbuf_read(int fd, ringbuf_t rb, size_t count);
@@ -187,6 +866,10 @@ ringbuf_read(int fd, ringbuf_t rb, size_t count);
  * This function will *not* allow the ring buffer to underflow. If
  * count is greater than the number of bytes used in the ring buffer,
  * no bytes are copied, and the function will return 0.
+ *
+ * If src is an MPMC ring buffer, the function returns a pointer to
+ * the end of the bytes that it copied, which may not be the ring
+ * buffer's tail pointer by the time it returns.
  */
 void *
 ringbuf_memcpy_from(void *dst, ringbuf_t src, size_t count);
@@ -196,7 +879,8 @@ ringbuf_memcpy_from(void *dst, ringbuf_t src, size_t count);
  * using the ring buffer rb as the source buffer for writing (starting
  * at the ring buffer's tail pointer), and returns the value returned
  * by write(2). It will only call write(2) once, and may return a
- * short count.
+ * short count. (Unless rb is a mirrored ring buffer, the count is cut
+ * short at the end of rb's contiguous buffer.)
  *
  * Note that this copy is destructive with respect to the ring buffer:
  * any bytes written from the ring buffer to the file descriptor are
@@ -214,6 +898,41 @@ ringbuf_memcpy_from(void *dst, ringbuf_t src, size_t count);
 ssize_t
 ringbuf_write(int fd, ringbuf_t rb, size_t count);
 
+/*
+ * Scatter/gather counterparts of ringbuf_read and ringbuf_write.
+ *
+ * ringbuf_readv and ringbuf_writev call readv(2) and writev(2),
+ * respectively, and ringbuf_recvmsg and ringbuf_sendmsg call
+ * recvmsg(2) and sendmsg(2) on the socket sockfd, passing flags
+ * through. Each returns the value returned by the system call, which
+ * it only calls once. Unlike ringbuf_read and ringbuf_write, the
+ * count is not cut short at the end of rb's contiguous buffer: when
+ * the bytes wrap around, both segments are passed to the same system
+ * call.
+ *
+ * ringbuf_readv and ringbuf_recvmsg have the same overflow behavior
+ * as ringbuf_read, except that count is also clamped to the ring
+ * buffer's capacity. ringbuf_writev and ringbuf_sendmsg have the same
+ * underflow behavior as ringbuf_write: if count is greater than the
+ * number of bytes used in the ring buffer, no system call is made,
+ * and the function returns 0.
+ *
+ * If ringbuf_recvmsg is called with MSG_TRUNC on a datagram socket,
+ * the value it returns may be greater than the number of bytes added
+ * to the ring buffer; only the bytes actually received are added.
+ */
+ssize_t
+ringbuf_readv(int fd, ringbuf_t rb, size_t count);
+
+ssize_t
+ringbuf_writev(int fd, ringbuf_t rb, size_t count);
+
+ssize_t
+ringbuf_recvmsg(int sockfd, ringbuf_t rb, size_t count, int flags);
+
+ssize_t
+ringbuf_sendmsg(int sockfd, ringbuf_t rb, size_t count, int flags);
+
 /*
  * Copy count bytes from ring buffer src, starting from its tail
  * pointer, into ring buffer dst. Returns dst's new head pointer after
@@ -231,7 +950,16 @@ ringbuf_write(int fd, ringbuf_t rb, size_t count);
  * overwritten in FIFO fashion, as needed. However, note that, if
  * calling the function results in an overflow, the value dst's tail
  * pointer may be different than it was before the function was
- * called.
+ * called. If count is greater than dst's capacity, only the last
+ * bytes, which survive the overflow, are copied, though all count
+ * bytes are removed from src.
+ *
+ * If dst is an SPSC ring buffer, or was created with
+ * RINGBUF_OVERFLOW_REJECT, no bytes are copied when count is greater
+ * than the number of free bytes in dst, and the function returns 0.
+ * If dst was created with RINGBUF_OVERFLOW_TRUNCATE, count is reduced
+ * to the number of free bytes in dst, and only that many bytes are
+ * copied and removed from src.
  *
  * It is *not* possible to underflow src; if count is greater than the
  * number of bytes used in src, no bytes are copied, and the function
@@ -240,4 +968,809 @@ ringbuf_write(int fd, ringbuf_t rb, size_t count);
 void *
 ringbuf_copy(ringbuf_t dst, ringbuf_t src, size_t count);
 
+/*
+ * Checksumming counterparts of ringbuf_memcpy_into,
+ * ringbuf_memcpy_from, and ringbuf_copy.
+ *
+ * Each behaves exactly like the function it's named after, and also
+ * folds the bytes that it transfers into the running CRC32C
+ * (Castagnoli) checksum *crc, in the same pass over memory as the
+ * copy. The checksum carries across the end of the ring buffer's
+ * contiguous buffer, and from one call to the next, so a message
+ * that's transferred in several pieces gets the same checksum as one
+ * that's transferred all at once. Start with *crc set to 0; the value
+ * that's left in *crc is the CRC32C of every byte transferred so far.
+ * *crc is unchanged when the transfer is refused and the function
+ * returns 0, and crc may be 0 if no checksum is wanted.
+ *
+ * The checksum covers every byte that the function removes from its
+ * source, including any that are skipped because an overflow would
+ * immediately overwrite them, so that it matches the checksum the
+ * sender computed. If dst was created with RINGBUF_OVERFLOW_TRUNCATE,
+ * it covers only the bytes actually transferred.
+ *
+ * When the CPU supports it, the checksum is computed with the SSE4.2
+ * or ARMv8 CRC32C instructions; otherwise, with a table-driven
+ * fallback that gives the same results. (Defining RINGBUF_NO_SIMD
+ * when compiling ringbuf.c always selects the fallback.)
+ */
+void *
+ringbuf_memcpy_into_crc32c(ringbuf_t dst, const void *src, size_t count,
+                           uint32_t *crc);
+
+void *
+ringbuf_memcpy_from_crc32c(void *dst, ringbuf_t src, size_t count,
+                           uint32_t *crc);
+
+void *
+ringbuf_copy_crc32c(ringbuf_t dst, ringbuf_t src, size_t count, uint32_t *crc);
+
+/*
+ * Fold the n bytes at buf into the CRC32C checksum crc, and return
+ * the result. Pass 0 as crc to start a new checksum; e.g.,
+ * ringbuf_crc32c(0, "123456789", 9) is 0xe3069283. This is the
+ * checksum that the *_crc32c transfer functions compute.
+ */
+uint32_t
+ringbuf_crc32c(uint32_t crc, const void *buf, size_t n);
+
+/*
+ * Streaming codecs.
+ *
+ * ringbuf_codec_copy feeds the bytes of ring buffer src, starting
+ * from its tail pointer, straight from both sides of the wrap into a
+ * streaming codec (a compressor or a decompressor), and writes the
+ * codec's output into the free bytes of ring buffer dst, so that
+ * neither side of the codec needs a linear staging buffer. Source
+ * bytes are removed from src as the codec consumes them, and output
+ * is added to dst as it's produced.
+ *
+ * A codec is a process function and its state. process consumes up
+ * to *in_len bytes at in and produces up to *out_len bytes at out,
+ * and stores the numbers of bytes it actually consumed and produced
+ * back in *in_len and *out_len. mode is one of:
+ *
+ * RINGBUF_CODEC_CONTINUE: consume as much input as possible; the
+ * codec may hold on to output.
+ *
+ * RINGBUF_CODEC_FLUSH: also produce all of the output that the input
+ * so far determines, e.g., end the current compressed block.
+ *
+ * RINGBUF_CODEC_END: also end the stream, e.g., finish the current
+ * compressed frame; the next input starts a new one.
+ *
+ * process returns 0 if it's done what mode asks for with this input,
+ * 1 if it needs more output space to finish, or -1 on error. It must
+ * make progress whenever it's given any output space, and once it's
+ * returned 1 for a flush or end, the caller must call it again with
+ * the same mode (and the input it didn't consume) until it returns 0.
+ * free, if it's not 0, releases the state; see ringbuf_codec_free.
+ *
+ * ringbuf_codec_copy codes up to count bytes of src (fewer, if src
+ * holds fewer): all of them are passed with mode
+ * RINGBUF_CODEC_CONTINUE, except that the last segment is passed with
+ * the given mode. It returns 0 when it's consumed all of them and
+ * done what mode asks for; 1 if it ran out of room in dst first, in
+ * which case the caller should make room in dst and call it again (with
+ * a count that covers the bytes that weren't consumed), and -1
+ * if the codec fails. dst never overflows. Neither src nor dst may be an
+ * MPMC ring buffer, and dst may not be a broadcast ring buffer.
+ *
+ * If the library is compiled with RINGBUF_ZSTD (and linked with
+ * -lzstd), ringbuf_codec_zstd_compress and
+ * ringbuf_codec_zstd_decompress initialize codec with a zstd
+ * streaming compressor (at the given compression level) or
+ * decompressor; with RINGBUF_LZ4 (and -llz4), ringbuf_codec_lz4_*
+ * do the same for LZ4 frames. Each returns 1 on success, or 0 if
+ * there's not enough memory or the level is invalid. The compressors
+ * produce standard frames, which the zstd and lz4 command-line tools
+ * can decompress. A decompressor ignores mode, except that with
+ * RINGBUF_CODEC_FLUSH, it also produces any decompressed output that
+ * it's still holding.
+ *
+ * ringbuf_codec_free releases codec's state.
+ */
+#define RINGBUF_CODEC_CONTINUE 0
+#define RINGBUF_CODEC_FLUSH 1
+#define RINGBUF_CODEC_END 2
+
+struct ringbuf_codec
+{
+    int (*process)(void *state, const void *in, size_t *in_len,
+                   void *out, size_t *out_len, int mode);
+    void (*free)(void *state);
+    void *state;
+};
+
+int
+ringbuf_codec_copy(ringbuf_t dst, ringbuf_t src, size_t count,
+                   const struct ringbuf_codec *codec, int mode);
+
+void
+ringbuf_codec_free(struct ringbuf_codec *codec);
+
+#ifdef RINGBUF_ZSTD
+int
+ringbuf_codec_zstd_compress(struct ringbuf_codec *codec, int level);
+
+int
+ringbuf_codec_zstd_decompress(struct ringbuf_codec *codec);
+#endif
+
+#ifdef RINGBUF_LZ4
+int
+ringbuf_codec_lz4_compress(struct ringbuf_codec *codec, int level);
+
+int
+ringbuf_codec_lz4_decompress(struct ringbuf_codec *codec);
+#endif
+
+/*
+ * Zero-copy access to the ring buffer.
+ *
+ * ringbuf_reserve reserves count free bytes, starting at rb's head
+ * pointer, for the producer to write into directly, and describes
+ * them with one or two iovecs (two if the reserved region wraps
+ * around the end of the buffer; see also RINGBUF_MIRROR). It returns
+ * the number of iovecs filled in, or 0 if there are fewer than count
+ * free bytes in rb. Nothing is copied, and the reserved bytes don't
+ * become part of the ring buffer's contents until they're committed
+ * with ringbuf_commit, which adds the first count bytes of the
+ * reservation to the ring buffer (count may be less than the number
+ * of bytes reserved) and returns the ring buffer's new head
+ * pointer. Any uncommitted bytes are released. Calling
+ * ringbuf_reserve again before ringbuf_commit replaces the previous
+ * reservation.
+ *
+ * Similarly, ringbuf_peek describes the count bytes starting at rb's
+ * tail pointer with one or two iovecs, without removing them from
+ * the ring buffer, and returns the number of iovecs filled in, or 0
+ * if fewer than count bytes are used in rb. ringbuf_consume removes
+ * count bytes from the ring buffer, starting at its tail pointer, and
+ * returns the ring buffer's new tail pointer, or 0 (having removed
+ * nothing) if fewer than count bytes are used.
+ *
+ * Reserving never overflows the ring buffer. ringbuf_reserve and
+ * ringbuf_commit are producer-side functions, and ringbuf_peek and
+ * ringbuf_consume are consumer-side functions, so they may be used
+ * concurrently with SPSC ring buffers. None of them may be used with
+ * MPMC ring buffers.
+ */
+int
+ringbuf_reserve(ringbuf_t rb, size_t count, struct iovec iov[2]);
+
+void *
+ringbuf_commit(ringbuf_t rb, size_t count);
+
+int
+ringbuf_peek(ringbuf_t rb, size_t count, struct iovec iov[2]);
+
+void *
+ringbuf_consume(ringbuf_t rb, size_t count);
+
+/*
+ * Describe the bytes used in ring buffer rb, beginning offset bytes
+ * from its tail pointer, with one or two iovecs (two if the bytes
+ * wrap around the end of the buffer), e.g., to pass them to a parser
+ * or to sendmsg(2). Neither the head nor the tail pointer is
+ * moved. Returns the number of iovecs filled in, which is 0 if offset
+ * is greater than or equal to the number of bytes used.
+ *
+ * As with ringbuf_findchr, offset is a logical offset from the tail
+ * pointer, not necessarily a linear offset.
+ */
+int
+ringbuf_used_iovec(const struct ringbuf_t *rb, size_t offset, struct iovec iov[2]);
+
+/*
+ * Describe all of the free bytes in ring buffer rb, beginning at its
+ * head pointer, with one or two iovecs. Neither the head nor the tail
+ * pointer is moved; see ringbuf_reserve to write into the free bytes
+ * and then add them to the ring buffer. Returns the number of iovecs
+ * filled in, which is 0 if the ring buffer is full.
+ */
+int
+ringbuf_free_iovec(const struct ringbuf_t *rb, struct iovec iov[2]);
+
+/*
+ * Records.
+ *
+ * These functions treat the ring buffer as a queue of variable-size
+ * records (messages), each framed by its length, rather than as a
+ * stream of bytes. A ring buffer that's used for records must only be
+ * accessed with these functions (and ringbuf_reset), and must not be
+ * an MPMC or broadcast ring buffer. The producer-side function,
+ * ringbuf_push_record, and the consumer-side functions may be used
+ * concurrently with SPSC ring buffers.
+ *
+ * ringbuf_push_record adds a record, a copy of the len bytes at src,
+ * to the ring buffer. It returns 1 on success, or 0 (having added
+ * nothing) if there isn't room for it; adding a record never
+ * overflows the ring buffer. Each record takes up 4 more bytes than
+ * its length. In ring buffers created with RINGBUF_RECORD_PAD, it may
+ * also be preceded by the unused bytes at the end of the buffer, if
+ * it wouldn't fit in them, so a record may not be added even though
+ * there are enough free bytes for it. Records of up to half the
+ * capacity, less 4 bytes, always fit in an empty ring buffer.
+ *
+ * ringbuf_peek_record describes the bytes of the oldest record in the
+ * ring buffer with one or two iovecs, without removing it, and
+ * returns its length, or -1 if the ring buffer is empty. In ring
+ * buffers created with RINGBUF_RECORD_PAD (or RINGBUF_MIRROR),
+ * iov[1].iov_len is always 0. ringbuf_peek_records does the same for
+ * up to n of the oldest records at once, filling in a pair of iovecs
+ * for each one, and returns the number of records described.
+ * ringbuf_consume_records removes up to n of the oldest records and
+ * returns the number of records removed.
+ *
+ * ringbuf_pop_record copies the oldest record to dst and removes it
+ * from the ring buffer, and returns its length, or -1 if the ring
+ * buffer is empty. If the record is longer than size bytes, it's
+ * neither copied nor removed, and its length is returned, so that the
+ * caller can compare it with size. ringbuf_pop_records copies up to n
+ * of the oldest records back-to-back to dst, stores their lengths in
+ * lens, and removes them from the ring buffer, stopping early at the
+ * first record that doesn't fit in the size bytes left in dst. It
+ * returns the number of records popped.
+ */
+int
+ringbuf_push_record(ringbuf_t rb, const void *src, size_t len);
+
+ssize_t
+ringbuf_peek_record(ringbuf_t rb, struct iovec iov[2]);
+
+size_t
+ringbuf_peek_records(ringbuf_t rb, struct iovec iov[][2], size_t n);
+
+size_t
+ringbuf_consume_records(ringbuf_t rb, size_t n);
+
+ssize_t
+ringbuf_pop_record(void *dst, ringbuf_t src, size_t size);
+
+size_t
+ringbuf_pop_records(void *dst, ringbuf_t src, size_t size, size_t *lens, size_t n);
+
+/*
+ * Element ring buffers.
+ *
+ * ringbuf_new_elems creates a ring buffer that holds up to nelems
+ * fixed-size elements (e.g., structs) of elem_size bytes each. Its
+ * internal buffer is a whole number of elements, so an element is
+ * never split across the end of the buffer, and can always be
+ * accessed in place. flags may be any of the flags accepted by
+ * ringbuf_new_flags except RINGBUF_RECORD_PAD; but with
+ * RINGBUF_MIRROR or RINGBUF_POW2, which round the buffer size up, the
+ * rounded size must also be a whole number of elements (e.g.,
+ * elem_size must be a power of two). Returns 0 if the arguments are
+ * invalid, or if there's not enough memory to fulfill the request.
+ *
+ * The byte-oriented functions above still work on element ring
+ * buffers, in which case byte counts are in bytes, and must be
+ * multiples of the element size; e.g., ringbuf_consume(rb, k *
+ * ringbuf_elem_size(rb)) removes k elements. ringbuf_elems_capacity,
+ * ringbuf_elems_used and ringbuf_elems_free are the element
+ * counterparts of ringbuf_capacity, ringbuf_bytes_used and
+ * ringbuf_bytes_free.
+ */
+ringbuf_t
+ringbuf_new_elems(size_t nelems, size_t elem_size, int flags);
+
+size_t
+ringbuf_elem_size(const struct ringbuf_t *rb);
+
+size_t
+ringbuf_elems_capacity(const struct ringbuf_t *rb);
+
+size_t
+ringbuf_elems_used(const struct ringbuf_t *rb);
+
+size_t
+ringbuf_elems_free(const struct ringbuf_t *rb);
+
+/*
+ * ringbuf_push copies one element from elem into the ring buffer, and
+ * ringbuf_push_n copies up to n elements from the array elems. Like
+ * ringbuf_memcpy_into, they overflow the ring buffer, overwriting the
+ * oldest elements, unless it's an SPSC or MPMC ring buffer, or one
+ * created with RINGBUF_OVERFLOW_TRUNCATE, in which case they only
+ * copy as many elements as there's room for. (If n is greater than
+ * the ring buffer's capacity in elements, an overflowing ring buffer
+ * ends up holding only the last elements of the array, just as
+ * ringbuf_memcpy_into keeps the last bytes of its source.) With
+ * RINGBUF_OVERFLOW_REJECT, ringbuf_push_n copies either all n
+ * elements or none. ringbuf_push returns 1 if the element was
+ * copied, and 0 otherwise; ringbuf_push_n returns the number of
+ * elements copied, counting any that were overwritten.
+ *
+ * ringbuf_pop copies the oldest element to dst and removes it from
+ * the ring buffer, and returns 1, or 0 if the ring buffer is
+ * empty. ringbuf_pop_n copies and removes up to n of the oldest
+ * elements, and returns the number of elements popped.
+ *
+ * All of these functions may be used with SPSC and MPMC ring buffers.
+ */
+int
+ringbuf_push(ringbuf_t rb, const void *elem);
+
+size_t
+ringbuf_push_n(ringbuf_t rb, const void *elems, size_t n);
+
+int
+ringbuf_pop(void *dst, ringbuf_t src);
+
+size_t
+ringbuf_pop_n(void *dst, ringbuf_t src, size_t n);
+
+/*
+ * Return a pointer to the k'th element in the ring buffer, counting
+ * from its tail pointer (the oldest element is element 0), without
+ * removing it, or 0 if there are k or fewer elements in the ring
+ * buffer. This is a consumer-side function, which may not be used
+ * with MPMC ring buffers.
+ */
+void *
+ringbuf_at(const struct ringbuf_t *rb, size_t k);
+
+/*
+ * Ring buffer sets.
+ *
+ * A ring buffer set is a fixed number of SPSC record ring buffers
+ * (shards) with a single consumer that drains all of them, so that
+ * many producer threads can feed one consumer without contending for
+ * a shared head, as they would with an MPMC ring buffer. Each
+ * producer thread uses its own shard, with ringbuf_push_record (and
+ * ringbuf_publish); the consumer uses the ringbuf_set_pop_* functions
+ * below, not the shards' own consumer-side functions.
+ *
+ * ringbuf_set_new creates a set of nshards shards of capacity bytes
+ * each, which take flags (any of the flags accepted by
+ * ringbuf_new_flags, except RINGBUF_MPMC and RINGBUF_BLOCKING; they're
+ * always SPSC) and are drained in the given order:
+ *
+ * RINGBUF_SET_ROUND_ROBIN takes one record from each shard that has
+ * one, in turn.
+ *
+ * RINGBUF_SET_BATCH takes records from one shard until it's empty,
+ * and then moves on to the next, which amortizes the cost of each
+ * shard's bookkeeping over as many records as possible.
+ *
+ * RINGBUF_SET_TIMESTAMP treats the first 8 bytes of each record as a
+ * timestamp (a uint64_t in native byte order; records shorter than 8
+ * bytes have a timestamp of 0), and takes the record with the
+ * earliest timestamp among the oldest records of all of the shards.
+ * If each producer's timestamps never decrease, the consumer sees
+ * the records in timestamp order, as far as it can tell: a record
+ * that's published late, after the consumer has already taken one
+ * with a later timestamp from another shard, still comes after that
+ * one. Choosing a record looks at every shard.
+ *
+ * ringbuf_set_new returns 0 if nshards is 0, or the flags, capacity
+ * or order are invalid, or there's not enough memory. ringbuf_set_free
+ * frees the set and all of its shards.
+ *
+ * ringbuf_set_shard returns shard i (for 0 <= i < nshards), creating
+ * it if it doesn't exist yet, or returns 0 if i is out of range or
+ * there's not enough memory. Each producer thread should get its shard
+ * itself: the shard is created on the NUMA node of the CPU the calling
+ * thread is running on, if the system allows it. ringbuf_set_shard
+ * may be called from any thread at any time; the consumer skips
+ * shards that don't exist yet.
+ *
+ * ringbuf_set_pop_record and ringbuf_set_pop_records are the set's
+ * counterparts of ringbuf_pop_record and ringbuf_pop_records, and
+ * take their records from the shards in the set's order. If shard
+ * isn't 0, ringbuf_set_pop_record also stores there the index of the
+ * shard that the record came from (or would have, if it's too long).
+ *
+ * ringbuf_set_bytes_used totals ringbuf_bytes_used over the shards,
+ * and ringbuf_set_get_stats totals their statistics, as
+ * ringbuf_get_stats reports them, except that high_water is the
+ * highest of the shards' high-water marks. It returns 0 (and zeroes
+ * stats) if statistics aren't compiled in.
+ */
+#define RINGBUF_SET_ROUND_ROBIN 0
+#define RINGBUF_SET_BATCH 1
+#define RINGBUF_SET_TIMESTAMP 2
+
+ringbuf_set_t
+ringbuf_set_new(size_t nshards, size_t capacity, int flags, int order);
+
+void
+ringbuf_set_free(ringbuf_set_t *set);
+
+size_t
+ringbuf_set_nshards(const struct ringbuf_set_t *set);
+
+ringbuf_t
+ringbuf_set_shard(ringbuf_set_t set, size_t i);
+
+ssize_t
+ringbuf_set_pop_record(void *dst, ringbuf_set_t set, size_t size, size_t *shard);
+
+size_t
+ringbuf_set_pop_records(void *dst, ringbuf_set_t set, size_t size, size_t *lens, size_t n);
+
+size_t
+ringbuf_set_bytes_used(const struct ringbuf_set_t *set);
+
+int
+ringbuf_set_get_stats(const struct ringbuf_set_t *set, struct ringbuf_stats *stats);
+
+#ifdef __linux__
+
+/*
+ * Zero-copy transfers out of a ring buffer, on Linux.
+ *
+ * A zero-copy sender hands the kernel references to the bytes in a
+ * ring buffer, rather than copies of them, either by vmsplice(2)'ing
+ * them into a pipe, or by sending them on a socket with
+ * MSG_ZEROCOPY. The kernel may still be reading the bytes after the
+ * system call returns, so they stay pinned in the ring buffer -- its
+ * tail pointer doesn't move, and the producer can't overwrite them --
+ * until ringbuf_zerocopy_complete finds that the kernel is done with
+ * them.
+ */
+typedef struct ringbuf_zerocopy_t *ringbuf_zerocopy_t;
+
+/*
+ * Create a new zero-copy sender for the bytes in ring buffer rb, to
+ * fd, which must be either the write end of a pipe or a socket that
+ * supports MSG_ZEROCOPY (enabling SO_ZEROCOPY on it). At most
+ * max_inflight zero-copy sends on a socket may be awaiting
+ * completion at once.
+ *
+ * rb must be an SPSC ring buffer, so that it never overflows the
+ * pinned bytes, and while the sender exists, it takes the place of
+ * rb's consumer: no consumer-side function may be called on rb. The
+ * sender must also be the only writer to a pipe, and the only sender
+ * of MSG_ZEROCOPY data on a socket, since that's how it keeps track
+ * of which bytes the kernel is done with. rb can't be resized while
+ * the sender exists.
+ *
+ * Returns the new sender, or 0 if rb isn't an SPSC ring buffer, fd
+ * doesn't support zero-copy transfers, or there's not enough memory.
+ */
+ringbuf_zerocopy_t
+ringbuf_zerocopy_new(ringbuf_t rb, int fd, size_t max_inflight);
+
+/*
+ * Free the sender and set *z to 0. Any bytes that are still pinned
+ * remain in the ring buffer.
+ */
+void
+ringbuf_zerocopy_free(ringbuf_zerocopy_t *z);
+
+/*
+ * Send count bytes from the sender's ring buffer, starting just after
+ * any bytes that have already been sent, by calling vmsplice(2) (for
+ * a pipe) or sendmsg(2) with MSG_ZEROCOPY (for a socket; flags are
+ * passed through), once, so both wrapped segments are sent together.
+ * Returns the value returned by the system call.
+ *
+ * If count is greater than the number of bytes in the ring buffer
+ * that haven't yet been sent, or if max_inflight sends are awaiting
+ * completion, nothing is sent, and the function returns 0.
+ *
+ * If a pipe's reader splices its contents onward, e.g., to a socket,
+ * the kernel may keep referring to the bytes after they've left the
+ * pipe, so a pipe's reader should copy them out (e.g., by splicing
+ * them to a file or reading them), or the bytes should be sent
+ * directly to the socket with MSG_ZEROCOPY instead.
+ */
+ssize_t
+ringbuf_zerocopy_send(ringbuf_zerocopy_t z, size_t count, int flags);
+
+/*
+ * Release the bytes the kernel is done with, advancing the ring
+ * buffer's tail pointer. For a pipe, those are the bytes its reader
+ * has consumed; for a socket, the bytes whose MSG_ZEROCOPY completion
+ * notifications have arrived on its error queue (this function reads
+ * them without blocking). Returns the number of bytes released, or -1
+ * on error, with errno set.
+ */
+ssize_t
+ringbuf_zerocopy_complete(ringbuf_zerocopy_t z);
+
+/*
+ * The number of bytes that have been sent but not yet released.
+ */
+size_t
+ringbuf_zerocopy_pinned(const struct ringbuf_zerocopy_t *z);
+
+#endif /* __linux__ */
+
+/*
+ * An asynchronous I/O engine for ring buffers, built on Linux's
+ * io_uring. Define RINGBUF_NO_IO_URING to build without it.
+ */
+#if defined(__linux__) && !defined(RINGBUF_NO_IO_URING)
+#define RINGBUF_IO_URING 1
+#endif
+
+#ifdef RINGBUF_IO_URING
+
+typedef struct ringbuf_uring_t *ringbuf_uring_t;
+
+/*
+ * Operations, as passed to a ringbuf_uring_fn.
+ */
+#define RINGBUF_URING_READ 0x1
+#define RINGBUF_URING_WRITE 0x2
+
+/*
+ * Create a new io_uring engine with room for (at least) entries
+ * queued operations. The engine talks to the kernel directly, without
+ * liburing.
+ *
+ * Returns the new engine, or 0 if io_uring isn't available or there's
+ * not enough memory.
+ */
+ringbuf_uring_t
+ringbuf_uring_new(unsigned entries);
+
+/*
+ * Free the engine and set *u to 0. Any operations that are still in
+ * flight are abandoned: those that were never submitted are dropped,
+ * and the rest are cancelled, and the engine waits until the kernel
+ * is done with them. The heads and tails of the ring buffers they
+ * target are left untouched, though an abandoned read may have
+ * written to a ring buffer's free bytes, and the ring buffers may be
+ * the target of new operations. (If io_uring_enter(2) fails while
+ * cancelling, the operations' ring buffers stay marked as in flight,
+ * and can't be.) The engine must be freed before any of the ring
+ * buffers registered with it, or targeted by its operations.
+ */
+void
+ringbuf_uring_free(ringbuf_uring_t *u);
+
+/*
+ * Register the storage of the nrbs ring buffers in rbs with the
+ * kernel as fixed buffers, so that it isn't mapped and unmapped on
+ * every operation. An engine's ring buffers can only be registered
+ * once, all together, and a ring buffer can be registered with only
+ * one engine.
+ *
+ * Operations on a registered ring buffer use a single contiguous
+ * segment, so, like ringbuf_read and ringbuf_write, they stop at the
+ * end of the ring buffer's contiguous buffer, unless it's a mirrored
+ * ring buffer. Operations on an unregistered ring buffer pass both
+ * segments to the kernel.
+ *
+ * Returns 1 on success, or 0 if the ring buffers can't be registered.
+ */
+int
+ringbuf_uring_register(ringbuf_uring_t u, ringbuf_t *rbs, unsigned nrbs);
+
+/*
+ * Queue a read from the file descriptor fd into the free bytes at
+ * ring buffer rb's head pointer, of at most count bytes. count is
+ * clamped to the number of free bytes in rb, so the read never
+ * overflows it. The bytes are added to rb when the read completes, in
+ * ringbuf_uring_complete.
+ *
+ * Queue a write of count bytes from ring buffer rb, starting at its
+ * tail pointer, to the file descriptor fd. If count is greater than
+ * the number of bytes used in rb, nothing is queued. The bytes
+ * actually written are removed from rb when the write completes.
+ *
+ * A ring buffer may have at most one read and one write in flight at
+ * a time. While a read is in flight, no other producer-side function
+ * may be called on the ring buffer, and while a write is in flight,
+ * no other consumer-side function may be called on it. The ring
+ * buffer must not be an MPMC ring buffer, and writes from broadcast
+ * ring buffers aren't supported.
+ *
+ * The operation isn't submitted to the kernel until the next call to
+ * ringbuf_uring_submit, which submits all of the operations queued
+ * on the engine, for any number of ring buffers, at once. arg is
+ * passed to the completion function.
+ *
+ * Returns 1 if the operation was queued, or 0 if there's nothing to
+ * do, the ring buffer already has an operation of the same kind in
+ * flight, or the engine is full.
+ */
+int
+ringbuf_uring_read(ringbuf_uring_t u, int fd, ringbuf_t rb, size_t count, void *arg);
+
+int
+ringbuf_uring_write(ringbuf_uring_t u, int fd, ringbuf_t rb, size_t count, void *arg);
+
+/*
+ * Submit all queued operations to the kernel with a single
+ * io_uring_enter(2), and wait until at least wait_nr operations have
+ * completed. Returns the value returned by io_uring_enter(2): the
+ * number of operations submitted, or -1 on error.
+ */
+int
+ringbuf_uring_submit(ringbuf_uring_t u, unsigned wait_nr);
+
+/*
+ * Process all completed operations without blocking, advancing the
+ * head pointer of each ring buffer with a completed read and the tail
+ * pointer of each ring buffer with a completed write by the number of
+ * bytes transferred. For each operation, fn (if not 0) is called with
+ * the operation's arg, its kind (RINGBUF_URING_READ or
+ * RINGBUF_URING_WRITE), its ring buffer, and its result, which, as
+ * with read(2) and write(2), is the number of bytes transferred, or a
+ * negated errno value on error. fn may queue new operations.
+ *
+ * Returns the number of operations processed.
+ */
+typedef void (*ringbuf_uring_fn)(void *arg, int op, ringbuf_t rb, int res);
+
+unsigned
+ringbuf_uring_complete(ringbuf_uring_t u, ringbuf_uring_fn fn);
+
+#endif /* RINGBUF_IO_URING */
+
+#ifdef RINGBUF_INLINE
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+/*
+ * Assumed size of a CPU cache line. The producer and consumer sides
+ * of the ring buffer are kept on separate cache lines so that, in
+ * SPSC mode, the two threads don't contend for the same line.
+ */
+#define RINGBUF_CACHELINE 64
+
+/*
+ * head and tail are free-running byte counters, not pointers: head
+ * is the total number of bytes ever written into the buffer, and tail
+ * the total number of bytes ever consumed from it. The number of
+ * bytes used is simply head - tail, and a counter's location in the
+ * contiguous buffer is (counter % size), or (counter & mask) for
+ * RINGBUF_POW2 ring buffers. 64-bit counters will not wrap in any
+ * realistic lifetime of a ring buffer.
+ *
+ * head is only ever stored by the producer side (the ringbuf_*
+ * functions that copy data into the buffer), and tail by the consumer
+ * side, except when a non-SPSC ring buffer overflows. Each side
+ * publishes its counter with a release store, and reads the other
+ * side's counter with an acquire load, so that the bytes in the
+ * buffer are always visible before the counter that covers them.
+ *
+ * The producer advances head_pending as it writes, and copies it to
+ * head to publish the new bytes, either immediately or, for
+ * RINGBUF_DEFER_PUBLISH ring buffers, in ringbuf_publish. Each side
+ * also keeps a private copy of the other side's counter (tail_cache
+ * and head_cache), which is always conservative, and only reloads
+ * the real thing when the cached copy says there isn't enough room
+ * or data for the operation at hand.
+ *
+ * MPMC ring buffers don't use the cached copies. Instead, producers
+ * claim regions of the buffer by atomically advancing head_pending
+ * (and consumers tail_pending), then copy their data in parallel;
+ * finally, each waits for the threads that claimed the preceding
+ * regions to finish, and then publishes its own region by advancing
+ * head (or tail). Claims and their publication therefore happen in
+ * the same order, and head and tail never cover a region that's
+ * still being copied.
+ *
+ * Broadcast ring buffers have an array of readers, each with its own
+ * tail, in place of a consumer; the ring buffer's own tail is
+ * maintained by the producer as the tail of the slowest reader, and
+ * is only updated when the producer runs out of room.
+ */
+struct ringbuf_t
+{
+    uintptr_t buf_offset; /* buf's address, relative to the ring buffer's */
+    size_t size;
+    size_t capacity;
+    size_t mask;
+    size_t map_size; /* length of buf's anonymous mapping, if any */
+    size_t elem_size; /* 1, except for element ring buffers */
+    size_t max_capacity; /* auto-grow ceiling, or 0 */
+    size_t stream_threshold; /* non-temporal copies of this many bytes up, or 0 */
+    int flags;
+    struct ringbuf_reader_t *readers;
+    size_t max_readers;
+    unsigned zerocopy_senders; /* zero-copy senders bound to the ring */
+
+    /* blocking waits, which are rare enough to share a line */
+    _Atomic uint32_t data_seq;
+    _Atomic uint32_t data_waiters;
+    _Atomic uint32_t space_seq;
+    _Atomic uint32_t space_waiters;
+    _Atomic unsigned data_spins;
+    _Atomic unsigned space_spins;
+    int eventfd;
+
+    /* persistent ring buffers' sync policy */
+    size_t sync_bytes;
+    unsigned sync_ms;
+#ifdef RINGBUF_IO_URING
+    struct ringbuf_uring_t *uring; /* engine this ring is registered with */
+    unsigned uring_index;          /* and its fixed buffer index there */
+    int uring_inflight;            /* RINGBUF_URING_* operations in flight */
+#endif
+
+    /* producer side */
+    _Alignas(RINGBUF_CACHELINE) _Atomic uint64_t head;
+    _Atomic uint64_t head_pending;
+    uint64_t tail_cache;
+    size_t reserved;
+    _Atomic uint64_t synced_head; /* head, as of the last sync */
+    _Atomic uint64_t synced_at;   /* when that was, in milliseconds */
+
+    /* consumer side */
+    _Alignas(RINGBUF_CACHELINE) _Atomic uint64_t tail;
+    _Atomic uint64_t tail_pending;
+    uint64_t head_cache;
+
+#ifdef RINGBUF_STATS
+    /*
+     * statistics, at the end so that they don't move the fields
+     * above; each side's counters are on their own line
+     */
+    _Alignas(RINGBUF_CACHELINE) _Atomic uint64_t stat_in_bytes;
+    _Atomic uint64_t stat_in_calls;
+    _Atomic uint64_t stat_in_short;
+    _Atomic uint64_t stat_in_rejected;
+    _Atomic uint64_t stat_in_wraps;
+    _Atomic uint64_t stat_overflows;
+    _Atomic uint64_t stat_overwritten;
+    _Atomic uint64_t stat_high_water;
+    _Alignas(RINGBUF_CACHELINE) _Atomic uint64_t stat_out_bytes;
+    _Atomic uint64_t stat_out_calls;
+    _Atomic uint64_t stat_out_short;
+    _Atomic uint64_t stat_out_rejected;
+    _Atomic uint64_t stat_out_wraps;
+#endif
+};
+
+inline size_t
+ringbuf_buffer_size(const struct ringbuf_t *rb)
+{
+    return rb->size;
+}
+
+inline size_t
+ringbuf_capacity(const struct ringbuf_t *rb)
+{
+    return rb->capacity;
+}
+
+inline size_t
+ringbuf_bytes_free(const struct ringbuf_t *rb)
+{
+    /* see ringbuf_bytes_used for why tail is loaded first */
+    uint64_t tail = atomic_load_explicit(&rb->tail, memory_order_acquire);
+    uint64_t used = atomic_load_explicit(&rb->head_pending, memory_order_relaxed) - tail;
+    return used < rb->capacity ? rb->capacity - used : 0;
+}
+
+inline size_t
+ringbuf_bytes_used(const struct ringbuf_t *rb)
+{
+    /*
+     * Load tail first. head never moves backwards, so head - tail
+     * can't be negative, even if the other side of an SPSC ring
+     * buffer is running concurrently. The result can still be stale
+     * by the time it's used, of course, but only conservatively so
+     * for the side doing the asking.
+     */
+    uint64_t tail = atomic_load_explicit(&rb->tail, memory_order_acquire);
+    uint64_t used = atomic_load_explicit(&rb->head, memory_order_acquire) - tail;
+    return used < rb->capacity ? used : rb->capacity;
+}
+
+inline int
+ringbuf_is_full(const struct ringbuf_t *rb)
+{
+    uint64_t tail = atomic_load_explicit(&rb->tail, memory_order_acquire);
+    return atomic_load_explicit(&rb->head_pending, memory_order_relaxed) - tail >= rb->capacity;
+}
+
+inline int
+ringbuf_is_empty(const struct ringbuf_t *rb)
+{
+    uint64_t tail = atomic_load_explicit(&rb->tail, memory_order_acquire);
+    return atomic_load_explicit(&rb->head, memory_order_acquire) == tail;
+}
+
+#endif /* RINGBUF_INLINE */
+
 #endif /* INCLUDED_RINGBUF_H */
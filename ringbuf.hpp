@@ -0,0 +1,473 @@
+#ifndef INCLUDED_RINGBUF_HPP
+#define INCLUDED_RINGBUF_HPP
+
+/*
+ * ringbuf.hpp - header-only C++ ring buffer (FIFO) of typed elements.
+ *
+ * To the extent possible under law, the author(s) have dedicated all
+ * copyright and related and neighboring rights to this software to
+ * the public domain worldwide. This software is distributed without
+ * any warranty.
+ *
+ * You should have received a copy of the CC0 Public Domain Dedication
+ * along with this software. If not, see
+ * <http://creativecommons.org/publicdomain/zero/1.0/>.
+ */
+
+/*
+ * ringbuf<T, N, Flags, Inline> is a ring buffer of up to N elements
+ * of type T, for C++17 and later. Its capacity is a compile-time
+ * constant, so index arithmetic folds to a mask when N is a power of
+ * two (and to a multiplication otherwise), and, as everything is
+ * defined in this header, it all inlines into the caller.
+ *
+ * Its semantics follow the C element ring buffers in ringbuf.h (see
+ * ringbuf_new_elems):
+ *
+ * - By default, pushing onto a full ring buffer overflows it: the
+ *   oldest element is destroyed and replaced, and the push
+ *   succeeds. The ring buffer isn't thread-safe.
+ *
+ * - With Flags = RINGBUF_SPSC, the ring buffer may be shared, without
+ *   locking, by one producer thread (which may call emplace, push and
+ *   push_n) and one consumer thread (which may call pop, pop_n, front
+ *   and at). It never overflows: pushing onto a full ring buffer
+ *   fails, and constructs nothing.
+ *
+ * - Popping from an empty ring buffer always fails; the ring buffer
+ *   can't underflow.
+ *
+ * With Inline = true (the default), the elements are stored in the
+ * ring buffer object itself, e.g., on the stack or as a member of
+ * another object; otherwise, they're stored in a separate
+ * allocation. Ring buffers can be moved but not copied. Moving an
+ * inline ring buffer moves its elements one at a time; moving a
+ * ring buffer with separate storage only moves the storage, and the
+ * moved-from ring buffer may then only be destroyed or assigned to.
+ *
+ * ringbuf.h itself can't be included in C++ code (its typedefs share
+ * their names with struct tags), so this header stands alone.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <type_traits>
+#include <utility>
+#if __cplusplus >= 202002L && __has_include(<span>)
+#include <span>
+#endif
+
+#ifndef RINGBUF_SPSC
+#define RINGBUF_SPSC 0x1 /* the same value as in ringbuf.h */
+#endif
+
+template <typename T, std::size_t N, int Flags = 0, bool Inline = true>
+class ringbuf
+{
+    static_assert(N > 0, "ringbuf capacity must be nonzero");
+    static_assert((Flags & ~RINGBUF_SPSC) == 0, "only RINGBUF_SPSC is supported");
+    static_assert(std::is_nothrow_destructible<T>::value,
+                  "ringbuf elements must be nothrow-destructible");
+
+public:
+    typedef T value_type;
+    typedef std::size_t size_type;
+
+    static constexpr bool spsc = (Flags & RINGBUF_SPSC) != 0;
+
+    ringbuf()
+        : storage_(allocate())
+    {
+    }
+
+    ringbuf(const ringbuf &) = delete;
+    ringbuf &operator=(const ringbuf &) = delete;
+
+    ringbuf(ringbuf &&other) noexcept(!Inline || std::is_nothrow_move_constructible<T>::value)
+        : storage_()
+    {
+        take(other);
+    }
+
+    ringbuf &
+    operator=(ringbuf &&other) noexcept(!Inline || std::is_nothrow_move_constructible<T>::value)
+    {
+        if (this != &other) {
+            if (data())
+                clear();
+            deallocate(storage_);
+            take(other);
+        }
+        return *this;
+    }
+
+    ~ringbuf()
+    {
+        if (data()) {
+            clear();
+            deallocate(storage_);
+        }
+    }
+
+    static constexpr size_type
+    capacity() noexcept
+    {
+        return N;
+    }
+
+    /*
+     * The number of elements in the ring buffer. As with
+     * ringbuf_elems_used, the result may be stale by the time it's
+     * returned if the ring buffer is shared.
+     */
+    size_type
+    size() const noexcept
+    {
+        std::uint64_t tail = tail_.load(std::memory_order_acquire);
+        return head_.load(std::memory_order_acquire) - tail;
+    }
+
+    bool
+    empty() const noexcept
+    {
+        return size() == 0;
+    }
+
+    bool
+    full() const noexcept
+    {
+        return size() == N;
+    }
+
+    /*
+     * Construct a new element in place, at the head of the ring
+     * buffer, from args. Returns true if the element was added, or
+     * false if the ring buffer is an SPSC ring buffer and is
+     * full. If T's constructor throws, nothing is added (though, if
+     * the ring buffer was full and isn't SPSC, its oldest element is
+     * still removed).
+     */
+    template <typename... Args>
+    bool
+    emplace(Args &&...args)
+    {
+        std::uint64_t head = head_.load(std::memory_order_relaxed);
+        if (!make_room(head, 1))
+            return false;
+        ::new (raw(head)) T(std::forward<Args>(args)...);
+        head_.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool
+    push(const T &value)
+    {
+        return emplace(value);
+    }
+
+    bool
+    push(T &&value)
+    {
+        return emplace(std::move(value));
+    }
+
+    /*
+     * Copy up to n elements from src to the head of the ring buffer,
+     * and return the number of elements copied. Like ringbuf_push_n,
+     * this copies all n elements, overwriting the oldest ones, unless
+     * the ring buffer is SPSC, in which case it only copies as many
+     * as there's room for. (If n is greater than N, only the last N
+     * elements of src end up in the ring buffer.)
+     */
+    size_type
+    push_n(const T *src, size_type n)
+    {
+        size_type count = n;
+        if (!spsc && n > N) {
+            src += n - N;
+            n = N;
+        }
+        std::uint64_t head = head_.load(std::memory_order_relaxed);
+        if (spsc)
+            n = std::min<size_type>(n, N - (head - load_tail_cache(head, n)));
+        else
+            make_room(head, n);
+
+        if constexpr (std::is_trivially_copyable<T>::value) {
+            size_type first = std::min<size_type>(n, N - index(head));
+            std::memcpy(raw(head), src, first * sizeof(T));
+            std::memcpy(raw(head + first), src + first, (n - first) * sizeof(T));
+            head_.store(head + n, std::memory_order_release);
+        } else
+            for (size_type i = 0; i != n; ++i) {
+                ::new (raw(head)) T(src[i]);
+                head_.store(++head, std::memory_order_release);
+            }
+        return spsc ? n : count;
+    }
+
+    /*
+     * Move the oldest element to dst, destroy it, and remove it from
+     * the ring buffer. Returns false, leaving dst untouched, if the
+     * ring buffer is empty.
+     */
+    bool
+    pop(T &dst)
+    {
+        std::uint64_t tail = tail_.load(std::memory_order_relaxed);
+        if (load_head_cache(tail, 1) == tail)
+            return false;
+        T *p = slot(tail);
+        dst = std::move(*p);
+        p->~T();
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    /*
+     * Destroy and remove the oldest element, if there is one.
+     */
+    bool
+    pop()
+    {
+        std::uint64_t tail = tail_.load(std::memory_order_relaxed);
+        if (load_head_cache(tail, 1) == tail)
+            return false;
+        slot(tail)->~T();
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    /*
+     * Move up to n of the oldest elements to dst, destroy them, and
+     * remove them from the ring buffer. Returns the number of elements
+     * popped.
+     */
+    size_type
+    pop_n(T *dst, size_type n)
+    {
+        std::uint64_t tail = tail_.load(std::memory_order_relaxed);
+        n = std::min<size_type>(n, load_head_cache(tail, n) - tail);
+        if constexpr (std::is_trivially_copyable<T>::value) {
+            size_type first = std::min<size_type>(n, N - index(tail));
+            std::memcpy(static_cast<void *>(dst), slot(tail), first * sizeof(T));
+            std::memcpy(static_cast<void *>(dst + first), slot(tail + first),
+                        (n - first) * sizeof(T));
+            tail_.store(tail + n, std::memory_order_release);
+        } else
+            for (size_type i = 0; i != n; ++i) {
+                T *p = slot(tail);
+                dst[i] = std::move(*p);
+                p->~T();
+                tail_.store(++tail, std::memory_order_release);
+            }
+        return n;
+    }
+
+#if __cplusplus >= 202002L && __has_include(<span>)
+    size_type
+    push_n(std::span<const T> src)
+    {
+        return push_n(src.data(), src.size());
+    }
+
+    size_type
+    pop_n(std::span<T> dst)
+    {
+        return pop_n(dst.data(), dst.size());
+    }
+#endif
+
+    /*
+     * Return a pointer to the k'th element, counting from the oldest
+     * (element 0), without removing it, or nullptr if there are k or
+     * fewer elements. Like ringbuf_at, this is a consumer-side
+     * function.
+     */
+    T *
+    at(size_type k) noexcept
+    {
+        std::uint64_t tail = tail_.load(std::memory_order_relaxed);
+        if (k >= load_head_cache(tail, k + 1) - tail)
+            return nullptr;
+        return slot(tail + k);
+    }
+
+    const T *
+    at(size_type k) const noexcept
+    {
+        return const_cast<ringbuf *>(this)->at(k);
+    }
+
+    T *
+    front() noexcept
+    {
+        return at(0);
+    }
+
+    const T *
+    front() const noexcept
+    {
+        return at(0);
+    }
+
+    /*
+     * Destroy all of the elements in the ring buffer. Like
+     * ringbuf_reset, this must not be called while other threads are
+     * using the ring buffer.
+     */
+    void
+    clear() noexcept
+    {
+        while (pop())
+            ;
+    }
+
+private:
+    struct alignas(T) inline_storage
+    {
+        unsigned char bytes[N * sizeof(T)];
+    };
+    typedef typename std::conditional<Inline, inline_storage, void *>::type storage_type;
+
+    static constexpr std::size_t cacheline = 64;
+
+    static constexpr size_type
+    index(std::uint64_t counter) noexcept
+    {
+        /* (N is a constant, so this is a mask when N is a power of two) */
+        return counter % N;
+    }
+
+    static storage_type
+    allocate()
+    {
+        if constexpr (Inline)
+            return storage_type();
+        else
+            return ::operator new(N * sizeof(T), std::align_val_t(alignof(T)));
+    }
+
+    static void
+    deallocate(storage_type &storage) noexcept
+    {
+        if constexpr (!Inline) {
+            if (storage)
+                ::operator delete(storage, std::align_val_t(alignof(T)));
+            storage = nullptr;
+        }
+    }
+
+    T *
+    data() noexcept
+    {
+        if constexpr (Inline)
+            return reinterpret_cast<T *>(storage_.bytes);
+        else
+            return static_cast<T *>(storage_);
+    }
+
+    /* the storage for the element at counter, which may not exist yet */
+    void *
+    raw(std::uint64_t counter) noexcept
+    {
+        return data() + index(counter);
+    }
+
+    T *
+    slot(std::uint64_t counter) noexcept
+    {
+        return std::launder(data() + index(counter));
+    }
+
+    /*
+     * The producer's and consumer's views of the other side's counter.
+     * As in the C core, SPSC ring buffers only reload them when the
+     * cached copy says there isn't enough room (or there aren't enough
+     * elements). In other ring buffers, the producer moves the tail
+     * when it overflows, so the head is always reloaded.
+     */
+    std::uint64_t
+    load_tail_cache(std::uint64_t head, size_type n) noexcept
+    {
+        if (N - (head - tail_cache_) < n)
+            tail_cache_ = tail_.load(std::memory_order_acquire);
+        return tail_cache_;
+    }
+
+    std::uint64_t
+    load_head_cache(std::uint64_t tail, size_type n) noexcept
+    {
+        if (!spsc)
+            return head_.load(std::memory_order_relaxed);
+        if (head_cache_ - tail < n)
+            head_cache_ = head_.load(std::memory_order_acquire);
+        return head_cache_;
+    }
+
+    /*
+     * Take over other's elements: move them one at a time into our
+     * (empty) inline storage, or take other's separate storage. other
+     * is left empty.
+     */
+    void
+    take(ringbuf &other)
+    {
+        std::uint64_t tail = other.tail_.load(std::memory_order_relaxed);
+        std::uint64_t head = other.head_.load(std::memory_order_relaxed);
+        if constexpr (Inline) {
+            head_.store(0, std::memory_order_relaxed);
+            tail_.store(0, std::memory_order_relaxed);
+            tail_cache_ = 0;
+            for (; tail != head; ++tail) {
+                emplace(std::move(*other.slot(tail)));
+                other.slot(tail)->~T();
+                other.tail_.store(tail + 1, std::memory_order_relaxed);
+            }
+        } else {
+            storage_ = other.storage_;
+            other.storage_ = nullptr;
+            head_.store(head, std::memory_order_relaxed);
+            tail_.store(tail, std::memory_order_relaxed);
+        }
+        head_cache_ = head_.load(std::memory_order_relaxed);
+        tail_cache_ = tail_.load(std::memory_order_relaxed);
+        other.head_.store(0, std::memory_order_relaxed);
+        other.tail_.store(0, std::memory_order_relaxed);
+        other.head_cache_ = other.tail_cache_ = 0;
+    }
+
+    /*
+     * Make room for n more elements at head: returns false if there
+     * isn't room in an SPSC ring buffer, and otherwise removes as many
+     * of the oldest elements as necessary.
+     */
+    bool
+    make_room(std::uint64_t head, size_type n) noexcept
+    {
+        if (spsc)
+            return N - (head - load_tail_cache(head, n)) >= n;
+        std::uint64_t tail = tail_.load(std::memory_order_relaxed);
+        while (N - (head - tail) < n) {
+            slot(tail)->~T();
+            tail_.store(++tail, std::memory_order_relaxed);
+        }
+        return true;
+    }
+
+    storage_type storage_;
+
+    /* producer side */
+    alignas(cacheline) std::atomic<std::uint64_t> head_{0};
+    std::uint64_t tail_cache_ = 0;
+
+    /* consumer side */
+    alignas(cacheline) std::atomic<std::uint64_t> tail_{0};
+    std::uint64_t head_cache_ = 0;
+};
+
+#endif /* INCLUDED_RINGBUF_HPP */